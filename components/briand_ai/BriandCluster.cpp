@@ -0,0 +1,388 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandCluster.hxx"
+
+using namespace std;
+using namespace Briand;
+
+void KMeansResult::Print() const {
+    printf("K-means: %u iterations, inertia %.4le, %u empty clusters reseeded, %ldms (assignment %ldms)\n",
+        static_cast<unsigned int>(this->Iterations), this->Inertia, static_cast<unsigned int>(this->Reseeded),
+        static_cast<long>(this->Time / 1000), static_cast<long>(this->AssignTime / 1000));
+}
+
+KMeans::KMeans(const size_t& clusters, const size_t& dimensions, const uint64_t& seed) : _generator(seed) {
+    // Check
+    if (clusters == 0) throw out_of_range("KMeans: clusters must be > 0.");
+    if (dimensions == 0) throw out_of_range("KMeans: dimensions must be > 0.");
+
+    this->_centroids = make_unique<Matrix>(clusters, dimensions, 0.0);
+    this->_transposed = make_unique<Matrix>(dimensions, clusters, 0.0);
+    this->_norms = make_unique<vector<double>>(clusters, 0.0);
+    this->_counts = make_unique<vector<size_t>>(clusters, 0);
+    this->_seeded = false;
+}
+
+KMeans::~KMeans() {
+    this->_centroids.reset();
+    this->_transposed.reset();
+    this->_norms.reset();
+    this->_counts.reset();
+}
+
+size_t KMeans::Clusters() const {
+    return this->_centroids->Rows();
+}
+
+size_t KMeans::Dimensions() const {
+    return this->_centroids->Cols();
+}
+
+const Matrix& KMeans::Centroids() const {
+    return *this->_centroids.get();
+}
+
+void KMeans::SetCentroids(const Matrix& centroids) {
+    // Check
+    if (centroids.Rows() != this->Clusters() || centroids.Cols() != this->Dimensions()) throw out_of_range("KMeans: centroids must be clusters x dimensions.");
+
+    *this->_centroids.get() = centroids;
+    std::fill(this->_counts->begin(), this->_counts->end(), 0);
+    this->Refresh();
+    this->_seeded = true;
+}
+
+void KMeans::CheckSamples(const Matrix& samples, const size_t& minimum) const {
+    if (samples.Cols() != this->Dimensions()) throw out_of_range("KMeans: samples must have " + to_string(this->Dimensions()) + " columns.");
+    if (samples.Rows() < minimum) throw out_of_range("KMeans: at least " + to_string(minimum) + " samples needed.");
+}
+
+void KMeans::Refresh() {
+    const Matrix& c = *this->_centroids.get();
+    Matrix& t = *this->_transposed.get();
+    auto& norms = *this->_norms.get();
+
+    for (size_t j = 0; j < c.Rows(); j++) {
+        double n = 0.0;
+        for (size_t i = 0; i < c.Cols(); i++) {
+            t[i][j] = c[j][i];
+            n += c[j][i] * c[j][i];
+        }
+        norms[j] = n;
+    }
+}
+
+void KMeans::AssignRows(const Matrix& samples, const size_t& begin, const size_t& end, size_t* labels, double* distances, double* dots) const {
+    const Matrix& t = *this->_transposed.get();
+    const double* norms = this->_norms->data();
+    const size_t k = this->Clusters();
+    const size_t d = this->Dimensions();
+
+    // Blocks of 4 samples: each row of C^T is loaded once for the 4 dot products rows (dots is 4 x k)
+    size_t i = begin;
+    for (; i < end; i += 4) {
+        const size_t m = min<size_t>(4, end - i);
+        std::fill(dots, dots + 4 * k, 0.0);
+
+        if (m == 4) {
+            const double* x0 = samples[i];
+            const double* x1 = samples[i + 1];
+            const double* x2 = samples[i + 2];
+            const double* x3 = samples[i + 3];
+            double* d0 = dots;
+            double* d1 = dots + k;
+            double* d2 = dots + 2 * k;
+            double* d3 = dots + 3 * k;
+            for (size_t f = 0; f < d; f++) {
+                const double* ct = t[f];
+                const double a0 = x0[f], a1 = x1[f], a2 = x2[f], a3 = x3[f];
+                for (size_t j = 0; j < k; j++) {
+                    const double c = ct[j];
+                    d0[j] += a0 * c;
+                    d1[j] += a1 * c;
+                    d2[j] += a2 * c;
+                    d3[j] += a3 * c;
+                }
+            }
+        }
+        else {
+            for (size_t s = 0; s < m; s++) {
+                const double* x = samples[i + s];
+                double* ds = dots + s * k;
+                for (size_t f = 0; f < d; f++) {
+                    const double* ct = t[f];
+                    const double a = x[f];
+                    for (size_t j = 0; j < k; j++) ds[j] += a * ct[j];
+                }
+            }
+        }
+
+        // |x - c|^2 = |x|^2 - 2 x.c + |c|^2 (|x|^2 does not change the nearest one)
+        for (size_t s = 0; s < m; s++) {
+            const double* x = samples[i + s];
+            const double* ds = dots + s * k;
+
+            double xn = 0.0;
+            for (size_t f = 0; f < d; f++) xn += x[f] * x[f];
+
+            size_t best = 0;
+            double bestValue = norms[0] - 2.0 * ds[0];
+            for (size_t j = 1; j < k; j++) {
+                const double v = norms[j] - 2.0 * ds[j];
+                if (v < bestValue) {
+                    bestValue = v;
+                    best = j;
+                }
+            }
+
+            labels[i + s] = best;
+            distances[i + s] = max(0.0, xn + bestValue);
+        }
+    }
+}
+
+double KMeans::Assign(const Matrix& samples, vector<size_t>& labels, vector<double>* distances) const {
+    // Check
+    this->CheckSamples(samples, 0);
+
+    const size_t n = samples.Rows();
+    const size_t k = this->Clusters();
+    vector<double> own;
+    vector<double>& squared = (distances != nullptr ? *distances : own);
+    labels.resize(n);
+    squared.resize(n);
+
+    Matrix::ForRows(n, n * k * this->Dimensions(), [this, &samples, &labels, &squared, k](const size_t& begin, const size_t& end) {
+        vector<double> dots(4 * k);
+        this->AssignRows(samples, begin, end, labels.data(), squared.data(), dots.data());
+    });
+
+    double inertia = 0.0;
+    for (size_t i = 0; i < n; i++) inertia += squared[i];
+    return inertia;
+}
+
+size_t KMeans::Predict(const double* sample) const {
+    const Matrix& c = *this->_centroids.get();
+    const auto& norms = *this->_norms.get();
+    const size_t d = this->Dimensions();
+
+    size_t best = 0;
+    double bestValue = 0.0;
+    for (size_t j = 0; j < c.Rows(); j++) {
+        const double* cj = c[j];
+        double dot = 0.0;
+        for (size_t f = 0; f < d; f++) dot += sample[f] * cj[f];
+        const double v = norms[j] - 2.0 * dot;
+        if (j == 0 || v < bestValue) {
+            bestValue = v;
+            best = j;
+        }
+    }
+
+    return best;
+}
+
+size_t KMeans::Predict(const vector<double>& sample) const {
+    // Check
+    if (sample.size() != this->Dimensions()) throw out_of_range("KMeans: sample must have " + to_string(this->Dimensions()) + " values.");
+
+    return this->Predict(sample.data());
+}
+
+void KMeans::Seed(const Matrix& samples) {
+    // Check
+    this->CheckSamples(samples, this->Clusters());
+
+    const size_t n = samples.Rows();
+    const size_t k = this->Clusters();
+    const size_t d = this->Dimensions();
+    Matrix& c = *this->_centroids.get();
+
+    // Squared distance of each sample from a point, kept if lower than nearest[] (into candidate[]), returns the sum
+    auto potential = [&samples, n, d](const double* point, const vector<double>& nearest, vector<double>& candidate) {
+        Matrix::ForRows(n, n * d, [&samples, &nearest, &candidate, point, d](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) {
+                const double* x = samples[i];
+                double s = 0.0;
+                for (size_t f = 0; f < d; f++) s += (x[f] - point[f]) * (x[f] - point[f]);
+                candidate[i] = min(s, nearest[i]);
+            }
+        });
+
+        double total = 0.0;
+        for (size_t i = 0; i < n; i++) total += candidate[i];
+        return total;
+    };
+
+    // First centroid uniform, then each next one is the best (lowest potential) of a few drawn with probability proportional
+    // to the squared distance from the nearest chosen (greedy k-means++, avoids two seeds in the same cluster)
+    const size_t trials = 2 + static_cast<size_t>(log(static_cast<double>(k)));
+    vector<double> nearest(n, std::numeric_limits<double>::max());
+    vector<double> candidate(n), best(n);
+    size_t chosen = this->_generator.NextUInt32() % n;
+    double total = potential(samples[chosen], nearest, nearest);
+    std::copy(samples[chosen], samples[chosen] + d, c[0]);
+
+    for (size_t j = 1; j < k; j++) {
+        double bestTotal = std::numeric_limits<double>::max();
+        size_t bestSample = 0;
+
+        for (size_t t = 0; t < trials; t++) {
+            // All samples on the chosen centroids: any sample
+            chosen = this->_generator.NextUInt32() % n;
+            if (total > 0.0) {
+                const double target = this->_generator.NextUniform() * total;
+                double cumulative = 0.0;
+                for (size_t i = 0; i < n; i++) {
+                    cumulative += nearest[i];
+                    if (cumulative > target && nearest[i] > 0.0) {
+                        chosen = i;
+                        break;
+                    }
+                }
+            }
+
+            const double candidateTotal = potential(samples[chosen], nearest, candidate);
+            if (candidateTotal < bestTotal) {
+                bestTotal = candidateTotal;
+                bestSample = chosen;
+                std::swap(best, candidate);
+            }
+        }
+
+        std::copy(samples[bestSample], samples[bestSample] + d, c[j]);
+        std::swap(nearest, best);
+        total = bestTotal;
+    }
+
+    std::fill(this->_counts->begin(), this->_counts->end(), 0);
+    this->Refresh();
+    this->_seeded = true;
+}
+
+unique_ptr<KMeansResult> KMeans::Fit(const Matrix& samples, const size_t& maxIterations, const double& tolerance) {
+    // Check
+    this->CheckSamples(samples, this->Clusters());
+
+    const int64_t start = esp_timer_get_time();
+    auto result = make_unique<KMeansResult>();
+    result->Iterations = 0;
+    result->Reseeded = 0;
+    result->AssignTime = 0;
+
+    if (!this->_seeded) this->Seed(samples);
+
+    const size_t n = samples.Rows();
+    const size_t k = this->Clusters();
+    const size_t d = this->Dimensions();
+    Matrix& c = *this->_centroids.get();
+    auto& counts = *this->_counts.get();
+
+    vector<size_t> labels;
+    vector<double> distances;
+    Matrix sums(k, d, 0.0);
+
+    while (result->Iterations < maxIterations) {
+        int64_t t = esp_timer_get_time();
+        this->Assign(samples, labels, &distances);
+        result->AssignTime += esp_timer_get_time() - t;
+        result->Iterations++;
+
+        // Update: each centroid is the mean of its samples
+        std::fill(sums.Data(), sums.Data() + k * d, 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+        for (size_t i = 0; i < n; i++) {
+            const double* x = samples[i];
+            double* s = sums[labels[i]];
+            for (size_t f = 0; f < d; f++) s[f] += x[f];
+            counts[labels[i]]++;
+        }
+
+        double shift = 0.0;
+        for (size_t j = 0; j < k; j++) {
+            double* cj = c[j];
+
+            if (counts[j] == 0) {
+                // Empty: move to the sample farthest from its centroid
+                const size_t far = std::max_element(distances.begin(), distances.end()) - distances.begin();
+                std::copy(samples[far], samples[far] + d, cj);
+                distances[far] = 0.0;
+                counts[j] = 1;
+                result->Reseeded++;
+                shift = std::numeric_limits<double>::max();
+                continue;
+            }
+
+            const double inverse = 1.0 / static_cast<double>(counts[j]);
+            double moved = 0.0;
+            for (size_t f = 0; f < d; f++) {
+                const double v = sums[j][f] * inverse;
+                moved += (v - cj[f]) * (v - cj[f]);
+                cj[f] = v;
+            }
+            shift = max(shift, moved);
+        }
+
+        this->Refresh();
+        if (shift <= tolerance * tolerance) break;
+    }
+
+    int64_t t = esp_timer_get_time();
+    result->Inertia = this->Assign(samples, labels);
+    result->AssignTime += esp_timer_get_time() - t;
+    result->Time = esp_timer_get_time() - start;
+
+    return std::move(result);
+}
+
+double KMeans::PartialFit(const Matrix& batch) {
+    // Check
+    this->CheckSamples(batch, this->_seeded ? 1 : this->Clusters());
+
+    if (!this->_seeded) this->Seed(batch);
+
+    const size_t d = this->Dimensions();
+    Matrix& c = *this->_centroids.get();
+    auto& counts = *this->_counts.get();
+
+    // Assign the whole batch first, then move each centroid towards its samples with rate 1 / samples seen
+    vector<size_t> labels;
+    const double inertia = this->Assign(batch, labels);
+    for (size_t i = 0; i < batch.Rows(); i++) {
+        const size_t j = labels[i];
+        counts[j]++;
+        const double rate = 1.0 / static_cast<double>(counts[j]);
+        const double* x = batch[i];
+        double* cj = c[j];
+        for (size_t f = 0; f < d; f++) cj[f] += rate * (x[f] - cj[f]);
+    }
+
+    this->Refresh();
+    return inertia;
+}
+
+void KMeans::Print() const {
+    const Matrix& c = *this->_centroids.get();
+
+    printf("KMeans: %u clusters, %u dimensions\n", static_cast<unsigned int>(c.Rows()), static_cast<unsigned int>(c.Cols()));
+    for (size_t j = 0; j < c.Rows(); j++) {
+        printf("  %2u (%u samples):", static_cast<unsigned int>(j), static_cast<unsigned int>(this->_counts->at(j)));
+        for (size_t f = 0; f < c.Cols(); f++) printf(" %.4lf", c[j][f]);
+        printf("\n");
+    }
+}
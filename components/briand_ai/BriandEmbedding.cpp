@@ -0,0 +1,731 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandEmbedding.hxx"
+
+using namespace std;
+using namespace Briand;
+
+/**********************************************************************
+    Saved format
+***********************************************************************/
+
+/// @brief Header at offset 0, followed by the list table (one entry for each list)
+class EmbeddingHeader {
+    public:
+    char Magic[4];
+    uint32_t Version;
+    uint32_t Precision;
+    uint32_t Dimensions;
+    uint32_t Lists;
+    uint32_t Count;
+    uint64_t Bytes;
+};
+
+/// @brief A list: vectors and offset of its section (ids, then scales if Int8, then vectors; each 16 bytes aligned)
+class EmbeddingListEntry {
+    public:
+    uint32_t Count;
+    uint32_t Reserved;
+    uint64_t Offset;
+};
+
+static const char EMBEDDING_MAGIC[4] = { 'B', 'E', 'I', 'X' };
+static const uint32_t EMBEDDING_VERSION = 1;
+
+static size_t Align16(const size_t& bytes) {
+    return (bytes + 15) / 16 * 16;
+}
+
+/// @brief Offsets of the parts of a list section (from its start), returns the section bytes
+static size_t ListLayout(const size_t& count, const size_t& dimensions, const EmbeddingPrecision& precision, size_t& scales, size_t& vectors) {
+    scales = Align16(count * sizeof(uint32_t));
+    vectors = scales + (precision == EmbeddingPrecision::Int8 ? Align16(count * sizeof(float)) : 0);
+    return vectors + Align16(count * dimensions * (precision == EmbeddingPrecision::Int8 ? sizeof(int8_t) : sizeof(float)));
+}
+
+/// @brief Offset of the centroids (after header and list table)
+static size_t CentroidsOffset(const size_t& lists) {
+    return Align16(sizeof(EmbeddingHeader) + lists * sizeof(EmbeddingListEntry));
+}
+
+/// @brief Keep a match in the top k (sorted by similarity, descending)
+static inline void KeepMatch(vector<EmbeddingMatch>& top, const size_t& k, const uint32_t& id, const float& similarity) {
+    if (top.size() == k && similarity <= top.back().Similarity) return;
+
+    EmbeddingMatch match;
+    match.Id = id;
+    match.Similarity = similarity;
+    match.Distance = 0.0f;
+    if (top.size() < k) top.push_back(match);
+    else top.back() = match;
+
+    for (size_t i = top.size() - 1; i > 0 && top[i - 1].Similarity < top[i].Similarity; i--) std::swap(top[i - 1], top[i]);
+}
+
+static inline float DotFloat(const float* a, const float* b, const size_t& n) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        s0 += a[j] * b[j];
+        s1 += a[j + 1] * b[j + 1];
+        s2 += a[j + 2] * b[j + 2];
+        s3 += a[j + 3] * b[j + 3];
+    }
+    for (; j < n; j++) s0 += a[j] * b[j];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static inline int32_t DotInt8(const int8_t* a, const int8_t* b, const size_t& n) {
+    // Integer sums are exact in any order: 16 independent lanes with a fixed trip count are vectorized (widening multiply-add)
+    // even at -O2, where the plain loop with an unknown length is not
+    int32_t lanes[16] = { 0 };
+    size_t j = 0;
+    for (; j + 16 <= n; j += 16)
+        for (size_t t = 0; t < 16; t++) lanes[t] += static_cast<int32_t>(a[j + t]) * static_cast<int32_t>(b[j + t]);
+
+    int32_t s = 0;
+    for (; j < n; j++) s += static_cast<int32_t>(a[j]) * static_cast<int32_t>(b[j]);
+    for (size_t t = 0; t < 16; t++) s += lanes[t];
+    return s;
+}
+
+/**********************************************************************
+    Embedding index class
+***********************************************************************/
+
+EmbeddingIndex::EmbeddingIndex() {
+    this->_dimensions = 0;
+    this->_precision = EmbeddingPrecision::Float32;
+    this->_views = make_unique<vector<ListView>>();
+    this->_centroids = make_unique<vector<float>>();
+    this->_centroidData = nullptr;
+    this->_size = 0;
+    this->_mapped = false;
+    this->_mapping = 0;
+}
+
+EmbeddingIndex::EmbeddingIndex(const size_t& dimensions, const EmbeddingPrecision& precision) : EmbeddingIndex() {
+    // Check
+    if (dimensions == 0) throw out_of_range("EmbeddingIndex: dimensions must be > 0.");
+
+    this->_dimensions = dimensions;
+    this->_precision = precision;
+    this->_lists = make_unique<vector<EmbeddingList>>(1);
+    this->_where = make_unique<unordered_map<uint32_t, uint64_t>>();
+    this->RefreshViews();
+}
+
+EmbeddingIndex::~EmbeddingIndex() {
+    if (this->_mapped) esp_partition_munmap(this->_mapping);
+
+    this->_lists.reset();
+    this->_views.reset();
+    this->_centroids.reset();
+    this->_where.reset();
+}
+
+size_t EmbeddingIndex::Dimensions() const {
+    return this->_dimensions;
+}
+
+EmbeddingPrecision EmbeddingIndex::Precision() const {
+    return this->_precision;
+}
+
+size_t EmbeddingIndex::Size() const {
+    return this->_size;
+}
+
+size_t EmbeddingIndex::Lists() const {
+    return this->_views->size();
+}
+
+bool EmbeddingIndex::Mapped() const {
+    return this->_mapped;
+}
+
+size_t EmbeddingIndex::Bytes() const {
+    const size_t vector = (this->_precision == EmbeddingPrecision::Int8 ? this->_dimensions + sizeof(float) : this->_dimensions * sizeof(float));
+    const size_t centroids = (this->_centroidData != nullptr ? this->Lists() * this->_dimensions * sizeof(float) : 0);
+    return this->_size * (vector + sizeof(uint32_t)) + centroids;
+}
+
+void EmbeddingIndex::RefreshView(const size_t& list) {
+    auto& l = this->_lists->at(list);
+    auto& v = this->_views->at(list);
+
+    v.Count = l.Ids.size();
+    v.Ids = l.Ids.data();
+    v.Scales = l.Scales.data();
+    v.Vectors = l.Vectors.data();
+    v.Codes = l.Codes.data();
+}
+
+void EmbeddingIndex::RefreshViews() {
+    this->_views->resize(this->_lists->size());
+    for (size_t i = 0; i < this->_lists->size(); i++) this->RefreshView(i);
+    this->_centroidData = (this->_centroids->size() > 0 ? this->_centroids->data() : nullptr);
+}
+
+void EmbeddingIndex::CheckWritable() const {
+    if (this->_mapped) throw runtime_error("EmbeddingIndex: a mapped index is read only (use Load() for an index that can be changed).");
+}
+
+void EmbeddingIndex::Normalize(const double* embedding, float* normalized) const {
+    double norm = 0.0;
+    for (size_t j = 0; j < this->_dimensions; j++) norm += embedding[j] * embedding[j];
+    if (norm <= 0.0) throw out_of_range("EmbeddingIndex: zero embedding.");
+
+    const double inverse = 1.0 / sqrt(norm);
+    for (size_t j = 0; j < this->_dimensions; j++) normalized[j] = static_cast<float>(embedding[j] * inverse);
+}
+
+void EmbeddingIndex::Quantize(const float* normalized, int8_t* codes, float& scale) const {
+    float largest = 0.0f;
+    for (size_t j = 0; j < this->_dimensions; j++) largest = max(largest, fabsf(normalized[j]));
+
+    // Zero vector (e.g. a zero centroid): all codes 0
+    if (largest == 0.0f) {
+        scale = 0.0f;
+        std::fill_n(codes, this->_dimensions, 0);
+        return;
+    }
+
+    scale = largest / 127.0f;
+    const float inverse = 127.0f / largest;
+    for (size_t j = 0; j < this->_dimensions; j++) codes[j] = static_cast<int8_t>(lrintf(normalized[j] * inverse));
+}
+
+size_t EmbeddingIndex::NearestList(const float* normalized) const {
+    if (this->_centroidData == nullptr) return 0;
+
+    size_t best = 0;
+    float bestValue = -2.0f;
+    for (size_t i = 0; i < this->Lists(); i++) {
+        const float s = DotFloat(normalized, this->_centroidData + i * this->_dimensions, this->_dimensions);
+        if (s > bestValue) {
+            bestValue = s;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+void EmbeddingIndex::ChooseLists(const float* normalized, vector<size_t>& lists) const {
+    lists.clear();
+    if (this->_centroidData == nullptr) {
+        lists.push_back(0);
+        return;
+    }
+
+    const size_t count = this->Lists();
+    const size_t probes = min(max<size_t>(this->Probes, 1), count);
+    vector<pair<float, size_t>> similarity(count);
+    for (size_t i = 0; i < count; i++) similarity[i] = make_pair(DotFloat(normalized, this->_centroidData + i * this->_dimensions, this->_dimensions), i);
+
+    std::partial_sort(similarity.begin(), similarity.begin() + probes, similarity.end(), [](const pair<float, size_t>& a, const pair<float, size_t>& b) { return a.first > b.first; });
+    for (size_t i = 0; i < probes; i++) lists.push_back(similarity[i].second);
+}
+
+void EmbeddingIndex::Append(const size_t& list, const uint32_t& id, const float* normalized, const int8_t* codes, const float& scale) {
+    auto& l = this->_lists->at(list);
+
+    (*this->_where.get())[id] = (static_cast<uint64_t>(list) << 32) | static_cast<uint64_t>(l.Ids.size());
+    l.Ids.push_back(id);
+    if (this->_precision == EmbeddingPrecision::Int8) {
+        l.Scales.push_back(scale);
+        l.Codes.insert(l.Codes.end(), codes, codes + this->_dimensions);
+    }
+    else {
+        l.Vectors.insert(l.Vectors.end(), normalized, normalized + this->_dimensions);
+    }
+
+    this->_size++;
+}
+
+void EmbeddingIndex::Enroll(const uint32_t& id, const double* embedding) {
+    this->CheckWritable();
+
+    vector<float> normalized(this->_dimensions);
+    vector<int8_t> codes(this->_precision == EmbeddingPrecision::Int8 ? this->_dimensions : 0);
+    float scale = 1.0f;
+    this->Normalize(embedding, normalized.data());
+    if (this->_precision == EmbeddingPrecision::Int8) this->Quantize(normalized.data(), codes.data(), scale);
+
+    this->Remove(id);
+    const size_t list = this->NearestList(normalized.data());
+    this->Append(list, id, normalized.data(), codes.data(), scale);
+    this->RefreshView(list);
+}
+
+void EmbeddingIndex::Enroll(const uint32_t& id, const vector<double>& embedding) {
+    // Check
+    if (embedding.size() != this->_dimensions) throw out_of_range("EmbeddingIndex: embedding must have " + to_string(this->_dimensions) + " values.");
+
+    this->Enroll(id, embedding.data());
+}
+
+bool EmbeddingIndex::Remove(const uint32_t& id) {
+    this->CheckWritable();
+
+    auto it = this->_where->find(id);
+    if (it == this->_where->end()) return false;
+
+    const size_t list = static_cast<size_t>(it->second >> 32);
+    const size_t position = static_cast<size_t>(it->second & 0xFFFFFFFF);
+    this->_where->erase(it);
+
+    // The last vector of the list takes its place
+    auto& l = this->_lists->at(list);
+    const size_t last = l.Ids.size() - 1;
+    const size_t d = this->_dimensions;
+    if (position != last) {
+        l.Ids[position] = l.Ids[last];
+        if (this->_precision == EmbeddingPrecision::Int8) {
+            l.Scales[position] = l.Scales[last];
+            std::copy(l.Codes.begin() + last * d, l.Codes.begin() + (last + 1) * d, l.Codes.begin() + position * d);
+        }
+        else {
+            std::copy(l.Vectors.begin() + last * d, l.Vectors.begin() + (last + 1) * d, l.Vectors.begin() + position * d);
+        }
+        (*this->_where.get())[l.Ids[position]] = (static_cast<uint64_t>(list) << 32) | static_cast<uint64_t>(position);
+    }
+
+    l.Ids.pop_back();
+    if (this->_precision == EmbeddingPrecision::Int8) {
+        l.Scales.pop_back();
+        l.Codes.resize(last * d);
+    }
+    else l.Vectors.resize(last * d);
+
+    this->_size--;
+    this->RefreshView(list);
+    return true;
+}
+
+bool EmbeddingIndex::Contains(const uint32_t& id) const {
+    if (this->_where != nullptr) return this->_where->find(id) != this->_where->end();
+
+    for (const auto& v : *this->_views.get()) {
+        if (std::find(v.Ids, v.Ids + v.Count, id) != v.Ids + v.Count) return true;
+    }
+    return false;
+}
+
+void EmbeddingIndex::Partition(const size_t& lists, const size_t& iterations, const uint64_t& seed) {
+    this->CheckWritable();
+
+    // Check
+    if (lists == 0) throw out_of_range("EmbeddingIndex: lists must be > 0.");
+    if (lists > 1 && lists > this->_size) throw out_of_range("EmbeddingIndex: at least one vector for each list needed.");
+
+    const size_t d = this->_dimensions;
+    const bool int8 = (this->_precision == EmbeddingPrecision::Int8);
+    const auto& current = *this->_lists.get();
+
+    // Vector of a row as floats (Int8 rows are dequantized)
+    auto row = [&current, d, int8](const size_t& list, const size_t& i, float* out) {
+        const auto& l = current[list];
+        if (int8) for (size_t j = 0; j < d; j++) out[j] = static_cast<float>(l.Codes[i * d + j]) * l.Scales[i];
+        else std::copy(l.Vectors.begin() + i * d, l.Vectors.begin() + (i + 1) * d, out);
+    };
+
+    // Centroids: k-means on up to 64 vectors for each list (evenly spaced), normalized.
+    // Computed aside: the index is unchanged if this throws.
+    vector<float> centroids;
+    if (lists > 1) {
+        const size_t samples = min(this->_size, 64 * lists);
+        Matrix training(samples, d);
+        vector<float> v(d);
+        size_t next = 0, seen = 0;
+        for (size_t list = 0; list < current.size() && next < samples; list++) {
+            for (size_t i = 0; i < current[list].Ids.size() && next < samples; i++, seen++) {
+                if (seen * samples / this->_size < next) continue;
+                row(list, i, v.data());
+                for (size_t j = 0; j < d; j++) training[next][j] = v[j];
+                next++;
+            }
+        }
+
+        KMeans model(lists, d, seed);
+        model.Fit(training, iterations);
+
+        centroids.resize(lists * d);
+        for (size_t c = 0; c < lists; c++) {
+            const double* centroid = model.Centroids()[c];
+            double norm = 0.0;
+            for (size_t j = 0; j < d; j++) norm += centroid[j] * centroid[j];
+            const double inverse = (norm > 0.0 ? 1.0 / sqrt(norm) : 0.0);
+            for (size_t j = 0; j < d; j++) centroids[c * d + j] = static_cast<float>(centroid[j] * inverse);
+        }
+    }
+
+    auto old = std::move(this->_lists);
+    this->_centroids->swap(centroids);
+    this->_centroidData = (this->_centroids->size() > 0 ? this->_centroids->data() : nullptr);
+
+    // Int8 vectors are assigned with integer dot products against quantized centroids (the scale of the vector does not change the nearest)
+    vector<int8_t> centroidCodes(int8 ? lists * d : 0);
+    vector<float> centroidScales(int8 ? lists : 0);
+    if (int8 && lists > 1) {
+        for (size_t c = 0; c < lists; c++) this->Quantize(this->_centroidData + c * d, centroidCodes.data() + c * d, centroidScales[c]);
+    }
+
+    // Each vector to the list of its nearest centroid (Int8 codes are moved as they are)
+    this->_lists = make_unique<vector<EmbeddingList>>(lists);
+    this->_views->resize(lists);
+    this->_where->clear();
+    this->_size = 0;
+    for (size_t list = 0; list < old->size(); list++) {
+        auto& l = old->at(list);
+        for (size_t i = 0; i < l.Ids.size(); i++) {
+            if (!int8) {
+                this->Append(this->NearestList(l.Vectors.data() + i * d), l.Ids[i], l.Vectors.data() + i * d, nullptr, 1.0f);
+                continue;
+            }
+
+            const int8_t* codes = l.Codes.data() + i * d;
+            size_t nearest = 0;
+            float bestValue = -std::numeric_limits<float>::max();
+            for (size_t c = 0; c < lists && lists > 1; c++) {
+                const float value = static_cast<float>(DotInt8(codes, centroidCodes.data() + c * d, d)) * centroidScales[c];
+                if (value > bestValue) {
+                    bestValue = value;
+                    nearest = c;
+                }
+            }
+            this->Append(nearest, l.Ids[i], nullptr, codes, l.Scales[i]);
+        }
+
+        // Release as soon as moved
+        l = EmbeddingList();
+    }
+
+    this->RefreshViews();
+}
+
+void EmbeddingIndex::ScanList(const ListView& list, const size_t& queries, const float* const* normalized, const int8_t* const* codes, const float* scales,
+    const size_t& k, vector<EmbeddingMatch>* const* top) const {
+
+    const size_t d = this->_dimensions;
+
+    if (this->_precision == EmbeddingPrecision::Int8) {
+        for (size_t r = 0; r < list.Count; r++) {
+            const int8_t* v = list.Codes + r * d;
+            const float scale = list.Scales[r];
+
+            // The stored vector stays in cache for all the queries (one vectorized integer dot product each)
+            for (size_t q = 0; q < queries; q++) KeepMatch(*top[q], k, list.Ids[r], static_cast<float>(DotInt8(v, codes[q], d)) * scale * scales[q]);
+        }
+    }
+    else {
+        for (size_t r = 0; r < list.Count; r++) {
+            const float* v = list.Vectors + r * d;
+
+            if (queries == 4) {
+                float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+                const float* q0 = normalized[0];
+                const float* q1 = normalized[1];
+                const float* q2 = normalized[2];
+                const float* q3 = normalized[3];
+                for (size_t j = 0; j < d; j++) {
+                    const float x = v[j];
+                    s0 += x * q0[j];
+                    s1 += x * q1[j];
+                    s2 += x * q2[j];
+                    s3 += x * q3[j];
+                }
+                KeepMatch(*top[0], k, list.Ids[r], s0);
+                KeepMatch(*top[1], k, list.Ids[r], s1);
+                KeepMatch(*top[2], k, list.Ids[r], s2);
+                KeepMatch(*top[3], k, list.Ids[r], s3);
+            }
+            else {
+                for (size_t q = 0; q < queries; q++) KeepMatch(*top[q], k, list.Ids[r], DotFloat(v, normalized[q], d));
+            }
+        }
+    }
+}
+
+void EmbeddingIndex::Search(const double* query, const size_t& k, vector<EmbeddingMatch>& matches) const {
+    const size_t d = this->_dimensions;
+    vector<float> normalized(d);
+    vector<int8_t> codes(this->_precision == EmbeddingPrecision::Int8 ? d : 0);
+    float scale = 1.0f;
+    this->Normalize(query, normalized.data());
+    if (this->_precision == EmbeddingPrecision::Int8) this->Quantize(normalized.data(), codes.data(), scale);
+
+    matches.clear();
+    matches.reserve(k);
+    if (k == 0) return;
+
+    vector<size_t> lists;
+    this->ChooseLists(normalized.data(), lists);
+
+    const float* q = normalized.data();
+    const int8_t* c = codes.data();
+    vector<EmbeddingMatch>* top = &matches;
+    for (const auto& list : lists) this->ScanList(this->_views->at(list), 1, &q, &c, &scale, k, &top);
+
+    for (auto& m : matches) m.Distance = sqrtf(max(0.0f, 2.0f - 2.0f * m.Similarity));
+}
+
+void EmbeddingIndex::Search(const vector<double>& query, const size_t& k, vector<EmbeddingMatch>& matches) const {
+    // Check
+    if (query.size() != this->_dimensions) throw out_of_range("EmbeddingIndex: query must have " + to_string(this->_dimensions) + " values.");
+
+    this->Search(query.data(), k, matches);
+}
+
+void EmbeddingIndex::SearchBatch(const Matrix& queries, const size_t& k, vector<vector<EmbeddingMatch>>& matches) const {
+    // Check
+    if (queries.Cols() != this->_dimensions) throw out_of_range("EmbeddingIndex: queries must have " + to_string(this->_dimensions) + " columns.");
+
+    const size_t n = queries.Rows();
+    const size_t d = this->_dimensions;
+    const bool int8 = (this->_precision == EmbeddingPrecision::Int8);
+    matches.resize(n);
+    if (n == 0) return;
+
+    // Partitioned: each query scans its own lists
+    const size_t scanned = (this->_centroidData != nullptr ? this->_size * min(this->Probes, this->Lists()) / this->Lists() : this->_size);
+    Matrix::ForRows(n, n * scanned * d, [this, &queries, &matches, k, d, int8](const size_t& begin, const size_t& end) {
+        vector<float> normalized(4 * d);
+        vector<int8_t> codes(int8 ? 4 * d : 0);
+        float scales[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        const float* q[4];
+        const int8_t* c[4];
+        vector<EmbeddingMatch>* top[4];
+        vector<size_t> lists;
+
+        for (size_t i = begin; i < end; i += 4) {
+            const size_t m = min<size_t>(4, end - i);
+            for (size_t b = 0; b < m; b++) {
+                this->Normalize(queries[i + b], normalized.data() + b * d);
+                if (int8) this->Quantize(normalized.data() + b * d, codes.data() + b * d, scales[b]);
+                q[b] = normalized.data() + b * d;
+                c[b] = codes.data() + (int8 ? b * d : 0);
+                top[b] = &matches[i + b];
+                top[b]->clear();
+                top[b]->reserve(k);
+            }
+            if (k == 0) continue;
+
+            if (this->_centroidData == nullptr) {
+                this->ScanList(this->_views->at(0), m, q, c, scales, k, top);
+            }
+            else {
+                for (size_t b = 0; b < m; b++) {
+                    this->ChooseLists(q[b], lists);
+                    for (const auto& list : lists) this->ScanList(this->_views->at(list), 1, &q[b], &c[b], &scales[b], k, &top[b]);
+                }
+            }
+
+            for (size_t b = 0; b < m; b++) {
+                for (auto& match : *top[b]) match.Distance = sqrtf(max(0.0f, 2.0f - 2.0f * match.Similarity));
+            }
+        }
+    });
+}
+
+size_t EmbeddingIndex::Save(WeightStore& store) const {
+    const size_t lists = this->Lists();
+    const size_t d = this->_dimensions;
+    const bool int8 = (this->_precision == EmbeddingPrecision::Int8);
+
+    // Layout
+    vector<EmbeddingListEntry> table(lists);
+    size_t offset = CentroidsOffset(lists) + Align16(this->_centroidData != nullptr ? lists * d * sizeof(float) : 0);
+    for (size_t i = 0; i < lists; i++) {
+        size_t scales, vectors;
+        table[i].Count = static_cast<uint32_t>(this->_views->at(i).Count);
+        table[i].Reserved = 0;
+        table[i].Offset = offset;
+        offset += ListLayout(table[i].Count, d, this->_precision, scales, vectors);
+    }
+
+    EmbeddingHeader header;
+    memcpy(header.Magic, EMBEDDING_MAGIC, sizeof(header.Magic));
+    header.Version = EMBEDDING_VERSION;
+    header.Precision = static_cast<uint32_t>(this->_precision);
+    header.Dimensions = static_cast<uint32_t>(d);
+    header.Lists = static_cast<uint32_t>(lists);
+    header.Count = static_cast<uint32_t>(this->_size);
+    header.Bytes = offset;
+
+    store.Prepare(offset);
+    store.Write(0, &header, sizeof(header));
+    store.Write(sizeof(header), table.data(), lists * sizeof(EmbeddingListEntry));
+    if (this->_centroidData != nullptr) store.Write(CentroidsOffset(lists), this->_centroidData, lists * d * sizeof(float));
+
+    for (size_t i = 0; i < lists; i++) {
+        const auto& v = this->_views->at(i);
+        if (v.Count == 0) continue;
+
+        size_t scales, vectors;
+        ListLayout(v.Count, d, this->_precision, scales, vectors);
+        store.Write(table[i].Offset, v.Ids, v.Count * sizeof(uint32_t));
+        if (int8) {
+            store.Write(table[i].Offset + scales, v.Scales, v.Count * sizeof(float));
+            store.Write(table[i].Offset + vectors, v.Codes, v.Count * d);
+        }
+        else store.Write(table[i].Offset + vectors, v.Vectors, v.Count * d * sizeof(float));
+    }
+
+    return offset;
+}
+
+/// @brief Read and check the header and the list table: every section must lie in the first header.Bytes <= available bytes
+static void ReadLayout(const std::function<void(const size_t& offset, void* destination, const size_t& bytes)>& read, const size_t& available,
+    EmbeddingHeader& header, vector<EmbeddingListEntry>& table) {
+
+    if (available < sizeof(header)) throw runtime_error("EmbeddingIndex: not an embedding index.");
+    read(0, &header, sizeof(header));
+    if (memcmp(header.Magic, EMBEDDING_MAGIC, sizeof(header.Magic)) != 0) throw runtime_error("EmbeddingIndex: not an embedding index.");
+    if (header.Version != EMBEDDING_VERSION) throw runtime_error("EmbeddingIndex: unsupported version " + to_string(header.Version));
+    if (header.Dimensions == 0 || header.Lists == 0 || header.Precision > static_cast<uint32_t>(EmbeddingPrecision::Int8)) throw runtime_error("EmbeddingIndex: invalid header.");
+    if (header.Bytes > available || header.Bytes < sizeof(header)) throw runtime_error("EmbeddingIndex: invalid header.");
+
+    // Sizes are bounded by Bytes before any product, so nothing below overflows
+    const uint64_t bytes = header.Bytes;
+    const uint64_t lists = header.Lists;
+    const uint64_t d = header.Dimensions;
+    if (lists > (bytes - sizeof(header)) / sizeof(EmbeddingListEntry) || d > bytes / sizeof(float)) throw runtime_error("EmbeddingIndex: invalid header.");
+
+    table.resize(header.Lists);
+    read(sizeof(header), table.data(), header.Lists * sizeof(EmbeddingListEntry));
+
+    // Centroids, then the list sections
+    uint64_t start = CentroidsOffset(header.Lists);
+    if (lists > 1) {
+        if (d > bytes / (lists * sizeof(float))) throw runtime_error("EmbeddingIndex: invalid centroids.");
+        start += Align16(lists * d * sizeof(float));
+    }
+    if (start > bytes) throw runtime_error("EmbeddingIndex: invalid centroids.");
+
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < header.Lists; i++) {
+        const auto& entry = table[i];
+        if (entry.Offset % 16 != 0 || entry.Offset < start || entry.Offset > bytes) throw runtime_error("EmbeddingIndex: invalid list " + to_string(i));
+        if (entry.Count > 0 && (entry.Count > bytes / sizeof(uint32_t) || d > bytes / entry.Count)) throw runtime_error("EmbeddingIndex: invalid list " + to_string(i));
+
+        size_t scales, vectors;
+        if (ListLayout(entry.Count, header.Dimensions, static_cast<EmbeddingPrecision>(header.Precision), scales, vectors) > bytes - entry.Offset) {
+            throw runtime_error("EmbeddingIndex: invalid list " + to_string(i));
+        }
+        count += entry.Count;
+    }
+    if (count != header.Count) throw runtime_error("EmbeddingIndex: list table does not match the header count.");
+}
+
+unique_ptr<EmbeddingIndex> EmbeddingIndex::Load(WeightStore& store) {
+    EmbeddingHeader header;
+    vector<EmbeddingListEntry> table;
+    ReadLayout([&store](const size_t& offset, void* destination, const size_t& bytes) { store.Read(offset, destination, bytes); }, store.Size(), header, table);
+
+    auto index = make_unique<EmbeddingIndex>(header.Dimensions, static_cast<EmbeddingPrecision>(header.Precision));
+    const size_t d = header.Dimensions;
+    const size_t lists = header.Lists;
+    const bool int8 = (index->_precision == EmbeddingPrecision::Int8);
+
+    if (lists > 1) {
+        index->_centroids->resize(lists * d);
+        store.Read(CentroidsOffset(lists), index->_centroids->data(), lists * d * sizeof(float));
+    }
+
+    index->_lists->resize(lists);
+    for (size_t i = 0; i < lists; i++) {
+        auto& l = index->_lists->at(i);
+        const size_t count = table[i].Count;
+        if (count == 0) continue;
+
+        size_t scales, vectors;
+        ListLayout(count, d, index->_precision, scales, vectors);
+        l.Ids.resize(count);
+        store.Read(table[i].Offset, l.Ids.data(), count * sizeof(uint32_t));
+        if (int8) {
+            l.Scales.resize(count);
+            l.Codes.resize(count * d);
+            store.Read(table[i].Offset + scales, l.Scales.data(), count * sizeof(float));
+            store.Read(table[i].Offset + vectors, l.Codes.data(), count * d);
+        }
+        else {
+            l.Vectors.resize(count * d);
+            store.Read(table[i].Offset + vectors, l.Vectors.data(), count * d * sizeof(float));
+        }
+
+        for (size_t p = 0; p < count; p++) (*index->_where.get())[l.Ids[p]] = (static_cast<uint64_t>(i) << 32) | static_cast<uint64_t>(p);
+        index->_size += count;
+    }
+
+    index->RefreshViews();
+    return std::move(index);
+}
+
+unique_ptr<EmbeddingIndex> EmbeddingIndex::Map(const string& label) {
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label.c_str());
+    if (partition == nullptr) throw runtime_error("EmbeddingIndex: data partition " + label + " not found.");
+
+    EmbeddingHeader header;
+    vector<EmbeddingListEntry> table;
+    ReadLayout([partition](const size_t& offset, void* destination, const size_t& bytes) {
+        if (esp_partition_read(partition, offset, destination, bytes) != ESP_OK) throw runtime_error("EmbeddingIndex: partition read error.");
+    }, partition->size, header, table);
+
+    const void* address = nullptr;
+    esp_partition_mmap_handle_t handle;
+    if (esp_partition_mmap(partition, 0, header.Bytes, ESP_PARTITION_MMAP_DATA, &address, &handle) != ESP_OK) throw runtime_error("EmbeddingIndex: partition mmap error.");
+
+    // Views point into the mapping
+    unique_ptr<EmbeddingIndex> index(new EmbeddingIndex());
+    index->_dimensions = header.Dimensions;
+    index->_precision = static_cast<EmbeddingPrecision>(header.Precision);
+    index->_size = header.Count;
+    index->_mapped = true;
+    index->_mapping = handle;
+
+    const uint8_t* base = static_cast<const uint8_t*>(address);
+    const size_t lists = header.Lists;
+    index->_centroidData = (lists > 1 ? reinterpret_cast<const float*>(base + CentroidsOffset(lists)) : nullptr);
+    index->_views->resize(lists);
+    for (size_t i = 0; i < lists; i++) {
+        auto& v = index->_views->at(i);
+        size_t scales, vectors;
+        ListLayout(table[i].Count, header.Dimensions, index->_precision, scales, vectors);
+        v.Count = table[i].Count;
+        v.Ids = reinterpret_cast<const uint32_t*>(base + table[i].Offset);
+        v.Scales = reinterpret_cast<const float*>(base + table[i].Offset + scales);
+        v.Vectors = reinterpret_cast<const float*>(base + table[i].Offset + vectors);
+        v.Codes = reinterpret_cast<const int8_t*>(base + table[i].Offset + vectors);
+    }
+
+    return std::move(index);
+}
+
+void EmbeddingIndex::Print() const {
+    size_t smallest = (this->Lists() > 0 ? this->_views->at(0).Count : 0), largest = 0;
+    for (const auto& v : *this->_views.get()) {
+        smallest = min(smallest, v.Count);
+        largest = max(largest, v.Count);
+    }
+
+    printf("EmbeddingIndex: %u identities, %u dimensions, %s, %u KB%s, %u lists (%u to %u vectors, %u probed)\n",
+        static_cast<unsigned int>(this->_size), static_cast<unsigned int>(this->_dimensions), this->_precision == EmbeddingPrecision::Int8 ? "int8" : "float32",
+        static_cast<unsigned int>(this->Bytes() / 1024), this->_mapped ? " mapped" : "", static_cast<unsigned int>(this->Lists()),
+        static_cast<unsigned int>(smallest), static_cast<unsigned int>(largest), static_cast<unsigned int>(min(this->Probes, this->Lists())));
+}
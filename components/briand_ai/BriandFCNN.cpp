@@ -19,6 +19,255 @@
 using namespace std;
 using namespace Briand;
 
+/**********************************************************************
+    Execution context class
+***********************************************************************/
+
+ExecutionContext::ExecutionContext(const vector<size_t>& layerSizes) {
+    this->Net = make_unique<vector<unique_ptr<vector<double>>>>();
+    this->Out = make_unique<vector<unique_ptr<vector<double>>>>();
+    this->Net->reserve(layerSizes.size());
+    this->Out->reserve(layerSizes.size());
+
+    for (const auto& neurons : layerSizes) {
+        this->Net->push_back(make_unique<vector<double>>(neurons, 0.0));
+        this->Out->push_back(make_unique<vector<double>>(neurons, 0.0));
+    }
+
+    // Exit heads have as many classes as outputs
+    const size_t outputs = (layerSizes.size() > 0 ? layerSizes.back() : 0);
+    this->HeadNet = make_unique<vector<double>>(outputs, 0.0);
+    this->HeadOut = make_unique<vector<double>>(outputs, 0.0);
+    this->Exit = (layerSizes.size() > 0 ? layerSizes.size() - 1 : 0);
+
+    // Incremental inference buffers, no allocations when predicting
+    const size_t largest = (layerSizes.size() > 0 ? *std::max_element(layerSizes.begin(), layerSizes.end()) : 0);
+    this->Cached = false;
+    this->Updates = 0;
+    this->Changed = make_unique<vector<size_t>>();
+    this->Changed->reserve(largest);
+    this->Difference = make_unique<vector<double>>();
+    this->Difference->reserve(largest);
+    this->Previous = make_unique<vector<double>>(largest, 0.0);
+}
+
+/**********************************************************************
+    Dataset and Fit() classes
+***********************************************************************/
+
+Dataset::Dataset() {
+    this->Inputs = make_unique<vector<vector<double>>>();
+    this->Targets = make_unique<vector<vector<double>>>();
+}
+
+void Dataset::Add(const vector<double>& input, const vector<double>& target) {
+    this->Inputs->push_back(input);
+    this->Targets->push_back(target);
+}
+
+size_t Dataset::Size() const {
+    return this->Inputs->size();
+}
+
+FitResult::FitResult() {
+    this->History = make_unique<vector<FitEpoch>>();
+    this->BestEpoch = 0;
+    this->BestLoss = std::numeric_limits<double>::max();
+    this->StoppedEarly = false;
+    this->Time = 0;
+}
+
+void FitResult::Print() const {
+    double throughput = 0;
+    for (const auto& e : *this->History.get()) throughput += e.SamplesPerSecond;
+    if (this->History->size() > 0) throughput /= static_cast<double>(this->History->size());
+
+    printf("Fit: %u epochs in %ldms (%s), best epoch %u with loss %.6lf, AVG %.0lf samples/s\n",
+        static_cast<unsigned int>(this->History->size()), this->Time / 1000, this->StoppedEarly ? "stopped early" : "max epochs",
+        static_cast<unsigned int>(this->BestEpoch), this->BestLoss, throughput);
+}
+
+NeuronPruningOptions::NeuronPruningOptions() {
+    // Fine tuning is optional
+    this->FineTune.Epochs = 0;
+}
+
+NeuronPruningResult::NeuronPruningResult() {
+    this->Before = make_unique<vector<size_t>>();
+    this->After = make_unique<vector<size_t>>();
+    this->Dead = 0;
+    this->Removed = 0;
+    this->WeightsBefore = 0;
+    this->WeightsAfter = 0;
+    this->FineTune = nullptr;
+}
+
+void NeuronPruningResult::Print() const {
+    printf("Neurons pruning: removed %u neurons (%u dead), layers", static_cast<unsigned int>(this->Removed), static_cast<unsigned int>(this->Dead));
+    for (size_t k = 0; k < this->Before->size(); k++) printf(" %u->%u", static_cast<unsigned int>(this->Before->at(k)), static_cast<unsigned int>(this->After->at(k)));
+    printf(", weights %u -> %u bytes (-%.1lf%%)\n", static_cast<unsigned int>(this->WeightsBefore), static_cast<unsigned int>(this->WeightsAfter),
+        this->WeightsBefore > 0 ? 100.0 * (1.0 - static_cast<double>(this->WeightsAfter) / static_cast<double>(this->WeightsBefore)) : 0.0);
+
+    if (this->FineTune != nullptr) this->FineTune->Print();
+}
+
+/** @brief Background validation of Fit(): a persistent thread computing the loss of a weights snapshot while training goes on */
+class FitValidator {
+    protected:
+
+    const Dataset& _data;
+    const vector<size_t>& _indexes;
+    unique_ptr<ExecutionContext> _context;
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _signal;
+    bool _requested;
+    bool _busy;
+    bool _stop;
+    double _loss;
+
+    void Loop() {
+        std::unique_lock<std::mutex> lock(this->_lock);
+
+        while (true) {
+            this->_signal.wait(lock, [this] { return this->_requested || this->_stop; });
+            if (this->_stop) return;
+            this->_requested = false;
+
+            // Snapshot is not touched by training until Wait() returns
+            lock.unlock();
+            const double loss = this->Snapshot->Evaluate(*this->_context.get(), this->_data, this->_indexes);
+            lock.lock();
+
+            this->_loss = loss;
+            this->_busy = false;
+            this->_signal.notify_all();
+        }
+    }
+
+    public:
+
+    /// @brief Weights being validated
+    unique_ptr<FCNN> Snapshot;
+
+    FitValidator(const FCNN& model, const Dataset& data, const vector<size_t>& indexes) : _data(data), _indexes(indexes) {
+        this->Snapshot = model.Clone();
+        this->_context = this->Snapshot->CreateContext();
+        this->_requested = false;
+        this->_busy = false;
+        this->_stop = false;
+        this->_loss = 0.0;
+
+        // On ESP run on the other core
+        esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+        cfg.pin_to_core = 1 % portNUM_PROCESSORS;
+        cfg.thread_name = "BriandFit";
+        esp_pthread_set_cfg(&cfg);
+        this->_thread = std::thread(&FitValidator::Loop, this);
+        esp_pthread_cfg_t defaults = esp_pthread_get_default_config();
+        esp_pthread_set_cfg(&defaults);
+    }
+
+    ~FitValidator() {
+        {
+            std::lock_guard<std::mutex> lock(this->_lock);
+            this->_stop = true;
+        }
+        this->_signal.notify_all();
+        if (this->_thread.joinable()) this->_thread.join();
+    }
+
+    /// @brief Start validating a copy of the model weights (previous validation must be collected with Wait())
+    void Start(const FCNN& model) {
+        this->Snapshot->CopyWeightsFrom(model);
+        std::lock_guard<std::mutex> lock(this->_lock);
+        this->_requested = true;
+        this->_busy = true;
+        this->_signal.notify_all();
+    }
+
+    /// @brief Wait the validation started and return its loss
+    double Wait() {
+        std::unique_lock<std::mutex> lock(this->_lock);
+        this->_signal.wait(lock, [this] { return !this->_busy; });
+        return this->_loss;
+    }
+};
+
+/**********************************************************************
+    Batch normalization class
+***********************************************************************/
+
+BatchNormalization::BatchNormalization(const size_t& neurons, const double& momentum, const double& epsilon) {
+    // Check
+    if (momentum <= 0.0 || momentum > 1.0) throw out_of_range("Batch normalization: momentum must be in (0, 1].");
+    if (epsilon <= 0.0) throw out_of_range("Batch normalization: epsilon must be > 0.");
+
+    this->Gamma = make_unique<vector<double>>(neurons, 1.0);
+    this->Beta = make_unique<vector<double>>(neurons, 0.0);
+    this->Mean = make_unique<vector<double>>(neurons, 0.0);
+    this->Variance = make_unique<vector<double>>(neurons, 1.0);
+    this->Momentum = momentum;
+    this->Epsilon = epsilon;
+    this->Linear = make_unique<vector<double>>(neurons, 0.0);
+    this->Normalized = make_unique<vector<double>>(neurons, 0.0);
+    this->Delta = make_unique<vector<double>>(neurons, 0.0);
+    this->GammaGradient = nullptr;
+    this->BetaGradient = nullptr;
+}
+
+BatchNormalization::BatchNormalization(const BatchNormalization& other) : BatchNormalization(other.Gamma->size(), other.Momentum, other.Epsilon) {
+    *this->Gamma.get() = *other.Gamma.get();
+    *this->Beta.get() = *other.Beta.get();
+    *this->Mean.get() = *other.Mean.get();
+    *this->Variance.get() = *other.Variance.get();
+}
+
+double BatchNormalization::Scale(const size_t& i) const {
+    return this->Gamma->at(i) / sqrt(this->Variance->at(i) + this->Epsilon);
+}
+
+void BatchNormalization::Update() {
+    // Exponential moving mean and variance
+    for (size_t i = 0; i < this->Mean->size(); i++) {
+        const double difference = this->Linear->at(i) - this->Mean->at(i);
+        this->Mean->at(i) += this->Momentum * difference;
+        this->Variance->at(i) = (1.0 - this->Momentum) * (this->Variance->at(i) + this->Momentum * difference * difference);
+    }
+}
+
+/**********************************************************************
+    Exit head class
+***********************************************************************/
+
+ExitHead::ExitHead(const size_t& classes, const size_t& neurons, const double& lossWeight) {
+    // Check
+    if (classes < 2) throw out_of_range("Exit head: at least 2 classes.");
+    if (lossWeight <= 0.0) throw out_of_range("Exit head: loss weight must be > 0.");
+
+    this->Weights = make_unique<Matrix>(classes, neurons, 0.0);
+    this->Bias = make_unique<vector<double>>(classes, 0.0);
+    this->LossWeight = lossWeight;
+    this->Net = make_unique<vector<double>>(classes, 0.0);
+    this->Out = make_unique<vector<double>>(classes, 0.0);
+    this->Delta = make_unique<vector<double>>(classes, 0.0);
+    this->WeightsGradient = nullptr;
+    this->BiasGradient = nullptr;
+}
+
+ExitHead::ExitHead(const ExitHead& other) : ExitHead(other.Weights->Rows(), other.Weights->Cols(), other.LossWeight) {
+    *this->Weights.get() = *other.Weights.get();
+    *this->Bias.get() = *other.Bias.get();
+}
+
+double ExitHead::Forward(const vector<double>& in, vector<double>& net, vector<double>& out) const {
+    this->Weights->MultiplyVector(in, net);
+    for (size_t i = 0; i < net.size(); i++) net[i] += (*this->Bias.get())[i];
+    Math::Softmax(net, out);
+
+    return *std::max_element(out.begin(), out.end());
+}
+
 /**********************************************************************
     Neural Layer class
 ***********************************************************************/
@@ -37,8 +286,16 @@ NeuralLayer::NeuralLayer(const LayerType& type, const size_t& neurons, Activatio
     this->_E = e;
     this->_dE = de;
     this->_type = type;
+    this->_softmax = false;
     this->_weights = nullptr;
-    this->_delta = nullptr;
+    this->_sparseWeights = nullptr;
+    this->_halfWeights = nullptr;
+    this->_pruneMask = nullptr;
+    this->_delta = make_unique<vector<double>>(neurons, 0.0);
+    this->_gradient = nullptr;
+    this->_biasGradient = nullptr;
+    this->_batchNorm = nullptr;
+    this->_exitHead = nullptr;
 
     // Bias neuron value is always 1 so just handle the weights (FCN)
     this->_bias_weights = nullptr;
@@ -81,9 +338,16 @@ NeuralLayer::NeuralLayer(const LayerType& type, const size_t& neurons, Activatio
 
 NeuralLayer::~NeuralLayer() {
     this->_weights.reset();
+    this->_sparseWeights.reset();
+    this->_halfWeights.reset();
+    this->_pruneMask.reset();
     this->_neuronsNet.reset();
     this->_neuronsOut.reset();
     this->_delta.reset();
+    this->_gradient.reset();
+    this->_biasGradient.reset();
+    this->_batchNorm.reset();
+    this->_exitHead.reset();
 }
 
 void NeuralLayer::SetBiasWeights(const vector<double>& bias_weights) { 
@@ -93,6 +357,70 @@ void NeuralLayer::SetBiasWeights(const vector<double>& bias_weights) {
     this->_bias_weights = make_unique<vector<double>>(bias_weights); 
 }
 
+size_t NeuralLayer::Neurons() const {
+    return this->_neuronsOut->size();
+}
+
+void NeuralLayer::Forward(const vector<double>& in, vector<double>& net, vector<double>& out, vector<double>* linear /*= nullptr*/) const {
+    // Weighted sum can be performed with weight_matrix * vector
+    // In math: z_(l) = W_(l) * a_(l-1)
+    if (this->_sparseWeights != nullptr) this->_sparseWeights->MultiplyVector(in, net);
+    else if (this->_halfWeights != nullptr) this->_halfWeights->MultiplyVector(in, net);
+    else this->_weights->MultiplyVector(in, net);
+
+    // Softmax output: all neurons together (output layers have a bias only after OptimizeForInference() merged a linear layer into them)
+    if (this->_softmax) {
+        if (this->_bias_weights != nullptr) {
+            for (size_t i = 0; i < net.size(); i++) net[i] += (*this->_bias_weights.get())[i];
+        }
+        Math::Softmax(net, out);
+        return;
+    }
+
+    // Now activate neurons applying the activation function of this layer
+    // In math a_l = f(z_l)
+    const BatchNormalization* norm = this->_batchNorm.get();
+    for (size_t i = 0; i < net.size(); i++) {
+        // If current layer has a bias, add the weighted value (1*b_i) to each neuron
+        if (this->_bias_weights != nullptr) net[i] += (*this->_bias_weights.get())[i];
+
+        // Normalize with running statistics
+        if (norm != nullptr) {
+            if (linear != nullptr) (*linear)[i] = net[i];
+            net[i] = norm->Scale(i) * (net[i] - (*norm->Mean.get())[i]) + (*norm->Beta.get())[i];
+        }
+
+        // Activate
+        out[i] = this->_f(net[i]);
+    }
+}
+
+size_t NeuralLayer::WeightsMemory() const {
+    if (this->_sparseWeights != nullptr) return this->_sparseWeights->MemoryBytes();
+    if (this->_halfWeights != nullptr) return this->_halfWeights->MemoryBytes();
+    if (this->_weights != nullptr) return SparseMatrix::DenseMemoryBytes(this->_weights->Rows(), this->_weights->Cols());
+    return 0;
+}
+
+void NeuralLayer::ApplyPruneMask() {
+    if (this->_pruneMask == nullptr || this->_weights == nullptr) return;
+
+    const size_t cols = this->_weights->Cols();
+    for (size_t i = 0; i < this->_weights->Rows(); i++) {
+        for (size_t j = 0; j < cols; j++) {
+            if (!(*this->_pruneMask.get())[i * cols + j]) (*this->_weights.get())[i][j] = 0.0;
+        }
+    }
+}
+
+bool NeuralLayer::DropWeightCopies() {
+    if (this->_sparseWeights == nullptr && this->_halfWeights == nullptr) return false;
+
+    this->_sparseWeights.reset();
+    this->_halfWeights.reset();
+    return true;
+}
+
 /**********************************************************************
     FCNN class
 ***********************************************************************/
@@ -100,10 +428,35 @@ void NeuralLayer::SetBiasWeights(const vector<double>& bias_weights) {
 FCNN::FCNN() {
     this->_hasOutputs = false;
     this->_layers = make_unique<vector<unique_ptr<NeuralLayer>>>();
+    this->_initializer = WeightInitializer::Uniform;
+    this->_generator = nullptr;
+    this->_revision = 0;
+    this->_exitThreshold = 2.0;
+    this->_exit = 0;
 }
 
 FCNN::~FCNN() {
     this->_layers.reset();
+    this->_generator.reset();
+}
+
+void FCNN::SetInitializer(const WeightInitializer& initializer) {
+    this->_initializer = initializer;
+}
+
+void FCNN::SetSeed(const uint64_t& seed) {
+    this->_generator = make_unique<Philox>(seed);
+}
+
+void FCNN::InitializeWeights(Matrix& weights, const ActivationFunction& activation) {
+    if (this->_generator != nullptr) {
+        this->_generator->Initialize(weights, this->_initializer, activation);
+        return;
+    }
+
+    Philox& generator = Philox::Default();
+    std::lock_guard<std::mutex> lock(Philox::DefaultLock());
+    generator.Initialize(weights, this->_initializer, activation);
 }
 
 void FCNN::AddInputLayer(const size_t& inputs) {
@@ -112,6 +465,7 @@ void FCNN::AddInputLayer(const size_t& inputs) {
 
     auto layer = make_unique<NeuralLayer>(LayerType::Input, inputs, nullptr, nullptr, nullptr, nullptr);
     this->_layers->push_back(std::move(layer));
+    this->_revision++;
 }
 
 void FCNN::AddInputLayer(const size_t& inputs, const vector<double>& values) {
@@ -142,10 +496,11 @@ void FCNN::AddHiddenLayer(const size_t& neurons, const ActivationFunction& activ
     const int cols = this->_layers->at(this->_layers->size() - 1)->_neuronsOut->size();
 
     Matrix init{rows, cols};
-    init.Randomize();
+    this->InitializeWeights(init, activationFunc);
 
     auto layer = make_unique<NeuralLayer>(LayerType::Hidden, neurons, activationFunc, activationDer, nullptr, nullptr, init);
     this->_layers->push_back(std::move(layer));
+    this->_revision++;
 }
 
 void FCNN::AddHiddenLayer(const size_t& neurons, const ActivationFunction& activationFunc, const ActivationFunction& activationDer, const Matrix& weights) {
@@ -161,6 +516,7 @@ void FCNN::AddHiddenLayer(const size_t& neurons, const ActivationFunction& activ
 
     auto layer = make_unique<NeuralLayer>(LayerType::Hidden, neurons, activationFunc, activationDer, nullptr, nullptr, weights);
     this->_layers->push_back(std::move(layer));
+    this->_revision++;
 }
 
 void FCNN::AddOutputLayer(const size_t& outputs, const ActivationFunction& activationFunc, const ActivationFunction& activationDer, const ErrorFunction& errorFunc, const ErrorFunction& errorFuncDer) {
@@ -172,11 +528,16 @@ void FCNN::AddOutputLayer(const size_t& outputs, const ActivationFunction& activ
     const int rows = outputs;
     const int cols = this->_layers->at(this->_layers->size() - 1)->_neuronsOut->size();
 
+    for (const auto& l : *this->_layers.get()) {
+        if (l->_exitHead != nullptr && l->_exitHead->Weights->Rows() != outputs) throw out_of_range("Invalid outputs: exit heads have " + to_string(l->_exitHead->Weights->Rows()) + " classes.");
+    }
+
     Matrix init{rows, cols};
-    init.Randomize();
+    this->InitializeWeights(init, activationFunc);
 
     auto layer = make_unique<NeuralLayer>(LayerType::Output, outputs, activationFunc, activationDer, errorFunc, errorFuncDer, init);
     this->_layers->push_back(std::move(layer));
+    this->_revision++;
 
     // Close network build
     this->_hasOutputs = true;
@@ -193,59 +554,291 @@ void FCNN::AddOutputLayer(const size_t& outputs, const ActivationFunction& activ
     // Check: matrix must have as many columns as the PREVIOUS layer neurons
     if (this->_layers->at(this->_layers->size() - 1)->_neuronsOut->size() != weights.Cols()) throw out_of_range("Invalid weights: weight matrix cols must be equal to the number of previous layer neurons.");
 
+    for (const auto& l : *this->_layers.get()) {
+        if (l->_exitHead != nullptr && l->_exitHead->Weights->Rows() != outputs) throw out_of_range("Invalid outputs: exit heads have " + to_string(l->_exitHead->Weights->Rows()) + " classes.");
+    }
 
     auto layer = make_unique<NeuralLayer>(LayerType::Output, outputs, activationFunc, activationDer, errorFunc, errorFuncDer, weights);
     this->_layers->push_back(std::move(layer));
+    this->_revision++;
 
     // Close network build
     this->_hasOutputs = true;
 }
 
-void FCNN::Propagate() {
+void FCNN::AddSoftmaxOutputLayer(const size_t& outputs) {
+    // Same as any output layer, then softmax on top of the net values
+    this->AddOutputLayer(outputs, Math::Identity, Math::DeIdentity, Math::CrossEntropy, Math::DeCrossEntropy);
+    this->_layers->back()->_softmax = true;
+}
+
+void FCNN::AddSoftmaxOutputLayer(const size_t& outputs, const Matrix& weights) {
+    this->AddOutputLayer(outputs, Math::Identity, Math::DeIdentity, Math::CrossEntropy, Math::DeCrossEntropy, weights);
+    this->_layers->back()->_softmax = true;
+}
+
+void FCNN::AddBatchNormalization(const double& momentum /*= 0.001*/, const double& epsilon /*= 1e-5*/) {
+    // Check
+    if (this->_layers == nullptr || this->_layers->size() < 2 || this->_hasOutputs) throw runtime_error("Cannot add batch normalization: must follow a hidden layer.");
+
+    const auto& l = this->_layers->back();
+    if (l->_type != LayerType::Hidden) throw runtime_error("Cannot add batch normalization: must follow a hidden layer.");
+    if (l->_batchNorm != nullptr) throw runtime_error("Cannot add batch normalization: layer is already normalized.");
+
+    l->_batchNorm = make_unique<BatchNormalization>(l->Neurons(), momentum, epsilon);
+    this->_revision++;
+}
+
+void FCNN::AddExitHead(const size_t& classes, const double& lossWeight /*= 0.5*/) {
+    // Check
+    if (this->_layers == nullptr || this->_layers->size() < 2 || this->_hasOutputs) throw runtime_error("Cannot add exit head: must follow a hidden layer.");
+
+    const auto& l = this->_layers->back();
+    if (l->_type != LayerType::Hidden) throw runtime_error("Cannot add exit head: must follow a hidden layer.");
+    if (l->_exitHead != nullptr) throw runtime_error("Cannot add exit head: layer has already a head.");
+
+    l->_exitHead = make_unique<ExitHead>(classes, l->Neurons(), lossWeight);
+    this->InitializeWeights(*l->_exitHead->Weights.get(), Math::Identity);
+}
+
+void FCNN::SetExitThreshold(const double& threshold) {
+    // Check
+    if (threshold <= 0.0) throw out_of_range("Exit threshold must be > 0.");
+
+    this->_exitThreshold = threshold;
+}
+
+size_t FCNN::ExitLayer() const {
+    return this->_exit;
+}
+
+void FCNN::Propagate(const bool& earlyExit /*= true*/) {
     // Check
     if (this->_layers == nullptr || this->_layers->size() < 1) throw runtime_error("Cannot propagate: missing an input layer.");
     if (!this->_hasOutputs) throw runtime_error("Cannot propagate: missing an output layer.");
     if (this->_layers == nullptr || this->_layers->size() < 2) throw runtime_error("Cannot propagate with less than 2 layers!");
 
+    // If the input layer has a bias, add it to the input values in its net vector
+    // (backpropagating would drive to wrong input value if iterated, so input values are never changed)
+    const auto& input = this->_layers->at(0);
+    const bool inputBias = (input->_bias_weights != nullptr && input->_bias_weights->size() > 0);
+    if (inputBias) {
+        for (size_t i = 0; i < input->_neuronsOut->size(); i++) input->_neuronsNet->at(i) = input->_neuronsOut->at(i) + input->_bias_weights->at(i);
+    }
+
+    // Exit heads are evaluated only when they can stop the forward
+    const bool heads = (earlyExit && this->_exitThreshold <= 1.0);
+    this->_exit = this->_layers->size() - 1;
+
     // Weighted sum calculation, starting from the first layer after input.
-    for (auto it = this->_layers->begin() + 1; it != this->_layers->end(); it++) {
+    for (size_t k = 1; k < this->_layers->size(); k++) {
         // Previous layer l-1
-        const auto& l_1 = (it - 1)->get();
+        const auto& l_1 = this->_layers->at(k - 1);
         // Current layer a_(l)
-        const auto& l = it->get();
+        const auto& l = this->_layers->at(k);
 
-        // If the previous layer is the input layer, separate calculus to add bias
-        // (backpropagating would drive to wrong input value if iterated)
+        const auto& a_l_1 = (k == 1 && inputBias) ? *l_1->_neuronsNet.get() : *l_1->_neuronsOut.get();
+        l->Forward(a_l_1, *l->_neuronsNet.get(), *l->_neuronsOut.get(), l->_batchNorm != nullptr ? l->_batchNorm->Linear.get() : nullptr);
 
-        if (l_1->_type == LayerType::Input && l_1->_bias_weights != nullptr && l_1->_bias_weights->size() > 0) {
-            // copy values
-            vector<double> a_l_1;
-            a_l_1.assign(l_1->_neuronsOut->begin(), l_1->_neuronsOut->end()); 
-            // add biasing
-            for (size_t i = 0; i<a_l_1.size(); i++) a_l_1[i] += l_1->_bias_weights->at(i);
+        // Confident enough: the head answer is the result
+        if (heads && l->_exitHead != nullptr) {
+            auto& head = *l->_exitHead.get();
+            if (head.Forward(*l->_neuronsOut.get(), *head.Net.get(), *head.Out.get()) >= this->_exitThreshold) {
+                this->_exit = k;
+                return;
+            }
+        }
+    }
+}
 
-            // Weighted sum can be performed with weight_matrix * vector
-            // In math: z_(l) = W_(l) * a_(l-1)
-            l->_neuronsNet = l->_weights->MultiplyVector(a_l_1);
+unique_ptr<ExecutionContext> FCNN::CreateContext() const {
+    // Check
+    if (!this->_hasOutputs) throw runtime_error("Cannot create context: missing an output layer.");
+
+    vector<size_t> sizes;
+    sizes.reserve(this->_layers->size());
+    for (const auto& layer : *this->_layers.get()) sizes.push_back(layer->Neurons());
+
+    return make_unique<ExecutionContext>(sizes);
+}
+
+void FCNN::Predict(ExecutionContext& context, const vector<double>& inputs, vector<double>& outputs) const {
+    // Check
+    if (!this->_hasOutputs || this->_layers->size() < 2) throw runtime_error("Cannot predict: network is not complete.");
+    if (context.Out->size() != this->_layers->size()) throw runtime_error("Cannot predict: context does not belong to this network.");
+
+    const auto& input = this->_layers->at(0);
+    if (inputs.size() != input->Neurons()) throw runtime_error("Input values: invalid size.");
+
+    // Input layer (with bias if any)
+    auto& x = *context.Net->at(0).get();
+    const bool inputBias = (input->_bias_weights != nullptr && input->_bias_weights->size() > 0);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        context.Out->at(0)->at(i) = inputs[i];
+        x[i] = inputs[i] + (inputBias ? input->_bias_weights->at(i) : 0.0);
+    }
+
+    // Forward, all state is in context
+    const bool heads = (this->_exitThreshold <= 1.0);
+    context.Exit = this->_layers->size() - 1;
+    context.Cached = false;
+    for (size_t k = 1; k < this->_layers->size(); k++) {
+        const auto& l = this->_layers->at(k);
+        const auto& a_l_1 = (k == 1) ? x : *context.Out->at(k - 1).get();
+        l->Forward(a_l_1, *context.Net->at(k).get(), *context.Out->at(k).get());
+
+        if (heads && l->_exitHead != nullptr && l->_exitHead->Forward(*context.Out->at(k).get(), *context.HeadNet.get(), *context.HeadOut.get()) >= this->_exitThreshold) {
+            context.Exit = k;
+            break;
+        }
+    }
+
+    // Copy result
+    const auto& result = (context.Exit + 1 < this->_layers->size() ? *context.HeadOut.get() : *context.Out->back().get());
+    if (outputs.size() != result.size()) outputs.resize(result.size());
+    std::copy(result.begin(), result.end(), outputs.begin());
+}
+
+size_t FCNN::PredictAnytime(ExecutionContext& context, const vector<double>& inputs, vector<double>& outputs, const int64_t& budgetUs) const {
+    const int64_t start = esp_timer_get_time();
+
+    // Check
+    if (!this->_hasOutputs || this->_layers->size() < 2) throw runtime_error("Cannot predict: network is not complete.");
+    if (context.Out->size() != this->_layers->size()) throw runtime_error("Cannot predict: context does not belong to this network.");
+
+    const auto& input = this->_layers->at(0);
+    if (inputs.size() != input->Neurons()) throw runtime_error("Input values: invalid size.");
+
+    auto& x = *context.Net->at(0).get();
+    const bool inputBias = (input->_bias_weights != nullptr && input->_bias_weights->size() > 0);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        context.Out->at(0)->at(i) = inputs[i];
+        x[i] = inputs[i] + (inputBias ? input->_bias_weights->at(i) : 0.0);
+    }
+
+    // Layer of the latest head answer, kept in context.HeadOut (0 = none yet)
+    size_t answered = 0;
+    context.Exit = this->_layers->size() - 1;
+    context.Cached = false;
+    for (size_t k = 1; k < this->_layers->size(); k++) {
+        const auto& l = this->_layers->at(k);
+        const auto& a_l_1 = (k == 1) ? x : *context.Out->at(k - 1).get();
+        l->Forward(a_l_1, *context.Net->at(k).get(), *context.Out->at(k).get());
+
+        if (l->_exitHead != nullptr) {
+            answered = k;
+            if (l->_exitHead->Forward(*context.Out->at(k).get(), *context.HeadNet.get(), *context.HeadOut.get()) >= this->_exitThreshold) {
+                context.Exit = k;
+                break;
+            }
+        }
+
+        // Out of time: the best answer is the deepest one (esp_timer_get_time() is unsigned on Linux, elapsed time is signed everywhere)
+        const int64_t elapsed = static_cast<int64_t>(esp_timer_get_time()) - start;
+        if (answered > 0 && k + 1 < this->_layers->size() && elapsed >= budgetUs) {
+            context.Exit = answered;
+            break;
+        }
+    }
+
+    const auto& result = (context.Exit + 1 < this->_layers->size() ? *context.HeadOut.get() : *context.Out->back().get());
+    if (outputs.size() != result.size()) outputs.resize(result.size());
+    std::copy(result.begin(), result.end(), outputs.begin());
+
+    return context.Exit;
+}
+
+size_t FCNN::PredictIncremental(ExecutionContext& context, const vector<double>& inputs, vector<double>& outputs, const double& maxChanged /*= 0.4*/, const size_t& refreshEvery /*= 1000*/) const {
+    // Check
+    if (!this->_hasOutputs || this->_layers->size() < 2) throw runtime_error("Cannot predict: network is not complete.");
+    if (context.Out->size() != this->_layers->size()) throw runtime_error("Cannot predict: context does not belong to this network.");
+
+    const auto& input = this->_layers->at(0);
+    if (inputs.size() != input->Neurons()) throw runtime_error("Input values: invalid size.");
+
+    // Full forward when nothing is cached, and periodically: incremental updates add rounding errors
+    const bool refresh = (!context.Cached || context.Updates >= refreshEvery);
+    auto& changed = *context.Changed.get();
+    auto& difference = *context.Difference.get();
+    auto& previous = *context.Previous.get();
+
+    // Changed inputs (the input bias cancels out in the differences)
+    auto& x = *context.Net->at(0).get();
+    auto& last = *context.Out->at(0).get();
+    const bool inputBias = (input->_bias_weights != nullptr && input->_bias_weights->size() > 0);
+    changed.clear();
+    difference.clear();
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (inputs[i] != last[i]) {
+            changed.push_back(i);
+            difference.push_back(inputs[i] - last[i]);
+        }
+        last[i] = inputs[i];
+        x[i] = inputs[i] + (inputBias ? input->_bias_weights->at(i) : 0.0);
+    }
+
+    size_t incremental = 0;
+    const size_t layers = this->_layers->size();
+    for (size_t k = 1; k < layers; k++) {
+        const auto& l = this->_layers->at(k);
+        const auto& in = (k == 1) ? x : *context.Out->at(k - 1).get();
+        auto& net = *context.Net->at(k).get();
+        auto& out = *context.Out->at(k).get();
+        const bool hidden = (k + 1 < layers);
+
+        // Net values must be W * in + bias: no batch normalization, weights with random access
+        const bool update = (!refresh && l->_batchNorm == nullptr && l->_sparseWeights == nullptr && l->_halfWeights == nullptr
+            && static_cast<double>(changed.size()) <= maxChanged * static_cast<double>(in.size()));
+
+        if (update) {
+            incremental++;
+
+            // Nothing changed, nothing to do for next layers too
+            if (changed.empty()) continue;
+
+            // net += W[:, j] * d_j for each changed input j, gathered row by row (weights are row-major)
+            const Matrix& w = *l->_weights.get();
+            const size_t count = changed.size();
+            for (size_t i = 0; i < net.size(); i++) {
+                const double* row = w[i];
+                double sum = 0.0;
+                for (size_t c = 0; c < count; c++) sum += row[changed[c]] * difference[c];
+                net[i] += sum;
+            }
+
+            if (hidden) std::copy(out.begin(), out.end(), previous.begin());
+            if (l->_softmax) Math::Softmax(net, out);
+            else {
+                for (size_t i = 0; i < net.size(); i++) out[i] = l->_f(net[i]);
+            }
         }
         else {
-            // Direct, save memory
-            
-            // Weighted sum can be performed with weight_matrix * vector
-            // In math: z_(l) = W_(l) * a_(l-1)
-            l->_neuronsNet = l->_weights->MultiplyVector(*l_1->_neuronsOut.get());
-        }    
-
-        // Now activate neurons applying the activation function of this layer
-        // In math a_l = f(z_l)
-        for (int i = 0; i< l->_neuronsNet->size(); i++) {
-            // If current layer has a bias, add the weighted value (1*b_i) to each neuron
-            if (l->_bias_weights != nullptr) l->_neuronsNet->at(i) += l->_bias_weights->at(i);
-            
-            // Activate
-            l->_neuronsOut->at(i) = l->_f( l->_neuronsNet->at(i) );
+            if (hidden) std::copy(out.begin(), out.end(), previous.begin());
+            l->Forward(in, net, out);
+        }
+
+        // Changed outputs are the changed inputs of next layer (ReLU layers keep many zeros)
+        changed.clear();
+        difference.clear();
+        if (hidden) {
+            for (size_t i = 0; i < out.size(); i++) {
+                if (out[i] != previous[i]) {
+                    changed.push_back(i);
+                    difference.push_back(out[i] - previous[i]);
+                }
+            }
         }
     }
+
+    context.Cached = true;
+    context.Updates = (refresh ? 0 : context.Updates + 1);
+    context.Exit = layers - 1;
+
+    const auto& result = *context.Out->back().get();
+    if (outputs.size() != result.size()) outputs.resize(result.size());
+    std::copy(result.begin(), result.end(), outputs.begin());
+
+    return incremental;
 }
 
 unique_ptr<vector<double>> FCNN::GetResult() {
@@ -254,7 +847,11 @@ unique_ptr<vector<double>> FCNN::GetResult() {
 
     auto& out = this->_layers->at(this->_layers->size() - 1);
     auto result = make_unique<vector<double>>();
-    result->assign(out->_neuronsOut->begin(), out->_neuronsOut->end());
+    if (this->_exit + 1 < this->_layers->size()) {
+        const auto& head = *this->_layers->at(this->_exit)->_exitHead.get();
+        result->assign(head.Out->begin(), head.Out->end());
+    }
+    else result->assign(out->_neuronsOut->begin(), out->_neuronsOut->end());
 
     return std::move(result);
 }
@@ -269,52 +866,92 @@ unique_ptr<vector<double>> FCNN::Predict(const vector<double>& inputs) {
 }
 
 double FCNN::Train(const vector<double>& inputs, const vector<double>& targets, const double& learningRate) {
+    // Calculate all deltas first (with current weights), then update
+    const double totalError = this->Backpropagate(inputs, targets);
+    this->UpdateWeights(learningRate);
+    BRIAND_LOGV("FCNN", "Train: error %.6lf", totalError);
+
+    return totalError;
+}
+
+const vector<double>& FCNN::LayerInput(const size_t& k) const {
+    // Input layer bias is added to the input values (see Propagate), so the input "activation" is its net vector
+    const auto& l_prev = this->_layers->at(k - 1);
+    const bool inputBias = (k == 1 && l_prev->_bias_weights != nullptr && l_prev->_bias_weights->size() > 0);
+    return inputBias ? *l_prev->_neuronsNet.get() : *l_prev->_neuronsOut.get();
+}
+
+double FCNN::Backpropagate(const vector<double>& inputs, const vector<double>& targets) {
     // Check
     if (this->_layers == nullptr || this->_layers->size() < 1) throw runtime_error("Cannot backpropagate: missing an input layer.");
     if (!this->_hasOutputs) throw runtime_error("Cannot backpropagate: missing an output layer.");
     if (targets.size() != this->_layers->at(this->_layers->size() - 1)->_neuronsOut->size()) throw out_of_range("Invalid targets: size must be equal to outputs.");
 
-    // Get results
-    auto outputs = this->Predict(inputs);
+    // Gradients need the full precision master weights: inference copies would be stale after the update anyway
+    for (const auto& l : *this->_layers.get()) {
+        if (l->DropWeightCopies()) this->_revision++;
+    }
+
+    // Get results (in output layer, no copies), exit heads are trained on all samples
+    this->SetInput(inputs);
+    this->Propagate(false);
     const auto& outputLayer = this->_layers->at(this->_layers->size() - 1);
+    const auto& outputs = *outputLayer->_neuronsOut.get();
 
 #if BRIAND_AI_DEBUG
     printf("\n\n    ------ TRAINING\n");
     printf("\nx = \n");
     Matrix::PrintVector(inputs);
     printf("\ny = \n");
-    Matrix::PrintVector(*outputLayer->_neuronsOut.get());
+    Matrix::PrintVector(outputs);
     printf("\ny^ = \n");
     Matrix::PrintVector(targets);
+    printf("\nJ = \n");
 #endif
 
     double totalError = 0;
 
-    // Calculate errors at output and total error. Save in J vector
-    auto J = make_unique<vector<double>>(targets);
-    for(size_t i = 0; i < J->size(); i++) {
-        J->at(i) = outputLayer->_E(targets[i], outputs->at(i)); 
-        totalError += J->at(i);
+    if (outputLayer->_softmax) {
+        // Fused softmax + cross-entropy in one pass:
+        // J_i = -y_i * log(p_i) = y_i * (logsumexp(z) - z_i), finite even when p_i underflows
+        // delta_i = dJ/dz_i = p_i - y_i (the softmax Jacobian is never built)
+        const auto& net = *outputLayer->_neuronsNet.get();
+        const double lse = Math::LogSumExp(net);
+
+        for (size_t i = 0; i < net.size(); i++) {
+            const double J = (targets[i] != 0.0 ? targets[i] * (lse - net[i]) : 0.0);
+            totalError += J;
+
+#if BRIAND_AI_DEBUG
+            printf("%.5f ", J);
+#endif
+
+            (*outputLayer->_delta.get())[i] = outputs[i] - targets[i];
+        }
     }
+    else {
+        for (size_t i = 0; i < outputLayer->_neuronsNet->size(); i++) {
+            // Calculate errors at output and total error
+            const double J = outputLayer->_E(targets[i], outputs[i]);
+            totalError += J;
+
+#if BRIAND_AI_DEBUG
+            printf("%.5f ", J);
+#endif
 
-    // Calculate delta for output layer
-    outputLayer->_delta = make_unique<vector<double>>();  
-    for (size_t i = 0; i < outputLayer->_neuronsNet->size(); i++) {
-        // (y - y^)*df(z)
-        outputLayer->_delta->push_back( (outputs->at(i) - targets[i]) * outputLayer->_df(outputLayer->_neuronsNet->at(i)) );
+            // Calculate delta for output layer
+            // dE(y^, y)*df(z) (for MSE: (y - y^)*df(z))
+            const double dE = (outputLayer->_dE != nullptr ? outputLayer->_dE(targets[i], outputs[i]) : outputs[i] - targets[i]);
+            outputLayer->_delta->at(i) = dE * outputLayer->_df(outputLayer->_neuronsNet->at(i));
+        }
     }
 
 #if BRIAND_AI_DEBUG
-    printf("\nTotal error = %.5f\n", totalError);
-    printf("\nJ = \n");
-    Matrix::PrintVector(*J.get());
+    printf("\n\nTotal error = %.5f\n", totalError);
     printf("\ndelta_L = \n");
     Matrix::PrintVector(*outputLayer->_delta.get());
 #endif
 
-    // Destroy unecessary objects
-    J.reset();
-
     // Backward iterate (until input is reached).
     for (size_t k = this->_layers->size() - 1; k >= 1; k--) {
         /* REMEMBER that at level l there is always the l-1 weights matrix by construction!
@@ -331,53 +968,822 @@ double FCNN::Train(const vector<double>& inputs, const vector<double>& targets,
         // Prev layer l-1
         const auto& l_prev = this->_layers->at(k-1);
 
-        // Vector-Vector product delta_l+1 by transposed output of layer l
-        // Here l = l+1 so l = l-1
-        auto m1 = Matrix::DotMultiplyVectors(*l->_delta.get(), *l_prev->_neuronsOut.get());
+        // Calculate new delta (for previous layer) to be delta_(l+1) in next for cycle, BEFORE weights are changed
+        // delta_l = ( Wl_T dot delta_l+1 ) *hadamard df(z_l)
+        // For the input layer df is the identity (just the bias gradient)
+        // Fused single pass, no transposed matrix or temporary vector
+        if (k == 1) Assign(*l_prev->_delta.get(), Transpose(*l->_weights.get()) * *l->_delta.get());
+        else Assign(*l_prev->_delta.get(), Hadamard(Transpose(*l->_weights.get()) * *l->_delta.get(), Apply(*l_prev->_neuronsNet.get(), l_prev->_df)));
+
+        // Exit head: weighted cross-entropy on the same targets, its gradient flows into the layer too
+        // delta_l += ( Wh_T dot (w * (p - y)) ) *hadamard df(z_l)
+        if (k > 1 && l_prev->_exitHead != nullptr) {
+            auto& head = *l_prev->_exitHead.get();
+            head.Forward(*l_prev->_neuronsOut.get(), *head.Net.get(), *head.Out.get());
+            for (size_t c = 0; c < head.Delta->size(); c++) head.Delta->at(c) = head.LossWeight * (head.Out->at(c) - targets[c]);
+            Assign(*l_prev->_delta.get(), *l_prev->_delta.get() + Hadamard(Transpose(*head.Weights.get()) * *head.Delta.get(), Apply(*l_prev->_neuronsNet.get(), l_prev->_df)));
+        }
+
+        // Batch normalization: delta is on normalized values, keep it for Gamma and Beta and bring it back to the weighted sum
+        // (statistics are constants): from here on the layer looks like an ordinary one
+        if (k > 1 && l_prev->_batchNorm != nullptr) {
+            auto& norm = *l_prev->_batchNorm.get();
+            for (size_t i = 0; i < l_prev->_delta->size(); i++) {
+                const double inverse = 1.0 / sqrt(norm.Variance->at(i) + norm.Epsilon);
+                const double scale = norm.Gamma->at(i) * inverse;
+                norm.Normalized->at(i) = (norm.Linear->at(i) - norm.Mean->at(i)) * inverse;
+                norm.Delta->at(i) = l_prev->_delta->at(i);
+                l_prev->_delta->at(i) *= scale;
+            }
+        }
+    }
 
-        // Multiply all elements by learning rate
-        m1->MultiplyScalar(learningRate);
+    // Running statistics, after they normalized this sample
+    for (const auto& l : *this->_layers.get()) {
+        if (l->_batchNorm != nullptr) l->_batchNorm->Update();
+    }
+
+    return totalError;
+}
+
+void FCNN::UpdateWeights(const double& learningRate) {
+    const auto& inputLayer = this->_layers->at(0);
+    const bool inputBias = (inputLayer->_bias_weights != nullptr && inputLayer->_bias_weights->size() > 0);
+
+    for (size_t k = this->_layers->size() - 1; k >= 1; k--) {
+        const auto& l = this->_layers->at(k);
+        const auto& a_prev = this->LayerInput(k);
 
 #if BRIAND_AI_DEBUG
-        printf("\nUpdating W_%d(%d,%d) ; b(%d). Using m1(%d,%d) = delta(%d)*a_l-1(%d) where l = %d\n"
+        printf("\nUpdating W_%d(%d,%d) ; b(%d). Using delta(%d)*a_l-1(%d) where l = %d\n"
             , k
             , l->_weights->Rows()
             , l->_weights->Cols()
-            , l->_type != LayerType::Output ? l->_bias_weights->size() : 0
-            , m1->Rows()
-            , m1->Cols()
+            , l->_bias_weights != nullptr ? l->_bias_weights->size() : 0
             , l->_delta->size()
-            , l_prev->_neuronsOut->size()
+            , a_prev.size()
             , k
         );
 #endif
 
-        // Check
-        assert(m1->Rows() == l->_weights->Rows());
-        assert(m1->Cols() == l->_weights->Cols());
-        assert(l->_delta->size() == l_prev->_bias_weights->size());
+        // Update weights and bias at layer l (bias of layer l is added to layer l net, see Propagate)
+        // W_l -= learningRate * (delta_l+1 dot a_l-1 transposed): evaluated in one pass over W, outer product never stored
+        *l->_weights.get() -= learningRate * Outer(*l->_delta.get(), a_prev);
+        if (l->_bias_weights != nullptr) Assign(*l->_bias_weights.get(), *l->_bias_weights.get() - learningRate * Column(*l->_delta.get()));
+
+        // Normalization scale and shift
+        if (l->_batchNorm != nullptr) {
+            auto& norm = *l->_batchNorm.get();
+            Assign(*norm.Gamma.get(), *norm.Gamma.get() - learningRate * Hadamard(Column(*norm.Delta.get()), Column(*norm.Normalized.get())));
+            Assign(*norm.Beta.get(), *norm.Beta.get() - learningRate * Column(*norm.Delta.get()));
+        }
+
+        // Exit head, on the output of this layer
+        if (l->_exitHead != nullptr) {
+            auto& head = *l->_exitHead.get();
+            *head.Weights.get() -= learningRate * Outer(*head.Delta.get(), *l->_neuronsOut.get());
+            Assign(*head.Bias.get(), *head.Bias.get() - learningRate * Column(*head.Delta.get()));
+        }
+
+        // Pruned weights stay at zero, sparse copy is now stale
+        l->ApplyPruneMask();
+        if (l->DropWeightCopies()) this->_revision++;
+    }
+
+    // Input bias
+    if (inputBias) {
+        Assign(*inputLayer->_bias_weights.get(), *inputLayer->_bias_weights.get() - learningRate * Column(*inputLayer->_delta.get()));
+    }
+}
+
+void FCNN::AccumulateGradients() {
+    for (size_t k = 0; k < this->_layers->size(); k++) {
+        const auto& l = this->_layers->at(k);
+
+        // Buffers allocated once, reused by all batches
+        if (k > 0) {
+            if (l->_gradient == nullptr) l->_gradient = make_unique<Matrix>(l->_weights->Rows(), l->_weights->Cols(), 0.0);
+            *l->_gradient.get() += Outer(*l->_delta.get(), this->LayerInput(k));
+        }
+
+        if (l->_bias_weights != nullptr && l->_bias_weights->size() > 0) {
+            if (l->_biasGradient == nullptr) l->_biasGradient = make_unique<vector<double>>(l->_bias_weights->size(), 0.0);
+            Assign(*l->_biasGradient.get(), *l->_biasGradient.get() + Column(*l->_delta.get()));
+        }
+
+        if (l->_batchNorm != nullptr) {
+            auto& norm = *l->_batchNorm.get();
+            if (norm.GammaGradient == nullptr) norm.GammaGradient = make_unique<vector<double>>(norm.Gamma->size(), 0.0);
+            if (norm.BetaGradient == nullptr) norm.BetaGradient = make_unique<vector<double>>(norm.Beta->size(), 0.0);
+            Assign(*norm.GammaGradient.get(), *norm.GammaGradient.get() + Hadamard(Column(*norm.Delta.get()), Column(*norm.Normalized.get())));
+            Assign(*norm.BetaGradient.get(), *norm.BetaGradient.get() + Column(*norm.Delta.get()));
+        }
+
+        if (l->_exitHead != nullptr) {
+            auto& head = *l->_exitHead.get();
+            if (head.WeightsGradient == nullptr) head.WeightsGradient = make_unique<Matrix>(head.Weights->Rows(), head.Weights->Cols(), 0.0);
+            if (head.BiasGradient == nullptr) head.BiasGradient = make_unique<vector<double>>(head.Bias->size(), 0.0);
+            *head.WeightsGradient.get() += Outer(*head.Delta.get(), *l->_neuronsOut.get());
+            Assign(*head.BiasGradient.get(), *head.BiasGradient.get() + Column(*head.Delta.get()));
+        }
+    }
+}
+
+void FCNN::ApplyGradients(const double& learningRate, const size_t& samples) {
+    if (samples == 0) return;
+    const double rate = learningRate / static_cast<double>(samples);
+
+    for (size_t k = 0; k < this->_layers->size(); k++) {
+        const auto& l = this->_layers->at(k);
+
+        if (k > 0 && l->_gradient != nullptr) {
+            *l->_weights.get() -= rate * *l->_gradient.get();
+            l->_gradient->MultiplyScalar(0.0);
+            l->ApplyPruneMask();
+            if (l->DropWeightCopies()) this->_revision++;
+        }
+
+        if (l->_biasGradient != nullptr) {
+            Assign(*l->_bias_weights.get(), *l->_bias_weights.get() - rate * Column(*l->_biasGradient.get()));
+            std::fill(l->_biasGradient->begin(), l->_biasGradient->end(), 0.0);
+        }
+
+        if (l->_batchNorm != nullptr && l->_batchNorm->GammaGradient != nullptr) {
+            auto& norm = *l->_batchNorm.get();
+            Assign(*norm.Gamma.get(), *norm.Gamma.get() - rate * Column(*norm.GammaGradient.get()));
+            Assign(*norm.Beta.get(), *norm.Beta.get() - rate * Column(*norm.BetaGradient.get()));
+            std::fill(norm.GammaGradient->begin(), norm.GammaGradient->end(), 0.0);
+            std::fill(norm.BetaGradient->begin(), norm.BetaGradient->end(), 0.0);
+        }
+
+        if (l->_exitHead != nullptr && l->_exitHead->WeightsGradient != nullptr) {
+            auto& head = *l->_exitHead.get();
+            *head.Weights.get() -= rate * *head.WeightsGradient.get();
+            Assign(*head.Bias.get(), *head.Bias.get() - rate * Column(*head.BiasGradient.get()));
+            head.WeightsGradient->MultiplyScalar(0.0);
+            std::fill(head.BiasGradient->begin(), head.BiasGradient->end(), 0.0);
+        }
+    }
+}
+
+unique_ptr<FitResult> FCNN::Fit(const Dataset& dataset, const FitOptions& options) {
+    // Check
+    if (!this->_hasOutputs) throw runtime_error("Cannot fit: missing an output layer.");
+    if (dataset.Size() == 0) throw runtime_error("Cannot fit: empty dataset.");
+
+    const size_t inputs = this->_layers->at(0)->Neurons();
+    const size_t outputs = this->_layers->back()->Neurons();
+    for (size_t i = 0; i < dataset.Size(); i++) {
+        if (dataset.Inputs->at(i).size() != inputs || dataset.Targets->at(i).size() != outputs) throw out_of_range("Cannot fit: sample size does not match network inputs/outputs.");
+    }
 
-        // Update weights and bias at layer l
-        for (int i=0; i < l->_weights->Rows(); i++) {
-            for (int j=0; j < l->_weights->Cols(); j++) {
-                l->_weights->at(i,j) -= m1->at(i,j); 
+    auto result = make_unique<FitResult>();
+    const long fitStart = esp_timer_get_time();
+    Philox generator(options.Seed, 1);
+
+    // Samples are never copied: only this permutation is shuffled
+    vector<size_t> indexes(dataset.Size());
+    for (size_t i = 0; i < indexes.size(); i++) indexes[i] = i;
+
+    auto shuffle = [&generator](vector<size_t>& v, const size_t& count) {
+        for (size_t i = count; i > 1; i--) std::swap(v[i - 1], v[generator.NextUInt32() % i]);
+    };
+
+    // Validation samples: another dataset or the tail of a shuffled permutation
+    const Dataset* validation = options.Validation;
+    vector<size_t> validationIndexes;
+    size_t trainCount = dataset.Size();
+
+    if (validation == nullptr && options.ValidationSplit > 0.0 && dataset.Size() > 1) {
+        shuffle(indexes, indexes.size());
+        size_t held = static_cast<size_t>(options.ValidationSplit * static_cast<double>(dataset.Size()));
+        if (held == 0) held = 1;
+        if (held >= dataset.Size()) held = dataset.Size() - 1;
+
+        trainCount = dataset.Size() - held;
+        validationIndexes.assign(indexes.begin() + trainCount, indexes.end());
+        indexes.resize(trainCount);
+        validation = &dataset;
+    }
+
+    unique_ptr<FitValidator> validator = nullptr;
+    if (validation != nullptr) validator = make_unique<FitValidator>(*this, *validation, validationIndexes);
+
+    // Best weights, copied only on improvement
+    unique_ptr<FCNN> best = (options.RestoreBest ? this->Clone() : nullptr);
+    size_t waiting = 0;
+    bool stop = false;
+
+    // Monitored loss of an epoch: improvement, plateau and target checks
+    auto monitor = [&](const size_t& epoch, const double& loss, const FCNN& weights) {
+        if (loss < result->BestLoss - options.MinDelta) {
+            result->BestLoss = loss;
+            result->BestEpoch = epoch;
+            waiting = 0;
+            if (best != nullptr) best->CopyWeightsFrom(weights);
+        }
+        else waiting++;
+
+        if (options.Patience > 0 && waiting >= options.Patience) stop = true;
+        if (options.TargetLoss > 0.0 && loss <= options.TargetLoss) stop = true;
+    };
+
+    // Collect the validation running in background (of previous epoch)
+    size_t validating = 0;
+    auto collect = [&]() {
+        if (validating == 0) return;
+        const double loss = validator->Wait();
+        result->History->at(validating - 1).ValidationLoss = loss;
+        monitor(validating, loss, *validator->Snapshot.get());
+        validating = 0;
+    };
+
+    for (size_t epoch = 1; epoch <= options.Epochs && !stop; epoch++) {
+        const long start = esp_timer_get_time();
+        BRIAND_TRACE("FCNN", "Fit epoch");
+
+        if (options.Shuffle) shuffle(indexes, trainCount);
+
+        double trainLoss = 0.0;
+        size_t inBatch = 0;
+
+        for (size_t i = 0; i < trainCount; i++) {
+            const size_t s = indexes[i];
+
+            if (options.BatchSize <= 1) {
+                trainLoss += this->Train(dataset.Inputs->at(s), dataset.Targets->at(s), options.LearningRate);
+                continue;
+            }
+
+            trainLoss += this->Backpropagate(dataset.Inputs->at(s), dataset.Targets->at(s));
+            this->AccumulateGradients();
+            if (++inBatch == options.BatchSize) {
+                this->ApplyGradients(options.LearningRate, inBatch);
+                inBatch = 0;
+            }
+        }
+        if (inBatch > 0) this->ApplyGradients(options.LearningRate, inBatch);
+
+        FitEpoch statistics;
+        statistics.Epoch = epoch;
+        statistics.TrainLoss = trainLoss / static_cast<double>(trainCount);
+        statistics.ValidationLoss = -1.0;
+        statistics.Time = esp_timer_get_time() - start;
+        statistics.SamplesPerSecond = static_cast<double>(trainCount) * 1000000.0 / static_cast<double>(statistics.Time > 0 ? statistics.Time : 1);
+        result->History->push_back(statistics);
+        BRIAND_LOGD("FCNN", "Fit epoch %u: train loss %.6lf, %.0lf samples/s", epoch, statistics.TrainLoss, statistics.SamplesPerSecond);
+
+        if (validator != nullptr) {
+            // Previous epoch validation has run while this epoch trained
+            collect();
+            if (!stop) {
+                validator->Start(*this);
+                validating = epoch;
             }
-            
-            l_prev->_bias_weights->at(i) -= learningRate * l->_delta->at(i);
+        }
+        else {
+            monitor(epoch, statistics.TrainLoss, *this);
         }
 
-        // Calculate new delta (from current layer) to be delta_(l+1) in next for cycle
-        // delta_l = ( Wl_T dot delta_l+1 ) *hadamard df(z_l)
-        auto Wl_T = l->_weights->Transpose();
-        auto temp = Wl_T->MultiplyVector(*l->_delta.get());
+        if (options.PrintEvery > 0 && (epoch % options.PrintEvery == 0 || epoch == 1)) {
+            printf("Epoch %5u: train loss %.6lf, %.0lf samples/s", static_cast<unsigned int>(epoch), statistics.TrainLoss, statistics.SamplesPerSecond);
+            // Latest validation available is the previous epoch one
+            if (epoch > 1 && validator != nullptr) printf(", validation loss %.6lf (epoch %u)", result->History->at(epoch - 2).ValidationLoss, static_cast<unsigned int>(epoch - 1));
+            printf("\n");
+        }
+    }
+
+    // Last validation
+    if (validator != nullptr) collect();
+    validator.reset();
+
+    result->StoppedEarly = stop;
+    if (best != nullptr && result->BestEpoch > 0) this->CopyWeightsFrom(*best.get());
+    result->Time = esp_timer_get_time() - fitStart;
+
+    return std::move(result);
+}
+
+double FCNN::Evaluate(ExecutionContext& context, const Dataset& dataset, const vector<size_t>& indexes) const {
+    const auto& outputLayer = this->_layers->back();
+    const size_t count = (indexes.size() > 0 ? indexes.size() : dataset.Size());
+    if (count == 0) return 0.0;
+
+    vector<double> outputs(outputLayer->Neurons());
+    double loss = 0.0;
+
+    for (size_t i = 0; i < count; i++) {
+        const size_t s = (indexes.size() > 0 ? indexes[i] : i);
+        const auto& targets = dataset.Targets->at(s);
+        this->Predict(context, dataset.Inputs->at(s), outputs);
+        for (size_t j = 0; j < outputs.size(); j++) loss += outputLayer->_E(targets[j], outputs[j]);
+    }
+
+    return loss / static_cast<double>(count);
+}
 
-        l_prev->_delta = make_unique<vector<double>>();
-        for (int i=0; i < l->_neuronsNet->size(); i++) {
-            l_prev->_delta->push_back( temp->at(i) * l->_df(l->_neuronsNet->at(i)) );
+unique_ptr<FCNN> FCNN::Clone() const {
+    auto copy = make_unique<FCNN>();
+    copy->_hasOutputs = this->_hasOutputs;
+    copy->_initializer = this->_initializer;
+    copy->_exitThreshold = this->_exitThreshold;
+
+    for (const auto& l : *this->_layers.get()) {
+        unique_ptr<NeuralLayer> layer;
+        if (l->_weights != nullptr) layer = make_unique<NeuralLayer>(l->_type, l->Neurons(), l->_f, l->_df, l->_E, l->_dE, *l->_weights.get());
+        else layer = make_unique<NeuralLayer>(l->_type, l->Neurons(), l->_f, l->_df, l->_E, l->_dE);
+
+        if (l->_bias_weights != nullptr) layer->_bias_weights = make_unique<vector<double>>(*l->_bias_weights.get());
+        else layer->_bias_weights.reset();
+
+        if (l->_pruneMask != nullptr) layer->_pruneMask = make_unique<vector<bool>>(*l->_pruneMask.get());
+        if (l->_batchNorm != nullptr) layer->_batchNorm = make_unique<BatchNormalization>(*l->_batchNorm.get());
+        if (l->_exitHead != nullptr) layer->_exitHead = make_unique<ExitHead>(*l->_exitHead.get());
+        layer->_softmax = l->_softmax;
+
+        copy->_layers->push_back(std::move(layer));
+    }
+
+    return std::move(copy);
+}
+
+void FCNN::CopyWeightsFrom(const FCNN& other) {
+    // Check
+    if (other._layers->size() != this->_layers->size()) throw runtime_error("Cannot copy weights: networks have different layers.");
+
+    for (size_t k = 0; k < this->_layers->size(); k++) {
+        const auto& to = this->_layers->at(k);
+        const auto& from = other._layers->at(k);
+
+        if (to->Neurons() != from->Neurons()) throw runtime_error("Cannot copy weights: networks have different layers.");
+
+        if (to->_weights != nullptr && from->_weights != nullptr) *to->_weights.get() = *from->_weights.get();
+        if (to->_bias_weights != nullptr && from->_bias_weights != nullptr) *to->_bias_weights.get() = *from->_bias_weights.get();
+        if (to->_batchNorm != nullptr && from->_batchNorm != nullptr) {
+            *to->_batchNorm->Gamma.get() = *from->_batchNorm->Gamma.get();
+            *to->_batchNorm->Beta.get() = *from->_batchNorm->Beta.get();
+            *to->_batchNorm->Mean.get() = *from->_batchNorm->Mean.get();
+            *to->_batchNorm->Variance.get() = *from->_batchNorm->Variance.get();
         }
+        if (to->_exitHead != nullptr && from->_exitHead != nullptr) {
+            *to->_exitHead->Weights.get() = *from->_exitHead->Weights.get();
+            *to->_exitHead->Bias.get() = *from->_exitHead->Bias.get();
+        }
+        if (to->DropWeightCopies()) this->_revision++;
     }
+}
 
-    return totalError;
+double FCNN::Prune(const double& threshold) {
+    // Check
+    if (!this->_hasOutputs) throw runtime_error("Cannot prune: missing an output layer.");
+
+    size_t zeros = 0, total = 0;
+
+    for (size_t k = 1; k < this->_layers->size(); k++) {
+        const auto& l = this->_layers->at(k);
+        const size_t rows = l->_weights->Rows();
+        const size_t cols = l->_weights->Cols();
+
+        if (l->_pruneMask == nullptr) l->_pruneMask = make_unique<vector<bool>>(rows * cols, true);
+
+        for (size_t i = 0; i < rows; i++) {
+            for (size_t j = 0; j < cols; j++) {
+                if (fabs((*l->_weights.get())[i][j]) < threshold) (*l->_pruneMask.get())[i * cols + j] = false;
+                if (!(*l->_pruneMask.get())[i * cols + j]) zeros++;
+            }
+        }
+
+        total += rows * cols;
+        l->ApplyPruneMask();
+        if (l->DropWeightCopies()) this->_revision++;
+    }
+
+    return (total > 0 ? static_cast<double>(zeros) / static_cast<double>(total) : 0.0);
+}
+
+double FCNN::PruneToSparsity(const double& sparsity) {
+    // Check
+    if (!this->_hasOutputs) throw runtime_error("Cannot prune: missing an output layer.");
+    if (sparsity < 0.0 || sparsity > 1.0) throw out_of_range("Sparsity must be between 0 and 1.");
+
+    size_t zeros = 0, total = 0;
+
+    for (size_t k = 1; k < this->_layers->size(); k++) {
+        const auto& l = this->_layers->at(k);
+        const size_t rows = l->_weights->Rows();
+        const size_t cols = l->_weights->Cols();
+        const size_t count = rows * cols;
+        const size_t toPrune = static_cast<size_t>(sparsity * static_cast<double>(count));
+
+        if (l->_pruneMask == nullptr) l->_pruneMask = make_unique<vector<bool>>(count, true);
+
+        // Smallest magnitudes first (already pruned weights are zero, so they are counted first)
+        vector<pair<double, size_t>> magnitudes;
+        magnitudes.reserve(count);
+        for (size_t i = 0; i < rows; i++) {
+            for (size_t j = 0; j < cols; j++) magnitudes.push_back(make_pair(fabs((*l->_weights.get())[i][j]), i * cols + j));
+        }
+        if (toPrune > 0 && toPrune < count) std::nth_element(magnitudes.begin(), magnitudes.begin() + toPrune, magnitudes.end());
+
+        for (size_t p = 0; p < toPrune && p < count; p++) (*l->_pruneMask.get())[magnitudes[p].second] = false;
+        for (size_t p = 0; p < count; p++) if (!(*l->_pruneMask.get())[p]) zeros++;
+
+        total += count;
+        l->ApplyPruneMask();
+        if (l->DropWeightCopies()) this->_revision++;
+    }
+
+    return (total > 0 ? static_cast<double>(zeros) / static_cast<double>(total) : 0.0);
+}
+
+unique_ptr<NeuronPruningResult> FCNN::PruneNeurons(const Dataset& dataset, const NeuronPruningOptions& options) {
+    // Check
+    if (!this->_hasOutputs || this->_layers->size() < 2) throw runtime_error("Cannot prune: network is not complete.");
+    if (dataset.Size() == 0) throw runtime_error("Cannot prune: empty dataset.");
+    if (options.MaxRemoval < 0.0 || options.MaxRemoval > 1.0) throw out_of_range("MaxRemoval must be between 0 and 1.");
+    for (const auto& l : *this->_layers.get()) {
+        if (l->_batchNorm != nullptr) throw runtime_error("Cannot prune: batch normalization must be folded first (OptimizeForInference()).");
+        if (l->_exitHead != nullptr) throw runtime_error("Cannot prune: exit heads are not supported.");
+    }
+
+    const size_t layers = this->_layers->size();
+    auto result = make_unique<NeuronPruningResult>();
+    for (const auto& l : *this->_layers.get()) result->Before->push_back(l->Neurons());
+    result->WeightsBefore = this->WeightsMemory();
+
+    // Output statistics of hidden layers, one pass over the dataset
+    vector<vector<double>> meanAbs(layers), maxAbs(layers), mean(layers);
+    for (size_t k = 1; k + 1 < layers; k++) {
+        const size_t neurons = this->_layers->at(k)->Neurons();
+        meanAbs[k].assign(neurons, 0.0);
+        maxAbs[k].assign(neurons, 0.0);
+        mean[k].assign(neurons, 0.0);
+    }
+
+    auto context = this->CreateContext();
+    vector<double> outputs;
+    for (size_t s = 0; s < dataset.Size(); s++) {
+        this->Predict(*context.get(), dataset.Inputs->at(s), outputs);
+
+        for (size_t k = 1; k + 1 < layers; k++) {
+            const auto& out = *context->Out->at(k).get();
+            for (size_t i = 0; i < out.size(); i++) {
+                meanAbs[k][i] += fabs(out[i]);
+                maxAbs[k][i] = std::max(maxAbs[k][i], fabs(out[i]));
+                mean[k][i] += out[i];
+            }
+        }
+    }
+
+    const double samples = static_cast<double>(dataset.Size());
+    for (size_t k = 1; k + 1 < layers; k++) {
+        for (auto& v : meanAbs[k]) v /= samples;
+        for (auto& v : mean[k]) v /= samples;
+    }
+
+    // Neurons to keep, all decided on the original network
+    vector<vector<bool>> keep(layers);
+    for (size_t k = 1; k + 1 < layers; k++) {
+        const size_t neurons = this->_layers->at(k)->Neurons();
+        const Matrix& next = *this->_layers->at(k + 1)->_weights.get();
+        keep[k].assign(neurons, true);
+
+        // Score: how much the neuron moves the next layer on average
+        vector<double> score(neurons, 0.0);
+        double total = 0.0;
+        for (size_t i = 0; i < neurons; i++) {
+            double norm = 0.0;
+            for (size_t r = 0; r < next.Rows(); r++) norm += next[r][i] * next[r][i];
+            score[i] = meanAbs[k][i] * sqrt(norm);
+            total += score[i];
+        }
+
+        // Dead neurons first (score -1), then the lowest scores
+        const double threshold = options.ScoreThreshold * total / static_cast<double>(neurons);
+        vector<pair<double, size_t>> candidates;
+        size_t dead = 0;
+        for (size_t i = 0; i < neurons; i++) {
+            if (maxAbs[k][i] <= options.DeadThreshold) {
+                candidates.push_back(make_pair(-1.0, i));
+                dead++;
+            }
+            else if (score[i] < threshold) {
+                candidates.push_back(make_pair(score[i], i));
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        // Dead neurons are not limited by MaxRemoval, but one neuron is always kept
+        size_t limit = std::max(dead, static_cast<size_t>(options.MaxRemoval * static_cast<double>(neurons)));
+        limit = std::min(limit, neurons - 1);
+
+        for (size_t c = 0; c < candidates.size() && c < limit; c++) {
+            keep[k][candidates[c].second] = false;
+            if (candidates[c].first < 0.0) result->Dead++;
+            result->Removed++;
+        }
+    }
+
+    // Rewrite layer k (rows) and layer k+1 (columns) as smaller dense layers
+    for (size_t k = 1; k + 1 < layers; k++) {
+        const auto& l = this->_layers->at(k);
+        const auto& next = this->_layers->at(k + 1);
+        const size_t neurons = l->Neurons();
+        const size_t cols = l->_weights->Cols();
+        const size_t nextRows = next->_weights->Rows();
+
+        vector<size_t> kept;
+        for (size_t i = 0; i < neurons; i++) if (keep[k][i]) kept.push_back(i);
+        if (kept.size() == neurons) continue;
+
+        // A removed neuron feeds the next layer with its mean output: fold it into the next bias
+        if (next->_bias_weights != nullptr && next->_bias_weights->size() > 0) {
+            for (size_t i = 0; i < neurons; i++) {
+                if (keep[k][i]) continue;
+                for (size_t r = 0; r < nextRows; r++) (*next->_bias_weights.get())[r] += (*next->_weights.get())[r][i] * mean[k][i];
+            }
+        }
+
+        auto weights = make_unique<Matrix>(static_cast<int>(kept.size()), static_cast<int>(cols));
+        auto nextWeights = make_unique<Matrix>(static_cast<int>(nextRows), static_cast<int>(kept.size()));
+        for (size_t a = 0; a < kept.size(); a++) {
+            for (size_t j = 0; j < cols; j++) (*weights.get())[a][j] = (*l->_weights.get())[kept[a]][j];
+            for (size_t r = 0; r < nextRows; r++) (*nextWeights.get())[r][a] = (*next->_weights.get())[r][kept[a]];
+        }
+
+        if (l->_pruneMask != nullptr) {
+            auto mask = make_unique<vector<bool>>(kept.size() * cols);
+            for (size_t a = 0; a < kept.size(); a++) {
+                for (size_t j = 0; j < cols; j++) (*mask.get())[a * cols + j] = (*l->_pruneMask.get())[kept[a] * cols + j];
+            }
+            l->_pruneMask = std::move(mask);
+        }
+
+        if (next->_pruneMask != nullptr) {
+            auto mask = make_unique<vector<bool>>(nextRows * kept.size());
+            for (size_t r = 0; r < nextRows; r++) {
+                for (size_t a = 0; a < kept.size(); a++) (*mask.get())[r * kept.size() + a] = (*next->_pruneMask.get())[r * neurons + kept[a]];
+            }
+            next->_pruneMask = std::move(mask);
+        }
+
+        if (l->_bias_weights != nullptr && l->_bias_weights->size() > 0) {
+            auto bias = make_unique<vector<double>>();
+            bias->reserve(kept.size());
+            for (const auto& i : kept) bias->push_back((*l->_bias_weights.get())[i]);
+            l->_bias_weights = std::move(bias);
+        }
+
+        l->_weights = std::move(weights);
+        next->_weights = std::move(nextWeights);
+        l->_neuronsNet = make_unique<vector<double>>(kept.size(), 0.0);
+        l->_neuronsOut = make_unique<vector<double>>(kept.size(), 0.0);
+        l->_delta = make_unique<vector<double>>(kept.size(), 0.0);
+
+        // Gradients and inference copies have the old shapes
+        l->_gradient.reset();
+        l->_biasGradient.reset();
+        next->_gradient.reset();
+        l->DropWeightCopies();
+        next->DropWeightCopies();
+        this->_revision++;
+    }
+
+    if (options.FineTune.Epochs > 0) result->FineTune = this->Fit(dataset, options.FineTune);
+
+    for (const auto& l : *this->_layers.get()) result->After->push_back(l->Neurons());
+    result->WeightsAfter = this->WeightsMemory();
+
+    return result;
+}
+
+size_t FCNN::OptimizeSparse(const double& maxDensity /*= 0.4*/, const SparseFormat& format /*= SparseFormat::CSR*/) {
+    // Check
+    if (!this->_hasOutputs) throw runtime_error("Cannot optimize: missing an output layer.");
+
+    size_t sparseLayers = 0;
+
+    for (size_t k = 1; k < this->_layers->size(); k++) {
+        const auto& l = this->_layers->at(k);
+        if (l->DropWeightCopies()) this->_revision++;
+
+        // Density is measured, not taken from the mask (trained weights could be zero too)
+        if (maxDensity > 0.0 && SparseMatrix::DensityOf(*l->_weights.get()) <= maxDensity) {
+            l->_sparseWeights = make_unique<SparseMatrix>(*l->_weights.get(), format);
+            this->_revision++;
+            sparseLayers++;
+        }
+    }
+
+    return sparseLayers;
+}
+
+size_t FCNN::SetWeightPrecision(const WeightPrecision& precision) {
+    // Check
+    if (!this->_hasOutputs) throw runtime_error("Cannot set precision: missing an output layer.");
+
+    size_t halfLayers = 0;
+
+    for (size_t k = 1; k < this->_layers->size(); k++) {
+        const auto& l = this->_layers->at(k);
+        if (l->_sparseWeights != nullptr) continue;
+
+        if (l->_halfWeights != nullptr) {
+            l->_halfWeights.reset();
+            this->_revision++;
+        }
+
+        // Built from the master copy each time: no rounding over rounding
+        if (precision != WeightPrecision::Double) {
+            l->_halfWeights = make_unique<HalfMatrix>(*l->_weights.get(), precision);
+            this->_revision++;
+            halfLayers++;
+        }
+    }
+
+    return halfLayers;
+}
+
+size_t FCNN::OptimizeForInference() {
+    // Check
+    if (!this->_hasOutputs || this->_layers->size() < 2) throw runtime_error("Cannot optimize: network is not complete.");
+
+    // 1) Batch normalization: s * (W * in + b - mean) + beta = (s * W) * in + s * (b - mean) + beta
+    for (const auto& l : *this->_layers.get()) {
+        if (l->_batchNorm == nullptr) continue;
+
+        const auto& norm = *l->_batchNorm.get();
+        Matrix& w = *l->_weights.get();
+        if (l->_bias_weights == nullptr) l->_bias_weights = make_unique<vector<double>>(l->Neurons(), 0.0);
+
+        for (size_t i = 0; i < w.Rows(); i++) {
+            const double scale = norm.Scale(i);
+            for (size_t j = 0; j < w.Cols(); j++) w[i][j] *= scale;
+            l->_bias_weights->at(i) = scale * (l->_bias_weights->at(i) - norm.Mean->at(i)) + norm.Beta->at(i);
+        }
+
+        l->_batchNorm.reset();
+        l->DropWeightCopies();
+        this->_revision++;
+    }
+
+    // 2) Linear layers: f(W2 * (W1 * in + b1) + b2) = f((W2 * W1) * in + (W2 * b1 + b2))
+    size_t removed = 0;
+    size_t k = 1;
+    while (k + 1 < this->_layers->size()) {
+        const auto& l = this->_layers->at(k);
+        const auto& next = this->_layers->at(k + 1);
+        const size_t cols = this->_layers->at(k - 1)->Neurons();
+
+        // Merge only if the merged matrix is not larger (a bottleneck stays), an exit head needs the layer output
+        const bool linear = (l->_type == LayerType::Hidden && l->_f == Math::Identity && !l->_softmax && l->_exitHead == nullptr);
+        if (!linear || next->Neurons() * cols > l->Neurons() * cols + next->Neurons() * l->Neurons()) {
+            k++;
+            continue;
+        }
+
+        vector<double> bias(next->Neurons(), 0.0);
+        if (l->_bias_weights != nullptr) next->_weights->MultiplyVector(*l->_bias_weights.get(), bias);
+        if (next->_bias_weights != nullptr) {
+            for (size_t i = 0; i < bias.size(); i++) bias[i] += next->_bias_weights->at(i);
+        }
+
+        // Output layers get a bias only if needed
+        const bool hasBias = (next->_bias_weights != nullptr || std::any_of(bias.begin(), bias.end(), [](const double& b) { return b != 0.0; }));
+
+        next->_weights = next->_weights->MultiplyMatrix(*l->_weights.get());
+        next->_bias_weights = (hasBias ? make_unique<vector<double>>(bias) : nullptr);
+        next->_pruneMask.reset();
+        next->_gradient.reset();
+        next->_biasGradient.reset();
+        next->DropWeightCopies();
+
+        this->_layers->erase(this->_layers->begin() + k);
+        this->_revision++;
+        removed++;
+    }
+
+    return removed;
+}
+
+size_t FCNN::WeightsMemory() const {
+    size_t bytes = 0;
+    for (const auto& layer : *this->_layers.get()) bytes += layer->WeightsMemory();
+    return bytes;
+}
+
+size_t FCNN::ActivationsMemory() const {
+    size_t bytes = 0;
+    for (const auto& layer : *this->_layers.get()) bytes += (layer->_neuronsNet->size() + layer->_neuronsOut->size() + layer->_delta->size()) * sizeof(double);
+    return bytes;
+}
+
+unique_ptr<CompiledFCNN> FCNN::Compile(const CompileMode& mode /*= CompileMode::Inference*/) {
+    // Validate topology once: the plan runs without checks
+    if (!this->_hasOutputs || this->_layers->size() < 2) throw runtime_error("Cannot compile: network is not complete.");
+
+    const size_t layers = this->_layers->size();
+    vector<size_t> neurons(layers);
+    for (size_t k = 0; k < layers; k++) {
+        const auto& l = this->_layers->at(k);
+        neurons[k] = l->Neurons();
+
+        if (l->_bias_weights != nullptr && l->_bias_weights->size() > 0 && l->_bias_weights->size() != neurons[k]) throw out_of_range("Cannot compile: invalid bias size at layer " + to_string(k));
+        if (l->_batchNorm != nullptr) throw runtime_error("Cannot compile: batch normalization at layer " + to_string(k) + " must be folded first (OptimizeForInference()).");
+        if (k == 0) continue;
+        if (l->_weights == nullptr || l->_weights->Rows() != neurons[k] || l->_weights->Cols() != neurons[k - 1]) throw out_of_range("Cannot compile: invalid weights at layer " + to_string(k));
+    }
+
+    // Training changes dense weights in place
+    if (mode == CompileMode::Training) {
+        for (const auto& l : *this->_layers.get()) {
+            if (l->DropWeightCopies()) this->_revision++;
+        }
+    }
+
+    auto plan = unique_ptr<CompiledFCNN>(new CompiledFCNN());
+    plan->_network = this;
+    plan->_mode = mode;
+    plan->_revision = this->_revision;
+    plan->_inputs = neurons[0];
+    plan->_outputs = neurons[layers - 1];
+    plan->_E = this->_layers->back()->_E;
+    plan->_dE = this->_layers->back()->_dE;
+
+    const auto& inputLayer = this->_layers->at(0);
+    const bool inputBias = (inputLayer->_bias_weights != nullptr && inputLayer->_bias_weights->size() > 0);
+    plan->_inputBias = (inputBias ? inputLayer->_bias_weights->data() : nullptr);
+
+    // Layer k only lives from its kernel to the next one: two adjacent layers are alive at the same time
+    size_t pair = 0;
+    for (size_t k = 1; k < layers; k++) pair = std::max(pair, neurons[k - 1] + neurons[k]);
+
+    // Even layers at the arena start, odd layers at its end
+    auto place = [pair, &neurons](double* arena, const size_t& k) { return (k % 2 == 0 ? arena : arena + pair - neurons[k]); };
+
+    vector<double*> net(layers), out(layers), delta(layers, nullptr);
+
+    if (mode == CompileMode::Inference) {
+        // Net values are not needed after activation: net and out share the buffer
+        plan->_arena = make_unique<InternalVector>(pair, 0.0);
+        for (size_t k = 0; k < layers; k++) net[k] = out[k] = place(plan->_arena->data(), k);
+    }
+    else {
+        // Backpropagation needs net and out of all layers, deltas only of two adjacent layers
+        size_t size = neurons[0];
+        for (size_t k = 1; k < layers; k++) size += 2 * neurons[k];
+        plan->_arena = make_unique<InternalVector>(size, 0.0);
+        plan->_deltas = make_unique<InternalVector>(pair, 0.0);
+
+        double* next = plan->_arena->data();
+        for (size_t k = 0; k < layers; k++) {
+            net[k] = next;
+            out[k] = (k == 0 ? next : next + neurons[k]);
+            next += (k == 0 ? neurons[k] : 2 * neurons[k]);
+
+            // Input layer delta is only needed for its bias
+            if (k > 0 || inputBias) delta[k] = place(plan->_deltas->data(), k);
+        }
+    }
+
+    plan->_input = out[0];
+    plan->_inputDelta = delta[0];
+
+    plan->_kernels->reserve(layers - 1);
+    if (mode == CompileMode::Training) plan->_gradients->reserve(layers - 1);
+    for (size_t k = 1; k < layers; k++) {
+        const auto& l = this->_layers->at(k);
+
+        FCNNKernel kernel;
+        kernel.Sparse = (mode == CompileMode::Inference ? l->_sparseWeights.get() : nullptr);
+        kernel.Half = (mode == CompileMode::Inference && kernel.Sparse == nullptr ? l->_halfWeights.get() : nullptr);
+        kernel.Dense = (kernel.Sparse == nullptr && kernel.Half == nullptr ? l->_weights.get() : nullptr);
+        kernel.Weights = (kernel.Dense != nullptr ? &(*l->_weights.get())[0] : nullptr);
+        kernel.Gemv = (kernel.Dense != nullptr && kernel.Dense->Tier() == MemoryTier::Internal ? KernelTuner::Select(neurons[k], neurons[k - 1]) : GemvKernel::Default);
+        kernel.Bias = (l->_bias_weights != nullptr && l->_bias_weights->size() > 0 ? l->_bias_weights->data() : nullptr);
+        kernel.Rows = neurons[k];
+        kernel.Cols = neurons[k - 1];
+        kernel.F = l->_f;
+        kernel.DF = l->_df;
+        kernel.Softmax = l->_softmax;
+        kernel.In = out[k - 1];
+        kernel.Net = net[k];
+        kernel.Out = out[k];
+        plan->_kernels->push_back(kernel);
+
+        if (mode == CompileMode::Training) {
+            FCNNGradientKernel gradient;
+            gradient.Delta = delta[k];
+            gradient.PreviousDelta = delta[k - 1];
+            gradient.PreviousNet = (k > 1 ? net[k - 1] : nullptr);
+            gradient.PreviousDF = (k > 1 ? this->_layers->at(k - 1)->_df : nullptr);
+            gradient.Layer = l.get();
+
+            plan->_gradients->push_back(gradient);
+        }
+    }
+
+    return std::move(plan);
 }
 
 void FCNN::PrintResult() {
@@ -394,3 +1800,199 @@ void FCNN::PrintResult() {
     */
 }
 
+
+/**********************************************************************
+    Compiled FCNN class
+***********************************************************************/
+
+CompiledFCNN::CompiledFCNN() {
+    this->_network = nullptr;
+    this->_mode = CompileMode::Inference;
+    this->_revision = 0;
+    this->_arena = make_unique<InternalVector>();
+    this->_deltas = make_unique<InternalVector>();
+    this->_kernels = make_unique<vector<FCNNKernel>>();
+    this->_gradients = make_unique<vector<FCNNGradientKernel>>();
+    this->_input = nullptr;
+    this->_inputBias = nullptr;
+    this->_inputDelta = nullptr;
+    this->_inputs = 0;
+    this->_outputs = 0;
+    this->_E = nullptr;
+    this->_dE = nullptr;
+}
+
+CompiledFCNN::~CompiledFCNN() {
+    this->_arena.reset();
+    this->_deltas.reset();
+    this->_kernels.reset();
+    this->_gradients.reset();
+}
+
+const CompileMode& CompiledFCNN::Mode() const {
+    return this->_mode;
+}
+
+size_t CompiledFCNN::Kernels() const {
+    return this->_kernels->size();
+}
+
+size_t CompiledFCNN::Inputs() const {
+    return this->_inputs;
+}
+
+size_t CompiledFCNN::PlannedBytes() const {
+    return (this->_arena->size() + this->_deltas->size()) * sizeof(double) + this->_kernels->size() * sizeof(FCNNKernel) + this->_gradients->size() * sizeof(FCNNGradientKernel);
+}
+
+void CompiledFCNN::CheckRevision() const {
+    // The only check at run time: raw pointers are valid while the network is not changed
+    if (this->_revision != this->_network->_revision) throw runtime_error("Compiled FCNN: network changed after Compile(), compile again.");
+}
+
+void CompiledFCNN::RunKernel(const FCNNKernel& k) {
+    // net = W * in
+    if (k.Sparse != nullptr) k.Sparse->MultiplyVector(k.In, k.Net);
+    else if (k.Half != nullptr) k.Half->MultiplyVector(k.In, k.Net);
+    else KernelTuner::MultiplyVector(k.Gemv, *k.Dense, k.In, k.Net);
+
+    // out = f(net + bias), in place when net and out are the same buffer
+    if (k.Softmax) {
+        if (k.Bias != nullptr) {
+            for (size_t i = 0; i < k.Rows; i++) k.Net[i] += k.Bias[i];
+        }
+        Math::Softmax(k.Net, k.Out, k.Rows);
+        return;
+    }
+
+    for (size_t i = 0; i < k.Rows; i++) {
+        const double net = k.Net[i] + (k.Bias != nullptr ? k.Bias[i] : 0.0);
+        k.Net[i] = net;
+        k.Out[i] = k.F(net);
+    }
+}
+
+void CompiledFCNN::Run() {
+    for (const auto& k : *this->_kernels.get()) RunKernel(k);
+}
+
+void CompiledFCNN::Forward(const vector<double>& inputs, vector<double>& outputs) {
+    this->CheckRevision();
+    if (inputs.size() != this->_inputs) throw runtime_error("Input values: invalid size.");
+
+    for (size_t i = 0; i < this->_inputs; i++) this->_input[i] = inputs[i] + (this->_inputBias != nullptr ? this->_inputBias[i] : 0.0);
+    this->Run();
+
+    const double* result = this->_kernels->back().Out;
+    if (outputs.size() != this->_outputs) outputs.resize(this->_outputs);
+    std::copy(result, result + this->_outputs, outputs.begin());
+}
+
+vector<double> CompiledFCNN::Profile(const vector<double>& inputs, const size_t& runs) {
+    this->CheckRevision();
+    if (inputs.size() != this->_inputs) throw runtime_error("Input values: invalid size.");
+    if (runs == 0) throw out_of_range("Compiled FCNN: runs must be > 0.");
+
+    rtc_cpu_freq_config_t frequency;
+    rtc_clk_cpu_freq_get_config(&frequency);
+
+    vector<double> cycles(this->_kernels->size(), 0.0);
+    for (size_t r = 0; r <= runs; r++) {
+        for (size_t i = 0; i < this->_inputs; i++) this->_input[i] = inputs[i] + (this->_inputBias != nullptr ? this->_inputBias[i] : 0.0);
+
+        for (size_t k = 0; k < this->_kernels->size(); k++) {
+            const uint64_t start = esp_timer_get_time();
+            RunKernel(this->_kernels->at(k));
+            // First run warms up caches, not counted
+            if (r > 0) cycles[k] += static_cast<double>(esp_timer_get_time() - start);
+        }
+    }
+
+    // us * MHz = cycles
+    for (auto& c : cycles) c *= static_cast<double>(frequency.freq_mhz) / static_cast<double>(runs);
+
+    return cycles;
+}
+
+double CompiledFCNN::Train(const vector<double>& inputs, const vector<double>& targets, const double& learningRate) {
+    if (this->_mode != CompileMode::Training) throw runtime_error("Compiled FCNN: Train() needs CompileMode::Training.");
+    this->CheckRevision();
+    if (inputs.size() != this->_inputs) throw runtime_error("Input values: invalid size.");
+    if (targets.size() != this->_outputs) throw out_of_range("Invalid targets: size must be equal to outputs.");
+
+    for (size_t i = 0; i < this->_inputs; i++) this->_input[i] = inputs[i] + (this->_inputBias != nullptr ? this->_inputBias[i] : 0.0);
+    this->Run();
+
+    // Output delta, same as FCNN::Backpropagate()
+    const auto& output = this->_kernels->back();
+    double* outputDelta = this->_gradients->back().Delta;
+    double totalError = 0;
+
+    if (output.Softmax) {
+        const double lse = Math::LogSumExp(output.Net, output.Rows);
+        for (size_t i = 0; i < output.Rows; i++) {
+            if (targets[i] != 0.0) totalError += targets[i] * (lse - output.Net[i]);
+            outputDelta[i] = output.Out[i] - targets[i];
+        }
+    }
+    else {
+        for (size_t i = 0; i < output.Rows; i++) {
+            totalError += this->_E(targets[i], output.Out[i]);
+            const double dE = (this->_dE != nullptr ? this->_dE(targets[i], output.Out[i]) : output.Out[i] - targets[i]);
+            outputDelta[i] = dE * output.DF(output.Net[i]);
+        }
+    }
+
+    // Backward: delta of the previous layer with weights not yet changed, then update this layer
+    for (size_t n = this->_kernels->size(); n > 0; n--) {
+        const auto& k = this->_kernels->at(n - 1);
+        const auto& g = this->_gradients->at(n - 1);
+
+        if (g.PreviousDelta != nullptr) {
+            std::fill(g.PreviousDelta, g.PreviousDelta + k.Cols, 0.0);
+
+            // W transposed * delta by rows
+            for (size_t i = 0; i < k.Rows; i++) {
+                const double* row = k.Weights[i];
+                const double d = g.Delta[i];
+                for (size_t j = 0; j < k.Cols; j++) g.PreviousDelta[j] += row[j] * d;
+            }
+
+            if (g.PreviousNet != nullptr) {
+                for (size_t j = 0; j < k.Cols; j++) g.PreviousDelta[j] *= g.PreviousDF(g.PreviousNet[j]);
+            }
+        }
+
+        // W -= learningRate * delta * in transposed, bias -= learningRate * delta
+        Matrix::ForRows(k.Rows, k.Rows * k.Cols, [&k, &g, &learningRate](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) {
+                double* row = k.Weights[i];
+                const double d = learningRate * g.Delta[i];
+                for (size_t j = 0; j < k.Cols; j++) row[j] -= d * k.In[j];
+                if (k.Bias != nullptr) k.Bias[i] -= d;
+            }
+        });
+
+        g.Layer->ApplyPruneMask();
+    }
+
+    if (this->_inputDelta != nullptr) {
+        for (size_t i = 0; i < this->_inputs; i++) this->_inputBias[i] -= learningRate * this->_inputDelta[i];
+    }
+
+    return totalError;
+}
+
+void CompiledFCNN::Print() const {
+    printf("Compiled FCNN (%s): %u kernels, activations arena %u doubles, deltas arena %u doubles, planned peak %u bytes\n",
+        this->_mode == CompileMode::Inference ? "inference" : "training", static_cast<unsigned int>(this->_kernels->size()),
+        static_cast<unsigned int>(this->_arena->size()), static_cast<unsigned int>(this->_deltas->size()), static_cast<unsigned int>(this->PlannedBytes()));
+
+    for (size_t k = 0; k < this->_kernels->size(); k++) {
+        const auto& kernel = this->_kernels->at(k);
+        const string gemv = string("GEMV ") + KernelTuner::Name(kernel.Gemv);
+        printf("  #%u %s %ux%u%s%s\n", static_cast<unsigned int>(k + 1), kernel.Sparse != nullptr ? "SpMV" : (kernel.Half != nullptr ? (kernel.Half->Format() == WeightPrecision::FP16 ? "GEMV fp16" : "GEMV bf16") : gemv.c_str()),
+            static_cast<unsigned int>(kernel.Rows), static_cast<unsigned int>(kernel.Cols),
+            kernel.Bias != nullptr ? " + bias" : "", kernel.Softmax ? " + softmax" : "");
+    }
+}
@@ -0,0 +1,490 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandFederated.hxx"
+
+using namespace std;
+using namespace Briand;
+
+/**********************************************************************
+    Message layout
+***********************************************************************/
+
+/// @brief Header bytes: type, encoding, node (2), round (4), samples (4), count (4), entries (4)
+static constexpr size_t FEDERATED_HEADER = 20;
+
+/// @brief Value encodings (bit 0 = int8 values with a scale, bit 1 = sparse entries)
+static constexpr uint8_t ENCODING_QUANTIZED = 0x01;
+static constexpr uint8_t ENCODING_SPARSE = 0x02;
+
+static void PutU16(vector<uint8_t>& m, const uint16_t& v) {
+    m.push_back(static_cast<uint8_t>(v));
+    m.push_back(static_cast<uint8_t>(v >> 8));
+}
+
+static void PutU32(vector<uint8_t>& m, const uint32_t& v) {
+    for (uint8_t b = 0; b < 4; b++) m.push_back(static_cast<uint8_t>(v >> (8 * b)));
+}
+
+static void PutFloat(vector<uint8_t>& m, const float& v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    PutU32(m, bits);
+}
+
+static void PutVarint(vector<uint8_t>& m, uint32_t v) {
+    while (v >= 0x80) {
+        m.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    m.push_back(static_cast<uint8_t>(v));
+}
+
+static uint32_t GetU32(const vector<uint8_t>& m, size_t& at) {
+    if (at + 4 > m.size()) throw runtime_error("Federated message: truncated.");
+    uint32_t v = 0;
+    for (uint8_t b = 0; b < 4; b++) v |= static_cast<uint32_t>(m[at + b]) << (8 * b);
+    at += 4;
+    return v;
+}
+
+static float GetFloat(const vector<uint8_t>& m, size_t& at) {
+    const uint32_t bits = GetU32(m, at);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+static uint32_t GetVarint(const vector<uint8_t>& m, size_t& at) {
+    uint32_t v = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        if (at >= m.size()) throw runtime_error("Federated message: truncated.");
+        const uint8_t b = m[at++];
+        v |= static_cast<uint32_t>(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) return v;
+    }
+    throw runtime_error("Federated message: invalid index.");
+}
+
+static void PutHeader(vector<uint8_t>& m, const FederatedMessageType& type, const uint8_t& encoding, const uint16_t& node, const uint32_t& round, const uint32_t& samples, const uint32_t& count, const uint32_t& entries) {
+    m.clear();
+    m.push_back(static_cast<uint8_t>(type));
+    m.push_back(encoding);
+    PutU16(m, node);
+    PutU32(m, round);
+    PutU32(m, samples);
+    PutU32(m, count);
+    PutU32(m, entries);
+}
+
+/**********************************************************************
+    Federated codec class
+***********************************************************************/
+
+void FederatedCodec::Parameters(const FCNN& network, vector<double>& parameters) {
+    // Check
+    if (!network._hasOutputs) throw runtime_error("Federated: network is not complete.");
+
+    size_t count = 0;
+    for (size_t k = 0; k < network._layers->size(); k++) {
+        const auto& l = network._layers->at(k);
+        if (k > 0) count += l->_weights->Rows() * l->_weights->Cols();
+        if (l->_bias_weights != nullptr) count += l->_bias_weights->size();
+        if (l->_batchNorm != nullptr) count += 4 * l->Neurons();
+        if (l->_exitHead != nullptr) count += l->_exitHead->Weights->Rows() * (l->_exitHead->Weights->Cols() + 1);
+    }
+    if (parameters.size() != count) parameters.resize(count);
+
+    size_t at = 0;
+    for (size_t k = 0; k < network._layers->size(); k++) {
+        const auto& l = network._layers->at(k);
+        if (k > 0) {
+            const Matrix& w = *l->_weights.get();
+            for (size_t r = 0; r < w.Rows(); r++) {
+                for (size_t c = 0; c < w.Cols(); c++) parameters[at++] = w[r][c];
+            }
+        }
+        if (l->_bias_weights != nullptr) {
+            for (const auto& b : *l->_bias_weights.get()) parameters[at++] = b;
+        }
+        if (l->_batchNorm != nullptr) {
+            for (const auto* v : { l->_batchNorm->Gamma.get(), l->_batchNorm->Beta.get(), l->_batchNorm->Mean.get(), l->_batchNorm->Variance.get() }) {
+                for (const auto& x : *v) parameters[at++] = x;
+            }
+        }
+        if (l->_exitHead != nullptr) {
+            const Matrix& w = *l->_exitHead->Weights.get();
+            for (size_t r = 0; r < w.Rows(); r++) {
+                for (size_t c = 0; c < w.Cols(); c++) parameters[at++] = w[r][c];
+            }
+            for (const auto& b : *l->_exitHead->Bias.get()) parameters[at++] = b;
+        }
+    }
+}
+
+void FederatedCodec::SetParameters(FCNN& network, const vector<double>& parameters) {
+    // Check
+    if (!network._hasOutputs) throw runtime_error("Federated: network is not complete.");
+
+    size_t at = 0;
+    auto next = [&]() -> double {
+        if (at >= parameters.size()) throw out_of_range("Federated: too few parameters for the network.");
+        return parameters[at++];
+    };
+
+    for (size_t k = 0; k < network._layers->size(); k++) {
+        const auto& l = network._layers->at(k);
+        if (k > 0) {
+            Matrix& w = *l->_weights.get();
+            for (size_t r = 0; r < w.Rows(); r++) {
+                for (size_t c = 0; c < w.Cols(); c++) w[r][c] = next();
+            }
+        }
+        if (l->_bias_weights != nullptr) {
+            for (auto& b : *l->_bias_weights.get()) b = next();
+        }
+        if (l->_batchNorm != nullptr) {
+            for (auto* v : { l->_batchNorm->Gamma.get(), l->_batchNorm->Beta.get(), l->_batchNorm->Mean.get(), l->_batchNorm->Variance.get() }) {
+                for (auto& x : *v) x = next();
+            }
+        }
+        if (l->_exitHead != nullptr) {
+            Matrix& w = *l->_exitHead->Weights.get();
+            for (size_t r = 0; r < w.Rows(); r++) {
+                for (size_t c = 0; c < w.Cols(); c++) w[r][c] = next();
+            }
+            for (auto& b : *l->_exitHead->Bias.get()) b = next();
+        }
+        if (l->DropWeightCopies()) network._revision++;
+    }
+
+    if (at != parameters.size()) throw out_of_range("Federated: too many parameters for the network.");
+}
+
+void FederatedCodec::EncodeModel(const uint32_t& round, const vector<double>& parameters, vector<uint8_t>& message) {
+    const uint32_t count = static_cast<uint32_t>(parameters.size());
+    message.reserve(FEDERATED_HEADER + 4 * count);
+    PutHeader(message, FederatedMessageType::Model, 0, 0, round, 0, count, count);
+    for (const auto& p : parameters) PutFloat(message, static_cast<float>(p));
+}
+
+void FederatedCodec::EncodeUpdate(const uint16_t& node, const uint32_t& round, const uint32_t& samples, const vector<double>& delta, const DeltaCompression& compression,
+    vector<double>* sent, vector<uint8_t>& message) {
+    // Check
+    if (compression.Density <= 0.0 || compression.Density > 1.0) throw out_of_range("Federated: density must be in (0, 1].");
+
+    const uint32_t count = static_cast<uint32_t>(delta.size());
+
+    // Entries: all, or the largest deltas in index order (index gaps stay small)
+    const size_t keep = max<size_t>(1, static_cast<size_t>(ceil(compression.Density * static_cast<double>(count))));
+    const bool sparse = keep < count;
+    vector<uint32_t> indexes;
+    if (sparse) {
+        indexes.resize(count);
+        for (uint32_t i = 0; i < count; i++) indexes[i] = i;
+        std::nth_element(indexes.begin(), indexes.begin() + keep, indexes.end(), [&delta](const uint32_t& a, const uint32_t& b) { return fabs(delta[a]) > fabs(delta[b]); });
+        indexes.resize(keep);
+        std::sort(indexes.begin(), indexes.end());
+    }
+    const uint32_t entries = (sparse ? static_cast<uint32_t>(keep) : count);
+    auto index = [&](const uint32_t& e) { return (sparse ? indexes[e] : e); };
+
+    // int8 scale: the largest sent magnitude maps to 127
+    double largest = 0.0;
+    if (compression.Quantize) {
+        for (uint32_t e = 0; e < entries; e++) largest = max(largest, fabs(delta[index(e)]));
+    }
+    const float scale = static_cast<float>(largest / 127.0);
+
+    const uint8_t encoding = (compression.Quantize ? ENCODING_QUANTIZED : 0) | (sparse ? ENCODING_SPARSE : 0);
+    message.reserve(FEDERATED_HEADER + 4 + entries * (sparse ? 2 : 0) + entries * (compression.Quantize ? 1 : 4));
+    PutHeader(message, FederatedMessageType::Update, encoding, node, round, samples, count, entries);
+    if (compression.Quantize) PutFloat(message, scale);
+
+    if (sent != nullptr) sent->assign(count, 0.0);
+
+    uint32_t previous = 0;
+    for (uint32_t e = 0; e < entries; e++) {
+        const uint32_t i = index(e);
+        if (sparse) {
+            PutVarint(message, i - previous);
+            previous = i;
+        }
+
+        double value;
+        if (compression.Quantize) {
+            const int8_t q = (scale > 0.0f ? static_cast<int8_t>(max(-127.0, min(127.0, std::round(delta[i] / scale)))) : 0);
+            message.push_back(static_cast<uint8_t>(q));
+            value = static_cast<double>(q) * static_cast<double>(scale);
+        }
+        else {
+            const float f = static_cast<float>(delta[i]);
+            PutFloat(message, f);
+            value = static_cast<double>(f);
+        }
+
+        if (sent != nullptr) sent->at(i) = value;
+    }
+}
+
+void FederatedCodec::EncodeStop(vector<uint8_t>& message) {
+    PutHeader(message, FederatedMessageType::Stop, 0, 0, 0, 0, 0, 0);
+}
+
+FederatedMessage FederatedCodec::Decode(const vector<uint8_t>& message, vector<double>& values) {
+    // Check
+    if (message.size() < FEDERATED_HEADER) throw runtime_error("Federated message: truncated.");
+
+    FederatedMessage header;
+    const uint8_t type = message[0];
+    if (type < static_cast<uint8_t>(FederatedMessageType::Model) || type > static_cast<uint8_t>(FederatedMessageType::Stop)) throw runtime_error("Federated message: unknown type " + to_string(type));
+    header.Type = static_cast<FederatedMessageType>(type);
+    const uint8_t encoding = message[1];
+    header.Node = static_cast<uint16_t>(message[2] | (message[3] << 8));
+
+    size_t at = 4;
+    header.Round = GetU32(message, at);
+    header.Samples = GetU32(message, at);
+    header.Count = GetU32(message, at);
+    const uint32_t entries = GetU32(message, at);
+
+    values.assign(header.Count, 0.0);
+    if (header.Type == FederatedMessageType::Stop) return header;
+
+    const bool quantized = (encoding & ENCODING_QUANTIZED) != 0;
+    const bool sparse = (encoding & ENCODING_SPARSE) != 0;
+    if (entries > header.Count || (!sparse && entries != header.Count)) throw runtime_error("Federated message: invalid entries.");
+
+    const float scale = (quantized ? GetFloat(message, at) : 0.0f);
+
+    uint32_t i = 0;
+    for (uint32_t e = 0; e < entries; e++) {
+        if (sparse) {
+            i += GetVarint(message, at);
+            if (i >= header.Count) throw runtime_error("Federated message: invalid index.");
+        }
+        else i = e;
+
+        if (quantized) {
+            if (at >= message.size()) throw runtime_error("Federated message: truncated.");
+            values[i] = static_cast<double>(static_cast<int8_t>(message[at++])) * static_cast<double>(scale);
+        }
+        else values[i] = static_cast<double>(GetFloat(message, at));
+    }
+
+    if (at != message.size()) throw runtime_error("Federated message: trailing bytes.");
+
+    return header;
+}
+
+/**********************************************************************
+    Loopback transport class
+***********************************************************************/
+
+LoopbackTransport::LoopbackTransport(const size_t& endpoints) {
+    // Check
+    if (endpoints < 2) throw out_of_range("Loopback transport: at least the coordinator and one node.");
+
+    this->_queues = make_unique<vector<std::deque<vector<uint8_t>>>>(endpoints);
+    this->_bytes = 0;
+}
+
+LoopbackTransport::~LoopbackTransport() {
+    this->_queues.reset();
+}
+
+void LoopbackTransport::Send(const size_t& to, const vector<uint8_t>& message) {
+    // Check
+    if (to >= this->_queues->size()) throw out_of_range("Loopback transport: invalid endpoint " + to_string(to));
+
+    {
+        std::lock_guard<std::mutex> lock(this->_lock);
+        this->_queues->at(to).push_back(message);
+    }
+    this->_bytes += message.size();
+    this->_signal.notify_all();
+}
+
+bool LoopbackTransport::Receive(const size_t& endpoint, vector<uint8_t>& message, const uint32_t& timeoutMs) {
+    // Check
+    if (endpoint >= this->_queues->size()) throw out_of_range("Loopback transport: invalid endpoint " + to_string(endpoint));
+
+    std::unique_lock<std::mutex> lock(this->_lock);
+    auto& queue = this->_queues->at(endpoint);
+    if (!this->_signal.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&queue] { return !queue.empty(); })) return false;
+
+    message = std::move(queue.front());
+    queue.pop_front();
+    return true;
+}
+
+size_t LoopbackTransport::BytesSent() const {
+    return this->_bytes;
+}
+
+/**********************************************************************
+    Federated node class
+***********************************************************************/
+
+FederatedNode::FederatedNode(const uint16_t& id, FederatedTransport& transport, const FCNN& model, const Dataset& data, const FitOptions& options, const DeltaCompression& compression) {
+    // Check
+    if (id == 0) throw out_of_range("Federated node: endpoint 0 is the coordinator.");
+    if (data.Size() == 0) throw runtime_error("Federated node: no local data.");
+
+    this->_id = id;
+    this->_transport = &transport;
+    this->_model = model.Clone();
+    this->_data = &data;
+    this->_options = options;
+    this->_compression = compression;
+    this->_global = make_unique<vector<double>>();
+    this->_local = make_unique<vector<double>>();
+    this->_sent = make_unique<vector<double>>();
+    this->_residual = make_unique<vector<double>>();
+    this->_stopped = false;
+}
+
+FederatedNode::~FederatedNode() {
+    this->_model.reset();
+    this->_global.reset();
+    this->_local.reset();
+    this->_sent.reset();
+    this->_residual.reset();
+}
+
+bool FederatedNode::Step(const uint32_t& timeoutMs) {
+    vector<uint8_t> message;
+    if (!this->_transport->Receive(this->_id, message, timeoutMs)) return false;
+
+    const FederatedMessage header = FederatedCodec::Decode(message, *this->_global.get());
+    if (header.Type == FederatedMessageType::Stop) {
+        this->_stopped = true;
+        return true;
+    }
+    if (header.Type != FederatedMessageType::Model) return true;
+
+    // Local training from the global parameters
+    FederatedCodec::SetParameters(*this->_model.get(), *this->_global.get());
+    FitOptions options = this->_options;
+    options.Seed = this->_options.Seed + header.Round;
+    this->_model->Fit(*this->_data, options);
+
+    // Delta (plus what previous rounds could not send)
+    FederatedCodec::Parameters(*this->_model.get(), *this->_local.get());
+    auto& delta = *this->_local.get();
+    const auto& global = *this->_global.get();
+    auto& residual = *this->_residual.get();
+    if (this->_compression.ErrorFeedback && residual.size() != delta.size()) residual.assign(delta.size(), 0.0);
+    for (size_t i = 0; i < delta.size(); i++) {
+        delta[i] -= global[i];
+        if (this->_compression.ErrorFeedback) delta[i] += residual[i];
+    }
+
+    FederatedCodec::EncodeUpdate(this->_id, header.Round, static_cast<uint32_t>(this->_data->Size()), delta, this->_compression,
+        this->_compression.ErrorFeedback ? this->_sent.get() : nullptr, message);
+
+    if (this->_compression.ErrorFeedback) {
+        for (size_t i = 0; i < delta.size(); i++) residual[i] = delta[i] - this->_sent->at(i);
+    }
+
+    this->_transport->Send(0, message);
+    return true;
+}
+
+void FederatedNode::Serve() {
+    while (!this->_stopped) this->Step(1000);
+}
+
+bool FederatedNode::Stopped() const {
+    return this->_stopped;
+}
+
+const FCNN& FederatedNode::Model() const {
+    return *this->_model.get();
+}
+
+/**********************************************************************
+    Federated coordinator class
+***********************************************************************/
+
+FederatedCoordinator::FederatedCoordinator(FederatedTransport& transport, FCNN& model, const size_t& nodes) {
+    // Check
+    if (nodes == 0 || nodes > 0xFFFF) throw out_of_range("Federated coordinator: nodes must be 1..65535.");
+
+    this->_transport = &transport;
+    this->_model = &model;
+    this->_nodes = nodes;
+    this->_round = 1;
+}
+
+FederatedRound FederatedCoordinator::Round(const uint32_t& timeoutMs) {
+    const long start = esp_timer_get_time();
+
+    FederatedRound stats;
+    stats.Round = this->_round++;
+    stats.Participants = 0;
+    stats.BytesDown = 0;
+    stats.BytesUp = 0;
+
+    // Broadcast
+    vector<double> global;
+    FederatedCodec::Parameters(*this->_model, global);
+    vector<uint8_t> message;
+    FederatedCodec::EncodeModel(stats.Round, global, message);
+    for (size_t n = 1; n <= this->_nodes; n++) {
+        this->_transport->Send(n, message);
+        stats.BytesDown += message.size();
+    }
+
+    // Gather: weighted sum of the deltas (weights = local samples)
+    vector<double> sum(global.size(), 0.0), delta;
+    vector<bool> arrived(this->_nodes + 1, false);
+    double weight = 0.0;
+    const long deadline = start + static_cast<long>(timeoutMs) * 1000;
+
+    while (stats.Participants < this->_nodes) {
+        const long left = deadline - esp_timer_get_time();
+        if (left <= 0) break;
+        if (!this->_transport->Receive(0, message, static_cast<uint32_t>(left / 1000 + 1))) break;
+
+        const FederatedMessage header = FederatedCodec::Decode(message, delta);
+        if (header.Type != FederatedMessageType::Update || header.Round != stats.Round) continue;
+        if (header.Node == 0 || header.Node > this->_nodes || arrived[header.Node]) continue;
+        if (delta.size() != global.size()) throw runtime_error("Federated coordinator: update of node " + to_string(header.Node) + " has a different model.");
+
+        const double w = static_cast<double>(header.Samples);
+        for (size_t i = 0; i < sum.size(); i++) sum[i] += w * delta[i];
+        weight += w;
+        arrived[header.Node] = true;
+        stats.Participants++;
+        stats.BytesUp += message.size();
+    }
+
+    // Average into the global model
+    if (weight > 0.0) {
+        for (size_t i = 0; i < global.size(); i++) global[i] += sum[i] / weight;
+        FederatedCodec::SetParameters(*this->_model, global);
+    }
+
+    stats.Time = esp_timer_get_time() - start;
+    return stats;
+}
+
+void FederatedCoordinator::Stop() {
+    vector<uint8_t> message;
+    FederatedCodec::EncodeStop(message);
+    for (size_t n = 1; n <= this->_nodes; n++) this->_transport->Send(n, message);
+}
@@ -0,0 +1,225 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandHalf.hxx"
+
+using namespace std;
+using namespace Briand;
+
+/// @brief 16 bit elements in internal RAM (streaming tiles)
+typedef vector<uint16_t, InternalAllocator<uint16_t>> InternalHalfVector;
+
+/// @brief Floats in internal RAM (input vector widened once for each GEMV)
+typedef vector<float, InternalAllocator<float>> InternalFloatVector;
+
+static inline float BitsToFloat(const uint32_t& bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+static inline uint32_t FloatToBits(const float& f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(float));
+    return bits;
+}
+
+/// @brief Widen an element: normal FP16 numbers (almost all weights) only need a shift and a rebias of the exponent
+template <WeightPrecision F>
+static inline float Widen(const uint16_t& bits) {
+    if (F == WeightPrecision::BF16) return BitsToFloat(static_cast<uint32_t>(bits) << 16);
+
+    const uint32_t exponent = bits & 0x7C00U;
+    if (exponent != 0 && exponent != 0x7C00U) return BitsToFloat(((static_cast<uint32_t>(bits) & 0x8000U) << 16) | (((static_cast<uint32_t>(bits) & 0x7FFFU) << 13) + 0x38000000U));
+    return HalfMatrix::FromFP16(bits);
+}
+
+/// @brief GEMV on a block of rows: widen to float as elements are read, float accumulation
+template <WeightPrecision F>
+static inline void MultiplyRows(const uint16_t* data, const size_t& cols, const float* v, double* result, const size_t& first, const size_t& rows) {
+    for (size_t r = 0; r < rows; r++) {
+        const uint16_t* row = data + r * cols;
+
+        // 4 independent accumulators: widening and multiply-add of different columns overlap
+        float a0 = 0.0f, a1 = 0.0f, a2 = 0.0f, a3 = 0.0f;
+        size_t j = 0;
+        for (; j + 4 <= cols; j += 4) {
+            a0 += Widen<F>(row[j]) * v[j];
+            a1 += Widen<F>(row[j + 1]) * v[j + 1];
+            a2 += Widen<F>(row[j + 2]) * v[j + 2];
+            a3 += Widen<F>(row[j + 3]) * v[j + 3];
+        }
+        for (; j < cols; j++) a0 += Widen<F>(row[j]) * v[j];
+        result[first + r] = static_cast<double>((a0 + a1) + (a2 + a3));
+    }
+}
+
+template <WeightPrecision F>
+static void Multiply(const uint16_t* data, const size_t& rowsCount, const size_t& cols, const MemoryTier& tier, const float* v, double* result) {
+    if (tier == MemoryTier::Internal || !Matrix::StreamExternal) {
+        const bool external = (tier == MemoryTier::External);
+        Matrix::ForRows(rowsCount, rowsCount * cols, [data, cols, v, result, external](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) {
+                if (external) Memory::Access(cols * sizeof(uint16_t));
+                MultiplyRows<F>(data + i * cols, cols, v, result, i, 1);
+            }
+        });
+        return;
+    }
+
+    // External RAM: same tiles of Matrix::MultiplyVector(), twice the rows for each tile
+    const size_t tileRows = std::max<size_t>(1, Memory::TileBytes / (cols > 0 ? cols * sizeof(uint16_t) : 1));
+
+    Matrix::ForRows(rowsCount, rowsCount * cols, [data, cols, v, result, tileRows](const size_t& begin, const size_t& end) {
+        static thread_local InternalHalfVector tile;
+        if (tile.size() < tileRows * cols) tile.resize(tileRows * cols);
+
+        for (size_t first = begin; first < end; first += tileRows) {
+            const size_t rows = std::min(tileRows, end - first);
+            Memory::Stream(tile.data(), data + first * cols, rows * cols * sizeof(uint16_t), MemoryTier::External);
+            MultiplyRows<F>(tile.data(), cols, v, result, first, rows);
+        }
+    });
+}
+
+HalfMatrix::HalfMatrix(const Matrix& dense, const WeightPrecision& format) {
+    if (format == WeightPrecision::Double) throw runtime_error("HalfMatrix: format must be FP16 or BF16.");
+
+    this->_rows = dense.Rows();
+    this->_cols = dense.Cols();
+    this->_format = format;
+
+    const size_t bytes = this->_rows * this->_cols * sizeof(uint16_t);
+    this->_data = static_cast<uint16_t*>(Memory::Allocate(bytes, Memory::TierFor(bytes)));
+    this->_tier = Memory::TierOf(this->_data);
+
+    const double* source = dense.Data();
+    for (size_t i = 0; i < this->_rows * this->_cols; i++) {
+        const float value = static_cast<float>(source[i]);
+        this->_data[i] = (format == WeightPrecision::FP16 ? HalfMatrix::ToFP16(value) : HalfMatrix::ToBF16(value));
+    }
+}
+
+HalfMatrix::~HalfMatrix() {
+    Memory::Free(this->_data);
+}
+
+const size_t& HalfMatrix::Rows() const {
+    return this->_rows;
+}
+
+const size_t& HalfMatrix::Cols() const {
+    return this->_cols;
+}
+
+const WeightPrecision& HalfMatrix::Format() const {
+    return this->_format;
+}
+
+const MemoryTier& HalfMatrix::Tier() const {
+    return this->_tier;
+}
+
+size_t HalfMatrix::MemoryBytes() const {
+    return this->_rows * this->_cols * sizeof(uint16_t);
+}
+
+double HalfMatrix::Get(const size_t& row, const size_t& col) const {
+    if (row >= this->_rows || col >= this->_cols) throw out_of_range("HalfMatrix: index out of range.");
+
+    const uint16_t bits = this->_data[row * this->_cols + col];
+    return static_cast<double>(this->_format == WeightPrecision::FP16 ? HalfMatrix::FromFP16(bits) : HalfMatrix::FromBF16(bits));
+}
+
+void HalfMatrix::MultiplyVector(const vector<double>& v, vector<double>& result) const {
+    if (v.size() != this->_cols) throw runtime_error("Matrix columns must be equal to vector size.");
+    if (result.size() != this->_rows) result.resize(this->_rows);
+
+    this->MultiplyVector(v.data(), result.data());
+}
+
+void HalfMatrix::MultiplyVector(const double* v, double* result) const {
+    // Input narrowed once, not for each row
+    static thread_local InternalFloatVector input;
+    if (input.size() < this->_cols) input.resize(this->_cols);
+    for (size_t j = 0; j < this->_cols; j++) input[j] = static_cast<float>(v[j]);
+
+    if (this->_format == WeightPrecision::FP16) Multiply<WeightPrecision::FP16>(this->_data, this->_rows, this->_cols, this->_tier, input.data(), result);
+    else Multiply<WeightPrecision::BF16>(this->_data, this->_rows, this->_cols, this->_tier, input.data(), result);
+}
+
+uint16_t HalfMatrix::ToFP16(const float& value) {
+    uint32_t x = FloatToBits(value);
+    const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000U);
+    x &= 0x7FFFFFFFU;
+
+    // Infinity and NaN (kept quiet)
+    if (x >= 0x7F800000U) return sign | 0x7C00U | (x > 0x7F800000U ? 0x0200U : 0);
+
+    // 65520 and more round to infinity
+    if (x >= 0x477FF000U) return sign | 0x7C00U;
+
+    // Less than 2^-14: subnormal or zero
+    if (x < 0x38800000U) {
+        if (x < 0x33000000U) return sign;
+
+        const uint32_t mantissa = (x & 0x007FFFFFU) | 0x00800000U;
+        const uint32_t shift = 126 - (x >> 23);
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1U << shift) - 1);
+        const uint32_t halfway = 1U << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) half++;
+        return sign | static_cast<uint16_t>(half);
+    }
+
+    // Normal: rebias exponent (127 -> 15), drop 13 mantissa bits rounding to nearest even (a carry into the exponent is correct)
+    uint32_t half = (x - 0x38000000U) >> 13;
+    const uint32_t rest = x & 0x1FFFU;
+    if (rest > 0x1000U || (rest == 0x1000U && (half & 1))) half++;
+    return sign | static_cast<uint16_t>(half);
+}
+
+float HalfMatrix::FromFP16(const uint16_t& bits) {
+    const uint32_t sign = (static_cast<uint32_t>(bits) & 0x8000U) << 16;
+    uint32_t exponent = (bits >> 10) & 0x1FU;
+    uint32_t mantissa = bits & 0x03FFU;
+
+    if (exponent == 0x1F) return BitsToFloat(sign | 0x7F800000U | (mantissa << 13));
+    if (exponent != 0) return BitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+    if (mantissa == 0) return BitsToFloat(sign);
+
+    // Subnormal: normalize
+    exponent = 113;
+    while ((mantissa & 0x0400U) == 0) {
+        mantissa <<= 1;
+        exponent--;
+    }
+
+    return BitsToFloat(sign | (exponent << 23) | ((mantissa & 0x03FFU) << 13));
+}
+
+uint16_t HalfMatrix::ToBF16(const float& value) {
+    const uint32_t x = FloatToBits(value);
+
+    // NaN stays NaN (rounding could turn it into infinity)
+    if ((x & 0x7FFFFFFFU) > 0x7F800000U) return static_cast<uint16_t>((x >> 16) | 0x0040U);
+
+    return static_cast<uint16_t>((x + 0x7FFFU + ((x >> 16) & 1)) >> 16);
+}
+
+float HalfMatrix::FromBF16(const uint16_t& bits) {
+    return BitsToFloat(static_cast<uint32_t>(bits) << 16);
+}
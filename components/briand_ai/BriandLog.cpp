@@ -0,0 +1,297 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandLog.hxx"
+
+using namespace std;
+using namespace Briand;
+
+std::atomic<uint8_t> TraceLog::Level(5);
+uint32_t TraceLog::DrainIntervalMs = 20;
+std::function<void(const char* line)> TraceLog::Sink = [](const char* line) { fputs(line, stdout); };
+
+/**********************************************************************
+    Ring (bounded multi-producer queue, one sequence number for each slot)
+***********************************************************************/
+
+/// @brief Ring slot: the sequence tells producers and the consumer whose turn it is
+class LogSlot {
+    public:
+    std::atomic<size_t> Sequence;
+    LogRecord Record;
+};
+
+/// @brief Slots (nullptr = not running), capacity - 1
+static LogSlot* LOG_RING = nullptr;
+static size_t LOG_MASK = 0;
+
+/// @brief Producers and consumer positions, on different cache lines
+alignas(64) static std::atomic<size_t> LOG_HEAD(0);
+alignas(64) static size_t LOG_TAIL = 0;
+alignas(64) static std::atomic<size_t> LOG_DROPPED(0);
+
+/// @brief Ring published to producers (acquire by readers)
+static std::atomic<LogSlot*> LOG_ACTIVE(nullptr);
+
+/// @brief Producers currently inside Push() (Stop() waits them before releasing the ring)
+static std::atomic<uint32_t> LOG_WRITERS(0);
+
+/// @brief Consumer side lock (drainer, Flush(), Start(), Stop()): producers never take it
+static std::mutex LOG_CONSUMER;
+
+/// @brief Drainer
+static std::thread LOG_DRAINER;
+static std::mutex LOG_DRAINER_LOCK;
+static std::condition_variable LOG_DRAINER_SIGNAL;
+static bool LOG_DRAINER_STOP = false;
+
+/// @brief Small thread ids
+static std::atomic<uint32_t> LOG_THREADS(0);
+
+static uint32_t ThreadId() {
+    thread_local uint32_t id = ++LOG_THREADS;
+    return id;
+}
+
+/// @brief Format and write all the committed records (consumer lock held)
+static size_t Drain() {
+    if (LOG_RING == nullptr) return 0;
+
+    size_t written = 0;
+    string line;
+    while (true) {
+        LogSlot& slot = LOG_RING[LOG_TAIL & LOG_MASK];
+        if (slot.Sequence.load(std::memory_order_acquire) != LOG_TAIL + 1) break;
+
+        TraceLog::Format(slot.Record, line);
+        slot.Sequence.store(LOG_TAIL + LOG_MASK + 1, std::memory_order_release);
+        LOG_TAIL++;
+
+        TraceLog::Sink(line.c_str());
+        written++;
+    }
+
+    return written;
+}
+
+static void DrainerLoop() {
+    std::unique_lock<std::mutex> wait(LOG_DRAINER_LOCK);
+    while (!LOG_DRAINER_STOP) {
+        LOG_DRAINER_SIGNAL.wait_for(wait, std::chrono::milliseconds(TraceLog::DrainIntervalMs));
+        std::lock_guard<std::mutex> lock(LOG_CONSUMER);
+        Drain();
+    }
+}
+
+/**********************************************************************
+    Trace log class
+***********************************************************************/
+
+void TraceLog::Start(const size_t& capacity) {
+    // Check
+    if (capacity < 2) throw out_of_range("TraceLog: capacity must be at least 2.");
+
+    std::lock_guard<std::mutex> lock(LOG_CONSUMER);
+    if (LOG_RING != nullptr) throw runtime_error("TraceLog: already running.");
+
+    size_t slots = 2;
+    while (slots < capacity) slots <<= 1;
+
+    LOG_RING = new LogSlot[slots];
+    for (size_t i = 0; i < slots; i++) LOG_RING[i].Sequence.store(i, std::memory_order_relaxed);
+    LOG_MASK = slots - 1;
+    LOG_HEAD = 0;
+    LOG_TAIL = 0;
+    LOG_DROPPED = 0;
+    LOG_ACTIVE.store(LOG_RING, std::memory_order_release);
+
+    // Drainer is low priority work, on ESP on the other core
+    LOG_DRAINER_STOP = false;
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.pin_to_core = 1 % portNUM_PROCESSORS;
+    cfg.thread_name = "BriandLog";
+    esp_pthread_set_cfg(&cfg);
+    LOG_DRAINER = std::thread(DrainerLoop);
+    esp_pthread_cfg_t defaults = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&defaults);
+}
+
+void TraceLog::Stop() {
+    if (!LOG_DRAINER.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> wait(LOG_DRAINER_LOCK);
+        LOG_DRAINER_STOP = true;
+    }
+    LOG_DRAINER_SIGNAL.notify_all();
+    LOG_DRAINER.join();
+
+    // New records go to callers, wait those in flight
+    LOG_ACTIVE.store(nullptr, std::memory_order_seq_cst);
+    while (LOG_WRITERS.load(std::memory_order_seq_cst) > 0) std::this_thread::yield();
+
+    std::lock_guard<std::mutex> lock(LOG_CONSUMER);
+    Drain();
+    delete[] LOG_RING;
+    LOG_RING = nullptr;
+}
+
+size_t TraceLog::Flush() {
+    std::lock_guard<std::mutex> lock(LOG_CONSUMER);
+    return Drain();
+}
+
+bool TraceLog::Running() {
+    return LOG_ACTIVE.load(std::memory_order_acquire) != nullptr;
+}
+
+size_t TraceLog::Recorded() {
+    return LOG_HEAD.load(std::memory_order_relaxed);
+}
+
+size_t TraceLog::Dropped() {
+    return LOG_DROPPED.load(std::memory_order_relaxed);
+}
+
+void TraceLog::Push(LogRecord& record) {
+    record.Thread = ThreadId();
+
+    LOG_WRITERS.fetch_add(1, std::memory_order_seq_cst);
+    LogSlot* ring = LOG_ACTIVE.load(std::memory_order_seq_cst);
+
+    if (ring == nullptr) {
+        // Not running: format here
+        LOG_WRITERS.fetch_sub(1, std::memory_order_release);
+        string line;
+        Format(record, line);
+        Sink(line.c_str());
+        return;
+    }
+
+    // Claim a slot: free when its sequence equals the position
+    size_t position = LOG_HEAD.load(std::memory_order_relaxed);
+    LogSlot* slot;
+    while (true) {
+        slot = &ring[position & LOG_MASK];
+        const size_t sequence = slot->Sequence.load(std::memory_order_acquire);
+        const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+        if (difference == 0) {
+            if (LOG_HEAD.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        }
+        else if (difference < 0) {
+            // Full: drop, never wait
+            LOG_DROPPED.fetch_add(1, std::memory_order_relaxed);
+            LOG_WRITERS.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        else position = LOG_HEAD.load(std::memory_order_relaxed);
+    }
+
+    slot->Record = record;
+    slot->Sequence.store(position + 1, std::memory_order_release);
+    LOG_WRITERS.fetch_sub(1, std::memory_order_release);
+}
+
+void TraceLog::RecordSpan(const uint8_t& level, const char* tag, const char* name, const int64_t& start) {
+    if (level > Level.load(std::memory_order_relaxed)) return;
+
+    LogRecord record;
+    record.Time = esp_timer_get_time();
+    record.Tag = tag;
+    record.Format = name;
+    record.Level = level;
+    record.Kind = LogRecordKind::Span;
+    record.Arguments = 1;
+    record.Types = 0;
+    record.Values[0].Integer = record.Time - start;
+    Push(record);
+}
+
+void TraceLog::Format(const LogRecord& record, string& line) {
+    static const char LETTERS[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+    char buffer[128];
+
+    snprintf(buffer, sizeof(buffer), "%c (%lld) #%u %s: ", record.Kind == LogRecordKind::Span ? 'T' : LETTERS[min<uint8_t>(record.Level, 5)],
+        static_cast<long long>(record.Time / 1000), static_cast<unsigned int>(record.Thread), record.Tag);
+    line = buffer;
+
+    if (record.Kind == LogRecordKind::Span) {
+        snprintf(buffer, sizeof(buffer), "%s %lldus\n", record.Format, static_cast<long long>(record.Values[0].Integer));
+        line += buffer;
+        return;
+    }
+
+    // Rebuild each conversion with the stored type (length modifiers of the caller do not matter)
+    const char* f = record.Format;
+    uint8_t argument = 0;
+    while (*f != '\0') {
+        if (*f != '%') {
+            line += *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            line += '%';
+            f += 2;
+            continue;
+        }
+
+        string spec = "%";
+        f++;
+        while (*f != '\0' && strchr("-+ #0123456789.", *f) != nullptr) spec += *f++;
+        while (*f != '\0' && strchr("hlLqjzt", *f) != nullptr) f++;
+        const char conversion = *f;
+        if (conversion == '\0') break;
+        f++;
+
+        if (argument >= record.Arguments) {
+            line += "<?>";
+            continue;
+        }
+
+        const uint8_t type = (record.Types >> (2 * argument)) & 0x03;
+        const LogArgument& value = record.Values[argument++];
+
+        if (strchr("diuoxXc", conversion) != nullptr) {
+            if (conversion == 'c') spec += 'c';
+            else {
+                spec += "ll";
+                spec += conversion;
+            }
+            const long long v = (type == 1 ? static_cast<long long>(value.Real) : static_cast<long long>(value.Integer));
+            if (conversion == 'c') snprintf(buffer, sizeof(buffer), spec.c_str(), static_cast<int>(v));
+            else snprintf(buffer, sizeof(buffer), spec.c_str(), v);
+        }
+        else if (strchr("fFeEgGaA", conversion) != nullptr) {
+            spec += conversion;
+            snprintf(buffer, sizeof(buffer), spec.c_str(), type == 1 ? value.Real : static_cast<double>(value.Integer));
+        }
+        else if (conversion == 's') {
+            spec += 's';
+            snprintf(buffer, sizeof(buffer), spec.c_str(), type == 2 && value.Pointer != nullptr ? static_cast<const char*>(value.Pointer) : "(null)");
+        }
+        else if (conversion == 'p') {
+            spec += 'p';
+            snprintf(buffer, sizeof(buffer), spec.c_str(), value.Pointer);
+        }
+        else {
+            snprintf(buffer, sizeof(buffer), "<%%%c?>", conversion);
+        }
+        line += buffer;
+    }
+
+    if (line.empty() || line.back() != '\n') line += '\n';
+}
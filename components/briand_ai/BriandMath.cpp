@@ -15,6 +15,7 @@
 */
 
 #include "BriandMath.hxx"
+#include "BriandRandom.hxx"
 
 using namespace std;
 
@@ -29,6 +30,110 @@ double Briand::Math::WeightedSum(const vector<double>& values, const vector<doub
     return sum; 
 }
 
+// Lanes of ExpLanes(): enough independent polynomials in flight to hide the multiply-add latency
+static constexpr size_t EXP_LANES = 8;
+
+static inline void ExpLanes(const double* __restrict x, double* __restrict y) {
+    // exp(x) = 2^k * exp(r), k = round(x / ln2), |r| <= ln2 / 2: exp(r) is its Taylor polynomial of degree 13 (Estrin's scheme)
+    // and 2^k is built in the exponent bits. No branches and no calls, so the fixed-count loop is vectorized.
+    const double log2e = 1.4426950408889634;
+    const double ln2hi = 6.93147180369123816490e-01;
+    const double ln2lo = 1.90821492927058770002e-10;
+    // 1.5 x 2^52: adding it rounds to an integer, kept in the low bits of the mantissa
+    const double shifter = 6755399441055744.0;
+
+    for (size_t t = 0; t < EXP_LANES; t++) {
+        const double shifted = x[t] * log2e + shifter;
+        const double k = shifted - shifter;
+        const double r = (x[t] - k * ln2hi) - k * ln2lo;
+
+        const double r2 = r * r, r4 = r2 * r2, r8 = r4 * r4;
+        const double a0 = 1.0 + r;
+        const double a1 = 1.0 / 2.0 + r * (1.0 / 6.0);
+        const double a2 = 1.0 / 24.0 + r * (1.0 / 120.0);
+        const double a3 = 1.0 / 720.0 + r * (1.0 / 5040.0);
+        const double a4 = 1.0 / 40320.0 + r * (1.0 / 362880.0);
+        const double a5 = 1.0 / 3628800.0 + r * (1.0 / 39916800.0);
+        const double a6 = 1.0 / 479001600.0 + r * (1.0 / 6227020800.0);
+        const double p = ((a0 + a1 * r2) + (a2 + a3 * r2) * r4) + ((a4 + a5 * r2) + a6 * r4) * r8;
+
+        uint64_t bits;
+        memcpy(&bits, &shifted, sizeof(bits));
+        bits = (bits + 1023) << 52;
+        double scale;
+        memcpy(&scale, &bits, sizeof(scale));
+        y[t] = p * scale;
+    }
+}
+
+static inline void ExpShifted(const double* x, const double& shift, const size_t& n, double* y) {
+    // exp(x - shift) of n <= EXP_LANES values, x and y may be the same array
+    double in[EXP_LANES], out[EXP_LANES];
+    if (n == EXP_LANES) for (size_t t = 0; t < EXP_LANES; t++) in[t] = x[t] - shift;
+    else for (size_t t = 0; t < EXP_LANES; t++) in[t] = (t < n ? x[t] - shift : 0.0);
+
+    ExpLanes(in, out);
+
+    // Out of the exponent range (2^k would wrap)
+    for (size_t t = 0; t < n; t++) {
+        if (in[t] < -708.0) out[t] = 0.0;
+        else if (in[t] > 709.0) out[t] = std::numeric_limits<double>::infinity();
+        y[t] = out[t];
+    }
+}
+
+void Briand::Math::Exp(const double* x, double* y, const size_t& n) {
+    for (size_t i = 0; i < n; i += EXP_LANES) ExpShifted(x + i, 0.0, std::min(EXP_LANES, n - i), y + i);
+}
+
+double Briand::Math::LogSumExp(const vector<double>& z) {
+    return Briand::Math::LogSumExp(z.data(), z.size());
+}
+
+double Briand::Math::LogSumExp(const double* z, const size_t& n) {
+    if (n == 0) return -std::numeric_limits<double>::infinity();
+
+    const double max = *std::max_element(z, z + n);
+    double terms[EXP_LANES];
+    double sum = 0.0;
+    for (size_t i = 0; i < n; i += EXP_LANES) {
+        const size_t m = std::min(EXP_LANES, n - i);
+        ExpShifted(z + i, max, m, terms);
+        for (size_t t = 0; t < m; t++) sum += terms[t];
+    }
+
+    return max + log(sum);
+}
+
+double Briand::Math::Softmax(const vector<double>& z, vector<double>& p) {
+    // Check
+    if (p.size() != z.size()) throw runtime_error("Briand::Math::Softmax - output size mismatch.");
+
+    return Briand::Math::Softmax(z.data(), p.data(), z.size());
+}
+
+double Briand::Math::Softmax(const double* z, double* p, const size_t& n) {
+    if (n == 0) return -std::numeric_limits<double>::infinity();
+
+    const double max = *std::max_element(z, z + n);
+
+    // exp(z - max) <= 1: no overflow, at least one term is 1 so no division by zero
+    // p[i] only depends on z[i], so p and z can be the same array
+    double sum = 0.0;
+    for (size_t i = 0; i < n; i += EXP_LANES) {
+        const size_t m = std::min(EXP_LANES, n - i);
+        ExpShifted(z + i, max, m, p + i);
+        for (size_t t = 0; t < m; t++) sum += p[i + t];
+    }
+
+    const double inverse = 1.0 / sum;
+    for (size_t i = 0; i < n; i++) p[i] *= inverse;
+
+    return max + log(sum);
+}
+
 double Briand::Math::Random() {
-    return esp_random() / static_cast<double>(UINT32_MAX);
+    Philox& generator = Philox::Default();
+    std::lock_guard<std::mutex> lock(Philox::DefaultLock());
+    return generator.NextUniform();
 }
@@ -15,10 +15,14 @@
 */
 
 #include "BriandMatrix.hxx"
+#include "BriandRandom.hxx"
 
 using namespace std;
 using namespace Briand;
 
+size_t Matrix::ParallelThreshold = 32768;
+bool Matrix::StreamExternal = true;
+
 Matrix::Matrix(const int& rows, const int& cols, const double& initialValue /*= 0.0*/) {
     this->_rows = rows;
     this->_cols = cols;
@@ -27,19 +31,16 @@ Matrix::Matrix(const int& rows, const int& cols, const double& initialValue /*=
 
 Matrix::Matrix(const std::initializer_list<std::initializer_list<double>>& m) {
     this->_rows = m.size();
-    this->_cols = 0;
-    
-    this->_matrix = new double*[this->_rows];
-    size_t i = 0;
-    size_t j;
+    this->_cols = (m.size() > 0 ? m.begin()->size() : 0);
+    this->InstanceMatrix();
 
+    size_t i = 0;
     for (auto& r : m) {
-        if (this->_cols == 0) this->_cols = r.size();
-        if (this->_cols != r.size()) throw out_of_range("Matrix cols not uniform in size");
-        this->_matrix[i] = new double[this->_cols];
-        j = 0;
-        for (auto& c : r) this->_matrix[i][j++] = c;
-        i++;
+        if (this->_cols != r.size()) {
+            this->FreeMatrix();
+            throw out_of_range("Matrix cols not uniform in size");
+        }
+        std::copy(r.begin(), r.end(), this->_matrix[i++]);
     }
 }
 
@@ -47,30 +48,50 @@ Matrix::Matrix(const Matrix& other) {
     // Instance new matrix with same rows and cols
     this->_rows = other.Rows();
     this->_cols = other.Cols();
-    
-    // Copy matrix weights while instancing
-    this->_matrix = new double*[this->_rows];
-    for (size_t i = 0; i < this->_rows; i++) {
-        this->_matrix[i] = new double[this->_cols];
-        for (size_t j = 0; j < this->_cols; j++)
-            this->_matrix[i][j] = other[i][j];
-    }    
+    this->InstanceMatrix();
+
+    // Copy matrix weights
+    std::copy_n(other.Data(), this->_rows * this->_cols, this->_data);
 }
 
 void Matrix::InstanceMatrix(const double& initialValue /* = 0.0*/) {
+    // One block for all elements, placed by size (big weights in external RAM if any)
+    const size_t bytes = this->_rows * this->_cols * sizeof(double);
+    this->_data = static_cast<double*>(Memory::Allocate(bytes, Memory::TierFor(bytes)));
+    this->_tier = Memory::TierOf(this->_data);
+    std::fill_n(this->_data, this->_rows * this->_cols, initialValue);
+
     this->_matrix = new double*[this->_rows];
-    for (size_t i = 0; i < this->_rows; i++) {
-        this->_matrix[i] = new double[this->_cols];
-        std::fill_n(this->_matrix[i], this->_cols, initialValue);
-    }
+    for (size_t i = 0; i < this->_rows; i++) this->_matrix[i] = this->_data + i * this->_cols;
+}
+
+void Matrix::FreeMatrix() {
+    if (this->_matrix == nullptr) return;
+
+    Memory::Free(this->_data);
+    delete[] this->_matrix;
+    this->_matrix = nullptr;
+    this->_data = nullptr;
 }
 
 Matrix::~Matrix() {
-    for (size_t i = 0; i < this->_rows; i++) {
-        if (this->_matrix[i] != nullptr) delete[] this->_matrix[i];
+    this->FreeMatrix();
+}
+
+Matrix& Matrix::operator=(const Matrix& other) {
+    if (this == &other) return *this;
+
+    // Reallocate only if size changes
+    if (this->_rows != other.Rows() || this->_cols != other.Cols()) {
+        this->FreeMatrix();
+        this->_rows = other.Rows();
+        this->_cols = other.Cols();
+        this->InstanceMatrix();
     }
-    
-    if (this->_matrix != nullptr) delete[] this->_matrix;
+
+    std::copy_n(other.Data(), this->_rows * this->_cols, this->_data);
+
+    return *this;
 }
 
 const size_t& Matrix::Rows() const {
@@ -81,20 +102,42 @@ const size_t& Matrix::Cols() const {
     return this->_cols;
 }
 
+double* Matrix::Data() const {
+    return this->_data;
+}
+
+const MemoryTier& Matrix::Tier() const {
+    return this->_tier;
+}
+
+void Matrix::MoveTo(const MemoryTier& tier) {
+    if (tier == this->_tier) return;
+
+    const size_t bytes = this->_rows * this->_cols * sizeof(double);
+    double* data = static_cast<double*>(Memory::Allocate(bytes, tier));
+    Memory::Stream(data, this->_data, bytes, this->_tier);
+    Memory::Free(this->_data);
+
+    this->_data = data;
+    this->_tier = Memory::TierOf(data);
+    for (size_t i = 0; i < this->_rows; i++) this->_matrix[i] = this->_data + i * this->_cols;
+}
+
 void Matrix::Randomize() {
-    for (size_t i = 0; i < this->_rows; i++) {
-        for (size_t j = 0; j < this->_cols; j++) {
-            // Random between 0 and 1
-            this->at(i, j) = static_cast<double>(esp_random()) / static_cast<double>(RAND_MAX);        }
-    }
+    // Random between 0 and 1, bulk fill from the default generator
+    Philox& generator = Philox::Default();
+    std::lock_guard<std::mutex> lock(Philox::DefaultLock());
+    generator.FillUniform(*this, 0.0, 1.0);
 }
 
 void Matrix::MultiplyScalar(const double& k) {
-    for (size_t i = 0; i < this->_rows; i++) {
-        for (size_t j = 0; j < this->_cols; j++) {
-            this->_matrix[i][j] = this->_matrix[i][j] * k;
+    Matrix::ForRows(this->_rows, this->_rows * this->_cols, [this, &k](const size_t& begin, const size_t& end) {
+        for (size_t i = begin; i < end; i++) {
+            for (size_t j = 0; j < this->_cols; j++) {
+                this->_matrix[i][j] = this->_matrix[i][j] * k;
+            }
         }
-    }
+    });
 }
 
 unique_ptr<Matrix> Matrix::MultiplyMatrix(const Matrix& other) {
@@ -105,13 +148,20 @@ unique_ptr<Matrix> Matrix::MultiplyMatrix(const Matrix& other) {
     auto result = make_unique<Matrix>(this->_rows, other.Cols(), 0.0); 
 
     const size_t N = other.Rows();
-
-    for (size_t i = 0; i < result->Rows(); i++) {
-        for (size_t j = 0; j < result->Cols(); j++) {
-            for (size_t k = 0; k < N; k++)
-                (*result.get())[i][j] += (*this)[i][k] * other[k][j];
+    const size_t P = other.Cols();
+    const Matrix& C = *result.get();
+
+    // Row panels of the result are independent. i-k-j order walks rows of other and C sequentially (cache friendly).
+    Matrix::ForRows(this->_rows, this->_rows * N * P, [this, &other, &C, N, P](const size_t& begin, const size_t& end) {
+        for (size_t i = begin; i < end; i++) {
+            double* ci = C[i];
+            for (size_t k = 0; k < N; k++) {
+                const double aik = this->_matrix[i][k];
+                const double* bk = other[k];
+                for (size_t j = 0; j < P; j++) ci[j] += aik * bk[j];
+            }
         }
-    }
+    });
 
     return std::move(result);
 }
@@ -124,13 +174,15 @@ unique_ptr<Matrix> Matrix::MultiplyMatrixHadamard(const Matrix& other) {
     // A(m,n) * B(m,n) = C(m,n)
     auto result = make_unique<Matrix>(this->_rows, this->_cols, 0.0); 
 
-    const size_t N = other.Rows();
+    const Matrix& C = *result.get();
 
-    for (size_t i = 0; i < result->Rows(); i++) {
-        for (size_t j = 0; j < result->Cols(); j++) {
-            (*result.get())[i][j] += (*this)[i][j] * other[i][j];
+    Matrix::ForRows(this->_rows, this->_rows * this->_cols, [this, &other, &C](const size_t& begin, const size_t& end) {
+        for (size_t i = begin; i < end; i++) {
+            for (size_t j = 0; j < this->_cols; j++) {
+                C[i][j] = this->_matrix[i][j] * other[i][j];
+            }
         }
-    }
+    });
 
     return std::move(result);
 }
@@ -139,19 +191,70 @@ unique_ptr<vector<double>> Matrix::MultiplyVector(const vector<double>& v) {
     // Condition: A x v is possible if number of cols in A equals the number of components in v
     if (v.size() != this->Cols()) throw out_of_range("Matrix A(m,n)*v(n) failed: n has different value!");
 
-    auto r = make_unique<vector<double>>();
-
-    for (size_t i = 0; i < this->Rows(); i++) {
-        double ri = 0;
-        for (size_t j = 0; j < this->Cols(); j++) {
-            ri += this->_matrix[i][j] * v[j];
-        }
-        r->push_back(ri);
-    }
+    auto r = make_unique<vector<double>>(this->_rows, 0.0);
+    this->MultiplyVector(v, *r.get());
 
     return std::move(r);
 }
 
+void Matrix::MultiplyVector(const vector<double>& v, vector<double>& result) const {
+    // Condition: A x v is possible if number of cols in A equals the number of components in v
+    if (v.size() != this->Cols()) throw out_of_range("Matrix A(m,n)*v(n) failed: n has different value!");
+    if (result.size() != this->Rows()) throw out_of_range("Matrix A(m,n)*v(n) failed: result must have m elements!");
+
+    this->MultiplyVector(v.data(), result.data());
+}
+
+void Matrix::MultiplyVector(const double* v, double* result) const {
+    const size_t cols = this->_cols;
+    const double* data = this->_data;
+
+    if (this->_tier == MemoryTier::Internal) {
+        // Row blocks are independent
+        Matrix::ForRows(this->_rows, this->_rows * cols, [data, cols, v, result](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) {
+                const double* row = data + i * cols;
+                double ri = 0;
+                for (size_t j = 0; j < cols; j++) ri += row[j] * v[j];
+                result[i] = ri;
+            }
+        });
+    }
+    else if (!Matrix::StreamExternal) {
+        Matrix::ForRows(this->_rows, this->_rows * cols, [data, cols, v, result](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) {
+                const double* row = data + i * cols;
+                Memory::Access(cols * sizeof(double));
+                double ri = 0;
+                for (size_t j = 0; j < cols; j++) ri += row[j] * v[j];
+                result[i] = ri;
+            }
+        });
+    }
+    else {
+        // External RAM: copy a tile of rows to internal RAM with one sequential burst, then compute from there
+        const size_t tileRows = std::max<size_t>(1, Memory::TileBytes / (cols > 0 ? cols * sizeof(double) : 1));
+
+        Matrix::ForRows(this->_rows, this->_rows * cols, [data, cols, v, result, tileRows](const size_t& begin, const size_t& end) {
+            // One tile for each thread, allocated at first use
+            static thread_local InternalVector tile;
+            if (tile.size() < tileRows * cols) tile.resize(tileRows * cols);
+
+            for (size_t first = begin; first < end; first += tileRows) {
+                const size_t rows = std::min(tileRows, end - first);
+                Memory::Stream(tile.data(), data + first * cols, rows * cols * sizeof(double), MemoryTier::External);
+
+                for (size_t r = 0; r < rows; r++) {
+                    const double* row = tile.data() + r * cols;
+                    double ri = 0;
+                    for (size_t j = 0; j < cols; j++) ri += row[j] * v[j];
+                    result[first + r] = ri;
+                }
+            }
+        });
+    }
+}
+
 unique_ptr<Matrix> Matrix::DotMultiplyVectors(const vector<double>& v1, const vector<double>& v2t) {
     // v1(m) * v2(p) = Matrix(m,p)
     auto result = make_unique<Matrix>(v1.size(), v2t.size(), 0.0);
@@ -164,23 +267,30 @@ unique_ptr<Matrix> Matrix::DotMultiplyVectors(const vector<double>& v1, const ve
         
     */
 
-    for (size_t i=0; i < v1.size(); i++) {
-        for (size_t j=0; j < v2t.size(); j++) {
-            result->at(i, j) = (v1[i] * v2t[j]);
-        }    
-    }
+    const Matrix& C = *result.get();
+
+    Matrix::ForRows(v1.size(), v1.size() * v2t.size(), [&v1, &v2t, &C](const size_t& begin, const size_t& end) {
+        for (size_t i = begin; i < end; i++) {
+            for (size_t j=0; j < v2t.size(); j++) {
+                C[i][j] = (v1[i] * v2t[j]);
+            }    
+        }
+    });
 
     return std::move(result); 
 }
 
 unique_ptr<Matrix> Matrix::ApplyFunction(double (*f)(const double& x)) {
     auto result = make_unique<Matrix>(this->_rows, this->_cols, 0.0);  
+    const Matrix& C = *result.get();
 
-    for (size_t i = 0; i < this->_rows; i++) {
-        for (size_t j = 0; j < this->_cols; j++) {
-            result->at(i, j) = f(this->_matrix[i][j]);
+    Matrix::ForRows(this->_rows, this->_rows * this->_cols, [this, &C, f](const size_t& begin, const size_t& end) {
+        for (size_t i = begin; i < end; i++) {
+            for (size_t j = 0; j < this->_cols; j++) {
+                C[i][j] = f(this->_matrix[i][j]);
+            }
         }
-    }
+    });
 
     return std::move(result);
 }
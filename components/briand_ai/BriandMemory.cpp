@@ -0,0 +1,96 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandMemory.hxx"
+
+using namespace std;
+using namespace Briand;
+
+// Same as the default CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL of ESP-IDF
+size_t Memory::ExternalThreshold = 16384;
+size_t Memory::TileBytes = 4096;
+
+#if !defined(ESP_PLATFORM)
+/// @brief Simulated external RAM latency (ns for each 32 bytes line)
+static std::atomic<uint32_t> SIMULATED_ACCESS_NS(0);
+static std::atomic<uint32_t> SIMULATED_BURST_NS(0);
+
+/// @brief Wait the simulated latency. Small delays are accumulated and paid together (the clock resolution is about 1us)
+static void SimulatedDelay(const uint64_t& ns) {
+    static thread_local uint64_t debt = 0;
+
+    debt += ns;
+    if (debt < 2000) return;
+
+    const auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(debt);
+    debt = 0;
+    while (std::chrono::steady_clock::now() < until) { /* busy wait like a stalled CPU */ }
+}
+#endif
+
+void* Memory::Allocate(const size_t& bytes, const MemoryTier& tier) {
+    const uint32_t internal = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    const uint32_t external = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    const size_t size = (bytes > 0 ? bytes : 1);
+
+    void* ptr = heap_caps_malloc(size, tier == MemoryTier::Internal ? internal : external);
+    if (ptr == nullptr) ptr = heap_caps_malloc(size, tier == MemoryTier::Internal ? external : internal);
+    if (ptr == nullptr) throw std::bad_alloc();
+
+    return ptr;
+}
+
+void Memory::Free(void* ptr) {
+    heap_caps_free(ptr);
+}
+
+MemoryTier Memory::TierFor(const size_t& bytes) {
+    return (bytes >= Memory::ExternalThreshold && Memory::HasExternal() ? MemoryTier::External : MemoryTier::Internal);
+}
+
+MemoryTier Memory::TierOf(const void* ptr) {
+    return (esp_ptr_external_ram(ptr) ? MemoryTier::External : MemoryTier::Internal);
+}
+
+bool Memory::HasExternal() {
+    return heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0;
+}
+
+size_t Memory::FreeBytes(const MemoryTier& tier) {
+    return heap_caps_get_free_size(tier == MemoryTier::Internal ? MALLOC_CAP_INTERNAL : MALLOC_CAP_SPIRAM);
+}
+
+void Memory::Stream(void* destination, const void* source, const size_t& bytes, const MemoryTier& tier) {
+    memcpy(destination, source, bytes);
+
+#if !defined(ESP_PLATFORM)
+    if (tier == MemoryTier::External) SimulatedDelay(static_cast<uint64_t>((bytes + 31) / 32) * SIMULATED_BURST_NS.load(std::memory_order_relaxed));
+#endif
+}
+
+void Memory::Access(const size_t& bytes) {
+#if !defined(ESP_PLATFORM)
+    SimulatedDelay(static_cast<uint64_t>((bytes + 31) / 32) * SIMULATED_ACCESS_NS.load(std::memory_order_relaxed));
+#endif
+}
+
+void Memory::Simulate(const size_t& internalBytes, const size_t& externalBytes, const uint32_t& accessNs, const uint32_t& burstNs) {
+#if !defined(ESP_PLATFORM)
+    briand_porting_heap_caps_simulate(internalBytes, externalBytes);
+    SIMULATED_ACCESS_NS = accessNs;
+    SIMULATED_BURST_NS = burstNs;
+#endif
+}
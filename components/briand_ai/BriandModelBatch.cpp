@@ -0,0 +1,379 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandModelBatch.hxx"
+
+using namespace std;
+using namespace Briand;
+
+ModelBatch::ModelBatch(const vector<const FCNN*>& networks, const vector<double>& learningRates, const vector<uint64_t>& seeds) {
+    // Check
+    if (networks.size() == 0) throw runtime_error("ModelBatch: no networks.");
+    if (learningRates.size() != networks.size() || seeds.size() != networks.size()) throw out_of_range("ModelBatch: one learning rate and one seed for each network.");
+
+    const FCNN& first = *networks[0];
+    if (!first._hasOutputs || first._layers->size() < 2) throw runtime_error("ModelBatch: network is not complete.");
+
+    const size_t M = networks.size();
+    const size_t layers = first._layers->size();
+    this->_models = M;
+
+    this->_sizes = make_unique<vector<size_t>>();
+    this->_f = make_unique<vector<ActivationFunction>>();
+    this->_df = make_unique<vector<ActivationFunction>>();
+    for (const auto& l : *first._layers.get()) {
+        this->_sizes->push_back(l->Neurons());
+        this->_f->push_back(l->_f);
+        this->_df->push_back(l->_df);
+    }
+    this->_softmax = first._layers->back()->_softmax;
+    this->_E = first._layers->back()->_E;
+    this->_dE = first._layers->back()->_dE;
+
+    // Same topology and functions, otherwise lanes would diverge
+    for (const auto& n : networks) {
+        if (n == nullptr || !n->_hasOutputs || n->_layers->size() != layers) throw runtime_error("ModelBatch: networks must have the same layers.");
+
+        for (size_t k = 0; k < layers; k++) {
+            const auto& l = n->_layers->at(k);
+            const auto& f = first._layers->at(k);
+            const bool bias = (l->_bias_weights != nullptr && l->_bias_weights->size() > 0);
+            const bool firstBias = (f->_bias_weights != nullptr && f->_bias_weights->size() > 0);
+
+            if (l->Neurons() != f->Neurons() || l->_f != f->_f || l->_df != f->_df || l->_softmax != f->_softmax || bias != firstBias) throw runtime_error("ModelBatch: networks must have the same layers at layer " + to_string(k));
+            if (l->_batchNorm != nullptr) throw runtime_error("ModelBatch: batch normalization is not supported (layer " + to_string(k) + ").");
+            if (bias && l->_bias_weights->size() != l->Neurons()) throw out_of_range("ModelBatch: invalid bias size at layer " + to_string(k));
+            if (k > 0 && (l->_weights == nullptr || l->_weights->Rows() != l->Neurons() || l->_weights->Cols() != n->_layers->at(k - 1)->Neurons())) throw out_of_range("ModelBatch: invalid weights at layer " + to_string(k));
+        }
+        if (n->_layers->back()->_E != this->_E || n->_layers->back()->_dE != this->_dE) throw runtime_error("ModelBatch: networks must have the same error function.");
+    }
+
+    // Interleave: model index is the innermost
+    this->_weights = make_unique<vector<vector<double>>>(layers - 1);
+    this->_bias = make_unique<vector<vector<double>>>(layers);
+    for (size_t k = 0; k < layers; k++) {
+        const size_t rows = this->_sizes->at(k);
+        const auto& f = first._layers->at(k);
+
+        if (f->_bias_weights != nullptr && f->_bias_weights->size() > 0) {
+            auto& bias = this->_bias->at(k);
+            bias.resize(rows * M);
+            for (size_t m = 0; m < M; m++) {
+                for (size_t i = 0; i < rows; i++) bias[i * M + m] = networks[m]->_layers->at(k)->_bias_weights->at(i);
+            }
+        }
+
+        if (k == 0) continue;
+
+        const size_t cols = this->_sizes->at(k - 1);
+        auto& weights = this->_weights->at(k - 1);
+        weights.resize(rows * cols * M);
+        for (size_t m = 0; m < M; m++) {
+            const Matrix& w = *networks[m]->_layers->at(k)->_weights.get();
+            for (size_t r = 0; r < rows; r++) {
+                for (size_t c = 0; c < cols; c++) weights[(r * cols + c) * M + m] = w[r][c];
+            }
+        }
+    }
+
+    this->_net = make_unique<vector<vector<double>>>(layers);
+    this->_out = make_unique<vector<vector<double>>>(layers);
+    this->_delta = make_unique<vector<vector<double>>>(layers);
+    for (size_t k = 0; k < layers; k++) {
+        this->_net->at(k).assign(this->_sizes->at(k) * M, 0.0);
+        this->_out->at(k).assign(this->_sizes->at(k) * M, 0.0);
+        this->_delta->at(k).assign(this->_sizes->at(k) * M, 0.0);
+    }
+    this->_targets = make_unique<vector<double>>(this->_sizes->back() * M, 0.0);
+
+    this->_rates = make_unique<vector<double>>(learningRates);
+    this->_seeds = make_unique<vector<uint64_t>>(seeds);
+}
+
+ModelBatch::~ModelBatch() {
+    this->_sizes.reset();
+    this->_weights.reset();
+    this->_bias.reset();
+    this->_net.reset();
+    this->_out.reset();
+    this->_delta.reset();
+    this->_targets.reset();
+    this->_f.reset();
+    this->_df.reset();
+    this->_rates.reset();
+    this->_seeds.reset();
+}
+
+const size_t& ModelBatch::Models() const {
+    return this->_models;
+}
+
+void ModelBatch::Forward(const size_t& begin, const size_t& end) {
+    const size_t M = this->_models;
+
+    for (size_t k = 1; k < this->_sizes->size(); k++) {
+        const size_t rows = this->_sizes->at(k);
+        const size_t cols = this->_sizes->at(k - 1);
+        const double* W = this->_weights->at(k - 1).data();
+        const double* in = this->_out->at(k - 1).data();
+        const double* bias = (this->_bias->at(k).size() > 0 ? this->_bias->at(k).data() : nullptr);
+        double* net = this->_net->at(k).data();
+        double* out = this->_out->at(k).data();
+        const ActivationFunction f = this->_f->at(k);
+
+        // net = W * in, one lane for each model
+        for (size_t r = 0; r < rows; r++) {
+            double* n = net + r * M;
+            for (size_t m = begin; m < end; m++) n[m] = 0.0;
+
+            for (size_t c = 0; c < cols; c++) {
+                const double* w = W + (r * cols + c) * M;
+                const double* x = in + c * M;
+                for (size_t m = begin; m < end; m++) n[m] += w[m] * x[m];
+            }
+        }
+
+        // Output layer softmax of each model across rows, same as Math::Softmax()
+        if (k + 1 == this->_sizes->size() && this->_softmax) {
+            for (size_t m = begin; m < end; m++) {
+                if (bias != nullptr) {
+                    for (size_t r = 0; r < rows; r++) net[r * M + m] += bias[r * M + m];
+                }
+
+                double top = net[m];
+                for (size_t r = 1; r < rows; r++) top = std::max(top, net[r * M + m]);
+                double sum = 0.0;
+                for (size_t r = 0; r < rows; r++) {
+                    out[r * M + m] = exp(net[r * M + m] - top);
+                    sum += out[r * M + m];
+                }
+                const double inverse = 1.0 / sum;
+                for (size_t r = 0; r < rows; r++) out[r * M + m] *= inverse;
+            }
+            continue;
+        }
+
+        for (size_t r = 0; r < rows; r++) {
+            for (size_t m = begin; m < end; m++) {
+                const size_t i = r * M + m;
+                if (bias != nullptr) net[i] += bias[i];
+                out[i] = f(net[i]);
+            }
+        }
+    }
+}
+
+void ModelBatch::Backward(const size_t& begin, const size_t& end, vector<double>& errors) {
+    const size_t M = this->_models;
+    const size_t layers = this->_sizes->size();
+    const size_t outputs = this->_sizes->back();
+    const double* net = this->_net->back().data();
+    const double* out = this->_out->back().data();
+    const double* targets = this->_targets->data();
+    double* delta = this->_delta->back().data();
+    const double* rates = this->_rates->data();
+
+    // Output delta, same as FCNN::Backpropagate()
+    for (size_t m = begin; m < end; m++) {
+        if (this->_softmax) {
+            double top = net[m];
+            for (size_t r = 1; r < outputs; r++) top = std::max(top, net[r * M + m]);
+            double sum = 0.0;
+            for (size_t r = 0; r < outputs; r++) sum += exp(net[r * M + m] - top);
+            const double lse = top + log(sum);
+
+            for (size_t r = 0; r < outputs; r++) {
+                const size_t i = r * M + m;
+                if (targets[i] != 0.0) errors[m] += targets[i] * (lse - net[i]);
+                delta[i] = out[i] - targets[i];
+            }
+            continue;
+        }
+
+        for (size_t r = 0; r < outputs; r++) {
+            const size_t i = r * M + m;
+            errors[m] += this->_E(targets[i], out[i]);
+            const double dE = (this->_dE != nullptr ? this->_dE(targets[i], out[i]) : out[i] - targets[i]);
+            delta[i] = dE * this->_df->back()(net[i]);
+        }
+    }
+
+    const bool inputBias = (this->_bias->at(0).size() > 0);
+
+    // Backward: delta of the previous layer with weights not yet changed, then update this layer
+    for (size_t k = layers - 1; k > 0; k--) {
+        const size_t rows = this->_sizes->at(k);
+        const size_t cols = this->_sizes->at(k - 1);
+        double* W = this->_weights->at(k - 1).data();
+        const double* in = this->_out->at(k - 1).data();
+        const double* d = this->_delta->at(k).data();
+        double* bias = (this->_bias->at(k).size() > 0 ? this->_bias->at(k).data() : nullptr);
+
+        if (k > 1 || inputBias) {
+            double* previous = this->_delta->at(k - 1).data();
+            for (size_t c = 0; c < cols; c++) {
+                for (size_t m = begin; m < end; m++) previous[c * M + m] = 0.0;
+            }
+
+            // W transposed * delta
+            for (size_t r = 0; r < rows; r++) {
+                for (size_t c = 0; c < cols; c++) {
+                    const double* w = W + (r * cols + c) * M;
+                    double* p = previous + c * M;
+                    for (size_t m = begin; m < end; m++) p[m] += w[m] * d[r * M + m];
+                }
+            }
+
+            // Input layer has no activation
+            if (k > 1) {
+                const double* previousNet = this->_net->at(k - 1).data();
+                const ActivationFunction df = this->_df->at(k - 1);
+                for (size_t c = 0; c < cols; c++) {
+                    for (size_t m = begin; m < end; m++) previous[c * M + m] *= df(previousNet[c * M + m]);
+                }
+            }
+        }
+
+        // W -= rate * delta * in transposed, bias -= rate * delta
+        for (size_t r = 0; r < rows; r++) {
+            for (size_t c = 0; c < cols; c++) {
+                double* w = W + (r * cols + c) * M;
+                const double* x = in + c * M;
+                for (size_t m = begin; m < end; m++) w[m] -= rates[m] * (d[r * M + m] * x[m]);
+            }
+            if (bias != nullptr) {
+                for (size_t m = begin; m < end; m++) bias[r * M + m] -= rates[m] * d[r * M + m];
+            }
+        }
+    }
+
+    if (inputBias) {
+        double* bias = this->_bias->at(0).data();
+        const double* d = this->_delta->at(0).data();
+        for (size_t i = 0; i < this->_sizes->at(0); i++) {
+            for (size_t m = begin; m < end; m++) bias[i * M + m] -= rates[m] * d[i * M + m];
+        }
+    }
+}
+
+unique_ptr<vector<double>> ModelBatch::Fit(const Dataset& dataset, const size_t& epochs, const bool& shuffle /*= true*/) {
+    // Check
+    if (dataset.Size() == 0) throw runtime_error("ModelBatch: empty dataset.");
+
+    const size_t M = this->_models;
+    const size_t inputs = this->_sizes->front();
+    const size_t outputs = this->_sizes->back();
+    for (size_t i = 0; i < dataset.Size(); i++) {
+        if (dataset.Inputs->at(i).size() != inputs || dataset.Targets->at(i).size() != outputs) throw out_of_range("ModelBatch: sample size does not match network inputs/outputs.");
+    }
+
+    auto losses = make_unique<vector<double>>(M, 0.0);
+    size_t parameters = 0;
+    for (const auto& w : *this->_weights.get()) parameters += w.size() / M;
+
+    // Blocks of models are independent for all the training: one parallel region
+    Matrix::ForRows(M, M * parameters * dataset.Size() * epochs, [this, &dataset, &epochs, &shuffle, &losses, M, inputs, outputs](const size_t& begin, const size_t& end) {
+        // Each model shuffles its own permutation with its own generator, same as FCNN::Fit()
+        vector<unique_ptr<Philox>> generators;
+        vector<vector<size_t>> indexes(end - begin, vector<size_t>(dataset.Size()));
+        for (size_t m = begin; m < end; m++) {
+            generators.push_back(make_unique<Philox>(this->_seeds->at(m), 1));
+            for (size_t i = 0; i < dataset.Size(); i++) indexes[m - begin][i] = i;
+        }
+
+        vector<double> errors(M, 0.0);
+        double* input = this->_out->at(0).data();
+        double* net = this->_net->at(0).data();
+        const double* bias = (this->_bias->at(0).size() > 0 ? this->_bias->at(0).data() : nullptr);
+        double* targets = this->_targets->data();
+
+        for (size_t epoch = 0; epoch < epochs; epoch++) {
+            for (size_t m = begin; m < end; m++) {
+                errors[m] = 0.0;
+                if (!shuffle) continue;
+
+                auto& v = indexes[m - begin];
+                for (size_t i = v.size(); i > 1; i--) std::swap(v[i - 1], v[generators[m - begin]->NextUInt32() % i]);
+            }
+
+            for (size_t step = 0; step < dataset.Size(); step++) {
+                // Gather the sample of each model into its lane
+                for (size_t m = begin; m < end; m++) {
+                    const size_t s = indexes[m - begin][step];
+                    const auto& x = dataset.Inputs->at(s);
+                    const auto& t = dataset.Targets->at(s);
+                    for (size_t i = 0; i < inputs; i++) input[i * M + m] = net[i * M + m] = x[i] + (bias != nullptr ? bias[i * M + m] : 0.0);
+                    for (size_t i = 0; i < outputs; i++) targets[i * M + m] = t[i];
+                }
+
+                this->Forward(begin, end);
+                this->Backward(begin, end, errors);
+            }
+        }
+
+        for (size_t m = begin; m < end; m++) losses->at(m) = errors[m] / static_cast<double>(dataset.Size());
+    });
+
+    return losses;
+}
+
+void ModelBatch::Predict(const vector<double>& inputs, vector<vector<double>>& outputs) {
+    const size_t M = this->_models;
+    if (inputs.size() != this->_sizes->front()) throw runtime_error("Input values: invalid size.");
+
+    const double* bias = (this->_bias->at(0).size() > 0 ? this->_bias->at(0).data() : nullptr);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        for (size_t m = 0; m < M; m++) this->_out->at(0)[i * M + m] = this->_net->at(0)[i * M + m] = inputs[i] + (bias != nullptr ? bias[i * M + m] : 0.0);
+    }
+
+    this->Forward(0, M);
+
+    const size_t n = this->_sizes->back();
+    const auto& out = this->_out->back();
+    if (outputs.size() != M) outputs.resize(M);
+    for (size_t m = 0; m < M; m++) {
+        if (outputs[m].size() != n) outputs[m].resize(n);
+        for (size_t i = 0; i < n; i++) outputs[m][i] = out[i * M + m];
+    }
+}
+
+void ModelBatch::CopyTo(const size_t& model, FCNN& network) const {
+    const size_t M = this->_models;
+    if (model >= M) throw out_of_range("ModelBatch: invalid model.");
+    if (network._layers->size() != this->_sizes->size()) throw runtime_error("ModelBatch: network must have the same layers.");
+
+    for (size_t k = 0; k < this->_sizes->size(); k++) {
+        const auto& l = network._layers->at(k);
+        const size_t rows = this->_sizes->at(k);
+        if (l->Neurons() != rows) throw runtime_error("ModelBatch: network must have the same layers.");
+
+        const auto& bias = this->_bias->at(k);
+        if (bias.size() > 0 && l->_bias_weights != nullptr && l->_bias_weights->size() == rows) {
+            for (size_t i = 0; i < rows; i++) l->_bias_weights->at(i) = bias[i * M + model];
+        }
+
+        if (k == 0) continue;
+
+        const size_t cols = this->_sizes->at(k - 1);
+        const auto& weights = this->_weights->at(k - 1);
+        Matrix& w = *l->_weights.get();
+        for (size_t r = 0; r < rows; r++) {
+            for (size_t c = 0; c < cols; c++) w[r][c] = weights[(r * cols + c) * M + model];
+        }
+
+        if (l->DropWeightCopies()) network._revision++;
+    }
+}
@@ -0,0 +1,321 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandPipeline.hxx"
+
+using namespace std;
+using namespace Briand;
+
+/// @brief Spins before sleeping for a tick when a stage has nothing to do (a tick is 10ms on ESP, too much latency for every wait)
+#define BRIAND_PIPELINE_SPINS 64
+
+/// @brief Wait a little when a stage has nothing to do
+/// @param spins Consecutive idle cycles counter
+static void PipelineIdle(uint32_t& spins) {
+    if (spins < BRIAND_PIPELINE_SPINS) {
+        spins++;
+        taskYIELD();
+    }
+    else {
+        // Sleep a tick so idle task can run (watchdog!)
+        vTaskDelay(1);
+    }
+}
+
+/**********************************************************************
+    PipelineFrame / PipelineConfig / PipelineStatistics
+***********************************************************************/
+
+PipelineFrame::PipelineFrame(const size_t& inputs, const size_t& outputs) {
+    this->Input = make_unique<vector<double>>(inputs, 0.0);
+    this->Output = make_unique<vector<double>>(outputs, 0.0);
+    this->Sequence = 0;
+    this->CaptureTime = 0;
+}
+
+PipelineConfig::PipelineConfig(const size_t& inputs, const size_t& outputs) {
+    this->Slots = 4;
+    this->InputSize = inputs;
+    this->OutputSize = outputs;
+    this->Overflow = PipelineOverflow::Block;
+
+    // Capture and post-processing are light: keep them together, leave a core to inference
+    this->Cores[static_cast<int>(PipelineStage::Capture)] = 0;
+    this->Cores[static_cast<int>(PipelineStage::Inference)] = (portNUM_PROCESSORS > 1 ? 1 : 0);
+    this->Cores[static_cast<int>(PipelineStage::PostProcess)] = 0;
+
+    this->StackSize = 4096;
+    this->Priority = 5;
+}
+
+void PipelineStatistics::Print() {
+    printf("Pipeline: elapsed %lluus, captured %llu, dropped %llu, completed %llu (%.1lf frames/s)\n",
+        static_cast<unsigned long long>(this->Elapsed),
+        static_cast<unsigned long long>(this->Captured),
+        static_cast<unsigned long long>(this->Dropped),
+        static_cast<unsigned long long>(this->Completed),
+        this->Elapsed > 0 ? static_cast<double>(this->Completed) * 1000000.0 / static_cast<double>(this->Elapsed) : 0.0);
+    printf("Pipeline: occupancy capture %.1lf%% inference %.1lf%% post %.1lf%%\n",
+        this->StageOccupancy[0] * 100.0, this->StageOccupancy[1] * 100.0, this->StageOccupancy[2] * 100.0);
+    printf("Pipeline: avg queue depth free %.2lf ready %.2lf done %.2lf\n",
+        this->StageQueueDepth[0], this->StageQueueDepth[1], this->StageQueueDepth[2]);
+    printf("Pipeline: end-to-end latency AVG = %ldus MIN = %ldus MAX = %ldus\n",
+        static_cast<long>(this->LatencyAvg), static_cast<long>(this->LatencyMin), static_cast<long>(this->LatencyMax));
+}
+
+/**********************************************************************
+    StreamingPipeline
+***********************************************************************/
+
+StreamingPipeline::StreamingPipeline(const PipelineConfig& config, PipelineSourceFunction capture, PipelineStageFunction inference, PipelineStageFunction postProcess, void* context)
+    : _config(config)
+{
+    // Check
+    if (config.Slots == 0) throw out_of_range("Pipeline needs at least one frame slot.");
+    if (config.InputSize == 0 || config.OutputSize == 0) throw out_of_range("Pipeline frame input and output sizes must be > 0.");
+    if (capture == nullptr || inference == nullptr || postProcess == nullptr) throw runtime_error("Pipeline stage functions are mandatory.");
+
+    this->_capture = capture;
+    this->_inference = inference;
+    this->_postProcess = postProcess;
+    this->_context = context;
+
+    // Preallocate frame slots, the latest one is the scratch frame used when dropping
+    this->_frames = make_unique<vector<unique_ptr<PipelineFrame>>>();
+    this->_frames->reserve(config.Slots + 1);
+    for (size_t i = 0; i < config.Slots + 1; i++) {
+        this->_frames->push_back(make_unique<PipelineFrame>(config.InputSize, config.OutputSize));
+    }
+
+    // Every ring can hold all slot indexes so a push never fails
+    this->_free = make_unique<SPSCRingBuffer<size_t>>(config.Slots);
+    this->_ready = make_unique<SPSCRingBuffer<size_t>>(config.Slots);
+    this->_done = make_unique<SPSCRingBuffer<size_t>>(config.Slots);
+
+    this->_running.store(false);
+    for (int i = 0; i < 3; i++) this->_stageExited[i].store(true);
+    this->_startTime = 0;
+    this->_stopTime = 0;
+}
+
+StreamingPipeline::~StreamingPipeline() {
+    if (this->IsRunning()) this->Stop();
+    this->_frames.reset();
+    this->_free.reset();
+    this->_ready.reset();
+    this->_done.reset();
+}
+
+void StreamingPipeline::Start() {
+    // Check
+    if (this->IsRunning()) throw runtime_error("Pipeline already running.");
+
+    // No task running: safe to reset from here. All slots are free.
+    this->_free->Reset();
+    this->_ready->Reset();
+    this->_done->Reset();
+    for (size_t i = 0; i < this->_config.Slots; i++) this->_free->Push(i);
+
+    // Reset statistics
+    this->_captured.store(0);
+    this->_dropped.store(0);
+    this->_completed.store(0);
+    for (int i = 0; i < 3; i++) {
+        this->_busy[i].store(0);
+        this->_queueSum[i].store(0);
+        this->_queueSamples[i].store(0);
+        this->_stageExited[i].store(false);
+    }
+    this->_latencySum.store(0);
+    this->_latencyMin.store(std::numeric_limits<uint64_t>::max());
+    this->_latencyMax.store(0);
+
+    this->_running.store(true);
+    this->_startTime = esp_timer_get_time();
+
+    // Start from the end of the chain so consumers are ready before producers
+    xTaskCreatePinnedToCore(StreamingPipeline::PostProcessTask, "PipelinePost", this->_config.StackSize, this, this->_config.Priority, NULL, this->_config.Cores[static_cast<int>(PipelineStage::PostProcess)]);
+    xTaskCreatePinnedToCore(StreamingPipeline::InferenceTask, "PipelineInfer", this->_config.StackSize, this, this->_config.Priority, NULL, this->_config.Cores[static_cast<int>(PipelineStage::Inference)]);
+    xTaskCreatePinnedToCore(StreamingPipeline::CaptureTask, "PipelineCapture", this->_config.StackSize, this, this->_config.Priority, NULL, this->_config.Cores[static_cast<int>(PipelineStage::Capture)]);
+}
+
+void StreamingPipeline::Stop() {
+    if (!this->IsRunning()) return;
+
+    this->_running.store(false);
+
+    // Wait for all stage tasks to leave their loop
+    while (!this->_stageExited[0].load() || !this->_stageExited[1].load() || !this->_stageExited[2].load()) {
+        vTaskDelay(1);
+    }
+
+    this->_stopTime = esp_timer_get_time();
+}
+
+bool StreamingPipeline::IsRunning() const {
+    return this->_running.load();
+}
+
+PipelineStatistics StreamingPipeline::GetStatistics() const {
+    PipelineStatistics stats;
+
+    const uint64_t end = this->IsRunning() ? esp_timer_get_time() : this->_stopTime;
+    stats.Elapsed = (this->_startTime > 0 && end > this->_startTime) ? end - this->_startTime : 0;
+    stats.Captured = this->_captured.load();
+    stats.Dropped = this->_dropped.load();
+    stats.Completed = this->_completed.load();
+
+    for (int i = 0; i < 3; i++) {
+        stats.StageOccupancy[i] = stats.Elapsed > 0 ? static_cast<double>(this->_busy[i].load()) / static_cast<double>(stats.Elapsed) : 0.0;
+        const uint64_t samples = this->_queueSamples[i].load();
+        stats.StageQueueDepth[i] = samples > 0 ? static_cast<double>(this->_queueSum[i].load()) / static_cast<double>(samples) : 0.0;
+    }
+
+    stats.LatencyAvg = stats.Completed > 0 ? static_cast<double>(this->_latencySum.load()) / static_cast<double>(stats.Completed) : 0.0;
+    stats.LatencyMin = stats.Completed > 0 ? this->_latencyMin.load() : 0;
+    stats.LatencyMax = this->_latencyMax.load();
+
+    return stats;
+}
+
+void StreamingPipeline::ExitTask(StreamingPipeline* p, const PipelineStage& stage) {
+    // After this flag the pipeline object could be destroyed, do not touch it anymore!
+    p->_stageExited[static_cast<int>(stage)].store(true);
+
+    vTaskDelete(NULL);
+
+#if !defined(ESP_PLATFORM)
+    // Like FreeRTOS, a task never returns: porting main() will cancel this thread
+    while (true) vTaskDelay(1000);
+#endif
+}
+
+void StreamingPipeline::CaptureTask(void* pipeline) {
+    auto p = static_cast<StreamingPipeline*>(pipeline);
+    const int stage = static_cast<int>(PipelineStage::Capture);
+    PipelineFrame& scratch = *p->_frames->back().get();
+    uint64_t sequence = 0;
+    uint32_t spins = 0;
+
+    // A slot taken from free ring is kept until a frame is really captured into it
+    size_t slot = 0;
+    bool haveSlot = false;
+
+    while (p->_running.load(std::memory_order_relaxed)) {
+        if (!haveSlot) {
+            const size_t available = p->_free->Count();
+            haveSlot = p->_free->Pop(slot);
+            if (haveSlot) {
+                p->_queueSum[stage].fetch_add(available, std::memory_order_relaxed);
+                p->_queueSamples[stage].fetch_add(1, std::memory_order_relaxed);
+            }
+            else if (p->_config.Overflow == PipelineOverflow::Block) {
+                // Backpressure: source will not be read until a slot is free
+                PipelineIdle(spins);
+                continue;
+            }
+        }
+
+        // Without a slot (drop policy) the frame is read anyway in the scratch slot, then discarded
+        PipelineFrame& frame = haveSlot ? *p->_frames->at(slot).get() : scratch;
+
+        const uint64_t start = esp_timer_get_time();
+        frame.CaptureTime = start;
+        if (!p->_capture(frame, p->_context)) {
+            // No frame ready from source
+            PipelineIdle(spins);
+            continue;
+        }
+        p->_busy[stage].fetch_add(esp_timer_get_time() - start, std::memory_order_relaxed);
+        spins = 0;
+
+        frame.Sequence = sequence++;
+        p->_captured.fetch_add(1, std::memory_order_relaxed);
+
+        if (haveSlot) {
+            p->_ready->Push(slot);
+            haveSlot = false;
+        }
+        else {
+            p->_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    StreamingPipeline::ExitTask(p, PipelineStage::Capture);
+}
+
+void StreamingPipeline::InferenceTask(void* pipeline) {
+    auto p = static_cast<StreamingPipeline*>(pipeline);
+    const int stage = static_cast<int>(PipelineStage::Inference);
+    uint32_t spins = 0;
+    size_t slot;
+
+    while (p->_running.load(std::memory_order_relaxed)) {
+        const size_t waiting = p->_ready->Count();
+        if (!p->_ready->Pop(slot)) {
+            PipelineIdle(spins);
+            continue;
+        }
+        spins = 0;
+        p->_queueSum[stage].fetch_add(waiting, std::memory_order_relaxed);
+        p->_queueSamples[stage].fetch_add(1, std::memory_order_relaxed);
+
+        const uint64_t start = esp_timer_get_time();
+        p->_inference(*p->_frames->at(slot).get(), p->_context);
+        p->_busy[stage].fetch_add(esp_timer_get_time() - start, std::memory_order_relaxed);
+
+        p->_done->Push(slot);
+    }
+
+    StreamingPipeline::ExitTask(p, PipelineStage::Inference);
+}
+
+void StreamingPipeline::PostProcessTask(void* pipeline) {
+    auto p = static_cast<StreamingPipeline*>(pipeline);
+    const int stage = static_cast<int>(PipelineStage::PostProcess);
+    uint32_t spins = 0;
+    size_t slot;
+
+    while (p->_running.load(std::memory_order_relaxed)) {
+        const size_t waiting = p->_done->Count();
+        if (!p->_done->Pop(slot)) {
+            PipelineIdle(spins);
+            continue;
+        }
+        spins = 0;
+        p->_queueSum[stage].fetch_add(waiting, std::memory_order_relaxed);
+        p->_queueSamples[stage].fetch_add(1, std::memory_order_relaxed);
+
+        PipelineFrame& frame = *p->_frames->at(slot).get();
+
+        const uint64_t start = esp_timer_get_time();
+        p->_postProcess(frame, p->_context);
+        const uint64_t end = esp_timer_get_time();
+        p->_busy[stage].fetch_add(end - start, std::memory_order_relaxed);
+
+        // End-to-end latency (this task is the only writer)
+        const uint64_t latency = end - frame.CaptureTime;
+        p->_latencySum.fetch_add(latency, std::memory_order_relaxed);
+        if (latency < p->_latencyMin.load(std::memory_order_relaxed)) p->_latencyMin.store(latency, std::memory_order_relaxed);
+        if (latency > p->_latencyMax.load(std::memory_order_relaxed)) p->_latencyMax.store(latency, std::memory_order_relaxed);
+        p->_completed.fetch_add(1, std::memory_order_relaxed);
+
+        // Give back the slot to capture stage
+        p->_free->Push(slot);
+    }
+
+    StreamingPipeline::ExitTask(p, PipelineStage::PostProcess);
+}
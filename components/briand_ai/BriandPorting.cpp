@@ -18,33 +18,45 @@
 
     #include "BriandInclude.hxx"
 
+	#if defined(__linux__)
+		#include <sys/mman.h>
+	#endif
+
 	const char *esp_err_to_name(esp_err_t code) {
 		return "UNDEFINED ON LINUX PLATFORM";
 	}
 
-	unique_ptr<map<string, esp_log_level_t>> LOG_LEVELS_MAP;
+	unique_ptr<map<string, esp_log_level_t, std::less<>>> LOG_LEVELS_MAP;
+	std::atomic<int> LOG_MAX_LEVEL(ESP_LOG_NONE);
+
+	// Tasks log concurrently: the map is locked, lookups do not build strings and never insert
+	static std::mutex LOG_LEVELS_LOCK;
+	static esp_log_level_t LOG_DEFAULT_LEVEL = ESP_LOG_NONE;
 	
 	void esp_log_level_set(const char* tag, esp_log_level_t level) {
-		// If wildcard, all to level.
+		std::lock_guard<std::mutex> lock(LOG_LEVELS_LOCK);
+
+		// If wildcard, all to level (and the default of tags never set).
 		if (strcmp(tag, "*") == 0) {
 			for (auto it = LOG_LEVELS_MAP->begin(); it != LOG_LEVELS_MAP->end(); ++it) {
 				it->second = level;
 			}
+			LOG_DEFAULT_LEVEL = level;
 		}
 		else {
 			(*LOG_LEVELS_MAP.get())[string(tag)] = level;
 		}
+
+		int highest = LOG_DEFAULT_LEVEL;
+		for (const auto& it : *LOG_LEVELS_MAP.get()) highest = max<int>(highest, it.second);
+		LOG_MAX_LEVEL = highest;
 	}
 
 	esp_log_level_t esp_log_level_get(const char* tag) {
-		auto it = LOG_LEVELS_MAP->find(string(tag));
-		
-		if (it == LOG_LEVELS_MAP->end()) {
-			// Create
-			(*LOG_LEVELS_MAP.get())[string(tag)] = ESP_LOG_NONE;
-		}
-		
-		return (*LOG_LEVELS_MAP.get())[string(tag)];
+		std::lock_guard<std::mutex> lock(LOG_LEVELS_LOCK);
+
+		auto it = LOG_LEVELS_MAP->find(tag);
+		return (it != LOG_LEVELS_MAP->end() ? it->second : LOG_DEFAULT_LEVEL);
 	}
 
 	void ESP_ERROR_CHECK(esp_err_t e) { /* do nothing */ }
@@ -57,12 +69,240 @@
 		info->total_allocated_bytes = 0;
 	}
 
-	void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t* info) { info->freq_mhz = 240; }
-	void rtc_clk_cpu_freq_mhz_to_config(uint32_t mhz, rtc_cpu_freq_config_t* out) { out->freq_mhz = mhz; }
-	void rtc_clk_cpu_freq_set_config(rtc_cpu_freq_config_t* info) { /* do nothing */ }
+	// Simulated CPU frequency: the host is taken as an ESP32 at 240 MHz
+	static std::atomic<uint32_t> SIMULATED_CPU_MHZ(240);
+
+	void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t* info) { info->freq_mhz = SIMULATED_CPU_MHZ; }
+
+	bool rtc_clk_cpu_freq_mhz_to_config(uint32_t mhz, rtc_cpu_freq_config_t* out) {
+		// ESP32 frequencies (PLL and XTAL derived)
+		if (mhz != 240 && mhz != 160 && mhz != 80 && mhz != 40 && mhz != 20 && mhz != 10) return false;
+		out->freq_mhz = mhz;
+		return true;
+	}
+
+	void rtc_clk_cpu_freq_set_config(const rtc_cpu_freq_config_t* info) { SIMULATED_CPU_MHZ = static_cast<uint32_t>(info->freq_mhz); }
+
+	void briand_porting_cpu_stretch(uint64_t start) {
+		const uint32_t mhz = SIMULATED_CPU_MHZ;
+		if (mhz >= 240) return;
+
+		// Work done since start would take 240 / MHz times longer: busy wait the difference like a slower CPU
+		const uint64_t now = esp_timer_get_time();
+		const uint64_t until = start + (now - start) * 240 / mhz;
+		while (esp_timer_get_time() < until) { /* busy wait */ }
+	}
 
 	size_t heap_caps_get_largest_free_block(uint32_t caps) { return 0; }
 
+	/** Simulated memory tiers: size of each block and its tier */
+	static std::unordered_map<const void*, pair<size_t, bool>> HEAP_CAPS_BLOCKS;
+	static std::mutex HEAP_CAPS_MUTEX;
+	static size_t HEAP_CAPS_SIZE[2] = { 0, 0 };	// internal (0 = unlimited), spiram (0 = none)
+	static size_t HEAP_CAPS_USED[2] = { 0, 0 };
+
+	void briand_porting_heap_caps_simulate(size_t internalBytes, size_t spiramBytes) {
+		std::lock_guard<std::mutex> lock(HEAP_CAPS_MUTEX);
+		HEAP_CAPS_SIZE[0] = internalBytes;
+		HEAP_CAPS_SIZE[1] = spiramBytes;
+	}
+
+	void* heap_caps_malloc(size_t size, uint32_t caps) {
+		std::lock_guard<std::mutex> lock(HEAP_CAPS_MUTEX);
+
+		const uint8_t tier = ((caps & MALLOC_CAP_SPIRAM) ? 1 : 0);
+		if (tier == 1 && HEAP_CAPS_SIZE[1] == 0) return nullptr;
+		if (HEAP_CAPS_SIZE[tier] > 0 && HEAP_CAPS_USED[tier] + size > HEAP_CAPS_SIZE[tier]) return nullptr;
+
+		void* ptr = malloc(size > 0 ? size : 1);
+		if (ptr == nullptr) return nullptr;
+
+		HEAP_CAPS_BLOCKS[ptr] = make_pair(size, tier == 1);
+		HEAP_CAPS_USED[tier] += size;
+		return ptr;
+	}
+
+	void heap_caps_free(void* ptr) {
+		if (ptr == nullptr) return;
+
+		std::lock_guard<std::mutex> lock(HEAP_CAPS_MUTEX);
+		auto it = HEAP_CAPS_BLOCKS.find(ptr);
+		if (it != HEAP_CAPS_BLOCKS.end()) {
+			HEAP_CAPS_USED[it->second.second ? 1 : 0] -= it->second.first;
+			HEAP_CAPS_BLOCKS.erase(it);
+		}
+
+		free(ptr);
+	}
+
+	size_t heap_caps_get_total_size(uint32_t caps) {
+		std::lock_guard<std::mutex> lock(HEAP_CAPS_MUTEX);
+		return HEAP_CAPS_SIZE[(caps & MALLOC_CAP_SPIRAM) ? 1 : 0];
+	}
+
+	size_t heap_caps_get_free_size(uint32_t caps) {
+		std::lock_guard<std::mutex> lock(HEAP_CAPS_MUTEX);
+		const uint8_t tier = ((caps & MALLOC_CAP_SPIRAM) ? 1 : 0);
+		return (HEAP_CAPS_SIZE[tier] > HEAP_CAPS_USED[tier] ? HEAP_CAPS_SIZE[tier] - HEAP_CAPS_USED[tier] : 0);
+	}
+
+	bool esp_ptr_external_ram(const void* p) {
+		std::lock_guard<std::mutex> lock(HEAP_CAPS_MUTEX);
+		auto it = HEAP_CAPS_BLOCKS.find(p);
+		return (it != HEAP_CAPS_BLOCKS.end() && it->second.second);
+	}
+
+	/** Simulated partition: temporary file and read speed */
+	class BriandPortingPartition {
+		public:
+		esp_partition_t partition;
+		FILE* file;
+		size_t readBytesPerSecond;
+	};
+
+	static unique_ptr<vector<unique_ptr<BriandPortingPartition>>> PARTITIONS = nullptr;
+	static std::mutex PARTITIONS_MUTEX;
+
+	static BriandPortingPartition* briand_porting_partition_of(const esp_partition_t* partition) {
+		if (PARTITIONS == nullptr || partition == nullptr) return nullptr;
+		for (auto& p : *PARTITIONS.get()) if (&p->partition == partition) return p.get();
+		return nullptr;
+	}
+
+	void briand_porting_partition_simulate(const char* label, size_t size, size_t readBytesPerSecond) {
+		std::lock_guard<std::mutex> lock(PARTITIONS_MUTEX);
+		if (PARTITIONS == nullptr) PARTITIONS = make_unique<vector<unique_ptr<BriandPortingPartition>>>();
+
+		auto p = make_unique<BriandPortingPartition>();
+		bzero(&p->partition, sizeof(esp_partition_t));
+		p->partition.type = ESP_PARTITION_TYPE_DATA;
+		p->partition.subtype = ESP_PARTITION_SUBTYPE_DATA_UNDEFINED;
+		p->partition.size = static_cast<uint32_t>(size);
+		p->partition.erase_size = 4096;
+		strncpy(p->partition.label, label, 16);
+		p->readBytesPerSecond = readBytesPerSecond;
+
+		// Erased flash is all 0xFF
+		p->file = tmpfile();
+		if (p->file == nullptr) return;
+		vector<uint8_t> erased(4096, 0xFF);
+		for (size_t written = 0; written < size; written += erased.size()) fwrite(erased.data(), 1, std::min(erased.size(), size - written), p->file);
+
+		PARTITIONS->push_back(std::move(p));
+	}
+
+	const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label) {
+		std::lock_guard<std::mutex> lock(PARTITIONS_MUTEX);
+		if (PARTITIONS == nullptr) return nullptr;
+
+		for (auto& p : *PARTITIONS.get()) {
+			if (type != ESP_PARTITION_TYPE_ANY && p->partition.type != type) continue;
+			if (subtype != ESP_PARTITION_SUBTYPE_ANY && p->partition.subtype != subtype) continue;
+			if (label != nullptr && strcmp(label, p->partition.label) != 0) continue;
+			return &p->partition;
+		}
+
+		return nullptr;
+	}
+
+	esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+		const long start = static_cast<long>(esp_timer_get_time());
+		size_t speed = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(PARTITIONS_MUTEX);
+			auto p = briand_porting_partition_of(partition);
+			if (p == nullptr || dst == nullptr) return ESP_ERR_INVALID_ARG;
+			if (src_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+			fseek(p->file, static_cast<long>(src_offset), SEEK_SET);
+			if (fread(dst, 1, size, p->file) != size) return ESP_FAIL;
+			speed = p->readBytesPerSecond;
+		}
+
+		// Flash read speed: the calling task is blocked like on a SPI transaction
+		if (speed > 0) {
+			const long end = start + static_cast<long>(static_cast<double>(size) * 1000000.0 / static_cast<double>(speed));
+			const long now = static_cast<long>(esp_timer_get_time());
+			if (end > now) std::this_thread::sleep_for(std::chrono::microseconds(end - now));
+		}
+
+		return ESP_OK;
+	}
+
+	esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+		std::lock_guard<std::mutex> lock(PARTITIONS_MUTEX);
+		auto p = briand_porting_partition_of(partition);
+		if (p == nullptr || src == nullptr) return ESP_ERR_INVALID_ARG;
+		if (dst_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+		fseek(p->file, static_cast<long>(dst_offset), SEEK_SET);
+		return (fwrite(src, 1, size, p->file) == size ? ESP_OK : ESP_FAIL);
+	}
+
+	esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+		std::lock_guard<std::mutex> lock(PARTITIONS_MUTEX);
+		auto p = briand_porting_partition_of(partition);
+		if (p == nullptr) return ESP_ERR_INVALID_ARG;
+		if (offset % partition->erase_size != 0 || size % partition->erase_size != 0 || offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+		vector<uint8_t> erased(partition->erase_size, 0xFF);
+		fseek(p->file, static_cast<long>(offset), SEEK_SET);
+		for (size_t done = 0; done < size; done += erased.size()) fwrite(erased.data(), 1, erased.size(), p->file);
+		return ESP_OK;
+	}
+
+	/** Partition mappings: address and length of each handle */
+	static unique_ptr<map<esp_partition_mmap_handle_t, pair<void*, size_t>>> MAPPINGS = nullptr;
+	static esp_partition_mmap_handle_t MAPPINGS_NEXT = 1;
+
+	esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, esp_partition_mmap_memory_t memory, const void** out_ptr, esp_partition_mmap_handle_t* out_handle) {
+		std::lock_guard<std::mutex> lock(PARTITIONS_MUTEX);
+		auto p = briand_porting_partition_of(partition);
+		if (p == nullptr || out_ptr == nullptr || out_handle == nullptr || size == 0) return ESP_ERR_INVALID_ARG;
+		if (offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+		if (MAPPINGS == nullptr) MAPPINGS = make_unique<map<esp_partition_mmap_handle_t, pair<void*, size_t>>>();
+		fflush(p->file);
+
+	#if defined(__linux__)
+		// Mappings start at a page boundary (on ESP at a MMU page boundary)
+		const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		const size_t base = offset - offset % page;
+		void* address = mmap(nullptr, size + offset - base, PROT_READ, MAP_SHARED, fileno(p->file), static_cast<off_t>(base));
+		if (address == MAP_FAILED) return ESP_FAIL;
+		*out_ptr = static_cast<const uint8_t*>(address) + (offset - base);
+		(*MAPPINGS.get())[MAPPINGS_NEXT] = make_pair(address, size + offset - base);
+	#else
+		// No mmap: a copy
+		void* address = malloc(size);
+		if (address == nullptr) return ESP_ERR_NO_MEM;
+		fseek(p->file, static_cast<long>(offset), SEEK_SET);
+		if (fread(address, 1, size, p->file) != size) {
+			free(address);
+			return ESP_FAIL;
+		}
+		*out_ptr = address;
+		(*MAPPINGS.get())[MAPPINGS_NEXT] = make_pair(address, size);
+	#endif
+
+		*out_handle = MAPPINGS_NEXT++;
+		return ESP_OK;
+	}
+
+	void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+		std::lock_guard<std::mutex> lock(PARTITIONS_MUTEX);
+		if (MAPPINGS == nullptr) return;
+		auto it = MAPPINGS->find(handle);
+		if (it == MAPPINGS->end()) return;
+
+	#if defined(__linux__)
+		munmap(it->second.first, it->second.second);
+	#else
+		free(it->second.first);
+	#endif
+		MAPPINGS->erase(it);
+	}
+
 	BriandIDFPortingTaskHandle::BriandIDFPortingTaskHandle(const std::thread::native_handle_type& h, const char* name, const std::thread::id& tid) {
 		this->handle = h;
 		this->name = string(name);
@@ -75,6 +315,7 @@
 	}
 
 	unique_ptr<vector<TaskHandle_t>> BRIAND_TASK_POOL = nullptr;
+	std::mutex BRIAND_TASK_POOL_MUTEX; // tasks may be created/deleted by other tasks while main() checks the pool
 
 	TickType_t CTRL_C_MAX_WAIT = 0; // this is useful max waiting time before killing thread (see main()) 
 
@@ -100,6 +341,9 @@
 	{
 		// do not worry for prioriry and task depth now...
 
+		// Lock before starting the thread: if the task calls vTaskDelete(NULL) immediately it must find itself in the pool
+		std::lock_guard<std::mutex> lock(BRIAND_TASK_POOL_MUTEX);
+
 		std::thread t(pvTaskCode, pvParameters);
 		TaskHandle_t tHandle = new BriandIDFPortingTaskHandle(t.native_handle(), pcName, t.get_id());
 
@@ -115,6 +359,19 @@
 		return static_cast<BaseType_t>(BRIAND_TASK_POOL->size()-1); // task index
 	}
 
+	BaseType_t xTaskCreatePinnedToCore(
+			TaskFunction_t pvTaskCode,
+			const char * const pcName,
+			const uint32_t usStackDepth,
+			void * const pvParameters,
+			UBaseType_t uxPriority,
+			TaskHandle_t * const pvCreatedTask,
+			const BaseType_t xCoreID)
+	{
+		// Core affinity is left to the o.s. scheduler
+		return xTaskCreate(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask);
+	}
+
 	void vTaskDelete(TaskHandle_t handle) {
 		std::thread::id idToKill;
 
@@ -126,6 +383,8 @@
 			idToKill = handle->thread_id;
 		}
 
+		std::lock_guard<std::mutex> lock(BRIAND_TASK_POOL_MUTEX);
+
 		if (BRIAND_TASK_POOL != nullptr) {
 			for (int i = 0; i<BRIAND_TASK_POOL->size(); i++) {
 				if (BRIAND_TASK_POOL->at(i)->thread_id == idToKill) {
@@ -163,7 +422,8 @@
 	esp_err_t nvs_flash_init(void) { return ESP_OK; }
 	esp_err_t nvs_flash_erase(void) { return ESP_OK; }
 	unsigned int esp_random() {
-		return static_cast<unsigned int>(rand());
+		// Like the ESP hardware RNG: full 32 bit range (rand() gives only 0..RAND_MAX)
+		return (static_cast<unsigned int>(rand() & 0xFFFF) << 16) | static_cast<unsigned int>(rand() & 0xFFFF);
 	}
 
 	esp_pthread_cfg_t esp_pthread_get_default_config(void) {
@@ -206,7 +466,7 @@
 		srand(time(NULL));
 
 		// Initialization
-		LOG_LEVELS_MAP = make_unique<map<string, esp_log_level_t>>();
+		LOG_LEVELS_MAP = make_unique<map<string, esp_log_level_t, std::less<>>>();
 
 		// Add this to the logging utils in order to deactivate output if necessary
 		esp_log_level_set("ESPLinuxPorting", ESP_LOG_NONE);
@@ -233,6 +493,7 @@
 
 		while(!CTRL_C_EVENT_SET) { 
 			// Check if any instanced thread should be terminated
+			BRIAND_TASK_POOL_MUTEX.lock();
 			for (int i=0; i<BRIAND_TASK_POOL->size(); i++) {
 				if (BRIAND_TASK_POOL->at(i)->toBeKilled) {
 					string tname = BRIAND_TASK_POOL->at(i)->name;
@@ -242,6 +503,7 @@
 					if (esp_log_level_get("ESPLinuxPorting") != ESP_LOG_NONE) cout << "Thread #" << i << "(" << tname << ") killed" << endl;
 				}
 			}
+			BRIAND_TASK_POOL_MUTEX.unlock();
 				
 			std::this_thread::sleep_for( std::chrono::milliseconds(500) ); 
 		}
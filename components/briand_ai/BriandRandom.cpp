@@ -0,0 +1,234 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandRandom.hxx"
+#include "BriandMatrix.hxx"
+
+using namespace std;
+using namespace Briand;
+
+/// @brief Philox4x32 round multipliers and key increments (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3")
+#define BRIAND_PHILOX_M0 0xD2511F53U
+#define BRIAND_PHILOX_M1 0xCD9E8D57U
+#define BRIAND_PHILOX_W0 0x9E3779B9U
+#define BRIAND_PHILOX_W1 0xBB67AE85U
+#define BRIAND_PHILOX_ROUNDS 10
+
+/// @brief Default generator
+static unique_ptr<Philox> DEFAULT_GENERATOR = nullptr;
+static std::mutex DEFAULT_GENERATOR_LOCK;
+
+/// @brief Uniform double in [0, 1) from two 32 bit numbers (53 bits)
+static inline double ToUniform(const uint32_t& a, const uint32_t& b) {
+    return (static_cast<double>(a >> 5) * 67108864.0 + static_cast<double>(b >> 6)) * (1.0 / 9007199254740992.0);
+}
+
+Philox::Philox(const uint64_t& seed, const uint64_t& stream /*= 0*/) {
+    this->_stream = stream;
+    this->Seed(seed);
+}
+
+void Philox::Block(const uint64_t& seed, const uint64_t& stream, const uint64_t& counter, uint32_t out[4]) {
+    uint32_t c0 = static_cast<uint32_t>(counter);
+    uint32_t c1 = static_cast<uint32_t>(counter >> 32);
+    uint32_t c2 = static_cast<uint32_t>(stream);
+    uint32_t c3 = static_cast<uint32_t>(stream >> 32);
+    uint32_t k0 = static_cast<uint32_t>(seed);
+    uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+
+    // Only 32x32->64 multiplications, xor and adds: cheap on Xtensa too
+    for (uint8_t r = 0; r < BRIAND_PHILOX_ROUNDS; r++) {
+        const uint64_t p0 = static_cast<uint64_t>(BRIAND_PHILOX_M0) * c0;
+        const uint64_t p1 = static_cast<uint64_t>(BRIAND_PHILOX_M1) * c2;
+        const uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+        const uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+        c1 = static_cast<uint32_t>(p1);
+        c3 = static_cast<uint32_t>(p0);
+        c0 = n0;
+        c2 = n2;
+        k0 += BRIAND_PHILOX_W0;
+        k1 += BRIAND_PHILOX_W1;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+void Philox::Seed(const uint64_t& seed) {
+    this->_seed = seed;
+    this->_counter = 0;
+    this->_used = 4;
+    this->_spare = 0.0;
+    this->_hasSpare = false;
+}
+
+const uint64_t& Philox::GetSeed() const {
+    return this->_seed;
+}
+
+uint32_t Philox::NextUInt32() {
+    if (this->_used >= 4) {
+        Philox::Block(this->_seed, this->_stream, this->_counter++, this->_buffer);
+        this->_used = 0;
+    }
+
+    return this->_buffer[this->_used++];
+}
+
+double Philox::NextUniform() {
+    const uint32_t a = this->NextUInt32();
+    const uint32_t b = this->NextUInt32();
+    return ToUniform(a, b);
+}
+
+double Philox::NextNormal() {
+    if (this->_hasSpare) {
+        this->_hasSpare = false;
+        return this->_spare;
+    }
+
+    // Box-Muller: 1 - u is in (0, 1] so log() is finite
+    const double r = sqrt(-2.0 * log(1.0 - this->NextUniform()));
+    const double theta = 2.0 * M_PI * this->NextUniform();
+    this->_spare = r * sin(theta);
+    this->_hasSpare = true;
+
+    return r * cos(theta);
+}
+
+void Philox::FillAt(double* out, const size_t& n, const uint64_t& first, const bool& normal, const double& a, const double& b) const {
+    uint32_t x[4];
+    size_t i = 0;
+
+    // Elements 2k and 2k+1 come from block first+k, whatever the range start is
+    while (i < n) {
+        Philox::Block(this->_seed, this->_stream, first + i / 2, x);
+
+        const double u1 = ToUniform(x[0], x[1]);
+        const double u2 = ToUniform(x[2], x[3]);
+        double v0, v1;
+
+        if (normal) {
+            const double r = sqrt(-2.0 * log(1.0 - u1));
+            const double theta = 2.0 * M_PI * u2;
+            v0 = a + b * r * cos(theta);
+            v1 = a + b * r * sin(theta);
+        }
+        else {
+            v0 = a + (b - a) * u1;
+            v1 = a + (b - a) * u2;
+        }
+
+        // A range may start on an odd element
+        if (i % 2 == 0) out[i++] = v0;
+        if (i < n) out[i++] = v1;
+    }
+}
+
+void Philox::FillUniform(vector<double>& out, const double& low /*= 0.0*/, const double& high /*= 1.0*/) {
+    this->FillAt(out.data(), out.size(), this->_counter, false, low, high);
+    this->_counter += (out.size() + 1) / 2;
+}
+
+void Philox::FillNormal(vector<double>& out, const double& mean /*= 0.0*/, const double& stddev /*= 1.0*/) {
+    this->FillAt(out.data(), out.size(), this->_counter, true, mean, stddev);
+    this->_counter += (out.size() + 1) / 2;
+}
+
+void Philox::FillMatrix(Matrix& m, const bool& normal, const double& a, const double& b) {
+    const size_t cols = m.Cols();
+    const uint64_t first = this->_counter;
+
+    // Element (i,j) is number i*cols+j of the fill: row blocks can run on any thread
+    Matrix::ForRows(m.Rows(), m.Rows() * cols * 8, [this, &m, cols, first, normal, a, b](const size_t& begin, const size_t& end) {
+        for (size_t i = begin; i < end; i++) {
+            const size_t start = i * cols;
+            if (start % 2 == 0) {
+                this->FillAt(m[i], cols, first + start / 2, normal, a, b);
+            }
+            else {
+                // Odd start: first element is the second number of its block
+                double pair[2];
+                this->FillAt(pair, 2, first + start / 2, normal, a, b);
+                m[i][0] = pair[1];
+                if (cols > 1) this->FillAt(m[i] + 1, cols - 1, first + (start + 1) / 2, normal, a, b);
+            }
+        }
+    });
+
+    this->_counter += (m.Rows() * cols + 1) / 2;
+}
+
+void Philox::FillUniform(Matrix& m, const double& low /*= 0.0*/, const double& high /*= 1.0*/) {
+    this->FillMatrix(m, false, low, high);
+}
+
+void Philox::FillNormal(Matrix& m, const double& mean /*= 0.0*/, const double& stddev /*= 1.0*/) {
+    this->FillMatrix(m, true, mean, stddev);
+}
+
+void Philox::Initialize(Matrix& weights, const WeightInitializer& initializer) {
+    this->Initialize(weights, initializer, nullptr);
+}
+
+void Philox::Initialize(Matrix& weights, const WeightInitializer& initializer, const ActivationFunction& activation) {
+    const double fanIn = static_cast<double>(weights.Cols() > 0 ? weights.Cols() : 1);
+    const double fanOut = static_cast<double>(weights.Rows() > 0 ? weights.Rows() : 1);
+
+    WeightInitializer scheme = initializer;
+    if (scheme == WeightInitializer::Auto) scheme = (activation == Math::ReLU ? WeightInitializer::He : WeightInitializer::Xavier);
+
+    switch (scheme) {
+        case WeightInitializer::Xavier: {
+            const double limit = sqrt(6.0 / (fanIn + fanOut));
+            this->FillUniform(weights, -limit, limit);
+            break;
+        }
+        case WeightInitializer::He:
+            this->FillNormal(weights, 0.0, sqrt(2.0 / fanIn));
+            break;
+        case WeightInitializer::LeCun:
+            this->FillNormal(weights, 0.0, sqrt(1.0 / fanIn));
+            break;
+        default:
+            this->FillUniform(weights, 0.0, 1.0);
+            break;
+    }
+}
+
+Philox& Philox::Default() {
+    std::lock_guard<std::mutex> lock(DEFAULT_GENERATOR_LOCK);
+
+    if (DEFAULT_GENERATOR == nullptr) {
+        const uint64_t seed = (static_cast<uint64_t>(esp_random()) << 32) | static_cast<uint64_t>(esp_random());
+        DEFAULT_GENERATOR = make_unique<Philox>(seed);
+    }
+
+    return *DEFAULT_GENERATOR.get();
+}
+
+std::mutex& Philox::DefaultLock() {
+    static std::mutex lock;
+    return lock;
+}
+
+void Philox::SetDefaultSeed(const uint64_t& seed) {
+    Philox& generator = Philox::Default();
+    std::lock_guard<std::mutex> lock(Philox::DefaultLock());
+    generator.Seed(seed);
+}
@@ -0,0 +1,278 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandScheduler.hxx"
+
+using namespace std;
+using namespace Briand;
+
+vector<CpuOperatingPoint> DeadlineScheduler::Esp32Points() {
+    // Datasheet modem-sleep currents (dual core, max while running, min while idle) x 3.3V
+    return {
+        { 80, 31.0 * 3.3, 20.0 * 3.3 },
+        { 160, 44.0 * 3.3, 27.0 * 3.3 },
+        { 240, 68.0 * 3.3, 30.0 * 3.3 }
+    };
+}
+
+DeadlineScheduler::DeadlineScheduler(const vector<CpuOperatingPoint>& points, const std::function<void(const ScheduledInference&)>& completed) {
+    // Check
+    if (points.size() == 0) throw runtime_error("Deadline scheduler: no operating points.");
+
+    this->_points = make_unique<vector<CpuOperatingPoint>>(points);
+    std::sort(this->_points->begin(), this->_points->end(), [](const CpuOperatingPoint& a, const CpuOperatingPoint& b) { return a.Mhz < b.Mhz; });
+    for (const auto& p : *this->_points.get()) {
+        rtc_cpu_freq_config_t config;
+        if (p.Mhz == 0 || !rtc_clk_cpu_freq_mhz_to_config(p.Mhz, &config)) throw out_of_range("Deadline scheduler: unsupported frequency " + to_string(p.Mhz) + " MHz.");
+    }
+
+    this->_models = make_unique<vector<Model>>();
+    this->_queue = make_unique<std::deque<Request>>();
+    this->_completed = completed;
+    this->_ticket = 1;
+    this->_stop = false;
+
+    this->_statistics.Completed = 0;
+    this->_statistics.Missed = 0;
+    this->_statistics.Failed = 0;
+    this->_statistics.Switches = 0;
+    this->_statistics.ActiveMillijoules = 0.0;
+    this->_statistics.IdleMillijoules = 0.0;
+    this->_statistics.ActiveUs.assign(this->_points->size(), 0);
+
+    rtc_cpu_freq_config_t initial;
+    rtc_clk_cpu_freq_get_config(&initial);
+    this->_initialMhz = static_cast<uint32_t>(initial.freq_mhz);
+
+    // Start idle at the lowest point
+    const int64_t now = esp_timer_get_time();
+    this->_lastEvent = now;
+    this->_lastFinished = now;
+    this->_running = false;
+    this->_completing = false;
+    this->_current = this->_points->size();
+    this->SetPoint(0, now);
+    this->_statistics.Switches = 0;
+
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.thread_name = "BriandDeadline";
+    esp_pthread_set_cfg(&cfg);
+    this->_thread = std::thread(&DeadlineScheduler::Loop, this);
+    esp_pthread_cfg_t defaults = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&defaults);
+}
+
+DeadlineScheduler::~DeadlineScheduler() {
+    this->Wait();
+
+    {
+        std::lock_guard<std::mutex> lock(this->_lock);
+        this->_stop = true;
+    }
+    this->_signal.notify_all();
+    if (this->_thread.joinable()) this->_thread.join();
+
+    rtc_cpu_freq_config_t config;
+    if (rtc_clk_cpu_freq_mhz_to_config(this->_initialMhz, &config)) rtc_clk_cpu_freq_set_config(&config);
+
+    this->_points.reset();
+    this->_models.reset();
+    this->_queue.reset();
+}
+
+size_t DeadlineScheduler::AddModel(CompiledFCNN& plan, const vector<double>& cycles) {
+    // Check
+    if (cycles.size() != plan.Kernels()) throw out_of_range("Deadline scheduler: one cycles value for each layer of the plan.");
+
+    Model model;
+    model.Plan = &plan;
+    model.Cycles = 0.0;
+    for (const auto& c : cycles) model.Cycles += c;
+
+    std::lock_guard<std::mutex> lock(this->_lock);
+    this->_models->push_back(model);
+    return this->_models->size() - 1;
+}
+
+uint64_t DeadlineScheduler::Submit(const size_t& model, const vector<double>& inputs, const int64_t& budgetUs) {
+    Request request;
+    request.Inputs = inputs;
+    request.Submitted = esp_timer_get_time();
+    request.Deadline = request.Submitted + budgetUs;
+    request.Model = model;
+
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(this->_lock);
+        if (model >= this->_models->size()) throw out_of_range("Deadline scheduler: invalid model " + to_string(model));
+        if (inputs.size() != this->_models->at(model).Plan->Inputs()) throw out_of_range("Deadline scheduler: invalid inputs size.");
+        ticket = this->_ticket++;
+        request.Ticket = ticket;
+
+        // Earliest deadline first
+        auto at = std::upper_bound(this->_queue->begin(), this->_queue->end(), request.Deadline, [](const int64_t& d, const Request& r) { return d < r.Deadline; });
+        this->_queue->insert(at, std::move(request));
+    }
+    this->_signal.notify_all();
+
+    return ticket;
+}
+
+void DeadlineScheduler::Wait() {
+    std::unique_lock<std::mutex> lock(this->_lock);
+    this->_signal.wait(lock, [this] { return this->_queue->empty() && !this->_running && !this->_completing; });
+}
+
+uint32_t DeadlineScheduler::Mhz() {
+    std::lock_guard<std::mutex> lock(this->_lock);
+    return this->_points->at(this->_current).Mhz;
+}
+
+SchedulerStatistics DeadlineScheduler::Statistics() {
+    std::lock_guard<std::mutex> lock(this->_lock);
+    this->Account(esp_timer_get_time());
+    return this->_statistics;
+}
+
+void DeadlineScheduler::Print() {
+    const SchedulerStatistics s = this->Statistics();
+
+    printf("Deadline scheduler: %u completed, %u missed, %u failed, %u frequency changes, energy %.3lfmJ (running %.3lfmJ, idle %.3lfmJ)\n",
+        static_cast<unsigned int>(s.Completed), static_cast<unsigned int>(s.Missed), static_cast<unsigned int>(s.Failed), static_cast<unsigned int>(s.Switches),
+        s.ActiveMillijoules + s.IdleMillijoules, s.ActiveMillijoules, s.IdleMillijoules);
+    for (size_t p = 0; p < this->_points->size(); p++) {
+        printf("  %3u MHz: running %ldus\n", static_cast<unsigned int>(this->_points->at(p).Mhz), static_cast<long>(s.ActiveUs[p]));
+    }
+}
+
+void DeadlineScheduler::Account(const int64_t& now) {
+    const auto& point = this->_points->at(this->_current);
+    const int64_t elapsed = now - this->_lastEvent;
+    if (elapsed <= 0) return;
+
+    // mW x us = nJ
+    if (this->_running) {
+        this->_statistics.ActiveMillijoules += point.ActiveMilliwatts * static_cast<double>(elapsed) / 1000000.0;
+        this->_statistics.ActiveUs[this->_current] += elapsed;
+    }
+    else this->_statistics.IdleMillijoules += point.IdleMilliwatts * static_cast<double>(elapsed) / 1000000.0;
+
+    this->_lastEvent = now;
+}
+
+void DeadlineScheduler::SetPoint(const size_t& point, const int64_t& now) {
+    if (point == this->_current) return;
+
+    if (this->_current < this->_points->size()) this->Account(now);
+
+    rtc_cpu_freq_config_t config;
+    rtc_clk_cpu_freq_mhz_to_config(this->_points->at(point).Mhz, &config);
+    rtc_clk_cpu_freq_set_config(&config);
+
+    this->_current = point;
+    this->_statistics.Switches++;
+}
+
+size_t DeadlineScheduler::Choose(const int64_t& now) const {
+    // Lowest point where every queued request, run in deadline order, ends in time
+    for (size_t p = 0; p < this->_points->size(); p++) {
+        const double mhz = static_cast<double>(this->_points->at(p).Mhz);
+        double end = static_cast<double>(now + (p != this->_current ? this->SwitchUs : 0));
+        bool feasible = true;
+
+        for (const auto& r : *this->_queue.get()) {
+            end += this->_models->at(r.Model).Cycles * this->Margin / mhz;
+            if (end > static_cast<double>(r.Deadline)) {
+                feasible = false;
+                break;
+            }
+        }
+
+        if (feasible) return p;
+    }
+
+    return this->_points->size() - 1;
+}
+
+void DeadlineScheduler::Loop() {
+    std::unique_lock<std::mutex> lock(this->_lock);
+
+    while (true) {
+        if (this->_queue->empty()) {
+            if (this->_stop) break;
+
+            // Idle: drop to the lowest point after IdleUs
+            const int64_t now = esp_timer_get_time();
+            const int64_t idle = now - this->_lastFinished;
+            if (this->_current != 0 && idle >= this->IdleUs) this->SetPoint(0, now);
+
+            if (this->_current != 0) this->_signal.wait_for(lock, std::chrono::microseconds(this->IdleUs - idle));
+            else this->_signal.wait(lock, [this] { return this->_stop || !this->_queue->empty(); });
+            continue;
+        }
+
+        const int64_t now = esp_timer_get_time();
+        this->SetPoint(this->Choose(now), now);
+
+        Request request = std::move(this->_queue->front());
+        this->_queue->pop_front();
+        const Model model = this->_models->at(request.Model);
+
+        ScheduledInference result;
+        result.Ticket = request.Ticket;
+        result.Model = request.Model;
+        result.Submitted = request.Submitted;
+        result.Deadline = request.Deadline;
+        result.Mhz = this->_points->at(this->_current).Mhz;
+
+        this->Account(now);
+        this->_running = true;
+        lock.unlock();
+
+        // A failed run (plan made stale by a network change) completes the request with the error, the worker goes on
+        result.Started = esp_timer_get_time();
+        try {
+            model.Plan->Forward(request.Inputs, result.Outputs);
+        }
+        catch (const exception& e) {
+            result.Outputs.clear();
+            result.Error = e.what();
+        }
+#if !defined(ESP_PLATFORM)
+        briand_porting_cpu_stretch(static_cast<uint64_t>(result.Started));
+#endif
+        result.Finished = esp_timer_get_time();
+        result.Missed = result.Finished > result.Deadline;
+
+        lock.lock();
+        this->Account(result.Finished);
+        this->_running = false;
+        this->_lastFinished = result.Finished;
+        this->_statistics.Completed++;
+        if (result.Missed) this->_statistics.Missed++;
+        if (!result.Error.empty()) this->_statistics.Failed++;
+
+        // Not running anymore (energy is accounted idle), but Wait() must not return before the callback did
+        if (this->_completed != nullptr) {
+            this->_completing = true;
+            lock.unlock();
+            this->_completed(result);
+            lock.lock();
+            this->_completing = false;
+        }
+        this->_signal.notify_all();
+    }
+}
@@ -0,0 +1,281 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandServer.hxx"
+
+using namespace std;
+using namespace Briand;
+
+InferenceServer::InferenceServer(const FCNN& network, const InferenceServerConfig& config) : _network(network) {
+    // Check
+    if (!network._hasOutputs || network._layers->size() < 2) throw runtime_error("Inference server: network is not complete.");
+    if (config.MaxBatch == 0) throw out_of_range("Inference server: MaxBatch must be > 0.");
+    if (config.MaxWaitUs < 0) throw out_of_range("Inference server: MaxWaitUs must be >= 0.");
+
+    size_t largest = 0;
+    for (size_t k = 0; k < network._layers->size(); k++) {
+        const auto& l = network._layers->at(k);
+        if (l->_batchNorm != nullptr) throw runtime_error("Inference server: batch normalization at layer " + to_string(k) + " must be folded first (FCNN::OptimizeForInference()).");
+        if (k > 0 && l->_weights == nullptr) throw runtime_error("Inference server: missing weights at layer " + to_string(k));
+        largest = max(largest, l->Neurons());
+    }
+
+    this->_config = config;
+    this->_queue = make_unique<MPSCRingBuffer<Request>>(config.QueueCapacity);
+    this->_batch = make_unique<vector<Request>>(config.MaxBatch);
+    for (auto& r : *this->_batch.get()) r.Inputs.reserve(network._layers->at(0)->Neurons());
+    this->_activations[0] = make_unique<vector<double>>(largest * config.MaxBatch, 0.0);
+    this->_activations[1] = make_unique<vector<double>>(largest * config.MaxBatch, 0.0);
+    this->_net = make_unique<vector<double>>(network._layers->back()->Neurons(), 0.0);
+    this->_probabilities = make_unique<vector<double>>(network._layers->back()->Neurons(), 0.0);
+
+    this->_statistics.Completed = 0;
+    this->_statistics.Rejected = 0;
+    this->_statistics.Batches = 0;
+    this->_statistics.LargestBatch = 0;
+    this->_rejected = 0;
+    this->_waiting = false;
+    this->_stop = false;
+
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.pin_to_core = config.Core % portNUM_PROCESSORS;
+    cfg.thread_name = "BriandServer";
+    esp_pthread_set_cfg(&cfg);
+    this->_thread = std::thread(&InferenceServer::Loop, this);
+    esp_pthread_cfg_t defaults = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&defaults);
+}
+
+InferenceServer::~InferenceServer() {
+    {
+        std::lock_guard<std::mutex> lock(this->_lock);
+        this->_stop = true;
+    }
+    this->_signal.notify_all();
+    if (this->_thread.joinable()) this->_thread.join();
+
+    this->_queue.reset();
+    this->_batch.reset();
+    this->_activations[0].reset();
+    this->_activations[1].reset();
+    this->_net.reset();
+    this->_probabilities.reset();
+}
+
+bool InferenceServer::Enqueue(Request& request) {
+    if (!this->_queue->Push(std::move(request))) return false;
+
+    // Either the worker sees the request before sleeping, or we see it waiting (fences on both sides)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->_waiting.load(std::memory_order_relaxed)) {
+        { std::lock_guard<std::mutex> lock(this->_lock); }
+        this->_signal.notify_one();
+    }
+
+    return true;
+}
+
+bool InferenceServer::Submit(const vector<double>& inputs, const std::function<void(const InferenceResult&)>& completed) {
+    // Check
+    if (inputs.size() != this->_network._layers->at(0)->Neurons()) throw out_of_range("Inference server: invalid inputs size.");
+
+    Request request;
+    request.Inputs = inputs;
+    request.Submitted = esp_timer_get_time();
+    request.Completed = completed;
+
+    if (this->Enqueue(request)) return true;
+
+    this->_rejected.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+std::future<InferenceResult> InferenceServer::Submit(const vector<double>& inputs) {
+    // Check
+    if (inputs.size() != this->_network._layers->at(0)->Neurons()) throw out_of_range("Inference server: invalid inputs size.");
+
+    Request request;
+    request.Inputs = inputs;
+    request.Submitted = esp_timer_get_time();
+    request.Promise = make_unique<std::promise<InferenceResult>>();
+    auto future = request.Promise->get_future();
+
+    // Backpressure: the request is moved only when queued
+    while (!this->Enqueue(request)) std::this_thread::yield();
+
+    return future;
+}
+
+size_t InferenceServer::Pending() const {
+    return this->_queue->Count();
+}
+
+InferenceServerStatistics InferenceServer::Statistics() {
+    std::lock_guard<std::mutex> lock(this->_lock);
+    InferenceServerStatistics s = this->_statistics;
+    s.Rejected = this->_rejected.load(std::memory_order_relaxed);
+    return s;
+}
+
+void InferenceServer::Print() {
+    const InferenceServerStatistics s = this->Statistics();
+
+    printf("Inference server: %u completed, %u rejected, %u batches (mean %.2lf requests, largest %u)\n",
+        static_cast<unsigned int>(s.Completed), static_cast<unsigned int>(s.Rejected), static_cast<unsigned int>(s.Batches),
+        s.Batches > 0 ? static_cast<double>(s.Completed) / static_cast<double>(s.Batches) : 0.0, static_cast<unsigned int>(s.LargestBatch));
+}
+
+void InferenceServer::Sleep(const int64_t& timeoutUs) {
+    std::unique_lock<std::mutex> lock(this->_lock);
+    this->_waiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (this->_queue->Count() == 0 && !this->_stop) {
+        if (timeoutUs < 0) this->_signal.wait(lock);
+        else if (timeoutUs > 0) this->_signal.wait_for(lock, std::chrono::microseconds(timeoutUs));
+    }
+
+    this->_waiting.store(false, std::memory_order_relaxed);
+}
+
+const double* InferenceServer::Forward(const size_t& requests) {
+    const auto& layers = *this->_network._layers.get();
+    const auto& batch = *this->_batch.get();
+    const size_t n = requests;
+
+    // Input layer (with bias if any), batch-innermost
+    const auto& input = layers[0];
+    const bool inputBias = (input->_bias_weights != nullptr && input->_bias_weights->size() > 0);
+    double* in = this->_activations[0]->data();
+    for (size_t c = 0; c < input->Neurons(); c++) {
+        const double bias = (inputBias ? input->_bias_weights->at(c) : 0.0);
+        for (size_t b = 0; b < n; b++) in[c * n + b] = batch[b].Inputs[c] + bias;
+    }
+
+    for (size_t k = 1; k < layers.size(); k++) {
+        const auto& l = layers[k];
+        const Matrix& w = *l->_weights.get();
+        const size_t rows = w.Rows();
+        const size_t cols = w.Cols();
+        double* out = this->_activations[k % 2]->data();
+
+        // Each weight is loaded once and applied to a tile of requests, accumulated in registers (inner loop over requests is contiguous)
+        for (size_t r = 0; r < rows; r++) {
+            double* z = out + r * n;
+            const double bias = (l->_bias_weights != nullptr ? l->_bias_weights->at(r) : 0.0);
+            const double* row = w[r];
+
+            size_t b = 0;
+            for (; b + 4 <= n; b += 4) {
+                double z0 = bias, z1 = bias, z2 = bias, z3 = bias;
+                const double* x = in + b;
+                for (size_t c = 0; c < cols; c++, x += n) {
+                    const double weight = row[c];
+                    z0 += weight * x[0];
+                    z1 += weight * x[1];
+                    z2 += weight * x[2];
+                    z3 += weight * x[3];
+                }
+                z[b] = z0;
+                z[b + 1] = z1;
+                z[b + 2] = z2;
+                z[b + 3] = z3;
+            }
+            for (; b < n; b++) {
+                double z0 = bias;
+                const double* x = in + b;
+                for (size_t c = 0; c < cols; c++, x += n) z0 += row[c] * x[0];
+                z[b] = z0;
+            }
+        }
+
+        // Activation
+        if (l->_softmax) {
+            auto& net = *this->_net.get();
+            auto& p = *this->_probabilities.get();
+            for (size_t b = 0; b < n; b++) {
+                for (size_t r = 0; r < rows; r++) net[r] = out[r * n + b];
+                Math::Softmax(net, p);
+                for (size_t r = 0; r < rows; r++) out[r * n + b] = p[r];
+            }
+        }
+        else {
+            for (size_t i = 0; i < rows * n; i++) out[i] = l->_f(out[i]);
+        }
+
+        in = out;
+    }
+
+    return in;
+}
+
+void InferenceServer::Loop() {
+    auto& batch = *this->_batch.get();
+    const size_t outputs = this->_network._layers->back()->Neurons();
+
+    InferenceResult result;
+    result.Outputs.resize(outputs);
+
+    while (true) {
+        // Collect: the first request, then more until the batch is full or MaxWaitUs after the first was submitted
+        size_t n = 0;
+        int64_t deadline = 0;
+        while (n < this->_config.MaxBatch) {
+            if (this->_queue->Pop(batch[n])) {
+                if (n == 0) deadline = batch[0].Submitted + this->_config.MaxWaitUs;
+                n++;
+                continue;
+            }
+
+            const int64_t now = esp_timer_get_time();
+            if (n > 0 && now >= deadline) break;
+
+            // Stopping: no more waits, run what is queued
+            bool stop;
+            {
+                std::lock_guard<std::mutex> lock(this->_lock);
+                stop = this->_stop;
+            }
+            if (stop && (n > 0 || this->_queue->Count() == 0)) break;
+
+            this->Sleep(n > 0 ? deadline - now : -1);
+        }
+        if (n == 0) break;
+
+        result.Started = esp_timer_get_time();
+        const double* out = this->Forward(n);
+        result.Finished = esp_timer_get_time();
+        result.Batch = n;
+
+        // Complete (the request slots are reused by next batches)
+        for (size_t b = 0; b < n; b++) {
+            auto& request = batch[b];
+            for (size_t r = 0; r < outputs; r++) result.Outputs[r] = out[r * n + b];
+            result.Submitted = request.Submitted;
+
+            if (request.Completed != nullptr) request.Completed(result);
+            if (request.Promise != nullptr) request.Promise->set_value(result);
+
+            request.Completed = nullptr;
+            request.Promise.reset();
+        }
+
+        std::lock_guard<std::mutex> lock(this->_lock);
+        this->_statistics.Completed += n;
+        this->_statistics.Batches++;
+        this->_statistics.LargestBatch = max(this->_statistics.LargestBatch, n);
+    }
+}
@@ -23,6 +23,8 @@ using namespace Briand::SimpleNN;
 
 Briand::SimpleNN::Neuron::Neuron() {
     this->Inputs = make_unique<vector<unique_ptr<Synapsis>>>();
+    this->Value = 0.0;
+    this->Id = 0;
 }
 
 Briand::SimpleNN::Neuron::Neuron(const double& value) : Neuron() {
@@ -79,6 +81,10 @@ void Briand::SimpleNN::NeuralLayer::UpdateNeurons() {
     }
 }
 
+Briand::ActivationFunction Briand::SimpleNN::NeuralLayer::Activation() const {
+    return this->_activationFunction;
+}
+
 Briand::SimpleNN::NeuralNetwork::NeuralNetwork() {
     // Do not do anything!
 }
@@ -106,6 +112,198 @@ void Briand::SimpleNN::NeuralNetwork::PropagateForward() {
     // After that output layer neurons will have the output value
 }
 
+unique_ptr<CompiledNetwork> Briand::SimpleNN::NeuralNetwork::Compile() const {
+    // Same checks of PropagateForward
+    if (this->InputLayer == nullptr || this->InputLayer->Neurons->size() == 0) throw runtime_error("Briand::NeuralNetwork::Compile - no inputs");
+    if (this->OutputLayer == nullptr || this->OutputLayer->Neurons->size() == 0) throw runtime_error("Briand::NeuralNetwork::Compile - no outputs");
+
+    // Layers updated by PropagateForward, in the same order
+    vector<const NeuralLayer*> layers;
+    if (this->HiddenLayers != nullptr) {
+        for (auto layer = this->HiddenLayers->begin(); layer != this->HiddenLayers->end(); layer++) layers.push_back(layer->get());
+    }
+    layers.push_back(this->OutputLayer.get());
+
+    // Compiled index of each front end neuron, and the other way round
+    unordered_map<const Neuron*, uint32_t> index;
+    vector<Neuron*> order;
+    auto addNeuron = [&index, &order](Neuron* n) {
+        if (index.find(n) != index.end()) return;
+        index[n] = static_cast<uint32_t>(order.size());
+        order.push_back(n);
+    };
+
+    // Neurons to compute: the ones with inputs in hidden/output layers (like UpdateValue does), with their layer activation
+    unordered_map<const Neuron*, ActivationFunction> computed;
+    vector<Neuron*> computedOrder;
+    for (const auto& layer : layers) {
+        for (auto neuron = layer->Neurons->begin(); neuron != layer->Neurons->end(); neuron++) {
+            if (neuron->get()->Inputs->size() == 0 || computed.find(neuron->get()) != computed.end()) continue;
+            computed[neuron->get()] = layer->Activation();
+            computedOrder.push_back(neuron->get());
+        }
+    }
+
+    // Sources first: inputs, then neurons never updated (bias, neurons without inputs or outside layers)
+    for (auto neuron = this->InputLayer->Neurons->begin(); neuron != this->InputLayer->Neurons->end(); neuron++) {
+        if (computed.find(neuron->get()) == computed.end()) addNeuron(neuron->get());
+    }
+    for (const auto& layer : layers) {
+        for (auto neuron = layer->Neurons->begin(); neuron != layer->Neurons->end(); neuron++) {
+            if (computed.find(neuron->get()) == computed.end()) addNeuron(neuron->get());
+        }
+    }
+    for (const auto& neuron : computedOrder) {
+        for (auto syn = neuron->Inputs->begin(); syn != neuron->Inputs->end(); syn++) {
+            if (computed.find(syn->get()->Source) == computed.end()) addNeuron(syn->get()->Source);
+        }
+    }
+    const uint32_t firstComputed = static_cast<uint32_t>(order.size());
+
+    // Topological order (Kahn): a neuron is ready when all its computed sources are placed
+    unordered_map<const Neuron*, size_t> waiting;
+    unordered_map<const Neuron*, vector<Neuron*>> dependents;
+    for (const auto& neuron : computedOrder) {
+        size_t count = 0;
+        for (auto syn = neuron->Inputs->begin(); syn != neuron->Inputs->end(); syn++) {
+            if (computed.find(syn->get()->Source) == computed.end()) continue;
+            dependents[syn->get()->Source].push_back(neuron);
+            count++;
+        }
+        waiting[neuron] = count;
+    }
+
+    std::deque<Neuron*> ready;
+    for (const auto& neuron : computedOrder) {
+        if (waiting[neuron] == 0) ready.push_back(neuron);
+    }
+
+    while (!ready.empty()) {
+        Neuron* neuron = ready.front();
+        ready.pop_front();
+        addNeuron(neuron);
+
+        auto found = dependents.find(neuron);
+        if (found == dependents.end()) continue;
+        for (const auto& next : found->second) {
+            if (--waiting[next] == 0) ready.push_back(next);
+        }
+    }
+
+    if (order.size() != firstComputed + computedOrder.size()) throw runtime_error("Briand::NeuralNetwork::Compile - the network has a cycle, cannot compile.");
+    if (order.size() > std::numeric_limits<uint32_t>::max()) throw runtime_error("Briand::NeuralNetwork::Compile - too many neurons.");
+
+    // Build the flat arrays
+    auto compiled = unique_ptr<CompiledNetwork>(new CompiledNetwork());
+    compiled->_firstComputed = firstComputed;
+    compiled->_neurons->assign(order.begin(), order.end());
+    compiled->_values->resize(order.size());
+    compiled->_activations->resize(order.size(), nullptr);
+    compiled->_offsets->reserve(order.size() + 1);
+    compiled->_offsets->push_back(0);
+
+    vector<std::pair<uint32_t, Synapsis*>> edges;
+    for (size_t n = 0; n < order.size(); n++) {
+        compiled->_values->at(n) = order[n]->Value;
+
+        if (n >= firstComputed) {
+            compiled->_activations->at(n) = computed[order[n]];
+
+            // Edges sorted by source, so values are read (almost) sequentially
+            edges.clear();
+            for (auto syn = order[n]->Inputs->begin(); syn != order[n]->Inputs->end(); syn++) edges.push_back({ index[syn->get()->Source], syn->get() });
+            std::sort(edges.begin(), edges.end(), [](const std::pair<uint32_t, Synapsis*>& a, const std::pair<uint32_t, Synapsis*>& b) { return a.first < b.first; });
+
+            for (const auto& edge : edges) {
+                compiled->_sources->push_back(edge.first);
+                compiled->_weights->push_back(edge.second->Weight);
+                compiled->_synapses->push_back(edge.second);
+            }
+        }
+
+        if (compiled->_sources->size() > std::numeric_limits<uint32_t>::max()) throw runtime_error("Briand::NeuralNetwork::Compile - too many synapses.");
+        compiled->_offsets->push_back(static_cast<uint32_t>(compiled->_sources->size()));
+    }
+
+    for (auto neuron = this->InputLayer->Neurons->begin(); neuron != this->InputLayer->Neurons->end(); neuron++) compiled->_inputs->push_back(index[neuron->get()]);
+    for (auto neuron = this->OutputLayer->Neurons->begin(); neuron != this->OutputLayer->Neurons->end(); neuron++) compiled->_outputs->push_back(index[neuron->get()]);
+
+    return std::move(compiled);
+}
+
+Briand::SimpleNN::CompiledNetwork::CompiledNetwork() {
+    this->_values = make_unique<vector<double>>();
+    this->_offsets = make_unique<vector<uint32_t>>();
+    this->_sources = make_unique<vector<uint32_t>>();
+    this->_weights = make_unique<vector<double>>();
+    this->_activations = make_unique<vector<ActivationFunction>>();
+    this->_neurons = make_unique<vector<Neuron*>>();
+    this->_synapses = make_unique<vector<Synapsis*>>();
+    this->_inputs = make_unique<vector<uint32_t>>();
+    this->_outputs = make_unique<vector<uint32_t>>();
+    this->_firstComputed = 0;
+}
+
+Briand::SimpleNN::CompiledNetwork::~CompiledNetwork() {
+    this->_values.reset();
+    this->_offsets.reset();
+    this->_sources.reset();
+    this->_weights.reset();
+    this->_activations.reset();
+    this->_neurons.reset();
+    this->_synapses.reset();
+    this->_inputs.reset();
+    this->_outputs.reset();
+}
+
+size_t Briand::SimpleNN::CompiledNetwork::Neurons() const {
+    return this->_values->size();
+}
+
+size_t Briand::SimpleNN::CompiledNetwork::Synapses() const {
+    return this->_sources->size();
+}
+
+size_t Briand::SimpleNN::CompiledNetwork::MemoryBytes() const {
+    return this->_values->size() * (sizeof(double) + sizeof(uint32_t) + sizeof(ActivationFunction) + sizeof(Neuron*))
+        + this->_sources->size() * (sizeof(uint32_t) + sizeof(double) + sizeof(Synapsis*))
+        + (this->_inputs->size() + this->_outputs->size()) * sizeof(uint32_t);
+}
+
+void Briand::SimpleNN::CompiledNetwork::Forward(const vector<double>& inputValues, vector<double>& outputValues) {
+    // Check
+    if (inputValues.size() != this->_inputs->size()) throw runtime_error("Briand::CompiledNetwork::Forward - more/less input values than network inputs");
+
+    double* values = this->_values->data();
+    const uint32_t* offsets = this->_offsets->data();
+    const uint32_t* sources = this->_sources->data();
+    const double* weights = this->_weights->data();
+    const ActivationFunction* activations = this->_activations->data();
+    const size_t neurons = this->_values->size();
+
+    // Set inputs
+    for (size_t i = 0; i < inputValues.size(); i++) values[this->_inputs->at(i)] = inputValues[i];
+
+    // One sweep: sources of each neuron are already computed
+    for (size_t n = this->_firstComputed; n < neurons; n++) {
+        double sum = 0.0;
+        for (uint32_t e = offsets[n]; e < offsets[n + 1]; e++) sum += values[sources[e]] * weights[e];
+        values[n] = activations[n](sum);
+    }
+
+    if (outputValues.size() != this->_outputs->size()) outputValues.resize(this->_outputs->size());
+    for (size_t i = 0; i < this->_outputs->size(); i++) outputValues[i] = values[this->_outputs->at(i)];
+}
+
+void Briand::SimpleNN::CompiledNetwork::RefreshWeights() {
+    for (size_t e = 0; e < this->_synapses->size(); e++) this->_weights->at(e) = this->_synapses->at(e)->Weight;
+    for (size_t n = 0; n < this->_firstComputed; n++) this->_values->at(n) = this->_neurons->at(n)->Value;
+}
+
+void Briand::SimpleNN::CompiledNetwork::StoreValues() const {
+    for (size_t n = 0; n < this->_neurons->size(); n++) this->_neurons->at(n)->Value = this->_values->at(n);
+}
+
 Briand::SimpleNN::Perceptron::Perceptron(const int& inputs, ActivationFunction activationFunction) {
     // Inputs must be valid
     if (inputs <= 0) throw runtime_error("Briand::Perceptron::Perceptron - inputs must be greater than 0.");
@@ -0,0 +1,209 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandSparse.hxx"
+#include "BriandThreadPool.hxx"
+
+using namespace std;
+using namespace Briand;
+
+SparseMatrix::SparseMatrix(const Matrix& dense, const SparseFormat& format, const double& zero /*= 0.0*/) {
+    this->_rows = dense.Rows();
+    this->_cols = dense.Cols();
+    this->_format = format;
+    this->_nonZeros = 0;
+    this->_values = make_unique<vector<double>>();
+    this->_columns = make_unique<vector<uint32_t>>();
+    this->_offsets = make_unique<vector<uint32_t>>();
+
+    if (this->_cols > std::numeric_limits<uint32_t>::max()) throw out_of_range("Sparse matrix: too many columns.");
+
+    if (format == SparseFormat::CSR) {
+        this->_offsets->reserve(this->_rows + 1);
+        this->_offsets->push_back(0);
+
+        for (size_t i = 0; i < this->_rows; i++) {
+            for (size_t j = 0; j < this->_cols; j++) {
+                if (fabs(dense[i][j]) > zero) {
+                    this->_values->push_back(dense[i][j]);
+                    this->_columns->push_back(static_cast<uint32_t>(j));
+                }
+            }
+            this->_offsets->push_back(static_cast<uint32_t>(this->_values->size()));
+        }
+
+        this->_nonZeros = this->_values->size();
+    }
+    else {
+        // Groups of 4 rows: a block is stored if any of its 4 values is non-zero
+        const size_t groups = (this->_rows + 3) / 4;
+        this->_offsets->reserve(groups + 1);
+        this->_offsets->push_back(0);
+
+        for (size_t g = 0; g < groups; g++) {
+            for (size_t j = 0; j < this->_cols; j++) {
+                bool any = false;
+                for (size_t r = 0; r < 4; r++) {
+                    const size_t i = g * 4 + r;
+                    if (i < this->_rows && fabs(dense[i][j]) > zero) {
+                        any = true;
+                        this->_nonZeros++;
+                    }
+                }
+                if (!any) continue;
+
+                this->_columns->push_back(static_cast<uint32_t>(j));
+                for (size_t r = 0; r < 4; r++) {
+                    const size_t i = g * 4 + r;
+                    this->_values->push_back(i < this->_rows && fabs(dense[i][j]) > zero ? dense[i][j] : 0.0);
+                }
+            }
+            this->_offsets->push_back(static_cast<uint32_t>(this->_columns->size()));
+        }
+    }
+
+    this->_values->shrink_to_fit();
+    this->_columns->shrink_to_fit();
+}
+
+SparseMatrix::~SparseMatrix() {
+    this->_values.reset();
+    this->_columns.reset();
+    this->_offsets.reset();
+}
+
+const size_t& SparseMatrix::Rows() const {
+    return this->_rows;
+}
+
+const size_t& SparseMatrix::Cols() const {
+    return this->_cols;
+}
+
+const SparseFormat& SparseMatrix::Format() const {
+    return this->_format;
+}
+
+const size_t& SparseMatrix::NonZeros() const {
+    return this->_nonZeros;
+}
+
+double SparseMatrix::Density() const {
+    if (this->_rows == 0 || this->_cols == 0) return 0.0;
+    return static_cast<double>(this->_nonZeros) / static_cast<double>(this->_rows * this->_cols);
+}
+
+size_t SparseMatrix::MemoryBytes() const {
+    return this->_values->size() * sizeof(double)
+        + this->_columns->size() * sizeof(uint32_t)
+        + this->_offsets->size() * sizeof(uint32_t);
+}
+
+void SparseMatrix::MultiplyVector(const vector<double>& v, vector<double>& result) const {
+    // Condition: A x v is possible if number of cols in A equals the number of components in v
+    if (v.size() != this->_cols) throw out_of_range("Sparse A(m,n)*v(n) failed: n has different value!");
+    if (result.size() != this->_rows) throw out_of_range("Sparse A(m,n)*v(n) failed: result must have m elements!");
+
+    this->MultiplyVector(v.data(), result.data());
+}
+
+void SparseMatrix::MultiplyVector(const double* v, double* result) const {
+    const double* values = this->_values->data();
+    const uint32_t* columns = this->_columns->data();
+    const uint32_t* offsets = this->_offsets->data();
+    const double* x = v;
+    double* y = result;
+
+    if (this->_format == SparseFormat::CSR) {
+        auto body = [values, columns, offsets, x, y](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) {
+                double yi = 0;
+                for (uint32_t k = offsets[i]; k < offsets[i + 1]; k++) yi += values[k] * x[columns[k]];
+                y[i] = yi;
+            }
+        };
+
+        // Same rule as dense kernels: split rows only if worth it
+        if (this->_values->size() < Matrix::ParallelThreshold) body(0, this->_rows);
+        else ThreadPool::Default().ParallelFor(0, this->_rows, 16, body);
+    }
+    else {
+        const size_t rows = this->_rows;
+        auto body = [values, columns, offsets, x, y, rows](const size_t& begin, const size_t& end) {
+            for (size_t g = begin; g < end; g++) {
+                // 4 independent accumulators, one column read for 4 multiply-adds
+                double y0 = 0, y1 = 0, y2 = 0, y3 = 0;
+                for (uint32_t b = offsets[g]; b < offsets[g + 1]; b++) {
+                    const double xj = x[columns[b]];
+                    const double* block = values + 4 * b;
+                    y0 += block[0] * xj;
+                    y1 += block[1] * xj;
+                    y2 += block[2] * xj;
+                    y3 += block[3] * xj;
+                }
+                const size_t i = g * 4;
+                y[i] = y0;
+                if (i + 1 < rows) y[i + 1] = y1;
+                if (i + 2 < rows) y[i + 2] = y2;
+                if (i + 3 < rows) y[i + 3] = y3;
+            }
+        };
+
+        const size_t groups = this->_offsets->size() - 1;
+        if (this->_values->size() < Matrix::ParallelThreshold) body(0, groups);
+        else ThreadPool::Default().ParallelFor(0, groups, 4, body);
+    }
+}
+
+unique_ptr<Matrix> SparseMatrix::ToDense() const {
+    auto dense = make_unique<Matrix>(this->_rows, this->_cols, 0.0);
+
+    if (this->_format == SparseFormat::CSR) {
+        for (size_t i = 0; i < this->_rows; i++) {
+            for (uint32_t k = this->_offsets->at(i); k < this->_offsets->at(i + 1); k++) {
+                (*dense.get())[i][this->_columns->at(k)] = this->_values->at(k);
+            }
+        }
+    }
+    else {
+        for (size_t g = 0; g + 1 < this->_offsets->size(); g++) {
+            for (uint32_t b = this->_offsets->at(g); b < this->_offsets->at(g + 1); b++) {
+                for (size_t r = 0; r < 4 && g * 4 + r < this->_rows; r++) {
+                    (*dense.get())[g * 4 + r][this->_columns->at(b)] = this->_values->at(4 * b + r);
+                }
+            }
+        }
+    }
+
+    return std::move(dense);
+}
+
+double SparseMatrix::DensityOf(const Matrix& dense, const double& zero /*= 0.0*/) {
+    if (dense.Rows() == 0 || dense.Cols() == 0) return 0.0;
+
+    size_t nonZeros = 0;
+    for (size_t i = 0; i < dense.Rows(); i++) {
+        for (size_t j = 0; j < dense.Cols(); j++) {
+            if (fabs(dense[i][j]) > zero) nonZeros++;
+        }
+    }
+
+    return static_cast<double>(nonZeros) / static_cast<double>(dense.Rows() * dense.Cols());
+}
+
+size_t SparseMatrix::DenseMemoryBytes(const size_t& rows, const size_t& cols) {
+    return rows * cols * sizeof(double) + rows * sizeof(double*);
+}
@@ -0,0 +1,356 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandStreaming.hxx"
+
+using namespace std;
+using namespace Briand;
+
+/**********************************************************************
+    File weight store class
+***********************************************************************/
+
+FileWeightStore::FileWeightStore(const string& path) {
+    this->_file = fopen(path.c_str(), "r+b");
+    if (this->_file == nullptr) this->_file = fopen(path.c_str(), "w+b");
+    if (this->_file == nullptr) throw runtime_error("FileWeightStore: cannot open " + path);
+
+    fseek(this->_file, 0, SEEK_END);
+    this->_size = static_cast<size_t>(ftell(this->_file));
+}
+
+FileWeightStore::~FileWeightStore() {
+    if (this->_file != nullptr) fclose(this->_file);
+}
+
+void FileWeightStore::Prepare(const size_t& bytes) {
+    std::lock_guard<std::mutex> lock(this->_lock);
+    if (ftruncate(fileno(this->_file), static_cast<off_t>(bytes)) != 0) throw runtime_error("FileWeightStore: cannot resize file.");
+    this->_size = bytes;
+}
+
+void FileWeightStore::Read(const size_t& offset, void* destination, const size_t& bytes) {
+    std::lock_guard<std::mutex> lock(this->_lock);
+    if (offset + bytes > this->_size) throw out_of_range("FileWeightStore: read out of file.");
+    if (fseek(this->_file, static_cast<long>(offset), SEEK_SET) != 0 || fread(destination, 1, bytes, this->_file) != bytes) throw runtime_error("FileWeightStore: read error.");
+}
+
+void FileWeightStore::Write(const size_t& offset, const void* source, const size_t& bytes) {
+    std::lock_guard<std::mutex> lock(this->_lock);
+    if (offset + bytes > this->_size) throw out_of_range("FileWeightStore: write out of file.");
+    if (fseek(this->_file, static_cast<long>(offset), SEEK_SET) != 0 || fwrite(source, 1, bytes, this->_file) != bytes) throw runtime_error("FileWeightStore: write error.");
+    fflush(this->_file);
+}
+
+size_t FileWeightStore::Size() const {
+    return this->_size;
+}
+
+/**********************************************************************
+    Partition weight store class
+***********************************************************************/
+
+PartitionWeightStore::PartitionWeightStore(const string& label) {
+    this->_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label.c_str());
+    if (this->_partition == nullptr) throw runtime_error("PartitionWeightStore: data partition " + label + " not found.");
+}
+
+void PartitionWeightStore::Prepare(const size_t& bytes) {
+    if (bytes > this->_partition->size) throw out_of_range("PartitionWeightStore: partition too small.");
+
+    // Flash is erased by sectors
+    const size_t sector = this->_partition->erase_size;
+    const size_t erase = (bytes + sector - 1) / sector * sector;
+    if (esp_partition_erase_range(this->_partition, 0, erase) != ESP_OK) throw runtime_error("PartitionWeightStore: erase error.");
+}
+
+void PartitionWeightStore::Read(const size_t& offset, void* destination, const size_t& bytes) {
+    if (esp_partition_read(this->_partition, offset, destination, bytes) != ESP_OK) throw runtime_error("PartitionWeightStore: read error.");
+}
+
+void PartitionWeightStore::Write(const size_t& offset, const void* source, const size_t& bytes) {
+    if (esp_partition_write(this->_partition, offset, source, bytes) != ESP_OK) throw runtime_error("PartitionWeightStore: write error.");
+}
+
+size_t PartitionWeightStore::Size() const {
+    return this->_partition->size;
+}
+
+/**********************************************************************
+    Streaming stats class
+***********************************************************************/
+
+StreamingStats::StreamingStats() {
+    this->Inferences = 0;
+    this->Time = 0;
+    this->Wait = 0;
+    this->Load = 0;
+    this->BytesRead = 0;
+}
+
+double StreamingStats::Overlap() const {
+    if (this->Load <= 0) return 1.0;
+    return std::max(0.0, 1.0 - static_cast<double>(this->Wait) / static_cast<double>(this->Load));
+}
+
+void StreamingStats::Print() const {
+    const double n = static_cast<double>(this->Inferences > 0 ? this->Inferences : 1);
+    printf("Streaming: %u inferences, AVG %.1lfus (stalled %.1lfus), load %.1lfus and %.0lf bytes each, overlap %.1lf%%\n",
+        static_cast<unsigned int>(this->Inferences), this->Time / n, this->Wait / n, this->Load / n, this->BytesRead / n, this->Overlap() * 100.0);
+}
+
+/**********************************************************************
+    Streamed FCNN class
+***********************************************************************/
+
+StreamedFCNN::StreamedFCNN() {
+    this->_store = nullptr;
+    this->_layers = make_unique<vector<Layer>>();
+    this->_inputBias = make_unique<vector<double>>();
+    this->_arena = make_unique<InternalVector>();
+    this->_buffers[0] = make_unique<InternalVector>();
+    this->_buffers[1] = make_unique<InternalVector>();
+    this->_loaded[0] = this->_loaded[1] = SIZE_MAX;
+    this->_first = 0;
+    this->_requestLayer = this->_requestBuffer = 0;
+    this->_requested = false;
+    this->_stop = false;
+    this->_inputs = 0;
+}
+
+StreamedFCNN::~StreamedFCNN() {
+    {
+        std::lock_guard<std::mutex> lock(this->_lock);
+        this->_stop = true;
+    }
+    this->_signal.notify_all();
+    if (this->_thread.joinable()) this->_thread.join();
+
+    this->_layers.reset();
+    this->_inputBias.reset();
+    this->_arena.reset();
+    this->_buffers[0].reset();
+    this->_buffers[1].reset();
+    this->_store.reset();
+}
+
+unique_ptr<StreamedFCNN> StreamedFCNN::Create(const FCNN& network, unique_ptr<WeightStore> store) {
+    if (store == nullptr) throw runtime_error("StreamedFCNN: missing store.");
+    if (!network._hasOutputs || network._layers->size() < 2) throw runtime_error("StreamedFCNN: network is not complete.");
+
+    const auto& source = *network._layers.get();
+    auto plan = unique_ptr<StreamedFCNN>(new StreamedFCNN());
+    plan->_inputs = source[0]->Neurons();
+    if (source[0]->_bias_weights != nullptr) plan->_inputBias = make_unique<vector<double>>(*source[0]->_bias_weights.get());
+
+    // Weights blobs back to back, row major
+    size_t offset = 0, largest = 0, pair = 0;
+    for (size_t k = 1; k < source.size(); k++) {
+        const auto& l = source[k];
+        const size_t cols = source[k - 1]->Neurons();
+        if (l->_weights == nullptr || l->_weights->Rows() != l->Neurons() || l->_weights->Cols() != cols) throw out_of_range("StreamedFCNN: invalid weights at layer " + to_string(k));
+        if (l->_batchNorm != nullptr) throw runtime_error("StreamedFCNN: batch normalization at layer " + to_string(k) + " must be folded first (FCNN::OptimizeForInference()).");
+
+        Layer layer;
+        layer.Rows = l->Neurons();
+        layer.Cols = cols;
+        layer.Offset = offset;
+        layer.F = l->_f;
+        layer.Softmax = l->_softmax;
+        layer.Bias = make_unique<vector<double>>();
+        if (l->_bias_weights != nullptr) *layer.Bias.get() = *l->_bias_weights.get();
+
+        offset += layer.Rows * layer.Cols * sizeof(double);
+        largest = std::max(largest, layer.Rows * layer.Cols);
+        pair = std::max(pair, layer.Rows + layer.Cols);
+        plan->_layers->push_back(std::move(layer));
+    }
+
+    store->Prepare(offset);
+    for (size_t k = 1; k < source.size(); k++) {
+        const auto& layer = plan->_layers->at(k - 1);
+        store->Write(layer.Offset, source[k]->_weights->Data(), layer.Rows * layer.Cols * sizeof(double));
+    }
+    plan->_store = std::move(store);
+
+    plan->_arena = make_unique<InternalVector>(pair, 0.0);
+    plan->_buffers[0] = make_unique<InternalVector>(largest, 0.0);
+    plan->_buffers[1] = make_unique<InternalVector>(largest, 0.0);
+
+    // On ESP loads run on the other core
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.pin_to_core = 1 % portNUM_PROCESSORS;
+    cfg.thread_name = "BriandStream";
+    esp_pthread_set_cfg(&cfg);
+    plan->_thread = std::thread(&StreamedFCNN::Loop, plan.get());
+    esp_pthread_cfg_t defaults = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&defaults);
+
+    // First layer is ready for the first Forward()
+    plan->Request(0, 0);
+
+    return std::move(plan);
+}
+
+void StreamedFCNN::Loop() {
+    std::unique_lock<std::mutex> lock(this->_lock);
+
+    while (true) {
+        this->_signal.wait(lock, [this] { return this->_requested || this->_stop; });
+        if (this->_stop) return;
+
+        const size_t k = this->_requestLayer;
+        const size_t b = this->_requestBuffer;
+        const auto& layer = this->_layers->at(k);
+        const size_t bytes = layer.Rows * layer.Cols * sizeof(double);
+
+        // Buffer b is not used by Forward() until the load is done
+        lock.unlock();
+        string error;
+        const long start = static_cast<long>(esp_timer_get_time());
+        try {
+            this->_store->Read(layer.Offset, this->_buffers[b]->data(), bytes);
+        }
+        catch (const exception& e) {
+            error = e.what();
+        }
+        const long elapsed = static_cast<long>(esp_timer_get_time()) - start;
+        lock.lock();
+
+        this->_loaded[b] = (error.empty() ? k : SIZE_MAX);
+        this->_error = error;
+        this->_stats.Load += elapsed;
+        this->_stats.BytesRead += bytes;
+        this->_requested = false;
+        this->_signal.notify_all();
+    }
+}
+
+void StreamedFCNN::Request(const size_t& layer, const size_t& buffer) {
+    std::lock_guard<std::mutex> lock(this->_lock);
+    this->_loaded[buffer] = SIZE_MAX;
+    this->_requestLayer = layer;
+    this->_requestBuffer = buffer;
+    this->_requested = true;
+    this->_signal.notify_all();
+}
+
+void StreamedFCNN::WaitFor(const size_t& layer, const size_t& buffer) {
+    const long start = static_cast<long>(esp_timer_get_time());
+    std::unique_lock<std::mutex> lock(this->_lock);
+
+    while (true) {
+        this->_signal.wait(lock, [this] { return !this->_requested; });
+
+        if (!this->_error.empty()) {
+            const string error = this->_error;
+            this->_error.clear();
+            throw runtime_error("StreamedFCNN: " + error);
+        }
+        if (this->_loaded[buffer] == layer) break;
+
+        // Not prefetched (first call after a failed load): load now
+        this->_loaded[buffer] = SIZE_MAX;
+        this->_requestLayer = layer;
+        this->_requestBuffer = buffer;
+        this->_requested = true;
+        this->_signal.notify_all();
+    }
+
+    this->_stats.Wait += static_cast<long>(esp_timer_get_time()) - start;
+}
+
+void StreamedFCNN::Forward(const vector<double>& inputs, vector<double>& outputs) {
+    if (inputs.size() != this->_inputs) throw runtime_error("Input values: invalid size.");
+
+    const long start = static_cast<long>(esp_timer_get_time());
+    const size_t layers = this->_layers->size();
+    const size_t pair = this->_arena->size();
+    double* arena = this->_arena->data();
+
+    // Even layers at the arena start, odd layers at its end (same as a compiled inference plan)
+    double* in = arena;
+    for (size_t i = 0; i < this->_inputs; i++) in[i] = inputs[i] + (this->_inputBias->size() > 0 ? this->_inputBias->at(i) : 0.0);
+
+    // Layer 0 was prefetched by the previous call (or Create()) into the buffer not used by the last layer
+    size_t b = this->_first;
+
+    for (size_t k = 0; k < layers; k++) {
+        this->WaitFor(k, b);
+
+        // Next layer (or first layer of the next call) loads while this one computes
+        if (layers > 1) this->Request((k + 1) % layers, 1 - b);
+
+        const auto& layer = this->_layers->at(k);
+        const double* w = this->_buffers[b]->data();
+        const double* bias = (layer.Bias->size() > 0 ? layer.Bias->data() : nullptr);
+        double* out = ((k + 1) % 2 == 0 ? arena : arena + pair - layer.Rows);
+
+        for (size_t r = 0; r < layer.Rows; r++) {
+            const double* row = w + r * layer.Cols;
+            double net = 0.0;
+            for (size_t c = 0; c < layer.Cols; c++) net += row[c] * in[c];
+            out[r] = net + (bias != nullptr ? bias[r] : 0.0);
+        }
+
+        if (layer.Softmax) Math::Softmax(out, out, layer.Rows);
+        else for (size_t r = 0; r < layer.Rows; r++) out[r] = layer.F(out[r]);
+
+        in = out;
+        if (layers > 1) b = 1 - b;
+    }
+    this->_first = b;
+
+    const size_t n = this->_layers->back().Rows;
+    if (outputs.size() != n) outputs.resize(n);
+    std::copy(in, in + n, outputs.begin());
+
+    this->_stats.Inferences++;
+    this->_stats.Time += static_cast<long>(esp_timer_get_time()) - start;
+}
+
+size_t StreamedFCNN::StoredBytes() const {
+    const auto& last = this->_layers->back();
+    return last.Offset + last.Rows * last.Cols * sizeof(double);
+}
+
+size_t StreamedFCNN::ResidentBytes() const {
+    size_t bytes = (this->_arena->size() + this->_buffers[0]->size() + this->_buffers[1]->size() + this->_inputBias->size()) * sizeof(double);
+    for (const auto& l : *this->_layers.get()) bytes += sizeof(Layer) + l.Bias->size() * sizeof(double);
+    return bytes;
+}
+
+const StreamingStats& StreamedFCNN::Stats() const {
+    return this->_stats;
+}
+
+void StreamedFCNN::ResetStats() {
+    std::lock_guard<std::mutex> lock(this->_lock);
+    this->_stats = StreamingStats();
+}
+
+void StreamedFCNN::Print() const {
+    printf("Streamed FCNN: %u layers, %u bytes of weights in store, %u bytes resident\n",
+        static_cast<unsigned int>(this->_layers->size()), static_cast<unsigned int>(this->StoredBytes()), static_cast<unsigned int>(this->ResidentBytes()));
+
+    for (size_t k = 0; k < this->_layers->size(); k++) {
+        const auto& l = this->_layers->at(k);
+        printf("  #%u %ux%u weights at %u%s%s\n", static_cast<unsigned int>(k + 1), static_cast<unsigned int>(l.Rows), static_cast<unsigned int>(l.Cols),
+            static_cast<unsigned int>(l.Offset), l.Bias->size() > 0 ? " + bias" : "", l.Softmax ? " + softmax" : "");
+    }
+
+    this->_stats.Print();
+}
@@ -0,0 +1,272 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandThreadPool.hxx"
+
+using namespace std;
+using namespace Briand;
+
+/// @brief Worker thread stack size (ESP only)
+#define BRIAND_THREADPOOL_STACK 4096
+
+/// @brief Max chunks of a ParallelReduce (fixed so result does not depend on the number of workers)
+#define BRIAND_THREADPOOL_REDUCE_CHUNKS 64
+
+/// @brief Pool the current thread works for (nullptr if not a worker)
+static thread_local const ThreadPool* CURRENT_POOL = nullptr;
+
+/// @brief Worker index of the current thread
+static thread_local size_t CURRENT_WORKER = 0;
+
+/// @brief Default pool
+static unique_ptr<ThreadPool> DEFAULT_POOL = nullptr;
+static std::mutex DEFAULT_POOL_LOCK;
+
+ThreadPool::ThreadPool(const size_t& workers) {
+    this->_pending.store(0);
+    this->_stop.store(false);
+    this->_nextQueue.store(0);
+
+    this->_queues = make_unique<vector<unique_ptr<WorkerQueue>>>();
+    this->_workers = make_unique<vector<std::thread>>();
+
+    for (size_t i = 0; i < workers; i++) this->_queues->push_back(make_unique<WorkerQueue>());
+
+    for (size_t i = 0; i < workers; i++) {
+        // Pin workers starting from core 1 (core 0 usually runs the caller, app_main())
+        esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+        cfg.pin_to_core = static_cast<int>((i + 1) % portNUM_PROCESSORS);
+        cfg.stack_size = BRIAND_THREADPOOL_STACK;
+        cfg.thread_name = "BriandPool";
+        esp_pthread_set_cfg(&cfg);
+
+        this->_workers->push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+    }
+
+    // Restore default configuration for other pthreads
+    esp_pthread_cfg_t defaults = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&defaults);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->_sleepLock);
+        this->_stop.store(true);
+    }
+    this->_sleep.notify_all();
+
+    for (auto& worker : *this->_workers.get()) {
+        if (worker.joinable()) worker.join();
+    }
+
+    this->_workers.reset();
+    this->_queues.reset();
+}
+
+size_t ThreadPool::Workers() const {
+    return this->_workers->size();
+}
+
+size_t ThreadPool::CurrentWorker() const {
+    return (CURRENT_POOL == this ? CURRENT_WORKER : this->_queues->size());
+}
+
+void ThreadPool::WorkerLoop(const size_t index) {
+    CURRENT_POOL = this;
+    CURRENT_WORKER = index;
+
+    std::function<void()> task;
+
+    while (!this->_stop.load()) {
+        if (this->TakeTask(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        // Nothing to do: sleep until something is submitted (timeout just for safety)
+        std::unique_lock<std::mutex> lock(this->_sleepLock);
+        this->_sleep.wait_for(lock, std::chrono::milliseconds(10), [this] { return this->_pending.load() > 0 || this->_stop.load(); });
+    }
+}
+
+bool ThreadPool::TakeTask(const size_t& index, std::function<void()>& task) {
+    const size_t queues = this->_queues->size();
+    if (queues == 0 || this->_pending.load() == 0) return false;
+
+    // Own queue first, newest task (still hot in cache)
+    if (index < queues) {
+        auto& own = *this->_queues->at(index).get();
+        std::lock_guard<std::mutex> lock(own.Lock);
+        if (!own.Tasks.empty()) {
+            task = std::move(own.Tasks.back());
+            own.Tasks.pop_back();
+            this->_pending.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // Steal the oldest task from the others
+    for (size_t i = 1; i <= queues; i++) {
+        auto& other = *this->_queues->at((index + i) % queues).get();
+        std::lock_guard<std::mutex> lock(other.Lock);
+        if (!other.Tasks.empty()) {
+            task = std::move(other.Tasks.front());
+            other.Tasks.pop_front();
+            this->_pending.fetch_sub(1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    if (this->_queues->size() == 0) {
+        // No workers, run now
+        task();
+        return;
+    }
+
+    // A worker pushes on its own queue, others spread tasks round robin
+    size_t index = this->CurrentWorker();
+    if (index >= this->_queues->size()) index = this->_nextQueue.fetch_add(1) % this->_queues->size();
+
+    // Count before pushing so the counter is never lower than the queued tasks
+    {
+        std::lock_guard<std::mutex> lock(this->_sleepLock);
+        this->_pending.fetch_add(1);
+    }
+
+    {
+        auto& queue = *this->_queues->at(index).get();
+        std::lock_guard<std::mutex> lock(queue.Lock);
+        queue.Tasks.push_back(std::move(task));
+    }
+
+    this->_sleep.notify_one();
+}
+
+void ThreadPool::ParallelFor(const size_t& begin, const size_t& end, const size_t& grain, const ParallelBody& body) {
+    if (end <= begin) return;
+
+    const size_t items = end - begin;
+    const size_t minChunk = (grain > 0 ? grain : 1);
+
+    // Nothing to split
+    if (this->Workers() == 0 || items <= minChunk) {
+        body(begin, end);
+        return;
+    }
+
+    // Some chunks more than threads, so stealing can balance uneven chunks
+    const size_t maxChunks = (this->Workers() + 1) * 4;
+    size_t chunks = (items + minChunk - 1) / minChunk;
+    if (chunks > maxChunks) chunks = maxChunks;
+    const size_t chunkSize = (items + chunks - 1) / chunks;
+    chunks = (items + chunkSize - 1) / chunkSize;
+
+    std::atomic<size_t> remaining(chunks);
+    std::exception_ptr error = nullptr;
+    std::mutex errorLock;
+
+    auto runChunk = [&](const size_t& b, const size_t& e) {
+        try {
+            body(b, e);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(errorLock);
+            if (error == nullptr) error = std::current_exception();
+        }
+        remaining.fetch_sub(1, std::memory_order_release);
+    };
+
+    // Queue all chunks but the first one, which runs here
+    for (size_t c = 1; c < chunks; c++) {
+        const size_t b = begin + c * chunkSize;
+        const size_t e = (b + chunkSize < end ? b + chunkSize : end);
+        this->Submit([&runChunk, b, e]() { runChunk(b, e); });
+    }
+    runChunk(begin, (begin + chunkSize < end ? begin + chunkSize : end));
+
+    // Help the workers until all chunks are done
+    const size_t me = this->CurrentWorker();
+    std::function<void()> task;
+    while (remaining.load(std::memory_order_acquire) > 0) {
+        if (this->TakeTask(me, task)) {
+            task();
+            task = nullptr;
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+
+    if (error != nullptr) std::rethrow_exception(error);
+}
+
+double ThreadPool::ParallelReduce(const size_t& begin, const size_t& end, const size_t& grain, const double& identity, const ParallelReduceBody& body, const ParallelCombine& combine) {
+    if (end <= begin) return identity;
+
+    // Chunks depend only on range and grain
+    const size_t items = end - begin;
+    size_t chunkSize = (items + BRIAND_THREADPOOL_REDUCE_CHUNKS - 1) / BRIAND_THREADPOOL_REDUCE_CHUNKS;
+    if (chunkSize < grain) chunkSize = grain;
+    if (chunkSize == 0) chunkSize = 1;
+    const size_t chunks = (items + chunkSize - 1) / chunkSize;
+
+    vector<double> partials(chunks, identity);
+
+    this->ParallelFor(0, chunks, 1, [&](const size_t& cb, const size_t& ce) {
+        for (size_t c = cb; c < ce; c++) {
+            const size_t b = begin + c * chunkSize;
+            const size_t e = (b + chunkSize < end ? b + chunkSize : end);
+            partials[c] = body(b, e);
+        }
+    });
+
+    double result = identity;
+    for (const auto& p : partials) result = combine(result, p);
+
+    return result;
+}
+
+size_t ThreadPool::Cores() {
+#if defined(ESP_PLATFORM)
+    return portNUM_PROCESSORS;
+#else
+    const size_t cores = std::thread::hardware_concurrency();
+    return (cores > 0 ? cores : 1);
+#endif
+}
+
+ThreadPool& ThreadPool::Default() {
+    std::lock_guard<std::mutex> lock(DEFAULT_POOL_LOCK);
+
+    if (DEFAULT_POOL == nullptr) {
+        // Caller works too, so one worker less than the cores
+        const size_t cores = ThreadPool::Cores();
+        DEFAULT_POOL = make_unique<ThreadPool>(cores > 1 ? cores - 1 : 0);
+    }
+
+    return *DEFAULT_POOL.get();
+}
+
+void ThreadPool::SetDefaultWorkers(const size_t& workers) {
+    std::lock_guard<std::mutex> lock(DEFAULT_POOL_LOCK);
+    DEFAULT_POOL.reset();
+    DEFAULT_POOL = make_unique<ThreadPool>(workers);
+}
@@ -0,0 +1,347 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BriandTuner.hxx"
+#include "BriandFCNN.hxx"
+
+using namespace std;
+using namespace Briand;
+
+/// @brief Multiply-adds of one timed batch of calls (many calls for tiny shapes, esp_timer has 1us resolution)
+#define BRIAND_TUNER_BATCH_MACS 262144
+
+/// @brief Kernels tuned by benchmark
+static const GemvKernel TUNER_CANDIDATES[] = { GemvKernel::Naive, GemvKernel::Unrolled, GemvKernel::Rows4, GemvKernel::Parallel };
+
+/// @brief Entries of this platform
+static vector<TunedShape> TUNER_TABLE;
+
+/// @brief Lines of other platforms from Load(), written back by Save()
+static vector<string> TUNER_FOREIGN;
+
+static std::mutex TUNER_LOCK;
+
+bool KernelTuner::AutoTune = true;
+uint32_t KernelTuner::BudgetUs = 2000;
+
+/// @brief One row with four accumulators
+static inline double UnrolledRow(const double* row, const double* v, const size_t& cols) {
+    double a0 = 0.0, a1 = 0.0, a2 = 0.0, a3 = 0.0;
+    size_t j = 0;
+    for (; j + 4 <= cols; j += 4) {
+        a0 += row[j] * v[j];
+        a1 += row[j + 1] * v[j + 1];
+        a2 += row[j + 2] * v[j + 2];
+        a3 += row[j + 3] * v[j + 3];
+    }
+    for (; j < cols; j++) a0 += row[j] * v[j];
+    return (a0 + a1) + (a2 + a3);
+}
+
+/// @brief Rows [begin, end) of result = M * v
+static void Gemv(const GemvKernel& kernel, const double* data, const size_t& cols, const double* v, double* result, const size_t& begin, const size_t& end) {
+    switch (kernel) {
+        case GemvKernel::Unrolled:
+        case GemvKernel::Parallel:
+            for (size_t i = begin; i < end; i++) result[i] = UnrolledRow(data + i * cols, v, cols);
+            break;
+
+        case GemvKernel::Rows4: {
+            size_t i = begin;
+            for (; i + 4 <= end; i += 4) {
+                const double* r0 = data + i * cols;
+                const double* r1 = r0 + cols;
+                const double* r2 = r1 + cols;
+                const double* r3 = r2 + cols;
+                double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+                for (size_t j = 0; j < cols; j++) {
+                    const double x = v[j];
+                    s0 += r0[j] * x;
+                    s1 += r1[j] * x;
+                    s2 += r2[j] * x;
+                    s3 += r3[j] * x;
+                }
+                result[i] = s0;
+                result[i + 1] = s1;
+                result[i + 2] = s2;
+                result[i + 3] = s3;
+            }
+            for (; i < end; i++) {
+                const double* row = data + i * cols;
+                double s = 0.0;
+                for (size_t j = 0; j < cols; j++) s += row[j] * v[j];
+                result[i] = s;
+            }
+            break;
+        }
+
+        default:
+            for (size_t i = begin; i < end; i++) {
+                const double* row = data + i * cols;
+                double s = 0.0;
+                for (size_t j = 0; j < cols; j++) s += row[j] * v[j];
+                result[i] = s;
+            }
+            break;
+    }
+}
+
+/// @brief result = M * v on raw rows in internal RAM
+static void Run(const GemvKernel& kernel, const double* data, const size_t& rows, const size_t& cols, const double* v, double* result) {
+    if (kernel != GemvKernel::Parallel || ThreadPool::Default().Workers() == 0 || rows < 2) {
+        Gemv(kernel, data, cols, v, result, 0, rows);
+        return;
+    }
+
+    // Split whatever the size: one block for each core
+    const size_t grain = std::max<size_t>(1, rows / (ThreadPool::Default().Workers() + 1));
+    ThreadPool::Default().ParallelFor(0, rows, grain, [data, cols, v, result](const size_t& begin, const size_t& end) {
+        Gemv(GemvKernel::Parallel, data, cols, v, result, begin, end);
+    });
+}
+
+string KernelTuner::Platform() {
+    string platform = BRIAND_PLATFORM;
+
+#if defined(CONFIG_IDF_TARGET)
+    platform += string("-") + CONFIG_IDF_TARGET;
+#elif defined(__x86_64__)
+    platform += "-x86_64";
+#elif defined(__aarch64__)
+    platform += "-aarch64";
+#elif defined(__arm__)
+    platform += "-arm";
+#endif
+
+    return platform + "-" + to_string(ThreadPool::Default().Workers() + 1) + "cores";
+}
+
+GemvKernel KernelTuner::Select(const size_t& rows, const size_t& cols) {
+    {
+        std::lock_guard<std::mutex> lock(TUNER_LOCK);
+        for (const auto& e : TUNER_TABLE) {
+            if (e.Rows == rows && e.Cols == cols) return e.Kernel;
+        }
+    }
+
+    return (KernelTuner::AutoTune ? KernelTuner::Tune(rows, cols) : GemvKernel::Default);
+}
+
+GemvKernel KernelTuner::Tune(const size_t& rows, const size_t& cols) {
+    if (rows == 0 || cols == 0) throw out_of_range("KernelTuner: empty shape.");
+
+    // Operands in internal RAM, like the weights that are dispatched
+    InternalVector data(rows * cols), v(cols), result(rows);
+    for (size_t i = 0; i < data.size(); i++) data[i] = static_cast<double>(i % 13) * 0.01 - 0.06;
+    for (size_t j = 0; j < cols; j++) v[j] = static_cast<double>(j % 7) * 0.1;
+
+    TunedShape entry;
+    entry.Rows = rows;
+    entry.Cols = cols;
+    entry.Kernel = GemvKernel::Default;
+    entry.Overridden = false;
+    std::fill_n(entry.Nanoseconds, 5, 0);
+
+    const size_t calls = std::max<size_t>(1, BRIAND_TUNER_BATCH_MACS / (rows * cols));
+    double best = std::numeric_limits<double>::max();
+
+    for (const auto& kernel : TUNER_CANDIDATES) {
+        // Warm up (caches, pool threads), then the best batch within the budget (at least 3 batches)
+        Run(kernel, data.data(), rows, cols, v.data(), result.data());
+
+        double fastest = std::numeric_limits<double>::max();
+        const long start = esp_timer_get_time();
+        for (size_t batch = 0; batch < 3 || esp_timer_get_time() - start < static_cast<long>(KernelTuner::BudgetUs); batch++) {
+            const long t = esp_timer_get_time();
+            for (size_t c = 0; c < calls; c++) Run(kernel, data.data(), rows, cols, v.data(), result.data());
+            fastest = std::min(fastest, static_cast<double>(esp_timer_get_time() - t) * 1000.0 / static_cast<double>(calls));
+        }
+
+        entry.Nanoseconds[static_cast<size_t>(kernel)] = static_cast<uint32_t>(std::max(1.0, std::min(fastest, 4e9)));
+        if (fastest < best) {
+            best = fastest;
+            entry.Kernel = kernel;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(TUNER_LOCK);
+    auto existing = std::find_if(TUNER_TABLE.begin(), TUNER_TABLE.end(), [&rows, &cols](const TunedShape& e) { return e.Rows == rows && e.Cols == cols; });
+    if (existing != TUNER_TABLE.end()) *existing = entry;
+    else TUNER_TABLE.push_back(entry);
+
+    return entry.Kernel;
+}
+
+size_t KernelTuner::Tune(const FCNN& network, const bool& force /*= false*/) {
+    // Distinct shapes of dense weights in internal RAM
+    vector<pair<size_t, size_t>> shapes;
+    for (size_t k = 1; k < network._layers->size(); k++) {
+        const auto& w = network._layers->at(k)->_weights;
+        if (w == nullptr || w->Tier() != MemoryTier::Internal) continue;
+
+        const auto shape = make_pair(w->Rows(), w->Cols());
+        if (std::find(shapes.begin(), shapes.end(), shape) == shapes.end()) shapes.push_back(shape);
+    }
+
+    size_t tuned = 0;
+    for (const auto& shape : shapes) {
+        if (!force) {
+            std::lock_guard<std::mutex> lock(TUNER_LOCK);
+            if (std::any_of(TUNER_TABLE.begin(), TUNER_TABLE.end(), [&shape](const TunedShape& e) { return e.Rows == shape.first && e.Cols == shape.second; })) continue;
+        }
+
+        KernelTuner::Tune(shape.first, shape.second);
+        tuned++;
+    }
+
+    return tuned;
+}
+
+void KernelTuner::Set(const size_t& rows, const size_t& cols, const GemvKernel& kernel) {
+    std::lock_guard<std::mutex> lock(TUNER_LOCK);
+
+    auto existing = std::find_if(TUNER_TABLE.begin(), TUNER_TABLE.end(), [&rows, &cols](const TunedShape& e) { return e.Rows == rows && e.Cols == cols; });
+    if (existing == TUNER_TABLE.end()) {
+        TunedShape entry;
+        entry.Rows = rows;
+        entry.Cols = cols;
+        std::fill_n(entry.Nanoseconds, 5, 0);
+        TUNER_TABLE.push_back(entry);
+        existing = TUNER_TABLE.end() - 1;
+    }
+
+    existing->Kernel = kernel;
+    existing->Overridden = true;
+}
+
+void KernelTuner::Clear() {
+    std::lock_guard<std::mutex> lock(TUNER_LOCK);
+    TUNER_TABLE.clear();
+}
+
+vector<TunedShape> KernelTuner::Entries() {
+    std::lock_guard<std::mutex> lock(TUNER_LOCK);
+    return TUNER_TABLE;
+}
+
+bool KernelTuner::Load(const string& path) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == nullptr) return false;
+
+    const string platform = KernelTuner::Platform();
+    vector<TunedShape> loaded;
+    vector<string> foreign;
+    char line[160], key[96], name[32];
+    unsigned long rows, cols;
+
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        if (line[0] == '#' || sscanf(line, "%95s %lu %lu %31s", key, &rows, &cols, name) != 4) continue;
+
+        if (platform != key) {
+            string text(line);
+            if (!text.empty() && text.back() == '\n') text.pop_back();
+            foreign.push_back(text);
+            continue;
+        }
+
+        // Unknown kernel (table of another version): skip the entry, as if the shape was never tuned
+        TunedShape entry;
+        try {
+            entry.Kernel = KernelTuner::Parse(name);
+        }
+        catch (const runtime_error&) {
+            continue;
+        }
+
+        entry.Rows = rows;
+        entry.Cols = cols;
+        entry.Overridden = true;
+        std::fill_n(entry.Nanoseconds, 5, 0);
+        loaded.push_back(entry);
+    }
+    fclose(file);
+
+    std::lock_guard<std::mutex> lock(TUNER_LOCK);
+    TUNER_FOREIGN = foreign;
+    for (const auto& entry : loaded) {
+        auto existing = std::find_if(TUNER_TABLE.begin(), TUNER_TABLE.end(), [&entry](const TunedShape& e) { return e.Rows == entry.Rows && e.Cols == entry.Cols; });
+        if (existing != TUNER_TABLE.end()) *existing = entry;
+        else TUNER_TABLE.push_back(entry);
+    }
+
+    return true;
+}
+
+bool KernelTuner::Save(const string& path) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) return false;
+
+    const string platform = KernelTuner::Platform();
+    std::lock_guard<std::mutex> lock(TUNER_LOCK);
+
+    fprintf(file, "# platform rows cols kernel (%s, %s, %s, %s, %s)\n", KernelTuner::Name(GemvKernel::Default), KernelTuner::Name(GemvKernel::Naive),
+        KernelTuner::Name(GemvKernel::Unrolled), KernelTuner::Name(GemvKernel::Rows4), KernelTuner::Name(GemvKernel::Parallel));
+    for (const auto& line : TUNER_FOREIGN) fprintf(file, "%s\n", line.c_str());
+    for (const auto& e : TUNER_TABLE) fprintf(file, "%s %lu %lu %s\n", platform.c_str(), static_cast<unsigned long>(e.Rows), static_cast<unsigned long>(e.Cols), KernelTuner::Name(e.Kernel));
+
+    const bool ok = (ferror(file) == 0);
+    fclose(file);
+    return ok;
+}
+
+void KernelTuner::Print() {
+    const auto entries = KernelTuner::Entries();
+    printf("Kernel table (%s): %u shapes\n", KernelTuner::Platform().c_str(), static_cast<unsigned int>(entries.size()));
+
+    for (const auto& e : entries) {
+        printf("  %5ux%-5u -> %-8s", static_cast<unsigned int>(e.Rows), static_cast<unsigned int>(e.Cols), KernelTuner::Name(e.Kernel));
+        if (e.Overridden) {
+            printf(" (set or loaded)\n");
+            continue;
+        }
+
+        for (const auto& kernel : TUNER_CANDIDATES) printf(" %s %uns", KernelTuner::Name(kernel), static_cast<unsigned int>(e.Nanoseconds[static_cast<size_t>(kernel)]));
+        printf("\n");
+    }
+}
+
+const char* KernelTuner::Name(const GemvKernel& kernel) {
+    switch (kernel) {
+        case GemvKernel::Naive: return "naive";
+        case GemvKernel::Unrolled: return "unrolled";
+        case GemvKernel::Rows4: return "rows4";
+        case GemvKernel::Parallel: return "parallel";
+        default: return "default";
+    }
+}
+
+GemvKernel KernelTuner::Parse(const string& name) {
+    if (name == "default") return GemvKernel::Default;
+    if (name == "naive") return GemvKernel::Naive;
+    if (name == "unrolled") return GemvKernel::Unrolled;
+    if (name == "rows4") return GemvKernel::Rows4;
+    if (name == "parallel") return GemvKernel::Parallel;
+    throw runtime_error("KernelTuner: unknown kernel " + name);
+}
+
+void KernelTuner::MultiplyVector(const GemvKernel& kernel, const Matrix& m, const double* v, double* result) {
+    if (kernel == GemvKernel::Default || m.Tier() != MemoryTier::Internal) {
+        m.MultiplyVector(v, result);
+        return;
+    }
+
+    Run(kernel, m.Data(), m.Rows(), m.Cols(), v, result);
+}
@@ -23,10 +23,26 @@
 
 #include "BriandInclude.hxx"
 #include "BriandMath.hxx"
+#include "BriandMemory.hxx"
+#include "BriandRandom.hxx"
 #include "BriandMatrix.hxx"
+#include "BriandMatrixExpression.hxx"
+#include "BriandSparse.hxx"
+#include "BriandHalf.hxx"
+#include "BriandModelBatch.hxx"
+#include "BriandTuner.hxx"
+#include "BriandFederated.hxx"
+#include "BriandLog.hxx"
+#include "BriandScheduler.hxx"
+#include "BriandServer.hxx"
+#include "BriandCluster.hxx"
+#include "BriandEmbedding.hxx"
 #include "BriandImage.hxx"
 #include "BriandSimpleNN.hxx"
 #include "BriandFCNN.hxx"
+#include "BriandStreaming.hxx"
 #include "BriandCNN.hxx"
+#include "BriandPipeline.hxx"
+#include "BriandThreadPool.hxx"
 
 #endif
\ No newline at end of file
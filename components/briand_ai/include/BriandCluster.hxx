@@ -0,0 +1,158 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_CLUSTER_H
+#define BRIAND_CLUSTER_H
+
+#include "BriandInclude.hxx"
+#include "BriandMatrix.hxx"
+#include "BriandRandom.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Result of KMeans::Fit() */
+    class KMeansResult {
+        public:
+
+        /// @brief Lloyd iterations run
+        size_t Iterations;
+
+        /// @brief Sum of squared distances of the samples to their centroid
+        double Inertia;
+
+        /// @brief Empty clusters moved to the farthest sample
+        size_t Reseeded;
+
+        /// @brief Total time and time spent in assignment (us)
+        int64_t Time, AssignTime;
+
+        /// @brief Print out the result
+        void Print() const;
+    };
+
+    /** @brief K-means clustering on samples stored in a Matrix (one sample for each row).
+        Seeding is greedy k-means++ (next centroid drawn with probability proportional to the squared distance from the nearest chosen one,
+        best of 2 + ln(k) draws).
+        Fit() runs Lloyd iterations on the whole set, PartialFit() updates the centroids with one mini-batch at a time (streaming data:
+        each centroid moves towards its samples with a per-centroid rate 1 / samples seen).
+        Assignment computes |x - c|^2 = |x|^2 - 2 x.c + |c|^2 where x.c for all the centroids is a row of X * C^T: the inner loop runs
+        over contiguous centroids (transposed copy kept with the norms), so it is vectorized, and blocks of samples are split across
+        ThreadPool::Default() if above Matrix::ParallelThreshold.
+        Predict() is a nearest centroid lookup (Clusters() x Dimensions() values, no allocations), small enough for ESP32.
+    */
+    class KMeans {
+        protected:
+
+        /// @brief Centroids (clusters x dimensions)
+        unique_ptr<Matrix> _centroids;
+
+        /// @brief Centroids transposed (dimensions x clusters) and squared norms, refreshed after each update
+        unique_ptr<Matrix> _transposed;
+        unique_ptr<vector<double>> _norms;
+
+        /// @brief Samples seen by each centroid (PartialFit() rates)
+        unique_ptr<vector<size_t>> _counts;
+
+        /// @brief Seeding generator
+        Philox _generator;
+
+        /// @brief Centroids were seeded
+        bool _seeded;
+
+        /// @brief Check the samples matrix
+        void CheckSamples(const Matrix& samples, const size_t& minimum) const;
+
+        /// @brief Recompute the transposed centroids and the norms
+        void Refresh();
+
+        /// @brief Nearest centroid of samples [begin, end) (single thread)
+        /// @param samples Samples
+        /// @param begin First sample
+        /// @param end Last sample (excluded)
+        /// @param labels Output labels (samples size)
+        /// @param distances Output squared distances (samples size)
+        /// @param dots Scratch (4 x clusters)
+        void AssignRows(const Matrix& samples, const size_t& begin, const size_t& end, size_t* labels, double* distances, double* dots) const;
+
+        public:
+
+        /// @brief Build an empty model (centroids are seeded by the first Fit() or PartialFit())
+        /// @param clusters Clusters (k)
+        /// @param dimensions Sample size
+        /// @param seed Seed of k-means++
+        KMeans(const size_t& clusters, const size_t& dimensions, const uint64_t& seed = 0);
+
+        ~KMeans();
+
+        /// @brief Clusters
+        /// @return k
+        size_t Clusters() const;
+
+        /// @brief Sample size
+        /// @return dimensions
+        size_t Dimensions() const;
+
+        /// @brief Centroids (one for each row)
+        /// @return centroids
+        const Matrix& Centroids() const;
+
+        /// @brief Set the centroids (as seeded, next Fit() starts from them)
+        /// @param centroids Centroids (clusters x dimensions)
+        void SetCentroids(const Matrix& centroids);
+
+        /// @brief Choose the initial centroids from the samples with k-means++
+        /// @param samples Samples (at least Clusters() rows)
+        void Seed(const Matrix& samples);
+
+        /// @brief Lloyd iterations until no centroid moves more than tolerance (seeds first if needed)
+        /// @param samples Samples (at least Clusters() rows)
+        /// @param maxIterations Max iterations
+        /// @param tolerance Max centroid shift to stop (euclidean)
+        /// @return Result
+        unique_ptr<KMeansResult> Fit(const Matrix& samples, const size_t& maxIterations = 100, const double& tolerance = 1e-4);
+
+        /// @brief Mini-batch update (seeds with the first batch)
+        /// @param batch Samples of the batch (at least Clusters() rows for the first call)
+        /// @return Inertia of the batch before the update
+        double PartialFit(const Matrix& batch);
+
+        /// @brief Nearest centroid of all the samples
+        /// @param samples Samples
+        /// @param labels Output labels (resized)
+        /// @param distances Output squared distances (resized, may be nullptr)
+        /// @return Inertia (sum of squared distances)
+        double Assign(const Matrix& samples, vector<size_t>& labels, vector<double>* distances = nullptr) const;
+
+        /// @brief Nearest centroid of a sample
+        /// @param sample Sample (Dimensions() values)
+        /// @return Cluster
+        size_t Predict(const double* sample) const;
+
+        /// @brief Nearest centroid of a sample
+        /// @param sample Sample
+        /// @return Cluster
+        size_t Predict(const vector<double>& sample) const;
+
+        /// @brief Print out the centroids
+        void Print() const;
+    };
+}
+
+#endif
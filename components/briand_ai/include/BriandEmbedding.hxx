@@ -0,0 +1,242 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_EMBEDDING_H
+#define BRIAND_EMBEDDING_H
+
+#include "BriandInclude.hxx"
+#include "BriandMatrix.hxx"
+#include "BriandStreaming.hxx"
+#include "BriandCluster.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Storage of the vectors of an EmbeddingIndex */
+    enum class EmbeddingPrecision : uint8_t {
+        /// @brief 4 bytes for each value
+        Float32 = 0,
+        /// @brief 1 byte for each value and a scale for each vector (symmetric, max abs value = 127)
+        Int8 = 1
+    };
+
+    /** @brief A search result */
+    class EmbeddingMatch {
+        public:
+
+        /// @brief Identity
+        uint32_t Id;
+
+        /// @brief Cosine similarity (-1 to 1)
+        float Similarity;
+
+        /// @brief L2 distance of the normalized vectors, sqrt(2 - 2 x Similarity) (same order, reversed)
+        float Distance;
+    };
+
+    /** @brief Similarity index of embeddings (e.g. face embeddings of enrolled identities).
+        Vectors are normalized on Enroll() and stored contiguously as Float32 or Int8 (4x smaller, similarity from int32 dot products),
+        so cosine similarity is a dot product and L2 distance follows from it.
+        Search() scans the stored vectors computing the dot products with unrolled loops the compiler vectorizes and keeps the top k;
+        SearchBatch() scans each vector once for 4 queries at a time and splits the queries across ThreadPool::Default().
+        Enroll()/Remove() are incremental (a removed vector is replaced by the last one of its list, nothing is rebuilt).
+        Partition() splits the vectors in lists around k-means centroids (IVF): Search() then scans only the Probes lists with the
+        nearest centroids, new vectors go to the list of their nearest centroid.
+        Save() writes a format (header, centroids, then ids, scales and vectors of each list, 16 bytes aligned) that Map() uses in place
+        from a flash partition (esp_partition_mmap()): a mapped index is searched without copies but cannot be changed.
+    */
+    class EmbeddingIndex {
+        protected:
+
+        /// @brief Vectors of a list (in RAM)
+        class EmbeddingList {
+            public:
+            vector<uint32_t> Ids;
+            vector<float> Scales;
+            vector<float> Vectors;
+            vector<int8_t> Codes;
+        };
+
+        /// @brief Vectors of a list (in RAM or mapped)
+        class ListView {
+            public:
+            size_t Count;
+            const uint32_t* Ids;
+            const float* Scales;
+            const float* Vectors;
+            const int8_t* Codes;
+        };
+
+        /// @brief Dimensions and precision
+        size_t _dimensions;
+        EmbeddingPrecision _precision;
+
+        /// @brief Lists (one if not partitioned, nullptr if mapped)
+        unique_ptr<vector<EmbeddingList>> _lists;
+
+        /// @brief Views of the lists, used by searches
+        unique_ptr<vector<ListView>> _views;
+
+        /// @brief Normalized centroids of the lists (lists x dimensions, empty if not partitioned) and pointer to them (RAM or mapped)
+        unique_ptr<vector<float>> _centroids;
+        const float* _centroidData;
+
+        /// @brief List and position of each identity (list << 32 | position, nullptr if mapped)
+        unique_ptr<unordered_map<uint32_t, uint64_t>> _where;
+
+        /// @brief Vectors stored
+        size_t _size;
+
+        /// @brief Mapping of a mapped index
+        bool _mapped;
+        esp_partition_mmap_handle_t _mapping;
+
+        /// @brief Build the views of all the RAM lists
+        void RefreshViews();
+
+        /// @brief Build the view of a RAM list (after it changed)
+        void RefreshView(const size_t& list);
+
+        /// @brief Throw if the index is mapped
+        void CheckWritable() const;
+
+        /// @brief Normalize (throws if zero)
+        void Normalize(const double* embedding, float* normalized) const;
+
+        /// @brief Quantize a normalized vector
+        void Quantize(const float* normalized, int8_t* codes, float& scale) const;
+
+        /// @brief Nearest centroid list (0 if not partitioned)
+        size_t NearestList(const float* normalized) const;
+
+        /// @brief Append a vector to a list
+        void Append(const size_t& list, const uint32_t& id, const float* normalized, const int8_t* codes, const float& scale);
+
+        /// @brief Lists to scan for a query (nearest Probes centroids)
+        void ChooseLists(const float* normalized, vector<size_t>& lists) const;
+
+        /// @brief Scan a list for up to 4 queries, keeping the top k of each
+        void ScanList(const ListView& list, const size_t& queries, const float* const* normalized, const int8_t* const* codes, const float* scales,
+            const size_t& k, vector<EmbeddingMatch>* const* top) const;
+
+        /// @brief Build an empty index, no checks
+        EmbeddingIndex();
+
+        public:
+
+        /// @brief Lists scanned by Search() when partitioned (nearest centroids)
+        size_t Probes = 8;
+
+        /// @brief Build an empty index
+        /// @param dimensions Embedding size
+        /// @param precision Storage precision
+        EmbeddingIndex(const size_t& dimensions, const EmbeddingPrecision& precision = EmbeddingPrecision::Float32);
+
+        /// @brief Release the index (and the mapping)
+        ~EmbeddingIndex();
+
+        /// @brief Embedding size
+        /// @return dimensions
+        size_t Dimensions() const;
+
+        /// @brief Storage precision
+        /// @return precision
+        EmbeddingPrecision Precision() const;
+
+        /// @brief Identities enrolled
+        /// @return size
+        size_t Size() const;
+
+        /// @brief Lists (1 if not partitioned)
+        /// @return lists
+        size_t Lists() const;
+
+        /// @brief Index is mapped from flash (read only)
+        /// @return true if mapped
+        bool Mapped() const;
+
+        /// @brief Bytes of vectors, scales and ids
+        /// @return bytes
+        size_t Bytes() const;
+
+        /// @brief Enroll an identity (replaces its vector if already enrolled)
+        /// @param id Identity
+        /// @param embedding Embedding (Dimensions() values, any norm but zero)
+        void Enroll(const uint32_t& id, const double* embedding);
+
+        /// @brief Enroll an identity (replaces its vector if already enrolled)
+        /// @param id Identity
+        /// @param embedding Embedding (any norm but zero)
+        void Enroll(const uint32_t& id, const vector<double>& embedding);
+
+        /// @brief Remove an identity
+        /// @param id Identity
+        /// @return false if not enrolled
+        bool Remove(const uint32_t& id);
+
+        /// @brief Identity is enrolled
+        /// @param id Identity
+        /// @return true if enrolled
+        bool Contains(const uint32_t& id) const;
+
+        /// @brief Split the vectors in lists around k-means centroids (1 = no partitions)
+        /// @param lists Lists (about sqrt(Size()) is a good start)
+        /// @param iterations K-means iterations (trained on up to 64 vectors for each list)
+        /// @param seed K-means seed
+        void Partition(const size_t& lists, const size_t& iterations = 10, const uint64_t& seed = 0);
+
+        /// @brief Most similar identities
+        /// @param query Query embedding (Dimensions() values)
+        /// @param k Results
+        /// @param matches Output matches, most similar first (up to k)
+        void Search(const double* query, const size_t& k, vector<EmbeddingMatch>& matches) const;
+
+        /// @brief Most similar identities
+        /// @param query Query embedding
+        /// @param k Results
+        /// @param matches Output matches, most similar first (up to k)
+        void Search(const vector<double>& query, const size_t& k, vector<EmbeddingMatch>& matches) const;
+
+        /// @brief Most similar identities of many queries
+        /// @param queries Query embeddings (one for each row)
+        /// @param k Results
+        /// @param matches Output matches of each query (resized)
+        void SearchBatch(const Matrix& queries, const size_t& k, vector<vector<EmbeddingMatch>>& matches) const;
+
+        /// @brief Save the index
+        /// @param store Store
+        /// @return Bytes written
+        size_t Save(WeightStore& store) const;
+
+        /// @brief Load an index saved by Save() in RAM (can be changed)
+        /// @param store Store
+        /// @return Index
+        static unique_ptr<EmbeddingIndex> Load(WeightStore& store);
+
+        /// @brief Map an index saved by Save() in a data partition: used in place, read only
+        /// @param label Partition label
+        /// @return Index
+        static unique_ptr<EmbeddingIndex> Map(const string& label);
+
+        /// @brief Print out size and layout
+        void Print() const;
+    };
+}
+
+#endif
@@ -22,12 +22,299 @@
 #include "BriandInclude.hxx"
 #include "BriandMatrix.hxx"
 #include "BriandMath.hxx"
+#include "BriandSparse.hxx"
+#include "BriandHalf.hxx"
+#include "BriandTuner.hxx"
+#include "BriandRandom.hxx"
+#include "BriandLog.hxx"
 
 using namespace std;
 using namespace Briand;
 
 namespace Briand {
 
+    /** @brief Mutable activation state of a FCNN for one thread.
+        The model (weights, biases, activations) is never modified by const inference, so many threads can share
+        the same FCNN each one with its own context. Create with FCNN::CreateContext(), all memory is allocated there.
+    */
+    class ExecutionContext {
+        public:
+
+        /// @brief Neuron net values, one vector for each layer. For the input layer this is the input with bias added.
+        unique_ptr<vector<unique_ptr<vector<double>>>> Net;
+
+        /// @brief Neuron activated values, one vector for each layer. For the input layer this is the input.
+        unique_ptr<vector<unique_ptr<vector<double>>>> Out;
+
+        /// @brief Exit head net and output values (size of the output layer, see FCNN::AddExitHead())
+        unique_ptr<vector<double>> HeadNet;
+        unique_ptr<vector<double>> HeadOut;
+
+        /// @brief Layer that produced the latest result (output layer index = no early exit)
+        size_t Exit;
+
+        /// @brief Net and Out hold a whole forward of the latest inputs (see FCNN::PredictIncremental())
+        bool Cached;
+
+        /// @brief Incremental updates since the latest full forward
+        size_t Updates;
+
+        /// @brief Changed inputs of the layer being updated (indexes and differences) and previous outputs of a layer (capacity of the largest layer)
+        unique_ptr<vector<size_t>> Changed;
+        unique_ptr<vector<double>> Difference;
+        unique_ptr<vector<double>> Previous;
+
+        /// @brief Build a context
+        /// @param layerSizes Neurons of each layer
+        ExecutionContext(const vector<size_t>& layerSizes);
+    };
+
+    /** @brief Training samples for FCNN::Fit(). Samples are accessed by index, never copied while training. */
+    class Dataset {
+        public:
+
+        /// @brief Input values of each sample
+        unique_ptr<vector<vector<double>>> Inputs;
+
+        /// @brief Target values of each sample
+        unique_ptr<vector<vector<double>>> Targets;
+
+        /// @brief Build an empty dataset
+        Dataset();
+
+        /// @brief Add a sample
+        /// @param input Input values
+        /// @param target Target values
+        void Add(const vector<double>& input, const vector<double>& target);
+
+        /// @brief Number of samples
+        /// @return samples
+        size_t Size() const;
+    };
+
+    /** @brief Options of FCNN::Fit() */
+    class FitOptions {
+        public:
+
+        /// @brief Max epochs
+        size_t Epochs = 100;
+
+        /// @brief Learning rate
+        double LearningRate = 0.1;
+
+        /// @brief Samples for each weights update (1 = update after each sample like Train())
+        size_t BatchSize = 1;
+
+        /// @brief Shuffle samples order at each epoch
+        bool Shuffle = true;
+
+        /// @brief Seed for shuffling and validation split
+        uint64_t Seed = 0;
+
+        /// @brief Validation dataset (nullptr = use ValidationSplit)
+        const Dataset* Validation = nullptr;
+
+        /// @brief Fraction of samples held out for validation when Validation is nullptr (0 = no validation, training loss is monitored)
+        double ValidationSplit = 0.0;
+
+        /// @brief Stop after this number of epochs without improvement of the monitored loss (0 = never)
+        size_t Patience = 10;
+
+        /// @brief Minimum loss decrease to be an improvement
+        double MinDelta = 1e-6;
+
+        /// @brief Stop when the monitored loss is less or equal than this (0 = never)
+        double TargetLoss = 0.0;
+
+        /// @brief At the end restore the weights of the best epoch
+        bool RestoreBest = true;
+
+        /// @brief Print statistics every this number of epochs (0 = never)
+        size_t PrintEvery = 0;
+    };
+
+    /** @brief Statistics of one Fit() epoch */
+    class FitEpoch {
+        public:
+
+        /// @brief Epoch number (from 1)
+        size_t Epoch;
+
+        /// @brief Mean training loss (measured while training)
+        double TrainLoss;
+
+        /// @brief Mean validation loss (-1 if no validation)
+        double ValidationLoss;
+
+        /// @brief Training time (us)
+        long Time;
+
+        /// @brief Training throughput
+        double SamplesPerSecond;
+    };
+
+    /** @brief Result of FCNN::Fit() */
+    class FitResult {
+        public:
+
+        /// @brief Statistics of each epoch
+        unique_ptr<vector<FitEpoch>> History;
+
+        /// @brief Epoch with the best monitored loss
+        size_t BestEpoch;
+
+        /// @brief Best monitored loss
+        double BestLoss;
+
+        /// @brief True if stopped before max epochs (plateau or target loss)
+        bool StoppedEarly;
+
+        /// @brief Total time (us)
+        long Time;
+
+        FitResult();
+
+        /// @brief Print out a summary
+        void Print() const;
+    };
+
+    /** @brief Options of FCNN::PruneNeurons() */
+    class NeuronPruningOptions {
+        public:
+
+        /// @brief Neurons whose output magnitude never exceeds this on the dataset are dead and always removed
+        double DeadThreshold = 1e-6;
+
+        /// @brief Neurons scoring (mean |output| * norm of outgoing weights) less than this fraction of the layer mean score are removed
+        double ScoreThreshold = 0.1;
+
+        /// @brief Max fraction of neurons removed from each hidden layer (at least one neuron is kept)
+        double MaxRemoval = 0.5;
+
+        /// @brief Fine tuning after pruning (FineTune.Epochs = 0: no fine tuning, default)
+        FitOptions FineTune;
+
+        NeuronPruningOptions();
+    };
+
+    /** @brief Result of FCNN::PruneNeurons() */
+    class NeuronPruningResult {
+        public:
+
+        /// @brief Neurons of each layer before and after pruning
+        unique_ptr<vector<size_t>> Before;
+        unique_ptr<vector<size_t>> After;
+
+        /// @brief Dead neurons removed
+        size_t Dead;
+
+        /// @brief All neurons removed (dead and low score)
+        size_t Removed;
+
+        /// @brief Weights memory before and after pruning (bytes)
+        size_t WeightsBefore, WeightsAfter;
+
+        /// @brief Fine tuning statistics (nullptr = no fine tuning)
+        unique_ptr<FitResult> FineTune;
+
+        NeuronPruningResult();
+
+        /// @brief Print out a summary
+        void Print() const;
+    };
+
+    /** @brief Batch normalization of the net values of a hidden layer, before activation: y = Gamma * (net - Mean) / sqrt(Variance + Epsilon) + Beta.
+        Training is per sample (or mini-batches of per-sample gradients), so net values are normalized with running statistics updated at each training sample
+        (exponential moving mean and variance), taken as constants by backpropagation. Gamma and Beta are trained.
+        FCNN::OptimizeForInference() folds it into the layer weights and bias: the deployed network pays nothing for it.
+    */
+    class BatchNormalization {
+        public:
+
+        /// @brief Scale and shift of each neuron (trained, initialized to 1 and 0)
+        unique_ptr<vector<double>> Gamma;
+        unique_ptr<vector<double>> Beta;
+
+        /// @brief Running mean and variance of the net values of each neuron (initialized to 0 and 1)
+        unique_ptr<vector<double>> Mean;
+        unique_ptr<vector<double>> Variance;
+
+        /// @brief Weight of a new sample in running statistics
+        double Momentum;
+
+        /// @brief Added to the variance (no division by zero)
+        double Epsilon;
+
+        /// @brief Training buffers: net values before normalization of latest Propagate(), normalized values and delta (on y) of latest Backpropagate()
+        unique_ptr<vector<double>> Linear;
+        unique_ptr<vector<double>> Normalized;
+        unique_ptr<vector<double>> Delta;
+
+        /// @brief Accumulated Gamma and Beta gradients for mini-batches (allocated at first use)
+        unique_ptr<vector<double>> GammaGradient;
+        unique_ptr<vector<double>> BetaGradient;
+
+        /// @brief Build an identity normalization
+        /// @param neurons Neurons of the layer
+        /// @param momentum Weight of a new sample in running statistics
+        /// @param epsilon Added to the variance
+        BatchNormalization(const size_t& neurons, const double& momentum, const double& epsilon);
+
+        /// @brief Deep copy of parameters and running statistics (training buffers are not copied)
+        /// @param other Normalization
+        BatchNormalization(const BatchNormalization& other);
+
+        /// @brief Scale applied to (net - Mean) of a neuron: Gamma / sqrt(Variance + Epsilon)
+        /// @param i Neuron
+        /// @return scale
+        double Scale(const size_t& i) const;
+
+        /// @brief Add a sample to running statistics (net values before normalization of latest Propagate())
+        void Update();
+    };
+
+    /** @brief Early exit classifier attached after a hidden layer: p = softmax(Weights * out + Bias), where out is the output of the layer.
+        Trained jointly with the network (cross-entropy on the same targets, scaled by LossWeight, added to the layer delta).
+        At inference, when the highest probability reaches the exit threshold the network returns p without running the next layers.
+        See FCNN::AddExitHead().
+    */
+    class ExitHead {
+        public:
+
+        /// @brief Weights (1 row for each class, 1 column for each neuron of the layer) and bias
+        unique_ptr<Matrix> Weights;
+        unique_ptr<vector<double>> Bias;
+
+        /// @brief Weight of the head loss in the training loss
+        double LossWeight;
+
+        /// @brief Training buffers: net values, probabilities and delta (scaled by LossWeight) of latest Backpropagate()
+        unique_ptr<vector<double>> Net;
+        unique_ptr<vector<double>> Out;
+        unique_ptr<vector<double>> Delta;
+
+        /// @brief Accumulated gradients for mini-batches (allocated at first use)
+        unique_ptr<Matrix> WeightsGradient;
+        unique_ptr<vector<double>> BiasGradient;
+
+        /// @brief Build a head with zero weights
+        /// @param classes Classes (outputs of the network)
+        /// @param neurons Neurons of the layer
+        /// @param lossWeight Weight of the head loss
+        ExitHead(const size_t& classes, const size_t& neurons, const double& lossWeight);
+
+        /// @brief Deep copy of weights and bias (training buffers are not copied)
+        /// @param other Head
+        ExitHead(const ExitHead& other);
+
+        /// @brief Classify a layer output. No allocations.
+        /// @param in Layer output
+        /// @param net Net values (classes)
+        /// @param out Probabilities (classes)
+        /// @return Confidence (highest probability)
+        double Forward(const vector<double>& in, vector<double>& net, vector<double>& out) const;
+    };
+
     /** @brief A layer of neurons */
     class NeuralLayer {
         protected:
@@ -35,6 +322,15 @@ namespace Briand {
         /// @brief Weights FROM PREVIOUS LAYER
         unique_ptr<Matrix> _weights;
 
+        /// @brief Sparse copy of _weights used by inference when the layer is sparse enough (nullptr = dense). See FCNN::OptimizeSparse()
+        unique_ptr<SparseMatrix> _sparseWeights;
+
+        /// @brief FP16/BF16 copy of _weights used by inference (nullptr = full precision). _weights stays the master copy for training. See FCNN::SetWeightPrecision()
+        unique_ptr<HalfMatrix> _halfWeights;
+
+        /// @brief Pruning mask (true = weight kept), nullptr if never pruned. Train() keeps pruned weights at zero.
+        unique_ptr<vector<bool>> _pruneMask;
+
         /// @brief Neuron net values (weighted sum)
         unique_ptr<vector<double>> _neuronsNet;
 
@@ -47,6 +343,12 @@ namespace Briand {
         /// @brief Delta of this layer
         unique_ptr<vector<double>> _delta;
 
+        /// @brief Accumulated weights gradient for mini-batches (allocated at first use)
+        unique_ptr<Matrix> _gradient;
+
+        /// @brief Accumulated bias gradient for mini-batches (allocated at first use)
+        unique_ptr<vector<double>> _biasGradient;
+
         /// @brief Layer type
         LayerType _type;
 
@@ -62,6 +364,15 @@ namespace Briand {
         /// @brief Error calculation function derivative
         ErrorFunction _dE;
 
+        /// @brief Softmax output layer with cross-entropy error (fused gradient output - target)
+        bool _softmax;
+
+        /// @brief Batch normalization of net values before activation (hidden layers only, nullptr = none). See FCNN::AddBatchNormalization()
+        unique_ptr<BatchNormalization> _batchNorm;
+
+        /// @brief Early exit classifier on the output of this layer (hidden layers only, nullptr = none). See FCNN::AddExitHead()
+        unique_ptr<ExitHead> _exitHead;
+
         public:
 
         /// @brief Builds a layer.
@@ -103,10 +414,100 @@ namespace Briand {
         /// @param bias_weights The bias weight vector (value always 1)
         void SetBiasWeights(const vector<double>& bias_weights);
 
+        /// @brief Forward this layer without touching its state: net = W * in + bias (normalized if batch normalization), out = f(net). No allocations.
+        /// @param in Previous layer output (if input layer with bias, the bias must already be added)
+        /// @param net Output net values (size of this layer)
+        /// @param out Output activated values (size of this layer)
+        /// @param linear If not nullptr, net values before batch normalization are copied here (training)
+        void Forward(const vector<double>& in, vector<double>& net, vector<double>& out, vector<double>* linear = nullptr) const;
+
+        /// @brief Number of neurons
+        /// @return neurons
+        size_t Neurons() const;
+
+        /// @brief Memory used by the weights actually used by inference (sparse, half precision or dense)
+        /// @return bytes
+        size_t WeightsMemory() const;
+
+        /// @brief Set to zero the weights removed by pruning
+        void ApplyPruneMask();
+
+        /// @brief Drop the inference copies of weights (sparse, half precision), stale after weights changes
+        /// @return true if there was a copy
+        bool DropWeightCopies();
+
         /* The FCNN class can access to all properties and methods */
         friend class FCNN;
+        friend class CompiledFCNN;
+        friend class StreamedFCNN;
+        friend class ModelBatch;
+        friend class KernelTuner;
+        friend class FederatedCodec;
+        friend class InferenceServer;
     }; 
 
+    /** @brief Compile modes of FCNN::Compile() */
+    enum class CompileMode {
+        Inference,  // Forward only: activations ping-pong in one arena sized to the largest adjacent layer pair
+        Training    // Forward and SGD training: net/out of all layers kept for backpropagation, deltas ping-pong
+    };
+
+    /** @brief One step of a compiled FCNN (one layer): net = W * in (+ bias), out = f(net). All pointers are resolved at compile time. */
+    class FCNNKernel {
+        public:
+
+        /// @brief Dense weights (nullptr if Sparse or Half is used)
+        const Matrix* Dense;
+
+        /// @brief Dense weights rows (nullptr if Sparse or Half is used)
+        double* const* Weights;
+
+        /// @brief Sparse weights (nullptr = dense)
+        const SparseMatrix* Sparse;
+
+        /// @brief Half precision weights (nullptr = dense)
+        const HalfMatrix* Half;
+
+        /// @brief Dense GEMV variant (see KernelTuner)
+        GemvKernel Gemv;
+
+        /// @brief Bias weights (nullptr = no bias)
+        double* Bias;
+
+        /// @brief Rows (layer neurons) and columns (previous layer neurons)
+        size_t Rows, Cols;
+
+        /// @brief Activation function and its derivative
+        ActivationFunction F, DF;
+
+        /// @brief Softmax on net values (F is not used)
+        bool Softmax;
+
+        /// @brief Input (previous layer output), net and output values. Net and Out are the same buffer in inference.
+        const double* In;
+        double* Net;
+        double* Out;
+    };
+
+    /** @brief Backward step of a compiled FCNN layer (training mode only) */
+    class FCNNGradientKernel {
+        public:
+
+        /// @brief Delta of this layer and of the previous layer (nullptr if not needed)
+        double* Delta;
+        double* PreviousDelta;
+
+        /// @brief Previous layer net values and activation derivative (nullptr for the first layer: input layer has no activation)
+        const double* PreviousNet;
+        ActivationFunction PreviousDF;
+
+        /// @brief Layer (for pruning mask)
+        NeuralLayer* Layer;
+    };
+
+    // Early declaration of CompiledFCNN class needed in FCNN.
+    class CompiledFCNN;
+
     /// @brief An empty Neural Network, without layers, neurons and connections.
     /// Has no particular methods, just basic data structure and propagation forward.
     /// Use it when you know what you are doing!
@@ -119,6 +520,47 @@ namespace Briand {
         /// @brief true when output layer is set
         bool _hasOutputs;
 
+        /// @brief Initializer of weights for layers added without weights
+        WeightInitializer _initializer;
+
+        /// @brief Own generator when seeded (nullptr = default generator)
+        unique_ptr<Philox> _generator;
+
+        /// @brief Incremented when layers or weights storage change (compiled plans hold raw pointers, see Compile())
+        size_t _revision;
+
+        /// @brief Exit heads confidence threshold (> 1 = never exit) and layer that produced the latest Propagate() result
+        double _exitThreshold;
+        size_t _exit;
+
+        /// @brief Initialize weights of a new layer with current initializer and generator
+        /// @param weights Weights matrix
+        /// @param activation Layer activation function
+        void InitializeWeights(Matrix& weights, const ActivationFunction& activation);
+
+        /// @brief Forward and backward pass: computes deltas of all layers, weights are not changed
+        /// @param inputs Inputs
+        /// @param targets Targets
+        /// @return Total error
+        double Backpropagate(const vector<double>& inputs, const vector<double>& targets);
+
+        /// @brief Update weights and biases with the deltas of latest Backpropagate()
+        /// @param learningRate Learning rate
+        void UpdateWeights(const double& learningRate);
+
+        /// @brief Add the gradients of latest Backpropagate() to the mini-batch gradients
+        void AccumulateGradients();
+
+        /// @brief Update weights with the mean of accumulated gradients and reset them
+        /// @param learningRate Learning rate
+        /// @param samples Samples accumulated
+        void ApplyGradients(const double& learningRate, const size_t& samples);
+
+        /// @brief Output of layer k-1 seen by layer k (input with bias for the first hidden layer)
+        /// @param k Layer index (> 0)
+        /// @return Input vector of layer k
+        const vector<double>& LayerInput(const size_t& k) const;
+
         public:
         
         /// @brief Build empty FCNN
@@ -126,6 +568,14 @@ namespace Briand {
 
         ~FCNN();
 
+        /// @brief Set the weights initializer for next AddHiddenLayer/AddOutputLayer without weights (default Uniform in [0, 1))
+        /// @param initializer Initializer
+        void SetInitializer(const WeightInitializer& initializer);
+
+        /// @brief Use an own generator with this seed for weights initialization (same seed = same network)
+        /// @param seed Seed
+        void SetSeed(const uint64_t& seed);
+
         /// @brief Adds input layer (can be called only once). STARTS THE NETWORK CREATION (must be first layer)
         /// @param inputs Number of inputs
         void AddInputLayer(const size_t& inputs);
@@ -168,16 +618,81 @@ namespace Briand {
         /// @param errorFuncDer Error/cost function derivative
         /// @param weights Weights from previous layer (must have 1 row for each layer's neuron, 1 column for each previous layer neuron)
         void AddOutputLayer(const size_t& outputs, const ActivationFunction& activationFunc, const ActivationFunction& activationDer, const ErrorFunction& errorFunc, const ErrorFunction& errorFuncDer, const Matrix& weights);
-    
+
+        /// @brief Adds a softmax output layer with cross-entropy error (can be called only once), for classifiers with one-hot targets.
+        /// Softmax uses log-sum-exp (no overflow) and training uses the fused gradient (output - target), no Jacobian.
+        /// CLOSES THE NETWORK CREATION (must be latest layer)
+        /// @param outputs Number of outputs (classes)
+        void AddSoftmaxOutputLayer(const size_t& outputs);
+
+        /// @brief Adds a softmax output layer with cross-entropy error and weights. See AddSoftmaxOutputLayer().
+        /// @param outputs Number of outputs (classes)
+        /// @param weights Weights from previous layer (must have 1 row for each layer's neuron, 1 column for each previous layer neuron)
+        void AddSoftmaxOutputLayer(const size_t& outputs, const Matrix& weights);
+
+        /// @brief Add batch normalization to the latest hidden layer: its net values are normalized before activation. See BatchNormalization.
+        /// Fold it with OptimizeForInference() before Compile(), StreamedFCNN, ModelBatch or PruneNeurons().
+        /// @param momentum Weight of a new sample in running statistics
+        /// @param epsilon Added to the variance
+        void AddBatchNormalization(const double& momentum = 0.001, const double& epsilon = 1e-5);
+
+        /// @brief Add an early exit classifier after the latest hidden layer, trained jointly with the network. See ExitHead.
+        /// Targets must be one-hot (the head has a softmax output with cross-entropy loss). The training loss returned stays the output layer one.
+        /// Exits are taken by Propagate(), Predict() and PredictAnytime() only: Compile(), StreamedFCNN and ModelBatch always run the whole network.
+        /// @param classes Classes (must be equal to the outputs of the network)
+        /// @param lossWeight Weight of the head loss
+        void AddExitHead(const size_t& classes, const double& lossWeight = 0.5);
+
+        /// @brief Set the confidence needed to return the answer of an exit head (highest probability >= threshold)
+        /// @param threshold Threshold (> 1 = never exit, default)
+        void SetExitThreshold(const double& threshold);
+
+        /// @brief Layer that produced the latest Propagate() result
+        /// @return Layer index (output layer index = no early exit)
+        size_t ExitLayer() const;
+
         /// @brief Propagates (forward).
-        void Propagate();
+        /// @param earlyExit Stop at the first exit head reaching the threshold (see SetExitThreshold()), GetResult() then returns its answer
+        void Propagate(const bool& earlyExit = true);
 
-        /// @brief Propagates the input forward and returns output neurons values
+        /// @brief Propagates the input forward and returns output neurons values (or the answer of an exit head, see SetExitThreshold())
         /// @param values Input values
         /// @return Output neurons values (result)
         unique_ptr<vector<double>> Predict(const vector<double>& inputs);
 
-        /// @brief Returns output neurons values after a Propagate()
+        /// @brief Create a new execution context for this network (one for each thread calling the const Predict)
+        /// @return context
+        unique_ptr<ExecutionContext> CreateContext() const;
+
+        /// @brief Thread-safe inference: the network is not modified, all the state is kept in context.
+        /// @param context Execution context (from CreateContext(), not shared between threads)
+        /// @param inputs Input values
+        /// @param outputs Output values (resized only if needed)
+        void Predict(ExecutionContext& context, const vector<double>& inputs, vector<double>& outputs) const;
+
+        /// @brief Thread-safe inference with a time budget: when the budget runs out the answer of the deepest exit head computed so far is returned.
+        /// If no head answered yet the forward continues to the next one (or to the output). Heads reaching the exit threshold still stop early.
+        /// @param context Execution context (from CreateContext(), not shared between threads)
+        /// @param inputs Input values
+        /// @param outputs Output values (resized only if needed)
+        /// @param budgetUs Time budget (us)
+        /// @return Layer that produced the answer (output layer index = whole network)
+        size_t PredictAnytime(ExecutionContext& context, const vector<double>& inputs, vector<double>& outputs, const int64_t& budgetUs) const;
+
+        /// @brief Thread-safe incremental inference for inputs that change little between calls: the context keeps the net values of the previous call.
+        /// Only changed inputs are propagated: for each layer net += W[:, j] * (in_j - previous in_j) over the changed inputs j, then the activation.
+        /// A layer is fully recomputed (GEMV) when more than maxChanged of its inputs changed, or when it has sparse or 16 bit weights or batch normalization.
+        /// Every refreshEvery calls (and at the first call, or after another Predict with the same context) the whole network is recomputed to bound
+        /// rounding drift. Results match Predict() up to rounding. Exit heads are not used.
+        /// @param context Execution context (from CreateContext(), not shared between threads, one for each input stream)
+        /// @param inputs Input values
+        /// @param outputs Output values (resized only if needed)
+        /// @param maxChanged Max fraction of changed inputs of a layer to update it incrementally (0-1)
+        /// @param refreshEvery Incremental calls between full recomputations
+        /// @return Layers updated incrementally (0 = full forward)
+        size_t PredictIncremental(ExecutionContext& context, const vector<double>& inputs, vector<double>& outputs, const double& maxChanged = 0.4, const size_t& refreshEvery = 1000) const;
+
+        /// @brief Returns output neurons values after a Propagate() (the exit head answer if it exited early, see ExitLayer())
         /// @return Output neurons values (result)
         unique_ptr<vector<double>> GetResult();
 
@@ -188,8 +703,196 @@ namespace Briand {
         /// @return Total error (sum of errors)
         double Train(const vector<double>& inputs, const vector<double>& targets, const double& learningRate);
 
+        /// @brief Train for many epochs on a dataset: shuffled index permutation, optional mini-batches,
+        /// validation on a background thread against a snapshot of the weights, early stopping on plateau.
+        /// The validation loss of epoch N is known while epoch N+1 trains, so early stopping may run one epoch more.
+        /// @param dataset Training samples
+        /// @param options Options
+        /// @return Statistics
+        unique_ptr<FitResult> Fit(const Dataset& dataset, const FitOptions& options);
+
+        /// @brief Mean loss (sum of output errors for each sample) on the given samples, network is not modified
+        /// @param context Execution context
+        /// @param dataset Samples
+        /// @param indexes Samples to use (empty = all)
+        /// @return Mean loss
+        double Evaluate(ExecutionContext& context, const Dataset& dataset, const vector<size_t>& indexes) const;
+
+        /// @brief Deep copy of this network (dense weights)
+        /// @return New network
+        unique_ptr<FCNN> Clone() const;
+
+        /// @brief Copy weights and biases from a network with the same structure (no allocations)
+        /// @param other Network
+        void CopyWeightsFrom(const FCNN& other);
+
+        /// @brief Magnitude pruning: weights with absolute value less than threshold are set to zero.
+        /// Pruned weights are kept at zero by next Train() calls, so the network can be fine-tuned after pruning.
+        /// @param threshold Magnitude threshold
+        /// @return Sparsity reached (fraction of zero weights, 0-1)
+        double Prune(const double& threshold);
+
+        /// @brief Magnitude pruning to a target sparsity: in each layer the smallest weights are set to zero. See Prune().
+        /// @param sparsity Target fraction of zero weights (0-1)
+        /// @return Sparsity reached (fraction of zero weights, 0-1)
+        double PruneToSparsity(const double& sparsity);
+
+        /// @brief Structured pruning: remove whole hidden neurons and shrink the dense layers (weights rows of the layer, columns of the next layer, biases).
+        /// Neurons are scored on a dataset by mean |output| times the L2 norm of their outgoing weights: dead neurons and low scores are removed.
+        /// The mean output of a removed neuron is folded into the next layer bias (when it has one), so constant neurons are removed without error.
+        /// The result is an ordinary smaller dense network: compiled plans, contexts and 16 bit or sparse copies must be built again.
+        /// @param dataset Samples for activation statistics (and fine tuning)
+        /// @param options Options
+        /// @return Statistics
+        unique_ptr<NeuronPruningResult> PruneNeurons(const Dataset& dataset, const NeuronPruningOptions& options);
+
+        /// @brief Choose weights storage for each layer by measured density: sparse if density <= maxDensity, dense otherwise.
+        /// Train() drops sparse copies (they would be stale), so call again after fine-tuning. 16 bit copies are dropped too.
+        /// @param maxDensity Max fraction of non-zero weights to use sparse storage (0 = all dense, 1 = all sparse)
+        /// @param format Sparse format
+        /// @return Number of layers using sparse weights
+        size_t OptimizeSparse(const double& maxDensity = 0.4, const SparseFormat& format = SparseFormat::CSR);
+
+        /// @brief Store the weights used by inference with 16 bit elements (half the memory of float, a quarter of double).
+        /// Kernels widen them to float as they read, the full precision weights stay as master copy for training.
+        /// Train() and Fit() drop the 16 bit copies (they would be stale), so call again after training. Layers with sparse weights are not changed.
+        /// @param precision FP16, BF16 or Double (drop 16 bit copies)
+        /// @return Number of layers using 16 bit weights
+        size_t SetWeightPrecision(const WeightPrecision& precision);
+
+        /// @brief Finalize the network for inference (outputs do not change, up to rounding):
+        /// 1) batch normalization is folded into the weights and bias of its layer (rows scaled by Gamma / sqrt(Variance + Epsilon), bias shifted);
+        /// 2) a hidden layer with Math::Identity activation is merged into the next one (W = W_next * W, bias = W_next * bias + bias_next), one GEMV less,
+        /// only when the merged matrix is not larger than the two ones (a narrow linear bottleneck is kept).
+        /// Merged layers lose prune masks, 16 bit or sparse copies: call OptimizeSparse() or SetWeightPrecision() after this.
+        /// @return Number of layers removed by merging
+        size_t OptimizeForInference();
+
+        /// @brief Memory used by weights used by inference (sparse, half precision or dense)
+        /// @return bytes
+        size_t WeightsMemory() const;
+
+        /// @brief Memory of activation buffers owned by layers (net, out and delta of each layer)
+        /// @return bytes
+        size_t ActivationsMemory() const;
+
+        /// @brief Validate the network once and build an execution plan: a flat list of kernels with raw pointers into one preallocated arena.
+        /// Inference keeps only two activation buffers alive (arena = largest adjacent layer pair), training keeps all net/out values and two deltas.
+        /// Dense kernels use the GEMV variant of KernelTuner::Select() for their shape (benchmarked here on first use if KernelTuner::AutoTune).
+        /// Training mode drops sparse weights copies (weights are changed in place).
+        /// The plan is tied to this network: after adding layers or changing weights storage (OptimizeSparse(), Train(), Fit(), Prune()...) compile again.
+        /// @param mode Compile mode
+        /// @return Compiled plan (one for each thread, it owns the activations)
+        unique_ptr<CompiledFCNN> Compile(const CompileMode& mode = CompileMode::Inference);
+
         /// @brief Print out result
         void PrintResult();
+
+        friend class CompiledFCNN;
+        friend class StreamedFCNN;
+        friend class ModelBatch;
+        friend class KernelTuner;
+        friend class FederatedCodec;
+        friend class InferenceServer;
+    };
+
+    /** @brief A FCNN compiled into a flat list of kernels (see FCNN::Compile()).
+        Checks are done once at compile time, so Forward() and Train() run without bounds checks or allocations.
+        Layer k activations are placed at the start of the arena for even k and at its end for odd k: adjacent layers never overlap.
+    */
+    class CompiledFCNN {
+        protected:
+
+        /// @brief Network (weights are read in place and changed in place by Train())
+        FCNN* _network;
+
+        /// @brief Compile mode
+        CompileMode _mode;
+
+        /// @brief Network revision at compile time
+        size_t _revision;
+
+        /// @brief Activations arena (internal RAM)
+        unique_ptr<InternalVector> _arena;
+
+        /// @brief Deltas arena (training only, internal RAM)
+        unique_ptr<InternalVector> _deltas;
+
+        /// @brief Kernels, one for each layer after the input
+        unique_ptr<vector<FCNNKernel>> _kernels;
+
+        /// @brief Backward kernels, same order of _kernels (training only)
+        unique_ptr<vector<FCNNGradientKernel>> _gradients;
+
+        /// @brief Input buffer (input values with input layer bias added)
+        double* _input;
+
+        /// @brief Input layer bias (nullptr = no bias)
+        double* _inputBias;
+
+        /// @brief Input layer delta (training with input bias only, otherwise nullptr)
+        double* _inputDelta;
+
+        /// @brief Inputs and outputs
+        size_t _inputs, _outputs;
+
+        /// @brief Output layer error functions (training)
+        ErrorFunction _E, _dE;
+
+        /// @brief Throw if the network changed after compile
+        void CheckRevision() const;
+
+        /// @brief Run one kernel
+        /// @param k Kernel
+        static void RunKernel(const FCNNKernel& k);
+
+        /// @brief Run all kernels on the current input buffer
+        void Run();
+
+        friend class FCNN;
+
+        CompiledFCNN();
+
+        public:
+
+        ~CompiledFCNN();
+
+        /// @brief Compile mode
+        /// @return mode
+        const CompileMode& Mode() const;
+
+        /// @brief Number of kernels
+        /// @return kernels
+        size_t Kernels() const;
+
+        /// @brief Input values expected by Forward()
+        /// @return inputs
+        size_t Inputs() const;
+
+        /// @brief Planned peak RAM of the plan: arenas and kernel lists
+        /// @return bytes
+        size_t PlannedBytes() const;
+
+        /// @brief Forward propagation
+        /// @param inputs Input values
+        /// @param outputs Output values (resized only if needed)
+        void Forward(const vector<double>& inputs, vector<double>& outputs);
+
+        /// @brief Cost profile: average CPU cycles of each kernel (time x current CPU frequency), input for DeadlineScheduler
+        /// @param inputs Input values
+        /// @param runs Measured runs
+        /// @return Cycles of each kernel
+        vector<double> Profile(const vector<double>& inputs, const size_t& runs = 100);
+
+        /// @brief Train once with stochastic gradient descent, same as FCNN::Train() (training mode only)
+        /// @param inputs Inputs
+        /// @param targets Targets
+        /// @param learningRate Learning rate
+        /// @return Total error
+        double Train(const vector<double>& inputs, const vector<double>& targets, const double& learningRate);
+
+        /// @brief Print out the plan and its memory
+        void Print() const;
     };
 }
 
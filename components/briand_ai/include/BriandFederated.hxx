@@ -0,0 +1,276 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_FEDERATED_H
+#define BRIAND_FEDERATED_H
+
+#include "BriandInclude.hxx"
+#include "BriandMath.hxx"
+#include "BriandFCNN.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Compression of the weight deltas sent by nodes */
+    class DeltaCompression {
+        public:
+
+        /// @brief Fraction of parameters sent, the largest deltas (1 = all, dense message)
+        double Density = 1.0;
+
+        /// @brief Values quantized to 8 bit with one scale for each message (otherwise float)
+        bool Quantize = false;
+
+        /// @brief What was not sent (dropped or rounded) is added to the next delta, so nothing is lost over rounds
+        bool ErrorFeedback = true;
+    };
+
+    /** @brief Federated message types */
+    enum class FederatedMessageType : uint8_t {
+        Model = 1,      // Coordinator -> node: global parameters of a round
+        Update = 2,     // Node -> coordinator: parameters delta after local training
+        Stop = 3        // Coordinator -> node: end
+    };
+
+    /** @brief Header of a federated message */
+    class FederatedMessage {
+        public:
+
+        /// @brief Type
+        FederatedMessageType Type;
+
+        /// @brief Sender node (0 = coordinator)
+        uint16_t Node;
+
+        /// @brief Round
+        uint32_t Round;
+
+        /// @brief Local training samples of the sender (weight of an update)
+        uint32_t Samples;
+
+        /// @brief Parameters of the model
+        uint32_t Count;
+    };
+
+    /** @brief Serialization of parameters and weight deltas. Little-endian messages: 20 bytes header, then
+        float values (dense), int8 values with a float scale (quantized), or only the largest entries as varint index gaps and values (sparse).
+    */
+    class FederatedCodec {
+        public:
+
+        /// @brief All trained parameters of a network in a flat vector: weights and biases of each layer, batch normalization parameters and statistics, exit heads
+        /// @param network Network
+        /// @param parameters Parameters (resized only if needed)
+        static void Parameters(const FCNN& network, vector<double>& parameters);
+
+        /// @brief Set all the parameters of a network (same layout of Parameters())
+        /// @param network Network
+        /// @param parameters Parameters
+        static void SetParameters(FCNN& network, const vector<double>& parameters);
+
+        /// @brief Encode the global parameters of a round (float values)
+        /// @param round Round
+        /// @param parameters Parameters
+        /// @param message Message
+        static void EncodeModel(const uint32_t& round, const vector<double>& parameters, vector<uint8_t>& message);
+
+        /// @brief Encode a delta
+        /// @param node Sender node
+        /// @param round Round
+        /// @param samples Local training samples
+        /// @param delta Delta of each parameter
+        /// @param compression Compression
+        /// @param sent If not nullptr, the delta as the coordinator will decode it (for error feedback)
+        /// @param message Message
+        static void EncodeUpdate(const uint16_t& node, const uint32_t& round, const uint32_t& samples, const vector<double>& delta, const DeltaCompression& compression,
+            vector<double>* sent, vector<uint8_t>& message);
+
+        /// @brief Encode a stop message
+        /// @param message Message
+        static void EncodeStop(vector<uint8_t>& message);
+
+        /// @brief Decode a message
+        /// @param message Message
+        /// @param values Parameters or delta (dense, resized to the parameters count, empty for Stop)
+        /// @return Header (throws runtime_error if malformed)
+        static FederatedMessage Decode(const vector<uint8_t>& message, vector<double>& values);
+    };
+
+    /** @brief Message transport between the coordinator (endpoint 0) and nodes (1..N): radio, MQTT, serial... Errors throw runtime_error. */
+    class FederatedTransport {
+        public:
+
+        virtual ~FederatedTransport() = default;
+
+        /// @brief Send a message (does not wait the receiver)
+        /// @param to Destination endpoint
+        /// @param message Message
+        virtual void Send(const size_t& to, const vector<uint8_t>& message) = 0;
+
+        /// @brief Wait a message for an endpoint
+        /// @param endpoint Endpoint
+        /// @param message Message
+        /// @param timeoutMs Max wait
+        /// @return false on timeout
+        virtual bool Receive(const size_t& endpoint, vector<uint8_t>& message, const uint32_t& timeoutMs) = 0;
+
+        /// @brief Bytes sent since creation
+        /// @return bytes
+        virtual size_t BytesSent() const = 0;
+    };
+
+    /** @brief In-process transport: one queue for each endpoint. The whole protocol runs on one machine with N simulated nodes (threads). */
+    class LoopbackTransport : public FederatedTransport {
+        protected:
+
+        /// @brief Queue of each endpoint
+        unique_ptr<vector<std::deque<vector<uint8_t>>>> _queues;
+
+        std::mutex _lock;
+        std::condition_variable _signal;
+
+        /// @brief Bytes sent
+        std::atomic<size_t> _bytes;
+
+        public:
+
+        /// @brief Build a transport
+        /// @param endpoints Endpoints (coordinator and nodes)
+        LoopbackTransport(const size_t& endpoints);
+
+        ~LoopbackTransport();
+
+        void Send(const size_t& to, const vector<uint8_t>& message) override;
+        bool Receive(const size_t& endpoint, vector<uint8_t>& message, const uint32_t& timeoutMs) override;
+        size_t BytesSent() const override;
+    };
+
+    /** @brief A node: trains its own copy of the model on local data (raw data never leaves the node) and sends back the compressed delta */
+    class FederatedNode {
+        protected:
+
+        /// @brief Node (endpoint)
+        uint16_t _id;
+
+        /// @brief Transport
+        FederatedTransport* _transport;
+
+        /// @brief Local model
+        unique_ptr<FCNN> _model;
+
+        /// @brief Local data
+        const Dataset* _data;
+
+        /// @brief Local training (FitOptions::Seed is increased each round)
+        FitOptions _options;
+
+        /// @brief Delta compression
+        DeltaCompression _compression;
+
+        /// @brief Global parameters of the current round, local parameters, delta sent and error feedback residual
+        unique_ptr<vector<double>> _global;
+        unique_ptr<vector<double>> _local;
+        unique_ptr<vector<double>> _sent;
+        unique_ptr<vector<double>> _residual;
+
+        /// @brief Stop received
+        bool _stopped;
+
+        public:
+
+        /// @brief Build a node
+        /// @param id Node (endpoint, > 0)
+        /// @param transport Transport
+        /// @param model Model architecture (copied, weights come from the coordinator)
+        /// @param data Local data (must live as long as the node)
+        /// @param options Local training of each round
+        /// @param compression Delta compression
+        FederatedNode(const uint16_t& id, FederatedTransport& transport, const FCNN& model, const Dataset& data, const FitOptions& options, const DeltaCompression& compression);
+
+        ~FederatedNode();
+
+        /// @brief Wait a message and handle it (a model: train and send the update)
+        /// @param timeoutMs Max wait
+        /// @return false on timeout
+        bool Step(const uint32_t& timeoutMs);
+
+        /// @brief Handle messages until stop (run it on its own thread)
+        void Serve();
+
+        /// @brief Stop received
+        /// @return true if stopped
+        bool Stopped() const;
+
+        /// @brief Local model
+        /// @return model
+        const FCNN& Model() const;
+    };
+
+    /** @brief Statistics of one federated round */
+    class FederatedRound {
+        public:
+
+        /// @brief Round
+        uint32_t Round;
+
+        /// @brief Nodes whose update arrived in time
+        size_t Participants;
+
+        /// @brief Bytes sent to nodes (model) and received from nodes (updates)
+        size_t BytesDown, BytesUp;
+
+        /// @brief Round time (us)
+        long Time;
+    };
+
+    /** @brief Coordinator: broadcasts the global model, merges the updates with a weighted average (FedAvg, weights = local samples) */
+    class FederatedCoordinator {
+        protected:
+
+        /// @brief Transport
+        FederatedTransport* _transport;
+
+        /// @brief Global model (changed in place)
+        FCNN* _model;
+
+        /// @brief Nodes (endpoints 1..nodes)
+        size_t _nodes;
+
+        /// @brief Next round
+        uint32_t _round;
+
+        public:
+
+        /// @brief Build a coordinator
+        /// @param transport Transport
+        /// @param model Global model (must live as long as the coordinator)
+        /// @param nodes Number of nodes (endpoints 1..nodes)
+        FederatedCoordinator(FederatedTransport& transport, FCNN& model, const size_t& nodes);
+
+        /// @brief Run a round: broadcast, wait the updates (late updates of older rounds are dropped), average them into the global model
+        /// @param timeoutMs Max wait of updates
+        /// @return Statistics
+        FederatedRound Round(const uint32_t& timeoutMs = 60000);
+
+        /// @brief Send stop to all nodes
+        void Stop();
+    };
+}
+
+#endif
@@ -0,0 +1,129 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_HALF_H
+#define BRIAND_HALF_H
+
+#include "BriandInclude.hxx"
+#include "BriandMemory.hxx"
+#include "BriandMatrix.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Storage precision of weights used by inference */
+    enum class WeightPrecision {
+        Double,     // 64 bit (default, same as training)
+        FP16,       // IEEE 754 half: 1 sign, 5 exponent, 10 mantissa bits. ~3 decimal digits, range +-65504
+        BF16        // bfloat16: 1 sign, 8 exponent, 7 mantissa bits. ~2 decimal digits, same range of float
+    };
+
+    /** @brief Read-only matrix stored with 16 bit elements (FP16 or BF16), built from a dense Matrix, used for weights in inference.
+        Elements are widened to float as they are read: GEMV runs on float (hardware FPU on ESP32, doubles are software emulated).
+        Storage is placed by the memory tier policy like Matrix (see Memory).
+    */
+    class HalfMatrix {
+        protected:
+
+        /// @brief Rows
+        size_t _rows;
+
+        /// @brief Columns
+        size_t _cols;
+
+        /// @brief Format (FP16 or BF16)
+        WeightPrecision _format;
+
+        /// @brief Elements, contiguous by rows
+        uint16_t* _data;
+
+        /// @brief Tier of _data
+        MemoryTier _tier;
+
+        public:
+
+        /// @brief Build from a dense matrix (rounded to nearest even)
+        /// @param dense Dense matrix
+        /// @param format FP16 or BF16
+        HalfMatrix(const Matrix& dense, const WeightPrecision& format);
+
+        HalfMatrix(const HalfMatrix&) = delete;
+        HalfMatrix& operator=(const HalfMatrix&) = delete;
+
+        ~HalfMatrix();
+
+        /// @brief Rows
+        /// @return rows
+        const size_t& Rows() const;
+
+        /// @brief Columns
+        /// @return cols
+        const size_t& Cols() const;
+
+        /// @brief Format
+        /// @return FP16 or BF16
+        const WeightPrecision& Format() const;
+
+        /// @brief Memory tier of the elements
+        /// @return tier
+        const MemoryTier& Tier() const;
+
+        /// @brief Memory used by elements
+        /// @return bytes
+        size_t MemoryBytes() const;
+
+        /// @brief Element widened to double
+        /// @param row Row
+        /// @param col Column
+        /// @return value
+        double Get(const size_t& row, const size_t& col) const;
+
+        /// @brief Multiply by a column vector: result = M * v, float accumulation
+        /// @param v Vector (size = columns)
+        /// @param result Result (resized only if needed)
+        void MultiplyVector(const vector<double>& v, vector<double>& result) const;
+
+        /// @brief Multiply by a column vector without checks (used by compiled plans)
+        /// @param v Vector (columns elements)
+        /// @param result Result (rows elements)
+        void MultiplyVector(const double* v, double* result) const;
+
+        /// @brief Round a float to FP16 (nearest even, overflow to infinity)
+        /// @param value Value
+        /// @return FP16 bits
+        static uint16_t ToFP16(const float& value);
+
+        /// @brief Widen FP16 to float (exact)
+        /// @param bits FP16 bits
+        /// @return value
+        static float FromFP16(const uint16_t& bits);
+
+        /// @brief Round a float to BF16 (nearest even)
+        /// @param value Value
+        /// @return BF16 bits
+        static uint16_t ToBF16(const float& value);
+
+        /// @brief Widen BF16 to float (exact)
+        /// @param bits BF16 bits
+        /// @return value
+        static float FromBF16(const uint16_t& bits);
+    };
+}
+
+#endif
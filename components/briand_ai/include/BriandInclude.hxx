@@ -17,7 +17,16 @@
 #pragma once
 
 #ifndef BRIAND_AI_DEBUG
-    #define BRIAND_AI_DEBUG 1 // DEBUG MODE (print to stdout calculus and other info)
+    #define BRIAND_AI_DEBUG 0 // DEBUG MODE (print to stdout calculus and other info, very slow: every training step prints full vectors)
+#endif
+
+#ifndef BRIAND_LOG_LEVEL
+    // Compile-time log level (0 = none, 1 = error, 2 = warning, 3 = info, 4 = debug, 5 = verbose): BRIAND_LOGx calls above it generate no code
+    #if defined(CONFIG_LOG_MAXIMUM_LEVEL)
+        #define BRIAND_LOG_LEVEL CONFIG_LOG_MAXIMUM_LEVEL
+    #else
+        #define BRIAND_LOG_LEVEL 3
+    #endif
 #endif
 
 #ifndef BRIAND_INCLUDE_H
@@ -42,6 +51,13 @@
     #include <signal.h>
 	#include <limits>
 	#include <cassert>
+	#include <atomic>
+	#include <mutex>
+	#include <condition_variable>
+	#include <functional>
+	#include <deque>
+	#include <unordered_map>
+	#include <future>
 
     /* 
         Small code redefining in linux/windows platform used ESP functions and types in order to compile and test on other platforms
@@ -56,6 +72,13 @@
         #include "esp_log.h"
 		#include "esp_random.h"
 		#include "esp_timer.h"
+		#include "freertos/FreeRTOS.h"
+		#include "freertos/task.h"
+		#include "esp_pthread.h"
+		#include "esp_heap_caps.h"
+		#include "esp_memory_utils.h"
+		#include "esp_partition.h"
+		#include "soc/rtc.h"
 
     #elif defined(__linux__) | defined(_WIN32)
         // Set BRIAND_PLATFORM for printing out current platform if needed
@@ -169,14 +192,22 @@
 			ESP_LOG_VERBOSE     /*!< Bigger chunks of debugging information, or frequent messages which can potentially flood the output. */
 		} esp_log_level_t;
 
-		extern unique_ptr<map<string, esp_log_level_t>> LOG_LEVELS_MAP;
+		// As ESP-IDF, LOG_LOCAL_LEVEL (defined before including) filters ESP_LOGx calls of a file at compile time
+		#ifndef LOG_LOCAL_LEVEL
+			#define LOG_LOCAL_LEVEL BRIAND_LOG_LEVEL
+		#endif
+
+		extern unique_ptr<map<string, esp_log_level_t, std::less<>>> LOG_LEVELS_MAP;
 		void esp_log_level_set(const char* tag, esp_log_level_t level);
 		esp_log_level_t esp_log_level_get(const char* tag);
-		#define ESP_LOGI(tag, _format, ...) { if(esp_log_level_get(tag) >= ESP_LOG_INFO) { printf("I "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
-		#define ESP_LOGV(tag, _format, ...) { if(esp_log_level_get(tag) >= ESP_LOG_VERBOSE) { printf("V "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
-		#define ESP_LOGD(tag, _format, ...) { if(esp_log_level_get(tag) >= ESP_LOG_DEBUG) { printf("D "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
-		#define ESP_LOGE(tag, _format, ...) { if(esp_log_level_get(tag) >= ESP_LOG_ERROR) { printf("E "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
-		#define ESP_LOGW(tag, _format, ...) { if(esp_log_level_get(tag) >= ESP_LOG_WARN) { printf("W "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
+		/** @brief Highest level set for any tag (lock-free check before looking up the tag) */
+		extern std::atomic<int> LOG_MAX_LEVEL;
+		#define ESP_LOG_LEVEL_ENABLED(tag, level) (LOG_LOCAL_LEVEL >= (level) && LOG_MAX_LEVEL.load(std::memory_order_relaxed) >= (level) && esp_log_level_get(tag) >= (level))
+		#define ESP_LOGI(tag, _format, ...) { if(ESP_LOG_LEVEL_ENABLED(tag, ESP_LOG_INFO)) { printf("I "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
+		#define ESP_LOGV(tag, _format, ...) { if(ESP_LOG_LEVEL_ENABLED(tag, ESP_LOG_VERBOSE)) { printf("V "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
+		#define ESP_LOGD(tag, _format, ...) { if(ESP_LOG_LEVEL_ENABLED(tag, ESP_LOG_DEBUG)) { printf("D "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
+		#define ESP_LOGE(tag, _format, ...) { if(ESP_LOG_LEVEL_ENABLED(tag, ESP_LOG_ERROR)) { printf("E "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
+		#define ESP_LOGW(tag, _format, ...) { if(ESP_LOG_LEVEL_ENABLED(tag, ESP_LOG_WARN)) { printf("W "); printf(tag); printf(" "); printf(_format, ##__VA_ARGS__); } }
 
 		void ESP_ERROR_CHECK(esp_err_t e);
 
@@ -229,13 +260,76 @@
 
 		void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps);
 
+		// CPU frequency is simulated: after rtc_clk_cpu_freq_set_config() work measured on the host is stretched by 240 / MHz
+		// by briand_porting_cpu_stretch(), so frequency policies can be tested off-device (the host counts as an ESP32 at 240 MHz)
 		void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t* info);
-		void rtc_clk_cpu_freq_mhz_to_config(uint32_t mhz, rtc_cpu_freq_config_t* out);
-		void rtc_clk_cpu_freq_set_config(rtc_cpu_freq_config_t* info);
+		bool rtc_clk_cpu_freq_mhz_to_config(uint32_t mhz, rtc_cpu_freq_config_t* out);
+		void rtc_clk_cpu_freq_set_config(const rtc_cpu_freq_config_t* info);
+
+		/** @brief Busy wait so the work done since start (us) takes as long as at the simulated frequency */
+		void briand_porting_cpu_stretch(uint64_t start);
 
 		#define esp_get_free_heap_size() 320000
 		size_t heap_caps_get_largest_free_block(uint32_t caps);
 
+		// Two memory tiers are simulated: internal RAM and SPI RAM (MALLOC_CAP_SPIRAM).
+		// Until briand_porting_heap_caps_simulate() is called internal RAM is unlimited and there is no SPI RAM.
+
+		void* heap_caps_malloc(size_t size, uint32_t caps);
+		void heap_caps_free(void* ptr);
+		size_t heap_caps_get_free_size(uint32_t caps);
+		size_t heap_caps_get_total_size(uint32_t caps);
+		bool esp_ptr_external_ram(const void* p);
+
+		/** @brief (Linux only) Simulate a board with the given internal RAM (0 = unlimited) and SPI RAM (0 = no PSRAM) sizes */
+		void briand_porting_heap_caps_simulate(size_t internalBytes, size_t spiramBytes);
+
+		// FLASH PARTITIONS (data partitions simulated with temporary files, see briand_porting_partition_simulate())
+
+		typedef enum {
+			ESP_PARTITION_TYPE_APP = 0x00,
+			ESP_PARTITION_TYPE_DATA = 0x01,
+			ESP_PARTITION_TYPE_ANY = 0xff
+		} esp_partition_type_t;
+
+		typedef enum {
+			ESP_PARTITION_SUBTYPE_DATA_UNDEFINED = 0x06,
+			ESP_PARTITION_SUBTYPE_ANY = 0xff
+		} esp_partition_subtype_t;
+
+		typedef struct {
+			esp_partition_type_t type;
+			esp_partition_subtype_t subtype;
+			uint32_t address;
+			uint32_t size;
+			uint32_t erase_size;
+			char label[17];
+			bool encrypted;
+		} esp_partition_t;
+
+		#define ESP_ERR_NO_MEM 0x101
+		#define ESP_ERR_INVALID_ARG 0x102
+		#define ESP_ERR_INVALID_SIZE 0x104
+
+		const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label);
+		esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size);
+		esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size);
+		esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size);
+
+		typedef enum {
+			ESP_PARTITION_MMAP_DATA,
+			ESP_PARTITION_MMAP_INST
+		} esp_partition_mmap_memory_t;
+
+		typedef uint32_t esp_partition_mmap_handle_t;
+
+		/** @brief Map a partition region in memory (read only, on Linux the simulated partition file is mapped) */
+		esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, esp_partition_mmap_memory_t memory, const void** out_ptr, esp_partition_mmap_handle_t* out_handle);
+		void esp_partition_munmap(esp_partition_mmap_handle_t handle);
+
+		/** @brief (Linux only) Create a simulated data partition (backed by a temporary file) with the given size and read speed (0 = no limit) */
+		void briand_porting_partition_simulate(const char* label, size_t size, size_t readBytesPerSecond);
+
 
 
         //
@@ -259,6 +353,9 @@
 		};
 
 		#define portTICK_PERIOD_MS 1
+		#define portNUM_PROCESSORS 2 // simulate a dual core ESP32
+		#define tskNO_AFFINITY 0x7FFFFFFF
+		#define taskYIELD() std::this_thread::yield()
 
 		typedef uint64_t TickType_t;
 		typedef int BaseType_t;
@@ -300,6 +397,7 @@
 		} TaskStatus_t;
 		
 		extern unique_ptr<vector<TaskHandle_t>> BRIAND_TASK_POOL;
+		extern std::mutex BRIAND_TASK_POOL_MUTEX;
 
 		void vTaskDelay(TickType_t delay);
 
@@ -313,6 +411,15 @@
 				UBaseType_t uxPriority,
 				TaskHandle_t * const pvCreatedTask);
 
+		BaseType_t xTaskCreatePinnedToCore(
+				TaskFunction_t pvTaskCode,
+				const char * const pcName,
+				const uint32_t usStackDepth,
+				void * const pvParameters,
+				UBaseType_t uxPriority,
+				TaskHandle_t * const pvCreatedTask,
+				const BaseType_t xCoreID);
+
 		void vTaskDelete(TaskHandle_t handle);
 
 		UBaseType_t uxTaskGetNumberOfTasks();
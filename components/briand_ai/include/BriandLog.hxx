@@ -0,0 +1,254 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_LOG_H
+#define BRIAND_LOG_H
+
+#include "BriandInclude.hxx"
+
+// Compile-time levels of single tags, overriding BRIAND_LOG_LEVEL. A list of {"tag", level}, entries each followed by a comma.
+// Example: -DBRIAND_LOG_TAG_LEVELS='{"FCNN",4},{"Pipeline",0},'
+#ifndef BRIAND_LOG_TAG_LEVELS
+    #define BRIAND_LOG_TAG_LEVELS
+#endif
+
+// Max arguments of a log record
+#define BRIAND_LOG_ARGUMENTS 6
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Compile-time level of a tag */
+    class LogTagLevel {
+        public:
+
+        /// @brief Tag (nullptr = end of table)
+        const char* Tag;
+
+        /// @brief Level (ESP_LOG_NONE ... ESP_LOG_VERBOSE)
+        uint8_t Level;
+    };
+
+    /// @brief Compile-time tag levels (BRIAND_LOG_TAG_LEVELS)
+    static constexpr LogTagLevel BRIAND_LOG_TAGS[] = { BRIAND_LOG_TAG_LEVELS { nullptr, 0 } };
+
+    /** @brief Log record kind */
+    enum class LogRecordKind : uint8_t {
+        Message,    // Formatted message (BRIAND_LOGx)
+        Span        // Timed scope (BRIAND_TRACE), first argument is the duration (us)
+    };
+
+    /** @brief Argument of a log record (type in LogRecord::Types) */
+    union LogArgument {
+        int64_t Integer;
+        double Real;
+        const void* Pointer;
+    };
+
+    /** @brief Binary log record: format and arguments are stored, the text is built later by the drainer */
+    class LogRecord {
+        public:
+
+        /// @brief Timestamp (us, esp_timer_get_time())
+        int64_t Time;
+
+        /// @brief Tag and format (must be string literals, or live until drained)
+        const char* Tag;
+        const char* Format;
+
+        /// @brief Recording thread (small id, 1 = first thread that logged)
+        uint32_t Thread;
+
+        /// @brief Level
+        uint8_t Level;
+
+        /// @brief Kind
+        LogRecordKind Kind;
+
+        /// @brief Arguments stored
+        uint8_t Arguments;
+
+        /// @brief Argument types, 2 bits each (0 = integer, 1 = real, 2 = pointer/string)
+        uint16_t Types;
+
+        /// @brief Arguments
+        LogArgument Values[BRIAND_LOG_ARGUMENTS];
+    };
+
+    /** @brief Low overhead logger.
+        Levels are filtered at compile time for each tag (BRIAND_LOG_LEVEL, BRIAND_LOG_TAG_LEVELS): filtered calls generate no code at all.
+        Kept calls copy format pointer and raw arguments into a lock-free multi-producer ring (no formatting, no locks, no allocations);
+        a background drainer formats the records and writes them to the sink. When the ring is full records are dropped and counted, producers never wait.
+        Before Start() (or after Stop()) records are formatted immediately by the caller.
+        Strings arguments (%s) are read by the drainer: pass literals or strings that outlive the drain.
+    */
+    class TraceLog {
+        public:
+
+        /// @brief Runtime level: records above are discarded (default ESP_LOG_VERBOSE, only compile-time filtering)
+        static std::atomic<uint8_t> Level;
+
+        /// @brief Drainer period (ms)
+        static uint32_t DrainIntervalMs;
+
+        /// @brief Output of formatted lines (default: stdout)
+        static std::function<void(const char* line)> Sink;
+
+        /// @brief Compile-time level of a tag
+        /// @param tag Tag
+        /// @return level
+        static constexpr uint8_t CompiledLevel(const char* tag) {
+            for (const auto& t : BRIAND_LOG_TAGS) {
+                if (t.Tag != nullptr && SameTag(t.Tag, tag)) return t.Level;
+            }
+            return BRIAND_LOG_LEVEL;
+        }
+
+        /// @brief Start the ring and the drainer
+        /// @param capacity Records in the ring (rounded up to a power of 2)
+        static void Start(const size_t& capacity = 1024);
+
+        /// @brief Drain everything, stop the drainer and release the ring (next records are formatted by callers)
+        static void Stop();
+
+        /// @brief Format and write all the records in the ring now (caller thread)
+        /// @return Records written
+        static size_t Flush();
+
+        /// @brief True if started
+        /// @return running
+        static bool Running();
+
+        /// @brief Records accepted since Start()
+        /// @return records
+        static size_t Recorded();
+
+        /// @brief Records dropped (ring full) since Start()
+        /// @return records
+        static size_t Dropped();
+
+        /// @brief Format a record ("I (time) tag: text", spans "T (time) tag: text 123us")
+        /// @param record Record
+        /// @param line Output (replaced)
+        static void Format(const LogRecord& record, string& line);
+
+        /// @brief Record a message (BRIAND_LOGx macros are preferred: they filter at compile time)
+        /// @param level Level
+        /// @param tag Tag
+        /// @param format printf format (integers, reals, strings and pointers; width, precision and flags are kept)
+        /// @param args Arguments
+        template <typename... Args>
+        static void Record(const uint8_t& level, const char* tag, const char* format, const Args&... args) {
+            static_assert(sizeof...(Args) <= BRIAND_LOG_ARGUMENTS, "TraceLog: too many log arguments.");
+
+            if (level > Level.load(std::memory_order_relaxed)) return;
+
+            LogRecord record;
+            record.Time = esp_timer_get_time();
+            record.Tag = tag;
+            record.Format = format;
+            record.Level = level;
+            record.Kind = LogRecordKind::Message;
+            record.Arguments = 0;
+            record.Types = 0;
+            (Store(record, args), ...);
+            Push(record);
+        }
+
+        /// @brief Record a span
+        /// @param level Level
+        /// @param tag Tag
+        /// @param name Span name
+        /// @param start Start time (us)
+        static void RecordSpan(const uint8_t& level, const char* tag, const char* name, const int64_t& start);
+
+        protected:
+
+        /// @brief Compare tags at compile time
+        static constexpr bool SameTag(const char* a, const char* b) {
+            while (*a != '\0' && *a == *b) {
+                a++;
+                b++;
+            }
+            return *a == *b;
+        }
+
+        /// @brief Add an argument to a record
+        template <typename T>
+        static void Store(LogRecord& record, const T& value) {
+            LogArgument& a = record.Values[record.Arguments];
+            uint16_t type;
+            if constexpr (std::is_floating_point<T>::value) {
+                a.Real = static_cast<double>(value);
+                type = 1;
+            }
+            else if constexpr (std::is_pointer<T>::value || std::is_array<T>::value || std::is_null_pointer<T>::value) {
+                a.Pointer = static_cast<const void*>(value);
+                type = 2;
+            }
+            else {
+                a.Integer = static_cast<int64_t>(value);
+                type = 0;
+            }
+            record.Types |= static_cast<uint16_t>(type << (2 * record.Arguments));
+            record.Arguments++;
+        }
+
+        /// @brief Put a record in the ring (format it immediately if not running)
+        static void Push(LogRecord& record);
+    };
+
+    /** @brief Timed scope: records a span when destroyed (see BRIAND_TRACE) */
+    class TraceScope {
+        public:
+
+        TraceScope(const uint8_t& level, const char* tag, const char* name) : _level(level), _tag(tag), _name(name), _start(esp_timer_get_time()) {}
+        ~TraceScope() { TraceLog::RecordSpan(this->_level, this->_tag, this->_name, this->_start); }
+
+        protected:
+
+        uint8_t _level;
+        const char* _tag;
+        const char* _name;
+        int64_t _start;
+    };
+
+    /** @brief Timed scope compiled out (see BRIAND_TRACE) */
+    class NullTraceScope {
+        public:
+
+        constexpr NullTraceScope(const uint8_t& /*level*/, const char* /*tag*/, const char* /*name*/) {}
+    };
+}
+
+// Log through the ring, tag must be a string literal. Calls above the compile-time level of the tag generate no code.
+#define BRIAND_LOG(level, tag, format, ...) do { if constexpr ((level) <= Briand::TraceLog::CompiledLevel(tag)) Briand::TraceLog::Record((level), (tag), (format), ##__VA_ARGS__); } while (0)
+#define BRIAND_LOGE(tag, format, ...) BRIAND_LOG(1, tag, format, ##__VA_ARGS__)
+#define BRIAND_LOGW(tag, format, ...) BRIAND_LOG(2, tag, format, ##__VA_ARGS__)
+#define BRIAND_LOGI(tag, format, ...) BRIAND_LOG(3, tag, format, ##__VA_ARGS__)
+#define BRIAND_LOGD(tag, format, ...) BRIAND_LOG(4, tag, format, ##__VA_ARGS__)
+#define BRIAND_LOGV(tag, format, ...) BRIAND_LOG(5, tag, format, ##__VA_ARGS__)
+
+// Time the rest of the scope (debug level), compiled out as BRIAND_LOGD
+#define BRIAND_TRACE_CONCAT2(a, b) a##b
+#define BRIAND_TRACE_CONCAT(a, b) BRIAND_TRACE_CONCAT2(a, b)
+#define BRIAND_TRACE(tag, name) \
+    std::conditional<(4 <= Briand::TraceLog::CompiledLevel(tag)), Briand::TraceScope, Briand::NullTraceScope>::type BRIAND_TRACE_CONCAT(_briandTrace, __LINE__)(4, tag, name)
+
+#endif
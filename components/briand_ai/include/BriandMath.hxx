@@ -52,7 +52,7 @@ namespace Briand {
         /** @brief Weighted sum function */
         static double WeightedSum(const vector<double>& values, const vector<double>& weights);
 
-        /** @brief Random number between 0 and 1 */
+        /** @brief Random number in [0, 1) from the default generator (see Philox::SetDefaultSeed()) */
         static double Random();
 
         /** @brief Mean squared error */
@@ -60,6 +60,28 @@ namespace Briand {
         
         /** @brief Mean squared error derivative */
         static constexpr double DeMSE(const double& target, const double& output) { return (output - target); }
+
+        /** @brief Cross-entropy error of one output (probability) */
+        static double CrossEntropy(const double& target, const double& output) { return -target * log(output > 1e-300 ? output : 1e-300); }
+
+        /** @brief Cross-entropy derivative (with softmax outputs FCNN uses the fused gradient output - target instead) */
+        static double DeCrossEntropy(const double& target, const double& output) { return -target / (output > 1e-300 ? output : 1e-300); }
+
+        /** @brief y = exp(x) on arrays of n values (y may be x): branch-free polynomial on blocks of 8 values the compiler vectorizes,
+            relative error below 5e-16, 0 below -708 and infinity above 709 */
+        static void Exp(const double* x, double* y, const size_t& n);
+
+        /** @brief log(sum(exp(z))) computed as max + log(sum(exp(z - max))): no overflow for large values */
+        static double LogSumExp(const vector<double>& z);
+
+        /** @brief LogSumExp on a raw array of n values */
+        static double LogSumExp(const double* z, const size_t& n);
+
+        /** @brief Softmax p = exp(z - LogSumExp(z)) in one pass over exp(z - max), no overflow. Returns LogSumExp(z). */
+        static double Softmax(const vector<double>& z, vector<double>& p);
+
+        /** @brief Softmax on raw arrays of n values, p may be the same array as z (in place). Returns LogSumExp(z). */
+        static double Softmax(const double* z, double* p, const size_t& n);
     };
 
     /// @brief Typedef (alias with C++ using) an activation function as a function returning a double and asking a const double& as parameter
@@ -20,11 +20,15 @@
 #define BRIAND_MATRIX_H
 
 #include "BriandInclude.hxx"
+#include "BriandThreadPool.hxx"
+#include "BriandMemory.hxx"
 
 using namespace std;
 
 namespace Briand {
 
+    template <typename E> class MatrixExpression;
+
     /** @brief Small matrix library. 
         If a more performing way of calculus is found then you need only to change the implementation here!
     */
@@ -37,15 +41,49 @@ namespace Briand {
         /// @brief Rows
         size_t _rows;
         
-        /// @brief Internal matrix
+        /// @brief Internal matrix (row pointers into _data)
         double** _matrix;
 
+        /// @brief Elements, contiguous by rows
+        double* _data;
+
+        /// @brief Memory tier of _data
+        MemoryTier _tier;
+
         /// @brief Instance internal data structures and allocate memory.
         /// @param initialValue initial value of elements
         void InstanceMatrix(const double& initialValue = 0.0);
 
+        /// @brief Release internal memory
+        void FreeMatrix();
+
         public:
 
+        /// @brief Operations touching at least this number of elements (multiply-adds for products) are split across ThreadPool::Default()
+        static size_t ParallelThreshold;
+
+        /// @brief Matrix by vector streams external RAM rows through an internal RAM tile of Memory::TileBytes (false = read external RAM directly)
+        static bool StreamExternal;
+
+        /// @brief Run body(firstRow, lastRow) on all rows, split in row blocks across the default pool if work is above ParallelThreshold
+        /// @param rows Rows
+        /// @param work Elements touched (or multiply-adds)
+        /// @param body Body working on rows [begin, end)
+        template <typename F>
+        static void ForRows(const size_t& rows, const size_t& work, const F& body) {
+            if (work < Matrix::ParallelThreshold || rows < 2 || ThreadPool::Default().Workers() == 0) {
+                body(0, rows);
+                return;
+            }
+
+            // Each block must be worth at least a quarter of the threshold
+            const size_t workPerRow = (work / rows > 0 ? work / rows : 1);
+            size_t grain = (Matrix::ParallelThreshold / 4) / workPerRow;
+            if (grain == 0) grain = 1;
+
+            ThreadPool::Default().ParallelFor(0, rows, grain, body);
+        }
+
         /// @brief Build a new matrix RxC with initial value
         /// @param rows 
         /// @param cols 
@@ -59,8 +97,36 @@ namespace Briand {
         /// @brief Useful copy constructor
         Matrix(const Matrix& other);
 
+        /// @brief Build a new matrix evaluating an expression (see BriandMatrixExpression.hxx)
+        /// @param expression Expression
+        template <typename E>
+        Matrix(const MatrixExpression<E>& expression);
+
         ~Matrix();
 
+        /// @brief Deep copy (memory is reallocated only if size differs)
+        /// @param other Matrix
+        /// @return this
+        Matrix& operator=(const Matrix& other);
+
+        /// @brief Evaluate an expression in a single pass, without temporaries (memory is reallocated only if size differs)
+        /// @param expression Expression
+        /// @return this
+        template <typename E>
+        Matrix& operator=(const MatrixExpression<E>& expression);
+
+        /// @brief Add an expression element by element in a single pass
+        /// @param expression Expression (same size)
+        /// @return this
+        template <typename E>
+        Matrix& operator+=(const MatrixExpression<E>& expression);
+
+        /// @brief Subtract an expression element by element in a single pass
+        /// @param expression Expression (same size)
+        /// @return this
+        template <typename E>
+        Matrix& operator-=(const MatrixExpression<E>& expression);
+
         /// @brief Return row number
         /// @return rows
         const size_t& Rows() const;
@@ -69,7 +135,19 @@ namespace Briand {
         /// @return cols
         const size_t& Cols() const;
 
-        /// @brief Randomize all matrix values
+        /// @brief Elements, contiguous by rows (element i,j is Data()[i * Cols() + j])
+        /// @return Elements
+        double* Data() const;
+
+        /// @brief Memory tier of the elements (chosen by Memory::TierFor() at allocation)
+        /// @return tier
+        const MemoryTier& Tier() const;
+
+        /// @brief Move the elements to another memory tier (row pointers from operator[] change)
+        /// @param tier Tier
+        void MoveTo(const MemoryTier& tier);
+
+        /// @brief Randomize all matrix values in [0, 1) with the default generator (use Philox for seeds and other distributions)
         void Randomize();
 
         /// @brief Multiply current matrix by a value.
@@ -81,6 +159,16 @@ namespace Briand {
         /// @return Pointer to resulting vector
         unique_ptr<vector<double>> MultiplyVector(const vector<double>& v);
 
+        /// @brief Multiply current matrix by a vector, without allocations (result must be already sized as matrix rows)
+        /// @param v vector
+        /// @param result Output vector
+        void MultiplyVector(const vector<double>& v, vector<double>& result) const;
+
+        /// @brief Multiply current matrix by a vector on raw arrays, no checks. External RAM rows are streamed through internal RAM tiles.
+        /// @param v vector (cols elements)
+        /// @param result Output (rows elements, must not overlap v)
+        void MultiplyVector(const double* v, double* result) const;
+
         /// @brief Multiply current matrix with other (dot operation). If input matrix is m*n other matrix must be n*p. Result will be a m*p matrix.
         /// @param other Matrix 
         /// @return new matrix
@@ -125,4 +213,6 @@ namespace Briand {
     };
 }
 
+#include "BriandMatrixExpression.hxx"
+
 #endif
\ No newline at end of file
@@ -0,0 +1,441 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_MATRIX_EXPRESSION_H
+#define BRIAND_MATRIX_EXPRESSION_H
+
+/*
+    Lazy matrix expressions (expression templates).
+
+    Operators between Matrix objects (and vectors, seen as columns) do not compute anything: they build a small
+    tree of nodes that is evaluated element by element only when assigned, in a single pass and without temporary
+    matrices. For example:
+
+        W -= learningRate * Outer(delta, input);        // one loop over W, no outer product matrix allocated
+        Assign(out, Apply(W * input + bias, Math::ReLU)); // one loop over the outputs
+
+    Nodes keep references to Matrix/vector operands: evaluate an expression in the same statement where it is built.
+    Operands of a product are read many times, so they should be Matrix/vector (or Transpose() of them).
+
+    This header is included by BriandMatrix.hxx.
+*/
+
+#include "BriandInclude.hxx"
+#include "BriandMatrix.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Base of all expressions (CRTP). Each node E provides Rows(), Cols(), operator()(i, j), Refers(address), Cost() and the Elementwise flag. */
+    template <typename E>
+    class MatrixExpression {
+        public:
+
+        /// @brief The real expression node
+        /// @return Node
+        const E& Self() const { return static_cast<const E&>(*this); }
+    };
+
+    /** @brief Leaf: a Matrix */
+    class MatrixTerm : public MatrixExpression<MatrixTerm> {
+        protected:
+        const Matrix& _m;
+
+        public:
+        /// @brief Element (i,j) depends only on operands element (i,j): safe to evaluate in-place on an operand
+        static constexpr bool Elementwise = true;
+
+        MatrixTerm(const Matrix& m) : _m(m) {}
+        size_t Rows() const { return this->_m.Rows(); }
+        size_t Cols() const { return this->_m.Cols(); }
+        double operator()(const size_t& i, const size_t& j) const { return this->_m[i][j]; }
+        /// @brief Row pointer (fast path for products)
+        const double* Row(const size_t& i) const { return this->_m[i]; }
+        /// @brief True if the expression reads the object at the given address
+        bool Refers(const void* p) const { return p == &this->_m; }
+        /// @brief Estimated operations for each element
+        size_t Cost() const { return 1; }
+    };
+
+    /** @brief Leaf: a vector, as a n x 1 column */
+    class VectorTerm : public MatrixExpression<VectorTerm> {
+        protected:
+        const vector<double>& _v;
+
+        public:
+        static constexpr bool Elementwise = true;
+
+        VectorTerm(const vector<double>& v) : _v(v) {}
+        size_t Rows() const { return this->_v.size(); }
+        size_t Cols() const { return 1; }
+        double operator()(const size_t& i, const size_t& /*j*/) const { return this->_v[i]; }
+        /// @brief Data pointer (fast path for products)
+        const double* Data() const { return this->_v.data(); }
+        bool Refers(const void* p) const { return p == &this->_v; }
+        size_t Cost() const { return 1; }
+    };
+
+    /** @brief Element by element operations */
+    class AddOperation { public: static double Apply(const double& a, const double& b) { return a + b; } };
+    class SubtractOperation { public: static double Apply(const double& a, const double& b) { return a - b; } };
+    class HadamardOperation { public: static double Apply(const double& a, const double& b) { return a * b; } };
+
+    /** @brief Node: element by element binary operation between same size expressions */
+    template <typename L, typename R, typename Op>
+    class BinaryExpression : public MatrixExpression<BinaryExpression<L, R, Op>> {
+        protected:
+        const L _l;
+        const R _r;
+
+        public:
+        static constexpr bool Elementwise = L::Elementwise && R::Elementwise;
+
+        BinaryExpression(const L& l, const R& r) : _l(l), _r(r) {
+            if (l.Rows() != r.Rows() || l.Cols() != r.Cols()) throw out_of_range("Matrix expression: operands must have the same size!");
+        }
+        size_t Rows() const { return this->_l.Rows(); }
+        size_t Cols() const { return this->_l.Cols(); }
+        double operator()(const size_t& i, const size_t& j) const { return Op::Apply(this->_l(i, j), this->_r(i, j)); }
+        bool Refers(const void* p) const { return this->_l.Refers(p) || this->_r.Refers(p); }
+        size_t Cost() const { return this->_l.Cost() + this->_r.Cost(); }
+    };
+
+    /** @brief Node: expression multiplied by a scalar */
+    template <typename E>
+    class ScaledExpression : public MatrixExpression<ScaledExpression<E>> {
+        protected:
+        const E _e;
+        const double _k;
+
+        public:
+        static constexpr bool Elementwise = E::Elementwise;
+
+        ScaledExpression(const E& e, const double& k) : _e(e), _k(k) {}
+        size_t Rows() const { return this->_e.Rows(); }
+        size_t Cols() const { return this->_e.Cols(); }
+        double operator()(const size_t& i, const size_t& j) const { return this->_k * this->_e(i, j); }
+        bool Refers(const void* p) const { return this->_e.Refers(p); }
+        size_t Cost() const { return this->_e.Cost() + 1; }
+    };
+
+    /** @brief Node: f() applied to each element (activation functions) */
+    template <typename E>
+    class ApplyExpression : public MatrixExpression<ApplyExpression<E>> {
+        protected:
+        const E _e;
+        double (*_f)(const double& x);
+
+        public:
+        static constexpr bool Elementwise = E::Elementwise;
+
+        ApplyExpression(const E& e, double (*f)(const double& x)) : _e(e), _f(f) {}
+        size_t Rows() const { return this->_e.Rows(); }
+        size_t Cols() const { return this->_e.Cols(); }
+        double operator()(const size_t& i, const size_t& j) const { return this->_f(this->_e(i, j)); }
+        bool Refers(const void* p) const { return this->_e.Refers(p); }
+        size_t Cost() const { return this->_e.Cost() + 4; }
+    };
+
+    /** @brief Node: transposed expression */
+    template <typename E>
+    class TransposeExpression : public MatrixExpression<TransposeExpression<E>> {
+        protected:
+        const E _e;
+
+        public:
+        static constexpr bool Elementwise = false;
+
+        TransposeExpression(const E& e) : _e(e) {}
+        size_t Rows() const { return this->_e.Cols(); }
+        size_t Cols() const { return this->_e.Rows(); }
+        double operator()(const size_t& i, const size_t& j) const { return this->_e(j, i); }
+        bool Refers(const void* p) const { return this->_e.Refers(p); }
+        size_t Cost() const { return this->_e.Cost(); }
+    };
+
+    /** @brief Node: matrix product (m x n by n x p). Each element is a dot product computed on demand. */
+    template <typename L, typename R>
+    class ProductExpression : public MatrixExpression<ProductExpression<L, R>> {
+        protected:
+        const L _l;
+        const R _r;
+
+        public:
+        static constexpr bool Elementwise = false;
+
+        ProductExpression(const L& l, const R& r) : _l(l), _r(r) {
+            if (l.Cols() != r.Rows()) throw out_of_range("Matrix expression: A(m,n)*B(n,p) failed: n has different value!");
+        }
+        size_t Rows() const { return this->_l.Rows(); }
+        size_t Cols() const { return this->_r.Cols(); }
+        double operator()(const size_t& i, const size_t& j) const {
+            double sum = 0;
+            const size_t n = this->_l.Cols();
+
+            if constexpr (std::is_same<L, MatrixTerm>::value && std::is_same<R, VectorTerm>::value) {
+                // Matrix by vector: plain dot product on contiguous data
+                const double* row = this->_l.Row(i);
+                const double* x = this->_r.Data();
+                for (size_t k = 0; k < n; k++) sum += row[k] * x[k];
+            }
+            else {
+                for (size_t k = 0; k < n; k++) sum += this->_l(i, k) * this->_r(k, j);
+            }
+
+            return sum;
+        }
+        bool Refers(const void* p) const { return this->_l.Refers(p) || this->_r.Refers(p); }
+        size_t Cost() const { return this->_l.Cols() * (this->_l.Cost() + this->_r.Cost()); }
+    };
+
+    /** @brief Node: outer product of two vectors u * v^T (same as Matrix::DotMultiplyVectors, never stored) */
+    class OuterExpression : public MatrixExpression<OuterExpression> {
+        protected:
+        const vector<double>& _u;
+        const vector<double>& _v;
+
+        public:
+        static constexpr bool Elementwise = false;
+
+        OuterExpression(const vector<double>& u, const vector<double>& v) : _u(u), _v(v) {}
+        size_t Rows() const { return this->_u.size(); }
+        size_t Cols() const { return this->_v.size(); }
+        double operator()(const size_t& i, const size_t& j) const { return this->_u[i] * this->_v[j]; }
+        bool Refers(const void* p) const { return p == &this->_u || p == &this->_v; }
+        size_t Cost() const { return 2; }
+    };
+
+    /** @brief Maps operands to expression nodes: Matrix -> MatrixTerm, vector -> VectorTerm, expressions -> themselves */
+    template <typename T, typename Enable = void>
+    class ExpressionOf {
+        public:
+        static constexpr bool Valid = false;
+        static constexpr bool Native = false;
+    };
+
+    template <>
+    class ExpressionOf<Matrix, void> {
+        public:
+        using Type = MatrixTerm;
+        static constexpr bool Valid = true;
+        static constexpr bool Native = true;
+        static Type Make(const Matrix& m) { return MatrixTerm(m); }
+    };
+
+    template <>
+    class ExpressionOf<vector<double>, void> {
+        public:
+        using Type = VectorTerm;
+        static constexpr bool Valid = true;
+        // Not native: operators need at least one Matrix/expression operand (never overload vector + vector)
+        static constexpr bool Native = false;
+        static Type Make(const vector<double>& v) { return VectorTerm(v); }
+    };
+
+    template <typename T>
+    class ExpressionOf<T, typename std::enable_if<std::is_base_of<MatrixExpression<T>, T>::value>::type> {
+        public:
+        using Type = T;
+        static constexpr bool Valid = true;
+        static constexpr bool Native = true;
+        static const T& Make(const T& e) { return e; }
+    };
+
+    /// @brief Enabled if A and B can be operands of a binary expression
+    template <typename A, typename B>
+    using EnableExpression = typename std::enable_if<ExpressionOf<A>::Valid && ExpressionOf<B>::Valid && (ExpressionOf<A>::Native || ExpressionOf<B>::Native)>::type;
+
+    /// @brief Enabled if A is a Matrix or an expression
+    template <typename A>
+    using EnableNative = typename std::enable_if<ExpressionOf<A>::Native>::type;
+
+    /// @brief Node type of an operand
+    template <typename A>
+    using ExpressionType = typename ExpressionOf<A>::Type;
+
+    template <typename A, typename B, typename = EnableExpression<A, B>>
+    BinaryExpression<ExpressionType<A>, ExpressionType<B>, AddOperation> operator+(const A& a, const B& b) {
+        return BinaryExpression<ExpressionType<A>, ExpressionType<B>, AddOperation>(ExpressionOf<A>::Make(a), ExpressionOf<B>::Make(b));
+    }
+
+    template <typename A, typename B, typename = EnableExpression<A, B>>
+    BinaryExpression<ExpressionType<A>, ExpressionType<B>, SubtractOperation> operator-(const A& a, const B& b) {
+        return BinaryExpression<ExpressionType<A>, ExpressionType<B>, SubtractOperation>(ExpressionOf<A>::Make(a), ExpressionOf<B>::Make(b));
+    }
+
+    /// @brief Matrix product (a vector operand is a column)
+    template <typename A, typename B, typename = EnableExpression<A, B>>
+    ProductExpression<ExpressionType<A>, ExpressionType<B>> operator*(const A& a, const B& b) {
+        return ProductExpression<ExpressionType<A>, ExpressionType<B>>(ExpressionOf<A>::Make(a), ExpressionOf<B>::Make(b));
+    }
+
+    template <typename A, typename = EnableNative<A>>
+    ScaledExpression<ExpressionType<A>> operator*(const double& k, const A& a) {
+        return ScaledExpression<ExpressionType<A>>(ExpressionOf<A>::Make(a), k);
+    }
+
+    template <typename A, typename = EnableNative<A>>
+    ScaledExpression<ExpressionType<A>> operator*(const A& a, const double& k) {
+        return ScaledExpression<ExpressionType<A>>(ExpressionOf<A>::Make(a), k);
+    }
+
+    template <typename A, typename = EnableNative<A>>
+    ScaledExpression<ExpressionType<A>> operator/(const A& a, const double& k) {
+        return ScaledExpression<ExpressionType<A>>(ExpressionOf<A>::Make(a), 1.0 / k);
+    }
+
+    template <typename A, typename = EnableNative<A>>
+    ScaledExpression<ExpressionType<A>> operator-(const A& a) {
+        return ScaledExpression<ExpressionType<A>>(ExpressionOf<A>::Make(a), -1.0);
+    }
+
+    /// @brief A vector as a n x 1 column expression (to combine vectors without a Matrix operand)
+    /// @param v vector
+    /// @return Expression
+    inline VectorTerm Column(const vector<double>& v) {
+        return VectorTerm(v);
+    }
+
+    /// @brief Outer product u * v^T
+    /// @param u vector (rows)
+    /// @param v vector (cols)
+    /// @return Expression
+    inline OuterExpression Outer(const vector<double>& u, const vector<double>& v) {
+        return OuterExpression(u, v);
+    }
+
+    /// @brief Hadamard (element by element) product
+    template <typename A, typename B, typename = typename std::enable_if<ExpressionOf<A>::Valid && ExpressionOf<B>::Valid>::type>
+    BinaryExpression<ExpressionType<A>, ExpressionType<B>, HadamardOperation> Hadamard(const A& a, const B& b) {
+        return BinaryExpression<ExpressionType<A>, ExpressionType<B>, HadamardOperation>(ExpressionOf<A>::Make(a), ExpressionOf<B>::Make(b));
+    }
+
+    /// @brief Transpose
+    template <typename A, typename = typename std::enable_if<ExpressionOf<A>::Valid>::type>
+    TransposeExpression<ExpressionType<A>> Transpose(const A& a) {
+        return TransposeExpression<ExpressionType<A>>(ExpressionOf<A>::Make(a));
+    }
+
+    /// @brief Apply f() to all elements
+    template <typename A, typename = typename std::enable_if<ExpressionOf<A>::Valid>::type>
+    ApplyExpression<ExpressionType<A>> Apply(const A& a, double (*f)(const double& x)) {
+        return ApplyExpression<ExpressionType<A>>(ExpressionOf<A>::Make(a), f);
+    }
+
+    /// @brief Evaluate a one-column expression into a vector, in a single pass (vector is resized if needed)
+    /// @param destination Output vector
+    /// @param expression Expression (n x 1)
+    template <typename E>
+    void Assign(vector<double>& destination, const MatrixExpression<E>& expression) {
+        const E& e = expression.Self();
+        if (e.Cols() != 1) throw out_of_range("Matrix expression: only a n x 1 expression can be assigned to a vector!");
+
+        // Not element by element (products): evaluate aside if the destination is an operand
+        if ((!E::Elementwise || destination.size() != e.Rows()) && e.Refers(&destination)) {
+            vector<double> temp(e.Rows());
+            Assign(temp, expression);
+            destination.swap(temp);
+            return;
+        }
+
+        if (destination.size() != e.Rows()) destination.resize(e.Rows());
+
+        double* d = destination.data();
+        Matrix::ForRows(e.Rows(), e.Rows() * e.Cost(), [d, &e](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) d[i] = e(i, 0);
+        });
+    }
+
+    template <typename E>
+    Matrix::Matrix(const MatrixExpression<E>& expression) {
+        const E& e = expression.Self();
+        this->_rows = e.Rows();
+        this->_cols = e.Cols();
+        this->InstanceMatrix();
+        *this = expression;
+    }
+
+    template <typename E>
+    Matrix& Matrix::operator=(const MatrixExpression<E>& expression) {
+        const E& e = expression.Self();
+
+        // Not element by element (products, transpose): evaluate aside if this matrix is an operand
+        if ((!E::Elementwise || this->_rows != e.Rows() || this->_cols != e.Cols()) && e.Refers(this)) {
+            Matrix temp(expression);
+            return (*this = temp);
+        }
+
+        // Reallocate only if size changes
+        if (this->_rows != e.Rows() || this->_cols != e.Cols()) {
+            this->FreeMatrix();
+            this->_rows = e.Rows();
+            this->_cols = e.Cols();
+            this->InstanceMatrix();
+        }
+
+        Matrix::ForRows(this->_rows, this->_rows * this->_cols * e.Cost(), [this, &e](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) {
+                double* row = this->_matrix[i];
+                for (size_t j = 0; j < this->_cols; j++) row[j] = e(i, j);
+            }
+        });
+
+        return *this;
+    }
+
+    template <typename E>
+    Matrix& Matrix::operator+=(const MatrixExpression<E>& expression) {
+        const E& e = expression.Self();
+        if (this->_rows != e.Rows() || this->_cols != e.Cols()) throw out_of_range("Matrix +=: operands must have the same size!");
+        if (!E::Elementwise && e.Refers(this)) {
+            Matrix temp(expression);
+            return (*this += MatrixTerm(temp));
+        }
+
+        Matrix::ForRows(this->_rows, this->_rows * this->_cols * e.Cost(), [this, &e](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) {
+                double* row = this->_matrix[i];
+                for (size_t j = 0; j < this->_cols; j++) row[j] += e(i, j);
+            }
+        });
+
+        return *this;
+    }
+
+    template <typename E>
+    Matrix& Matrix::operator-=(const MatrixExpression<E>& expression) {
+        const E& e = expression.Self();
+        if (this->_rows != e.Rows() || this->_cols != e.Cols()) throw out_of_range("Matrix -=: operands must have the same size!");
+        if (!E::Elementwise && e.Refers(this)) {
+            Matrix temp(expression);
+            return (*this -= MatrixTerm(temp));
+        }
+
+        Matrix::ForRows(this->_rows, this->_rows * this->_cols * e.Cost(), [this, &e](const size_t& begin, const size_t& end) {
+            for (size_t i = begin; i < end; i++) {
+                double* row = this->_matrix[i];
+                for (size_t j = 0; j < this->_cols; j++) row[j] -= e(i, j);
+            }
+        });
+
+        return *this;
+    }
+}
+
+#endif
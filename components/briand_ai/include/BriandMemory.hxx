@@ -0,0 +1,123 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_MEMORY_H
+#define BRIAND_MEMORY_H
+
+#include "BriandInclude.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Memory tiers */
+    enum class MemoryTier {
+        Internal,   // Internal SRAM (MALLOC_CAP_INTERNAL): fast, small
+        External    // SPI RAM / PSRAM (MALLOC_CAP_SPIRAM): large, many times slower
+    };
+
+    /** @brief Placement of tensors in memory tiers.
+        Hot small tensors (activations, biases, streaming tiles) go to internal RAM, blocks of at least ExternalThreshold
+        bytes (big weights) go to external RAM when the board has it. If a tier is full the other one is used.
+        On Linux the porting layer simulates both tiers (see Simulate()), external RAM accesses are charged with a configurable latency.
+    */
+    class Memory {
+        public:
+
+        /// @brief Blocks of at least this size are placed in external RAM (if available)
+        static size_t ExternalThreshold;
+
+        /// @brief Size of the internal RAM tile used to stream external weights (see Matrix::MultiplyVector())
+        static size_t TileBytes;
+
+        /// @brief Allocate a block in a tier (the other tier if full)
+        /// @param bytes Size
+        /// @param tier Preferred tier
+        /// @return Block (throws bad_alloc if no tier has room)
+        static void* Allocate(const size_t& bytes, const MemoryTier& tier);
+
+        /// @brief Free a block from Allocate()
+        /// @param ptr Block
+        static void Free(void* ptr);
+
+        /// @brief Tier chosen by the placement policy for a block of this size
+        /// @param bytes Size
+        /// @return Tier
+        static MemoryTier TierFor(const size_t& bytes);
+
+        /// @brief Tier of a block from Allocate()
+        /// @param ptr Block
+        /// @return Tier
+        static MemoryTier TierOf(const void* ptr);
+
+        /// @brief True if the board has external RAM
+        /// @return true if available
+        static bool HasExternal();
+
+        /// @brief Free bytes of a tier
+        /// @param tier Tier
+        /// @return bytes
+        static size_t FreeBytes(const MemoryTier& tier);
+
+        /// @brief Copy from any tier to internal RAM with a sequential burst (tile streaming). Charged with the simulated burst latency if the source is external.
+        /// @param destination Destination (internal RAM)
+        /// @param source Source
+        /// @param bytes Bytes
+        /// @param tier Source tier
+        static void Stream(void* destination, const void* source, const size_t& bytes, const MemoryTier& tier);
+
+        /// @brief Account for a direct (uncached) read of external RAM: charged with the simulated access latency on Linux, no-op on ESP
+        /// @param bytes Bytes read
+        static void Access(const size_t& bytes);
+
+        /// @brief (Linux only, no-op on ESP) Simulate a board: tier sizes and external RAM latency for each 32 bytes line
+        /// @param internalBytes Internal RAM size (0 = unlimited, default)
+        /// @param externalBytes External RAM size (0 = no PSRAM, default)
+        /// @param accessNs Latency of a line read directly from external RAM (cache miss)
+        /// @param burstNs Latency of a line copied with a sequential burst
+        static void Simulate(const size_t& internalBytes, const size_t& externalBytes, const uint32_t& accessNs, const uint32_t& burstNs);
+    };
+
+    /** @brief STL allocator placing containers in internal RAM (heap_caps_malloc(MALLOC_CAP_INTERNAL)) */
+    template <typename T>
+    class InternalAllocator {
+        public:
+
+        typedef T value_type;
+
+        InternalAllocator() = default;
+
+        template <typename U>
+        InternalAllocator(const InternalAllocator<U>&) {}
+
+        T* allocate(std::size_t n) { return static_cast<T*>(Memory::Allocate(n * sizeof(T), MemoryTier::Internal)); }
+
+        void deallocate(T* p, std::size_t /*n*/) { Memory::Free(p); }
+
+        template <typename U>
+        bool operator==(const InternalAllocator<U>&) const { return true; }
+
+        template <typename U>
+        bool operator!=(const InternalAllocator<U>&) const { return false; }
+    };
+
+    /// @brief Vector of doubles in internal RAM (activations, tiles)
+    typedef vector<double, InternalAllocator<double>> InternalVector;
+}
+
+#endif
@@ -0,0 +1,115 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_MODELBATCH_H
+#define BRIAND_MODELBATCH_H
+
+#include "BriandInclude.hxx"
+#include "BriandMath.hxx"
+#include "BriandMatrix.hxx"
+#include "BriandFCNN.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Many small FCNN with the same topology trained in lockstep (hyperparameter sweeps, ensembles).
+        Every value is stored model-major: element i of model m is at [i * Models() + m], so the innermost loop of forward,
+        backward and SGD update runs over models on contiguous memory (one SIMD lane for each model) and a block of models
+        can run on its own thread. Each model has its own learning rate and shuffling seed.
+        Training is the same per-sample SGD of FCNN::Fit() with BatchSize 1: a model gives the same weights it would give alone.
+        Prune masks and 16 bit or sparse copies of the source networks are not used.
+    */
+    class ModelBatch {
+        protected:
+
+        /// @brief Models
+        size_t _models;
+
+        /// @brief Neurons of each layer
+        unique_ptr<vector<size_t>> _sizes;
+
+        /// @brief Weights of layers 1..L-1: element (r, c) of model m at [(r * cols + c) * models + m]
+        unique_ptr<vector<vector<double>>> _weights;
+
+        /// @brief Biases of each layer (empty = no bias): neuron i of model m at [i * models + m]
+        unique_ptr<vector<vector<double>>> _bias;
+
+        /// @brief Net, output and delta values of each layer (input layer: input with bias added in both)
+        unique_ptr<vector<vector<double>>> _net;
+        unique_ptr<vector<vector<double>>> _out;
+        unique_ptr<vector<vector<double>>> _delta;
+
+        /// @brief Targets of current step
+        unique_ptr<vector<double>> _targets;
+
+        /// @brief Activation functions of each layer
+        unique_ptr<vector<ActivationFunction>> _f;
+        unique_ptr<vector<ActivationFunction>> _df;
+
+        /// @brief Softmax output layer
+        bool _softmax;
+
+        /// @brief Output layer error functions
+        ErrorFunction _E, _dE;
+
+        /// @brief Learning rate and shuffling seed of each model
+        unique_ptr<vector<double>> _rates;
+        unique_ptr<vector<uint64_t>> _seeds;
+
+        /// @brief Forward models [begin, end) on the input already in the input layer
+        void Forward(const size_t& begin, const size_t& end);
+
+        /// @brief Backward and SGD update of models [begin, end) with the targets already loaded
+        /// @param errors Error of each model (added)
+        void Backward(const size_t& begin, const size_t& end, vector<double>& errors);
+
+        public:
+
+        /// @brief Build a batch copying the weights of the networks
+        /// @param networks Networks (same layers, neurons, activation and error functions)
+        /// @param learningRates Learning rate of each network
+        /// @param seeds Shuffling seed of each network (as FitOptions::Seed)
+        ModelBatch(const vector<const FCNN*>& networks, const vector<double>& learningRates, const vector<uint64_t>& seeds);
+
+        ~ModelBatch();
+
+        /// @brief Number of models
+        /// @return models
+        const size_t& Models() const;
+
+        /// @brief Train all models for some epochs, each one on its own shuffled order of the samples (blocks of models run on ThreadPool::Default())
+        /// @param dataset Samples
+        /// @param epochs Epochs
+        /// @param shuffle Shuffle samples at each epoch
+        /// @return Mean training loss of the last epoch for each model
+        unique_ptr<vector<double>> Fit(const Dataset& dataset, const size_t& epochs, const bool& shuffle = true);
+
+        /// @brief Forward all models on the same input (ensemble)
+        /// @param inputs Input values
+        /// @param outputs Output values of each model (resized only if needed)
+        void Predict(const vector<double>& inputs, vector<vector<double>>& outputs);
+
+        /// @brief Copy the weights of a model back to a network with the same topology
+        /// @param model Model
+        /// @param network Network
+        void CopyTo(const size_t& model, FCNN& network) const;
+    };
+}
+
+#endif
@@ -0,0 +1,399 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_PIPELINE_H
+#define BRIAND_PIPELINE_H
+
+#include "BriandInclude.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Lock-free ring buffer with exactly ONE producer task and ONE consumer task.
+        Producer only writes _tail, consumer only writes _head, so no lock is needed (just acquire/release ordering).
+        One slot is always kept empty to tell "full" from "empty".
+    */
+    template <typename T>
+    class SPSCRingBuffer {
+        protected:
+
+        /// @brief Slots (capacity + 1)
+        unique_ptr<T[]> _slots;
+
+        /// @brief Number of slots allocated (capacity + 1)
+        size_t _size;
+
+        /// @brief Next slot to read (written by consumer only). Own cache line to avoid false sharing between cores.
+        alignas(64) std::atomic<size_t> _head;
+
+        /// @brief Next slot to write (written by producer only)
+        alignas(64) std::atomic<size_t> _tail;
+
+        public:
+
+        /// @brief Build a ring buffer (all memory allocated here, never after)
+        /// @param capacity Max items in buffer
+        SPSCRingBuffer(const size_t& capacity) {
+            if (capacity == 0) throw out_of_range("Ring buffer capacity must be > 0");
+            this->_size = capacity + 1;
+            this->_slots = make_unique<T[]>(this->_size);
+            this->_head.store(0);
+            this->_tail.store(0);
+        }
+
+        /// @brief Push an item (producer side only)
+        /// @param item Item to push
+        /// @return false if buffer is full
+        bool Push(const T& item) {
+            const size_t tail = this->_tail.load(std::memory_order_relaxed);
+            const size_t next = (tail + 1) % this->_size;
+            if (next == this->_head.load(std::memory_order_acquire)) return false;
+            this->_slots[tail] = item;
+            this->_tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        /// @brief Pop an item (consumer side only)
+        /// @param item Output item
+        /// @return false if buffer is empty
+        bool Pop(T& item) {
+            const size_t head = this->_head.load(std::memory_order_relaxed);
+            if (head == this->_tail.load(std::memory_order_acquire)) return false;
+            item = this->_slots[head];
+            this->_head.store((head + 1) % this->_size, std::memory_order_release);
+            return true;
+        }
+
+        /// @brief Empty the buffer (only when producer and consumer are both stopped!)
+        void Reset() {
+            this->_head.store(0);
+            this->_tail.store(0);
+        }
+
+        /// @brief Items currently in buffer (approximated if called while other side is working)
+        /// @return number of items
+        size_t Count() const {
+            const size_t head = this->_head.load(std::memory_order_acquire);
+            const size_t tail = this->_tail.load(std::memory_order_acquire);
+            return (tail + this->_size - head) % this->_size;
+        }
+
+        /// @brief Max number of items
+        /// @return capacity
+        size_t Capacity() const {
+            return this->_size - 1;
+        }
+    };
+
+    /** @brief Bounded lock-free queue with MANY producer tasks and ONE consumer task.
+        Each slot has a sequence number telling whose turn it is: a producer claims a position with a CAS on the tail, fills the slot
+        and publishes it by advancing the slot sequence, the consumer reads the slots in order. Producers never wait for each other while filling.
+        Capacity is rounded up to a power of 2.
+    */
+    template <typename T>
+    class MPSCRingBuffer {
+        protected:
+
+        /// @brief A slot: free for position p when Sequence == p, readable when Sequence == p + 1
+        class Slot {
+            public:
+            std::atomic<size_t> Sequence;
+            T Item;
+        };
+
+        /// @brief Slots
+        unique_ptr<Slot[]> _slots;
+
+        /// @brief Slots - 1
+        size_t _mask;
+
+        /// @brief Next position to claim (producers). Own cache line to avoid false sharing between cores.
+        alignas(64) std::atomic<size_t> _tail;
+
+        /// @brief Next position to read (written by consumer only)
+        alignas(64) std::atomic<size_t> _head;
+
+        /// @brief Claim a free slot
+        /// @return slot and its position, nullptr if full
+        Slot* Claim(size_t& position) {
+            position = this->_tail.load(std::memory_order_relaxed);
+            while (true) {
+                Slot* slot = &this->_slots[position & this->_mask];
+                const size_t sequence = slot->Sequence.load(std::memory_order_acquire);
+                const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+                if (difference == 0) {
+                    if (this->_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) return slot;
+                }
+                else if (difference < 0) return nullptr;
+                else position = this->_tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        public:
+
+        /// @brief Build a ring buffer (all slots allocated here, never after)
+        /// @param capacity Max items in buffer (rounded up to a power of 2)
+        MPSCRingBuffer(const size_t& capacity) {
+            if (capacity == 0) throw out_of_range("Ring buffer capacity must be > 0");
+            size_t slots = 1;
+            while (slots < capacity) slots <<= 1;
+            this->_slots = make_unique<Slot[]>(slots);
+            for (size_t i = 0; i < slots; i++) this->_slots[i].Sequence.store(i, std::memory_order_relaxed);
+            this->_mask = slots - 1;
+            this->_tail.store(0);
+            this->_head.store(0);
+        }
+
+        /// @brief Push an item (any producer)
+        /// @param item Item to push (moved into the slot only if there is room)
+        /// @return false if buffer is full
+        bool Push(T&& item) {
+            size_t position;
+            Slot* slot = this->Claim(position);
+            if (slot == nullptr) return false;
+            slot->Item = std::move(item);
+            slot->Sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /// @brief Push a copy of an item (any producer)
+        /// @param item Item to push
+        /// @return false if buffer is full
+        bool Push(const T& item) {
+            size_t position;
+            Slot* slot = this->Claim(position);
+            if (slot == nullptr) return false;
+            slot->Item = item;
+            slot->Sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /// @brief Pop an item (consumer side only)
+        /// @param item Output item (moved out of the slot)
+        /// @return false if buffer is empty (or the next item is still being written)
+        bool Pop(T& item) {
+            const size_t head = this->_head.load(std::memory_order_relaxed);
+            Slot& slot = this->_slots[head & this->_mask];
+            if (slot.Sequence.load(std::memory_order_acquire) != head + 1) return false;
+            item = std::move(slot.Item);
+            slot.Sequence.store(head + this->_mask + 1, std::memory_order_release);
+            this->_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /// @brief Items currently in buffer, claimed ones included (approximated while producers are working)
+        /// @return number of items
+        size_t Count() const {
+            const size_t head = this->_head.load(std::memory_order_acquire);
+            const size_t tail = this->_tail.load(std::memory_order_acquire);
+            return (tail > head ? tail - head : 0);
+        }
+
+        /// @brief Max number of items
+        /// @return capacity
+        size_t Capacity() const {
+            return this->_mask + 1;
+        }
+    };
+
+    /** @brief A preallocated frame slot travelling along the pipeline stages */
+    class PipelineFrame {
+        public:
+
+        /// @brief Preprocessed input values (written by capture stage, size fixed at pipeline creation)
+        unique_ptr<vector<double>> Input;
+
+        /// @brief Inference output values (written by inference stage, size fixed at pipeline creation)
+        unique_ptr<vector<double>> Output;
+
+        /// @brief Frame sequence number (assigned by capture stage)
+        uint64_t Sequence;
+
+        /// @brief Capture timestamp in microseconds (esp_timer_get_time())
+        uint64_t CaptureTime;
+
+        /// @brief Build a frame slot
+        /// @param inputs Input vector size
+        /// @param outputs Output vector size
+        PipelineFrame(const size_t& inputs, const size_t& outputs);
+    };
+
+    /// @brief Capture/preprocess stage function: fill frame.Input and return true, or return false if no frame is ready yet.
+    using PipelineSourceFunction = bool (*)(PipelineFrame& frame, void* context);
+
+    /// @brief Inference or post-processing stage function
+    using PipelineStageFunction = void (*)(PipelineFrame& frame, void* context);
+
+    /** @brief What capture stage does when all frame slots are busy */
+    enum class PipelineOverflow {
+        Block,      // wait for a free slot (backpressure on the source)
+        DropNewest  // capture anyway in a scratch slot and discard the frame
+    };
+
+    /** @brief Pipeline stages */
+    enum class PipelineStage { Capture = 0, Inference = 1, PostProcess = 2 };
+
+    /** @brief Pipeline configuration */
+    class PipelineConfig {
+        public:
+
+        /// @brief Frame slots preallocated (max frames in flight)
+        size_t Slots;
+
+        /// @brief Frame input size
+        size_t InputSize;
+
+        /// @brief Frame output size
+        size_t OutputSize;
+
+        /// @brief Overflow policy
+        PipelineOverflow Overflow;
+
+        /// @brief Core for each stage (index with PipelineStage). Default capture/post on core 0, inference on core 1.
+        BaseType_t Cores[3];
+
+        /// @brief Stack size for each stage task
+        uint32_t StackSize;
+
+        /// @brief Priority for each stage task
+        UBaseType_t Priority;
+
+        /// @brief Default configuration
+        /// @param inputs Frame input size
+        /// @param outputs Frame output size
+        PipelineConfig(const size_t& inputs, const size_t& outputs);
+    };
+
+    /** @brief Pipeline statistics snapshot */
+    class PipelineStatistics {
+        public:
+
+        /// @brief Frames captured (including dropped)
+        uint64_t Captured;
+
+        /// @brief Frames dropped because of no free slot
+        uint64_t Dropped;
+
+        /// @brief Frames that completed the post-processing
+        uint64_t Completed;
+
+        /// @brief Stage busy fraction (0-1) over the running time (index with PipelineStage)
+        double StageOccupancy[3];
+
+        /// @brief Average number of frames in stage input queue (taken one included) when the stage takes one (index with PipelineStage, capture = free slots)
+        double StageQueueDepth[3];
+
+        /// @brief End-to-end latency (capture to post-process end) in microseconds
+        double LatencyAvg;
+        uint64_t LatencyMin;
+        uint64_t LatencyMax;
+
+        /// @brief Running time in microseconds
+        uint64_t Elapsed;
+
+        /// @brief Print out statistics
+        void Print();
+    };
+
+    /** @brief Streaming executor: capture/preprocess, inference and post-processing run as three tasks (on different cores if available)
+        connected by lock-free SPSC ring buffers carrying indexes of preallocated frame slots.
+        No memory is allocated after construction.
+
+        free slots --> [capture] --ready--> [inference] --done--> [post-process] --> free slots
+    */
+    class StreamingPipeline {
+        protected:
+
+        /// @brief Configuration
+        PipelineConfig _config;
+
+        /// @brief Frame slots (+ 1 scratch frame used when dropping)
+        unique_ptr<vector<unique_ptr<PipelineFrame>>> _frames;
+
+        /// @brief Free slots (post-process -> capture)
+        unique_ptr<SPSCRingBuffer<size_t>> _free;
+
+        /// @brief Captured slots (capture -> inference)
+        unique_ptr<SPSCRingBuffer<size_t>> _ready;
+
+        /// @brief Inferred slots (inference -> post-process)
+        unique_ptr<SPSCRingBuffer<size_t>> _done;
+
+        /// @brief Stage functions and user context
+        PipelineSourceFunction _capture;
+        PipelineStageFunction _inference;
+        PipelineStageFunction _postProcess;
+        void* _context;
+
+        /// @brief Run flag
+        std::atomic<bool> _running;
+
+        /// @brief Set by each stage task when its loop ends
+        std::atomic<bool> _stageExited[3];
+
+        /// @brief Statistics counters (each one written by a single stage)
+        std::atomic<uint64_t> _captured;
+        std::atomic<uint64_t> _dropped;
+        std::atomic<uint64_t> _completed;
+        std::atomic<uint64_t> _busy[3];
+        std::atomic<uint64_t> _queueSum[3];
+        std::atomic<uint64_t> _queueSamples[3];
+        std::atomic<uint64_t> _latencySum;
+        std::atomic<uint64_t> _latencyMin;
+        std::atomic<uint64_t> _latencyMax;
+        uint64_t _startTime;
+        uint64_t _stopTime;
+
+        /// @brief Task functions
+        static void CaptureTask(void* pipeline);
+        static void InferenceTask(void* pipeline);
+        static void PostProcessTask(void* pipeline);
+
+        /// @brief Common task ending
+        static void ExitTask(StreamingPipeline* p, const PipelineStage& stage);
+
+        public:
+
+        /// @brief Build the pipeline and preallocate everything
+        /// @param config Configuration
+        /// @param capture Capture/preprocess function
+        /// @param inference Inference function
+        /// @param postProcess Post-processing function
+        /// @param context User context passed to all functions
+        StreamingPipeline(const PipelineConfig& config, PipelineSourceFunction capture, PipelineStageFunction inference, PipelineStageFunction postProcess, void* context);
+
+        ~StreamingPipeline();
+
+        /// @brief Start the stage tasks
+        void Start();
+
+        /// @brief Stop the stage tasks and wait for them to end. Frames in flight are discarded.
+        void Stop();
+
+        /// @brief True if running
+        bool IsRunning() const;
+
+        /// @brief Statistics snapshot (can be called while running)
+        /// @return statistics
+        PipelineStatistics GetStatistics() const;
+    };
+}
+
+#endif
@@ -0,0 +1,165 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_RANDOM_H
+#define BRIAND_RANDOM_H
+
+#include "BriandInclude.hxx"
+#include "BriandMath.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    // Early declaration of Matrix class needed in Philox.
+    class Matrix;
+
+    /** @brief Weight initialization schemes (fanIn = previous layer neurons, fanOut = layer neurons) */
+    enum class WeightInitializer {
+        Uniform,    // Uniform in [0, 1) (library default, same as Matrix::Randomize())
+        Xavier,     // Glorot uniform in [-sqrt(6/(fanIn+fanOut)), +sqrt(6/(fanIn+fanOut))), for sigmoid/tanh
+        He,         // Normal with mean 0 and stddev sqrt(2/fanIn), for ReLU
+        LeCun,      // Normal with mean 0 and stddev sqrt(1/fanIn)
+        Auto        // He for ReLU layers, Xavier otherwise
+    };
+
+    /** @brief Philox4x32-10 counter-based pseudo random generator.
+        Each block of 4 random 32 bit numbers is a pure function of (seed, stream, block counter), so any element of a
+        sequence can be computed without the previous ones: bulk fills are split across threads and give the same
+        numbers with any number of threads, on ESP and Linux.
+        Bulk fills use one block for every 2 doubles: element i of a fill always comes from block (first + i/2).
+        An instance is not thread safe (Default() is).
+    */
+    class Philox {
+        protected:
+
+        /// @brief Key (seed)
+        uint64_t _seed;
+
+        /// @brief Stream (independent sequences with the same seed)
+        uint64_t _stream;
+
+        /// @brief Next block
+        uint64_t _counter;
+
+        /// @brief Current block for single numbers
+        uint32_t _buffer[4];
+
+        /// @brief Numbers used in current block (4 = empty)
+        uint8_t _used;
+
+        /// @brief Spare normal number of Box-Muller (valid if _hasSpare)
+        double _spare;
+        bool _hasSpare;
+
+        /// @brief Fill with uniform (normal = false) or normal (normal = true) numbers starting at a given block
+        /// @param out Output
+        /// @param n Elements
+        /// @param first First block
+        /// @param normal Normal or uniform distribution
+        /// @param a low (uniform) or mean (normal)
+        /// @param b high (uniform) or stddev (normal)
+        void FillAt(double* out, const size_t& n, const uint64_t& first, const bool& normal, const double& a, const double& b) const;
+
+        /// @brief Fill a matrix (element (i,j) is number i*cols+j of the fill), split across ThreadPool::Default() if large
+        void FillMatrix(Matrix& m, const bool& normal, const double& a, const double& b);
+
+        public:
+
+        /// @brief Build a generator
+        /// @param seed Seed
+        /// @param stream Stream number (generators with same seed and different stream are independent)
+        Philox(const uint64_t& seed, const uint64_t& stream = 0);
+
+        /// @brief Compute one block: 4 random numbers from (seed, stream, counter), 10 rounds
+        /// @param seed Seed
+        /// @param stream Stream
+        /// @param counter Block counter
+        /// @param out Output (4 numbers)
+        static void Block(const uint64_t& seed, const uint64_t& stream, const uint64_t& counter, uint32_t out[4]);
+
+        /// @brief Restart the sequence with a new seed
+        /// @param seed Seed
+        void Seed(const uint64_t& seed);
+
+        /// @brief Seed
+        /// @return seed
+        const uint64_t& GetSeed() const;
+
+        /// @brief Next random 32 bit number
+        /// @return random number
+        uint32_t NextUInt32();
+
+        /// @brief Next uniform number in [0, 1) (53 bits)
+        /// @return random number
+        double NextUniform();
+
+        /// @brief Next normal number (mean 0, stddev 1)
+        /// @return random number
+        double NextNormal();
+
+        /// @brief Fill with uniform numbers in [low, high)
+        /// @param out Output vector (all elements)
+        /// @param low Low bound
+        /// @param high High bound (excluded)
+        void FillUniform(vector<double>& out, const double& low = 0.0, const double& high = 1.0);
+
+        /// @brief Fill with normal numbers
+        /// @param out Output vector (all elements)
+        /// @param mean Mean
+        /// @param stddev Standard deviation
+        void FillNormal(vector<double>& out, const double& mean = 0.0, const double& stddev = 1.0);
+
+        /// @brief Fill a matrix with uniform numbers in [low, high)
+        /// @param m Matrix
+        /// @param low Low bound
+        /// @param high High bound (excluded)
+        void FillUniform(Matrix& m, const double& low = 0.0, const double& high = 1.0);
+
+        /// @brief Fill a matrix with normal numbers
+        /// @param m Matrix
+        /// @param mean Mean
+        /// @param stddev Standard deviation
+        void FillNormal(Matrix& m, const double& mean = 0.0, const double& stddev = 1.0);
+
+        /// @brief Initialize a weights matrix (rows = layer neurons = fanOut, cols = previous layer neurons = fanIn)
+        /// @param weights Weights matrix
+        /// @param initializer Scheme (Auto is resolved as Xavier, use the overload with activation)
+        void Initialize(Matrix& weights, const WeightInitializer& initializer);
+
+        /// @brief Initialize a weights matrix, Auto resolved by layer activation function
+        /// @param weights Weights matrix
+        /// @param initializer Scheme
+        /// @param activation Layer activation function
+        void Initialize(Matrix& weights, const WeightInitializer& initializer, const ActivationFunction& activation);
+
+        /// @brief Default generator used by Math::Random() and Matrix::Randomize() (seeded with esp_random() at first use). Lock DefaultLock() to use it from more threads.
+        /// @return Default generator
+        static Philox& Default();
+
+        /// @brief Lock of the default generator
+        /// @return mutex
+        static std::mutex& DefaultLock();
+
+        /// @brief Seed the default generator (reproducible runs)
+        /// @param seed Seed
+        static void SetDefaultSeed(const uint64_t& seed);
+    };
+}
+
+#endif
@@ -0,0 +1,212 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_SCHEDULER_H
+#define BRIAND_SCHEDULER_H
+
+#include "BriandInclude.hxx"
+#include "BriandFCNN.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief CPU operating point: frequency and power drawn (used to account energy) */
+    class CpuOperatingPoint {
+        public:
+
+        /// @brief Frequency (MHz, must be accepted by rtc_clk_cpu_freq_mhz_to_config())
+        uint32_t Mhz;
+
+        /// @brief Power while running and while idle at this frequency (mW)
+        double ActiveMilliwatts, IdleMilliwatts;
+    };
+
+    /** @brief A completed inference */
+    class ScheduledInference {
+        public:
+
+        /// @brief Ticket returned by Submit()
+        uint64_t Ticket;
+
+        /// @brief Model
+        size_t Model;
+
+        /// @brief Outputs
+        vector<double> Outputs;
+
+        /// @brief Submit time, absolute deadline, start and end of the run (us, esp_timer_get_time())
+        int64_t Submitted, Deadline, Started, Finished;
+
+        /// @brief Frequency of the run (MHz)
+        uint32_t Mhz;
+
+        /// @brief Finished after the deadline
+        bool Missed;
+
+        /// @brief Error of a failed run (e.g. stale plan), empty if completed (Outputs are empty)
+        string Error;
+    };
+
+    /** @brief Statistics of a DeadlineScheduler */
+    class SchedulerStatistics {
+        public:
+
+        /// @brief Inferences completed, those that missed the deadline and those that failed (also completed, with an error)
+        size_t Completed, Missed, Failed;
+
+        /// @brief Frequency changes
+        size_t Switches;
+
+        /// @brief Energy while running and while idle (mJ, from the operating points power)
+        double ActiveMillijoules, IdleMillijoules;
+
+        /// @brief Running time at each operating point (us, same order of the points)
+        vector<int64_t> ActiveUs;
+    };
+
+    /** @brief Deadline-aware CPU frequency scaling around inference.
+        Each request has a latency budget, each model a cost profile (cycles of each layer, see CompiledFCNN::Profile()).
+        Requests run earliest deadline first on a worker task. Before each run the lowest operating point that still meets the deadline
+        of every queued request (cumulative cycles x Margin / MHz, plus the switch time) is set with rtc_clk_cpu_freq_set_config():
+        a burst of requests raises the clock, a lone request runs slow. After IdleUs without requests the lowest point is set.
+        If no point meets all deadlines the highest one is used.
+        On Linux the frequency is simulated (see briand_porting_cpu_stretch()), so policies can be tested and benchmarked off-device.
+        On ESP32 do not use together with the power management driver (esp_pm), that changes the frequency too.
+    */
+    class DeadlineScheduler {
+        protected:
+
+        /// @brief A queued request
+        class Request {
+            public:
+            uint64_t Ticket;
+            size_t Model;
+            vector<double> Inputs;
+            int64_t Submitted, Deadline;
+        };
+
+        /// @brief A registered model
+        class Model {
+            public:
+            CompiledFCNN* Plan;
+            double Cycles;
+        };
+
+        /// @brief Operating points (ascending frequency)
+        unique_ptr<vector<CpuOperatingPoint>> _points;
+
+        /// @brief Models
+        unique_ptr<vector<Model>> _models;
+
+        /// @brief Queue, ascending deadline
+        unique_ptr<std::deque<Request>> _queue;
+
+        /// @brief Completion callback (worker task)
+        std::function<void(const ScheduledInference&)> _completed;
+
+        /// @brief Current operating point and frequency at construction (restored at the end)
+        size_t _current;
+        uint32_t _initialMhz;
+
+        /// @brief Energy accounting: last event time and running flag
+        int64_t _lastEvent;
+        bool _running;
+
+        /// @brief A completion callback is running (Wait() returns after it)
+        bool _completing;
+
+        /// @brief Last run end (idle detection)
+        int64_t _lastFinished;
+
+        /// @brief Next ticket
+        uint64_t _ticket;
+
+        /// @brief Statistics
+        SchedulerStatistics _statistics;
+
+        std::thread _thread;
+        std::mutex _lock;
+        std::condition_variable _signal;
+        bool _stop;
+
+        /// @brief Charge the energy since the last event (lock held)
+        void Account(const int64_t& now);
+
+        /// @brief Set an operating point (lock held)
+        void SetPoint(const size_t& point, const int64_t& now);
+
+        /// @brief Lowest point meeting all the queued deadlines (lock held)
+        size_t Choose(const int64_t& now) const;
+
+        /// @brief Worker loop
+        void Loop();
+
+        public:
+
+        /// @brief Safety factor on profiled cycles (cache misses, interrupts)
+        double Margin = 1.15;
+
+        /// @brief Idle time before the lowest point is set (us)
+        int64_t IdleUs = 5000;
+
+        /// @brief Time of a frequency change (us, counted when choosing a different point)
+        int64_t SwitchUs = 20;
+
+        /// @brief ESP32 operating points (80, 160, 240 MHz) with typical datasheet currents at 3.3V, radio off
+        /// @return points
+        static vector<CpuOperatingPoint> Esp32Points();
+
+        /// @brief Build a scheduler and start its worker (at the lowest point)
+        /// @param points Operating points (any order)
+        /// @param completed Called by the worker when an inference completes (may be nullptr)
+        DeadlineScheduler(const vector<CpuOperatingPoint>& points, const std::function<void(const ScheduledInference&)>& completed = nullptr);
+
+        /// @brief Waits the queued requests, stops the worker and restores the initial frequency
+        ~DeadlineScheduler();
+
+        /// @brief Register a model
+        /// @param plan Compiled plan (must live as long as the scheduler, used only by the worker)
+        /// @param cycles Cycles of each layer (CompiledFCNN::Profile())
+        /// @return Model id
+        size_t AddModel(CompiledFCNN& plan, const vector<double>& cycles);
+
+        /// @brief Queue an inference
+        /// @param model Model id
+        /// @param inputs Inputs (size of the plan inputs, throws out_of_range otherwise)
+        /// @param budgetUs Latency budget from now (us)
+        /// @return Ticket
+        uint64_t Submit(const size_t& model, const vector<double>& inputs, const int64_t& budgetUs);
+
+        /// @brief Wait until the queue is empty and the last run completed (callback returned)
+        void Wait();
+
+        /// @brief Current frequency (MHz)
+        /// @return MHz
+        uint32_t Mhz();
+
+        /// @brief Statistics (energy accounted up to now)
+        /// @return copy
+        SchedulerStatistics Statistics();
+
+        /// @brief Print out the statistics
+        void Print();
+    };
+}
+
+#endif
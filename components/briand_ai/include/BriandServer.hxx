@@ -0,0 +1,173 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_SERVER_H
+#define BRIAND_SERVER_H
+
+#include "BriandInclude.hxx"
+#include "BriandFCNN.hxx"
+#include "BriandPipeline.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief A completed request of an InferenceServer */
+    class InferenceResult {
+        public:
+
+        /// @brief Outputs
+        vector<double> Outputs;
+
+        /// @brief Submit time, start and end of the batch that ran it (us, esp_timer_get_time())
+        int64_t Submitted, Started, Finished;
+
+        /// @brief Requests in the batch
+        size_t Batch;
+    };
+
+    /** @brief InferenceServer configuration */
+    class InferenceServerConfig {
+        public:
+
+        /// @brief Max requests in a batch
+        size_t MaxBatch = 8;
+
+        /// @brief Max wait for more requests after the first one of a batch was submitted (us, 0 = run what is queued)
+        int64_t MaxWaitUs = 500;
+
+        /// @brief Queue capacity (rounded up to a power of 2)
+        size_t QueueCapacity = 64;
+
+        /// @brief Core of the worker task (modulo the cores available)
+        BaseType_t Core = 1;
+    };
+
+    /** @brief Statistics of an InferenceServer */
+    class InferenceServerStatistics {
+        public:
+
+        /// @brief Requests completed and rejected (queue full)
+        size_t Completed, Rejected;
+
+        /// @brief Batches run and largest batch
+        size_t Batches, LargestBatch;
+    };
+
+    /** @brief Inference server for a FCNN shared by many producer tasks.
+        Requests are accepted from any thread into a lock-free multi-producer queue (see MPSCRingBuffer) and a worker task coalesces them
+        into micro-batches, bounded by MaxBatch and by MaxWaitUs after the first request. A batch runs in one forward pass where each
+        weight is loaded once for all the requests (values stored batch-innermost: element i of request b at [i * batch + b]).
+        Each request is completed by its callback (worker task) or its future.
+        The network is read in place (dense master weights, so 16 bit or sparse copies are not used): do not change it while the server runs.
+        Batch normalization must be folded first (FCNN::OptimizeForInference()), exit heads are not used.
+    */
+    class InferenceServer {
+        protected:
+
+        /// @brief A queued request
+        class Request {
+            public:
+            vector<double> Inputs;
+            int64_t Submitted;
+            std::function<void(const InferenceResult&)> Completed;
+            unique_ptr<std::promise<InferenceResult>> Promise;
+        };
+
+        /// @brief Network
+        const FCNN& _network;
+
+        /// @brief Configuration
+        InferenceServerConfig _config;
+
+        /// @brief Requests queue
+        unique_ptr<MPSCRingBuffer<Request>> _queue;
+
+        /// @brief Batch being collected (worker only)
+        unique_ptr<vector<Request>> _batch;
+
+        /// @brief Activations of a batch, layer k in _activations[k % 2] (largest layer x MaxBatch each)
+        unique_ptr<vector<double>> _activations[2];
+
+        /// @brief Softmax of one request (output layer size)
+        unique_ptr<vector<double>> _net;
+        unique_ptr<vector<double>> _probabilities;
+
+        /// @brief Statistics (worker, under _lock) and rejected requests (producers)
+        InferenceServerStatistics _statistics;
+        std::atomic<size_t> _rejected;
+
+        std::thread _thread;
+        std::mutex _lock;
+        std::condition_variable _signal;
+
+        /// @brief Worker is about to sleep (producers notify only then)
+        std::atomic<bool> _waiting;
+        bool _stop;
+
+        /// @brief Queue a request and wake the worker if needed
+        /// @param request Request
+        /// @return false if the queue is full
+        bool Enqueue(Request& request);
+
+        /// @brief Sleep until a request arrives, at most timeoutUs (< 0 = no timeout)
+        void Sleep(const int64_t& timeoutUs);
+
+        /// @brief Forward the first requests of the batch
+        /// @param requests Requests
+        /// @return Output values (batch-innermost)
+        const double* Forward(const size_t& requests);
+
+        /// @brief Worker loop
+        void Loop();
+
+        public:
+
+        /// @brief Build a server and start its worker
+        /// @param network Network (must live as long as the server, not changed while it runs)
+        /// @param config Configuration
+        InferenceServer(const FCNN& network, const InferenceServerConfig& config = InferenceServerConfig());
+
+        /// @brief Completes the queued requests and stops the worker
+        ~InferenceServer();
+
+        /// @brief Queue a request completed by a callback
+        /// @param inputs Input values
+        /// @param completed Called by the worker task when the request completes (keep it short: next batch waits)
+        /// @return false if the queue is full (request dropped and counted as rejected)
+        bool Submit(const vector<double>& inputs, const std::function<void(const InferenceResult&)>& completed);
+
+        /// @brief Queue a request completed by a future. If the queue is full waits for room.
+        /// @param inputs Input values
+        /// @return Future of the result
+        std::future<InferenceResult> Submit(const vector<double>& inputs);
+
+        /// @brief Requests queued and not yet taken by the worker
+        /// @return requests
+        size_t Pending() const;
+
+        /// @brief Statistics
+        /// @return copy
+        InferenceServerStatistics Statistics();
+
+        /// @brief Print out the statistics
+        void Print();
+    };
+}
+
+#endif
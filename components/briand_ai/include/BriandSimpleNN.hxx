@@ -101,8 +101,15 @@ namespace Briand::SimpleNN {
 
         /// @brief Updates all layer's neurons values
         void UpdateNeurons();
+
+        /// @brief Activation function of the layer
+        /// @return Pointer to activation function
+        ActivationFunction Activation() const;
     }; 
 
+    // Early declaration of CompiledNetwork class needed in NeuralNetwork.
+    class CompiledNetwork;
+
     /// @brief An empty Neural Network, without layers, neurons and connections.
     /// Has no particular methods, just basic data structure and propagation forward.
     /// Use it when you know what you are doing!
@@ -123,10 +130,84 @@ namespace Briand::SimpleNN {
         /// @brief Forward Propagation
         virtual void PropagateForward();
 
+        /// @brief Compile the neuron graph into flat arrays for fast forward propagation (see CompiledNetwork).
+        /// The network stays the editable front end: after weight changes call CompiledNetwork::RefreshWeights(), after topology changes compile again.
+        /// @return Compiled network (valid while this network and its neurons exist)
+        unique_ptr<CompiledNetwork> Compile() const;
+
         /// @brief Constructor
         NeuralNetwork();
     };
 
+    /** @brief A NeuralNetwork compiled into contiguous arrays (CSR edge list).
+        Neurons are numbered in topological order (each neuron after all of its sources), so a forward pass is a single
+        sweep over offsets/sources/weights with no pointer chasing. Neurons without inputs (inputs, bias, ...) come first.
+    */
+    class CompiledNetwork {
+        protected:
+
+        /// @brief Neuron values, in compiled order
+        unique_ptr<vector<double>> _values;
+
+        /// @brief First edge of each neuron (neurons + 1 items)
+        unique_ptr<vector<uint32_t>> _offsets;
+
+        /// @brief Source neuron of each edge
+        unique_ptr<vector<uint32_t>> _sources;
+
+        /// @brief Weight of each edge
+        unique_ptr<vector<double>> _weights;
+
+        /// @brief Activation function of each neuron (nullptr for neurons without inputs)
+        unique_ptr<vector<ActivationFunction>> _activations;
+
+        /// @brief Front end neuron of each compiled neuron
+        unique_ptr<vector<Neuron*>> _neurons;
+
+        /// @brief Front end synapsis of each edge (for weights refresh)
+        unique_ptr<vector<Synapsis*>> _synapses;
+
+        /// @brief Compiled index of input layer neurons
+        unique_ptr<vector<uint32_t>> _inputs;
+
+        /// @brief Compiled index of output layer neurons
+        unique_ptr<vector<uint32_t>> _outputs;
+
+        /// @brief First neuron with inputs (the ones before are only sources)
+        uint32_t _firstComputed;
+
+        friend class NeuralNetwork;
+
+        CompiledNetwork();
+
+        public:
+
+        ~CompiledNetwork();
+
+        /// @brief Number of neurons
+        /// @return neurons
+        size_t Neurons() const;
+
+        /// @brief Number of synapses (edges)
+        /// @return synapses
+        size_t Synapses() const;
+
+        /// @brief Memory used by the compiled arrays
+        /// @return bytes
+        size_t MemoryBytes() const;
+
+        /// @brief Forward propagation over the flat arrays
+        /// @param inputValues Input values (one for each input layer neuron)
+        /// @param outputValues Output values (resized to output layer neurons if needed)
+        void Forward(const vector<double>& inputValues, vector<double>& outputValues);
+
+        /// @brief Reload weights (and values of source neurons that are not inputs, like bias) from the front end graph
+        void RefreshWeights();
+
+        /// @brief Write the values computed by the latest Forward() back to the front end neurons
+        void StoreValues() const;
+    };
+
     /// @brief Perceptron (one input layer, one output layer with single out, no hidden layers)
     class Perceptron : public NeuralNetwork {
         protected:
@@ -0,0 +1,122 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_SPARSE_H
+#define BRIAND_SPARSE_H
+
+#include "BriandInclude.hxx"
+#include "BriandMatrix.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Sparse storage formats */
+    enum class SparseFormat {
+        CSR,        // Compressed Sparse Row: one value and one column index for each non-zero
+        Block4x1    // 4 rows x 1 column blocks: one column index every 4 values, 4 accumulators in SpMV
+    };
+
+    /** @brief Read-only sparse matrix built from a (pruned) dense Matrix, used for weights in inference. */
+    class SparseMatrix {
+        protected:
+
+        /// @brief Rows
+        size_t _rows;
+
+        /// @brief Columns
+        size_t _cols;
+
+        /// @brief Storage format
+        SparseFormat _format;
+
+        /// @brief Non-zero values (Block4x1: 4 values for each block, zero padded)
+        unique_ptr<vector<double>> _values;
+
+        /// @brief Column of each value (Block4x1: column of each block)
+        unique_ptr<vector<uint32_t>> _columns;
+
+        /// @brief CSR: first value of each row (rows + 1 items). Block4x1: first block of each 4-rows group (groups + 1 items).
+        unique_ptr<vector<uint32_t>> _offsets;
+
+        /// @brief Non-zero elements of the dense matrix
+        size_t _nonZeros;
+
+        public:
+
+        /// @brief Build from a dense matrix
+        /// @param dense Dense matrix
+        /// @param format Storage format
+        /// @param zero Elements with absolute value less or equal than this are not stored
+        SparseMatrix(const Matrix& dense, const SparseFormat& format, const double& zero = 0.0);
+
+        ~SparseMatrix();
+
+        /// @brief Rows
+        /// @return rows
+        const size_t& Rows() const;
+
+        /// @brief Columns
+        /// @return cols
+        const size_t& Cols() const;
+
+        /// @brief Storage format
+        /// @return format
+        const SparseFormat& Format() const;
+
+        /// @brief Non-zero elements of the source matrix
+        /// @return non-zeros
+        const size_t& NonZeros() const;
+
+        /// @brief Fraction of non-zero elements (0-1)
+        /// @return density
+        double Density() const;
+
+        /// @brief Memory used by values and indexes
+        /// @return bytes
+        size_t MemoryBytes() const;
+
+        /// @brief Sparse matrix by dense vector (SpMV), without allocations
+        /// @param v vector (cols elements)
+        /// @param result Output vector (rows elements)
+        void MultiplyVector(const vector<double>& v, vector<double>& result) const;
+
+        /// @brief Sparse matrix by dense vector on raw arrays, no checks (used by compiled plans, see FCNN::Compile())
+        /// @param v vector (cols elements)
+        /// @param result Output (rows elements, must not overlap v)
+        void MultiplyVector(const double* v, double* result) const;
+
+        /// @brief Back to a dense matrix
+        /// @return Dense matrix
+        unique_ptr<Matrix> ToDense() const;
+
+        /// @brief Fraction of non-zero elements of a dense matrix (0-1)
+        /// @param dense Matrix
+        /// @param zero Elements with absolute value less or equal than this are zeros
+        /// @return density
+        static double DensityOf(const Matrix& dense, const double& zero = 0.0);
+
+        /// @brief Memory used by a dense matrix of the given size (values and row pointers)
+        /// @param rows Rows
+        /// @param cols Columns
+        /// @return bytes
+        static size_t DenseMemoryBytes(const size_t& rows, const size_t& cols);
+    };
+}
+
+#endif
@@ -0,0 +1,244 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_STREAMING_H
+#define BRIAND_STREAMING_H
+
+#include "BriandInclude.hxx"
+#include "BriandMath.hxx"
+#include "BriandMemory.hxx"
+#include "BriandFCNN.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /** @brief Storage of weights outside RAM (file, flash partition). Errors throw runtime_error. */
+    class WeightStore {
+        public:
+
+        virtual ~WeightStore() = default;
+
+        /// @brief Prepare the store to be written with this number of bytes (truncate file, erase flash)
+        /// @param bytes Bytes
+        virtual void Prepare(const size_t& bytes) = 0;
+
+        /// @brief Read bytes
+        /// @param offset Offset
+        /// @param destination Destination
+        /// @param bytes Bytes
+        virtual void Read(const size_t& offset, void* destination, const size_t& bytes) = 0;
+
+        /// @brief Write bytes (only after Prepare())
+        /// @param offset Offset
+        /// @param source Source
+        /// @param bytes Bytes
+        virtual void Write(const size_t& offset, const void* source, const size_t& bytes) = 0;
+
+        /// @brief Capacity
+        /// @return bytes
+        virtual size_t Size() const = 0;
+    };
+
+    /** @brief Weights in a file (SPIFFS, SD card on ESP, any file on Linux) */
+    class FileWeightStore : public WeightStore {
+        protected:
+
+        /// @brief File
+        FILE* _file;
+
+        /// @brief File size
+        size_t _size;
+
+        /// @brief Serializes seek and read
+        std::mutex _lock;
+
+        public:
+
+        /// @brief Open (or create) a file
+        /// @param path File path
+        FileWeightStore(const string& path);
+
+        ~FileWeightStore();
+
+        void Prepare(const size_t& bytes) override;
+        void Read(const size_t& offset, void* destination, const size_t& bytes) override;
+        void Write(const size_t& offset, const void* source, const size_t& bytes) override;
+        size_t Size() const override;
+    };
+
+    /** @brief Weights in a data partition of the SPI flash (needs a custom partition table with a data partition with this label).
+        On Linux partitions are simulated by the porting layer (briand_porting_partition_simulate()).
+    */
+    class PartitionWeightStore : public WeightStore {
+        protected:
+
+        /// @brief Partition
+        const esp_partition_t* _partition;
+
+        public:
+
+        /// @brief Find a data partition
+        /// @param label Partition label
+        PartitionWeightStore(const string& label);
+
+        void Prepare(const size_t& bytes) override;
+        void Read(const size_t& offset, void* destination, const size_t& bytes) override;
+        void Write(const size_t& offset, const void* source, const size_t& bytes) override;
+        size_t Size() const override;
+    };
+
+    /** @brief Statistics of a StreamedFCNN */
+    class StreamingStats {
+        public:
+
+        /// @brief Forward() calls
+        size_t Inferences;
+
+        /// @brief Time spent in Forward() (us)
+        long Time;
+
+        /// @brief Time Forward() was stalled waiting for weights (us)
+        long Wait;
+
+        /// @brief Time spent loading weights by the prefetch thread (us)
+        long Load;
+
+        /// @brief Bytes read from the store
+        size_t BytesRead;
+
+        StreamingStats();
+
+        /// @brief Fraction of load time hidden behind compute: 1 - Wait/Load (1 = all loads overlapped)
+        /// @return overlap 0-1
+        double Overlap() const;
+
+        /// @brief Print out
+        void Print() const;
+    };
+
+    /** @brief Out-of-core FCNN inference: weights stay in a WeightStore and each layer is streamed in just before it runs.
+        Two weight buffers in internal RAM alternate: while layer k computes on one, a prefetch thread (on the other core on ESP)
+        loads layer k+1 into the other, and after the last layer the first one is loaded for the next Forward().
+        Only biases, activations and the two buffers (sized to the largest layer) are resident.
+        Activation functions cannot be stored, so the plan is built from the network (see Create()); the network can be destroyed after.
+    */
+    class StreamedFCNN {
+        protected:
+
+        /// @brief One layer after the input: topology and resident data
+        class Layer {
+            public:
+            size_t Rows, Cols;
+            size_t Offset;
+            ActivationFunction F;
+            bool Softmax;
+            unique_ptr<vector<double>> Bias;
+        };
+
+        /// @brief Weights store
+        unique_ptr<WeightStore> _store;
+
+        /// @brief Layers (one for each weights matrix)
+        unique_ptr<vector<Layer>> _layers;
+
+        /// @brief Input layer bias (empty = no bias)
+        unique_ptr<vector<double>> _inputBias;
+
+        /// @brief Activations arena (ping-pong, same as a compiled inference plan)
+        unique_ptr<InternalVector> _arena;
+
+        /// @brief Weights double buffer
+        unique_ptr<InternalVector> _buffers[2];
+
+        /// @brief Layer held by each buffer (SIZE_MAX = none)
+        size_t _loaded[2];
+
+        /// @brief Buffer of the first layer for next Forward()
+        size_t _first;
+
+        /// @brief Load requested to the prefetch thread (layer and buffer, _requested = false if none)
+        size_t _requestLayer, _requestBuffer;
+        bool _requested;
+
+        /// @brief Prefetch thread
+        std::thread _thread;
+        std::mutex _lock;
+        std::condition_variable _signal;
+        bool _stop;
+
+        /// @brief Inputs
+        size_t _inputs;
+
+        /// @brief Statistics
+        StreamingStats _stats;
+
+        /// @brief Error of the prefetch thread (rethrown by Forward())
+        string _error;
+
+        /// @brief Prefetch thread loop
+        void Loop();
+
+        /// @brief Ask the prefetch thread to load a layer (the thread must be idle)
+        /// @param layer Layer
+        /// @param buffer Buffer
+        void Request(const size_t& layer, const size_t& buffer);
+
+        /// @brief Wait until a layer is in a buffer (loaded now if it was not requested)
+        /// @param layer Layer
+        /// @param buffer Buffer
+        void WaitFor(const size_t& layer, const size_t& buffer);
+
+        StreamedFCNN();
+
+        public:
+
+        ~StreamedFCNN();
+
+        /// @brief Write the weights of a network to a store and build the streamed plan (weights are then read only from the store)
+        /// @param network Complete network (dense weights are written, sparse copies are not used)
+        /// @param store Store (prepared and overwritten)
+        /// @return Streamed plan
+        static unique_ptr<StreamedFCNN> Create(const FCNN& network, unique_ptr<WeightStore> store);
+
+        /// @brief Forward propagation (one caller at a time)
+        /// @param inputs Input values
+        /// @param outputs Output values (resized only if needed)
+        void Forward(const vector<double>& inputs, vector<double>& outputs);
+
+        /// @brief Bytes of weights in the store
+        /// @return bytes
+        size_t StoredBytes() const;
+
+        /// @brief Resident RAM: two weight buffers, activations and biases
+        /// @return bytes
+        size_t ResidentBytes() const;
+
+        /// @brief Statistics
+        /// @return statistics
+        const StreamingStats& Stats() const;
+
+        /// @brief Reset statistics
+        void ResetStats();
+
+        /// @brief Print out the plan and its statistics
+        void Print() const;
+    };
+}
+
+#endif
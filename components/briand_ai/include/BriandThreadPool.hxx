@@ -0,0 +1,133 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_THREADPOOL_H
+#define BRIAND_THREADPOOL_H
+
+#include "BriandInclude.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    /// @brief A parallel loop body: works on range [begin, end)
+    using ParallelBody = std::function<void(const size_t& begin, const size_t& end)>;
+
+    /// @brief A parallel reduction body: returns the partial result of range [begin, end)
+    using ParallelReduceBody = std::function<double(const size_t& begin, const size_t& end)>;
+
+    /// @brief Combines two partial results of a reduction
+    using ParallelCombine = std::function<double(const double& a, const double& b)>;
+
+    /** @brief Persistent work-stealing thread pool.
+        Each worker has its own task queue: takes its own tasks from the back and, when empty, steals from the front of the others.
+        The thread calling ParallelFor/ParallelReduce works too (so N workers + caller = N+1 cores busy) and nested calls cannot deadlock.
+        On ESP each worker is pinned to a core with esp_pthread_cfg_t, on Linux the o.s. scheduler decides.
+    */
+    class ThreadPool {
+        protected:
+
+        /** @brief A worker task queue */
+        class WorkerQueue {
+            public:
+            std::mutex Lock;
+            std::deque<std::function<void()>> Tasks;
+        };
+
+        /// @brief One queue for each worker
+        unique_ptr<vector<unique_ptr<WorkerQueue>>> _queues;
+
+        /// @brief Worker threads
+        unique_ptr<vector<std::thread>> _workers;
+
+        /// @brief Tasks queued and not yet taken
+        std::atomic<size_t> _pending;
+
+        /// @brief Stop flag
+        std::atomic<bool> _stop;
+
+        /// @brief Round robin index for submissions from outside the pool
+        std::atomic<size_t> _nextQueue;
+
+        /// @brief Sleeping workers wait here
+        std::mutex _sleepLock;
+        std::condition_variable _sleep;
+
+        /// @brief Worker loop
+        /// @param index worker index
+        void WorkerLoop(const size_t index);
+
+        /// @brief Take a task: from own queue (back) if a worker, otherwise steal from others (front)
+        /// @param index Worker index (or the number of workers if caller is not a worker)
+        /// @param task Output task
+        /// @return true if a task was taken
+        bool TakeTask(const size_t& index, std::function<void()>& task);
+
+        /// @brief Worker index of the calling thread in this pool (or the number of workers if not a worker)
+        size_t CurrentWorker() const;
+
+        public:
+
+        /// @brief Build the pool and start the workers
+        /// @param workers Number of worker threads (0 = everything runs in the calling thread)
+        ThreadPool(const size_t& workers);
+
+        ~ThreadPool();
+
+        /// @brief Number of worker threads
+        /// @return workers
+        size_t Workers() const;
+
+        /// @brief Queue a task
+        /// @param task Task
+        void Submit(std::function<void()> task);
+
+        /// @brief Run body on [begin, end) split in chunks of at least grain items, return when all chunks are done.
+        /// Exceptions thrown by body are rethrown here.
+        /// @param begin First index
+        /// @param end Last index (excluded)
+        /// @param grain Minimum items for each chunk
+        /// @param body Loop body
+        void ParallelFor(const size_t& begin, const size_t& end, const size_t& grain, const ParallelBody& body);
+
+        /// @brief Parallel reduction on [begin, end). Chunks do not depend on the number of workers and partial results
+        /// are combined in chunk order, so the result is the same with any number of workers.
+        /// @param begin First index
+        /// @param end Last index (excluded)
+        /// @param grain Minimum items for each chunk
+        /// @param identity Identity value for combine (0 for sum)
+        /// @param body Partial result of a chunk
+        /// @param combine Combine function
+        /// @return Result
+        double ParallelReduce(const size_t& begin, const size_t& end, const size_t& grain, const double& identity, const ParallelReduceBody& body, const ParallelCombine& combine);
+
+        /// @brief Number of cores of this platform
+        /// @return cores
+        static size_t Cores();
+
+        /// @brief Default pool used by library kernels (created at first use with one worker less than the cores)
+        /// @return The default pool
+        static ThreadPool& Default();
+
+        /// @brief Replace the default pool (do not call while the default pool is in use!)
+        /// @param workers Number of worker threads
+        static void SetDefaultWorkers(const size_t& workers);
+    };
+}
+
+#endif
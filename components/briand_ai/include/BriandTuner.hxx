@@ -0,0 +1,142 @@
+/** Copyright (C) 2023 briand (https://github.com/briand-hub)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef BRIAND_TUNER_H
+#define BRIAND_TUNER_H
+
+#include "BriandInclude.hxx"
+#include "BriandMemory.hxx"
+#include "BriandMatrix.hxx"
+
+using namespace std;
+
+namespace Briand {
+
+    // Early declaration of FCNN class needed in KernelTuner.
+    class FCNN;
+
+    /** @brief Dense matrix by vector (GEMV) kernel variants */
+    enum class GemvKernel {
+        Default,    // Matrix::MultiplyVector(): one accumulator, split across the pool above Matrix::ParallelThreshold (not tuned)
+        Naive,      // One accumulator for each row, single thread
+        Unrolled,   // Four accumulators for each row (independent multiply-adds), single thread
+        Rows4,      // Four rows for each pass (each input element loaded once for four rows), single thread
+        Parallel    // Unrolled rows always split across ThreadPool::Default()
+    };
+
+    /** @brief Tuned shape of the kernel table */
+    class TunedShape {
+        public:
+
+        /// @brief Matrix shape
+        size_t Rows, Cols;
+
+        /// @brief Kernel used
+        GemvKernel Kernel;
+
+        /// @brief Measured time of one call for each tuned variant (ns, index = GemvKernel, 0 = not measured)
+        uint32_t Nanoseconds[5];
+
+        /// @brief Set by KernelTuner::Set() or loaded from a table (not measured here)
+        bool Overridden;
+    };
+
+    /** @brief Startup auto-tuner of GEMV kernels: the fastest variant depends on shape and platform (a 5x7 layer on ESP32 and a 512x512 one on x86 want different code).
+        Candidates are benchmarked once for each shape (on first use by FCNN::Compile() when AutoTune is set, or explicitly with Tune()),
+        the winners are cached in a small table keyed by shape, persisted with the platform (Save()/Load()) and used by compiled plans afterwards.
+        Decisions can be dumped with Print() and overridden with Set() or by editing the saved table.
+        Only weights in internal RAM are dispatched: external RAM weights keep the tiled streaming of Matrix::MultiplyVector().
+        Variants sum in different orders: results may differ in the last bits.
+    */
+    class KernelTuner {
+        public:
+
+        /// @brief Benchmark shapes missing from the table on first use (false = missing shapes use GemvKernel::Default)
+        static bool AutoTune;
+
+        /// @brief Benchmark time budget for each candidate (us)
+        static uint32_t BudgetUs;
+
+        /// @brief Platform key of the table: platform, chip/architecture and workers of the default pool
+        /// @return key
+        static string Platform();
+
+        /// @brief Kernel for a shape: the table entry, benchmarked now if missing and AutoTune is set, otherwise GemvKernel::Default
+        /// @param rows Rows
+        /// @param cols Columns
+        /// @return kernel
+        static GemvKernel Select(const size_t& rows, const size_t& cols);
+
+        /// @brief Benchmark all candidates on a shape and store the winner (overrides are replaced)
+        /// @param rows Rows
+        /// @param cols Columns
+        /// @return winner
+        static GemvKernel Tune(const size_t& rows, const size_t& cols);
+
+        /// @brief Benchmark the shapes of all dense layers of a network (model finalization, before Compile())
+        /// @param network Network
+        /// @param force Benchmark again shapes already in the table
+        /// @return Shapes benchmarked
+        static size_t Tune(const FCNN& network, const bool& force = false);
+
+        /// @brief Override the kernel of a shape
+        /// @param rows Rows
+        /// @param cols Columns
+        /// @param kernel Kernel
+        static void Set(const size_t& rows, const size_t& cols, const GemvKernel& kernel);
+
+        /// @brief Remove all the entries of this platform
+        static void Clear();
+
+        /// @brief Entries of this platform
+        /// @return copy of the table
+        static vector<TunedShape> Entries();
+
+        /// @brief Load a table saved by Save(): entries of other platforms are kept aside (saved back untouched), entries with unknown kernels are skipped
+        /// @param path File path
+        /// @return false if the file cannot be read
+        static bool Load(const string& path);
+
+        /// @brief Save the table (one "platform rows cols kernel" line for each entry)
+        /// @param path File path
+        /// @return false if the file cannot be written
+        static bool Save(const string& path);
+
+        /// @brief Print out the decisions with the measured times
+        static void Print();
+
+        /// @brief Kernel name (as in saved tables)
+        /// @param kernel Kernel
+        /// @return name
+        static const char* Name(const GemvKernel& kernel);
+
+        /// @brief Kernel from its name
+        /// @param name Name
+        /// @return kernel (throws runtime_error if unknown)
+        static GemvKernel Parse(const string& name);
+
+        /// @brief result = M * v with a kernel variant, no checks (external RAM matrices always use Matrix::MultiplyVector())
+        /// @param kernel Kernel
+        /// @param m Matrix
+        /// @param v Vector (columns elements)
+        /// @param result Result (rows elements)
+        static void MultiplyVector(const GemvKernel& kernel, const Matrix& m, const double* v, double* result);
+    };
+}
+
+#endif
@@ -328,28 +328,2267 @@ void performance_test(){
 
     fcnn.reset();
 
+    // 
+    // FCNN concurrent const inference: one shared model, one context for each thread
+    // 
+
+    fcnn = make_unique<Briand::FCNN>();
+    fcnn->AddInputLayer(64);
+    fcnn->AddHiddenLayer(32, Briand::Math::ReLU, Briand::Math::DeReLU);
+    fcnn->AddHiddenLayer(32, Briand::Math::ReLU, Briand::Math::DeReLU);
+    fcnn->AddOutputLayer(4, Briand::Math::Sigmoid, Briand::Math::DeSigmoid, Briand::Math::MSE, Briand::Math::DeMSE);
+
+    const size_t PREDICTIONS = 4000;
+    const size_t maxThreads = std::max(2u, std::min(4u, std::thread::hardware_concurrency()));
+    double singleThread = 0;
+
+    for (size_t threads = 1; threads <= maxThreads; threads++) {
+        vector<std::thread> workers;
+        start = esp_timer_get_time();
+        for (size_t t = 0; t < threads; t++) {
+            workers.push_back(std::thread([&fcnn, threads, PREDICTIONS]() {
+                auto context = fcnn->CreateContext();
+                vector<double> in(64, 0.5);
+                vector<double> out(4, 0.0);
+                for (size_t p = 0; p < PREDICTIONS / threads; p++) fcnn->Predict(*context.get(), in, out);
+            }));
+        }
+        for (auto& w : workers) w.join();
+        took = esp_timer_get_time() - start;
+        if (threads == 1) singleThread = static_cast<double>(took);
+        printf("FCNN(64,32,32,4) %u predictions on %u threads took: %ldus (%.0lf predictions/s, speedup %.2lfx)\n", 
+            static_cast<unsigned int>(PREDICTIONS), static_cast<unsigned int>(threads), took, 
+            static_cast<double>(PREDICTIONS) * 1000000.0 / static_cast<double>(took), singleThread / static_cast<double>(took));
+    }
+
+    fcnn.reset();
+
+
+    printf("***********************************************************\n\n\n");    
+}
+
+/** @brief Thread pool test (matrix kernels speedup against number of cores) */
+void threadpool_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************* THREAD POOL TEST ********************\n\n");
+
+#if defined(ESP_PLATFORM)
+    const size_t GEMM = 64, GEMV = 256, ELEMENTS = 256;
+#else
+    const size_t GEMM = 256, GEMV = 1024, ELEMENTS = 1024;
+#endif
+    const uint8_t TESTS = 5;
+    const size_t maxCores = std::max(static_cast<size_t>(4), Briand::ThreadPool::Cores());
+    long start = 0;
+    double base[4] = { 0, 0, 0, 0 };
+
+    auto a = make_unique<Briand::Matrix>(GEMM, GEMM, 0.5);
+    auto b = make_unique<Briand::Matrix>(GEMM, GEMM, 0.25);
+    auto w = make_unique<Briand::Matrix>(GEMV, GEMV, 0.5);
+    auto e = make_unique<Briand::Matrix>(ELEMENTS, ELEMENTS, 0.5);
+    vector<double> v(GEMV, 1.0), r(GEMV, 0.0);
+    vector<double> big(ELEMENTS * ELEMENTS, 0.001);
+
+    printf("Platform has %u cores. Timings are averages of %u runs.\n", static_cast<unsigned int>(Briand::ThreadPool::Cores()), TESTS);
+    printf("cores | GEMM %ux%u       | GEMV %ux%u       | Hadamard %ux%u   | Reduce %u\n", 
+        static_cast<unsigned int>(GEMM), static_cast<unsigned int>(GEMM), static_cast<unsigned int>(GEMV), static_cast<unsigned int>(GEMV), 
+        static_cast<unsigned int>(ELEMENTS), static_cast<unsigned int>(ELEMENTS), static_cast<unsigned int>(big.size()));
+
+    // Caller works too: cores = workers + 1
+    for (size_t cores = 1; cores <= maxCores; cores++) {
+        Briand::ThreadPool::SetDefaultWorkers(cores - 1);
+        double took[4] = { 0, 0, 0, 0 };
+        double sum = 0;
+
+        for (uint8_t i = 0; i < TESTS; i++) {
+            start = esp_timer_get_time();
+            auto c = a->MultiplyMatrix(*b.get());
+            took[0] += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+
+            start = esp_timer_get_time();
+            w->MultiplyVector(v, r);
+            took[1] += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+
+            start = esp_timer_get_time();
+            auto h = e->MultiplyMatrixHadamard(*e.get());
+            took[2] += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+
+            start = esp_timer_get_time();
+            sum = Briand::ThreadPool::Default().ParallelReduce(0, big.size(), 4096, 0.0, 
+                [&big](const size_t& b, const size_t& e) { double s = 0; for (size_t k = b; k < e; k++) s += big[k]; return s; },
+                [](const double& x, const double& y) { return x + y; });
+            took[3] += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+        }
+
+        if (cores == 1) std::copy_n(took, 4, base);
+        printf("%5u | %7ldus (%.2lfx) | %7ldus (%.2lfx) | %7ldus (%.2lfx) | %7ldus (%.2lfx) sum = %.3lf\n", static_cast<unsigned int>(cores),
+            static_cast<long>(took[0]), base[0] / took[0], static_cast<long>(took[1]), base[1] / took[1],
+            static_cast<long>(took[2]), base[2] / took[2], static_cast<long>(took[3]), base[3] / took[3], sum);
+    }
+
+    // Back to default
+    Briand::ThreadPool::SetDefaultWorkers(Briand::ThreadPool::Cores() - 1);
+
+    printf("***********************************************************\n\n\n");    
+}
+
+/** @brief Sparse weights test (memory and latency at 50/80/95% sparsity) */
+void sparse_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** SPARSE TEST ************************\n\n");
+
+#if defined(ESP_PLATFORM)
+    const size_t N = 64;
+#else
+    const size_t N = 256;
+#endif
+    const uint8_t TESTS = 50;
+
+    auto fcnn = make_unique<Briand::FCNN>();
+    fcnn->AddInputLayer(N);
+    fcnn->AddHiddenLayer(N, Briand::Math::ReLU, Briand::Math::DeReLU);
+    fcnn->AddHiddenLayer(N, Briand::Math::ReLU, Briand::Math::DeReLU);
+    fcnn->AddOutputLayer(10, Briand::Math::Sigmoid, Briand::Math::DeSigmoid, Briand::Math::MSE, Briand::Math::DeMSE);
+
+    auto context = fcnn->CreateContext();
+    vector<double> in(N, 0.0), dense(10, 0.0), out(10, 0.0);
+    for (size_t i = 0; i < N; i++) in[i] = Briand::Math::Random();
+
+    const char* names[] = { "dense", "CSR", "block 4x1", "auto" };
+    const double sparsities[] = { 0.0, 0.5, 0.8, 0.95 };
+
+    printf("FCNN(%u,%u,%u,10) weights memory and prediction latency (AVG of %u)\n", static_cast<unsigned int>(N), static_cast<unsigned int>(N), static_cast<unsigned int>(N), TESTS);
+
+    for (const auto& sparsity : sparsities) {
+        const double reached = fcnn->PruneToSparsity(sparsity);
+
+        for (uint8_t mode = 0; mode < 4; mode++) {
+            size_t sparseLayers = 0;
+            if (mode == 0) sparseLayers = fcnn->OptimizeSparse(0.0);
+            else if (mode == 1) sparseLayers = fcnn->OptimizeSparse(1.0, Briand::SparseFormat::CSR);
+            else if (mode == 2) sparseLayers = fcnn->OptimizeSparse(1.0, Briand::SparseFormat::Block4x1);
+            else sparseLayers = fcnn->OptimizeSparse();
+
+            double avg = 0;
+            for (uint8_t i = 0; i < TESTS; i++) {
+                long start = esp_timer_get_time();
+                fcnn->Predict(*context.get(), in, out);
+                avg += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+            }
+
+            // Results must not change with storage
+            double diff = 0;
+            if (mode == 0) dense = out;
+            for (size_t i = 0; i < out.size(); i++) diff = std::max(diff, fabs(out[i] - dense[i]));
+
+            printf("sparsity %3.0lf%% %-9s: %u sparse layers, weights %7u bytes, predict %6ldus, max diff from dense %.1e\n", reached * 100.0, names[mode],
+                static_cast<unsigned int>(sparseLayers), static_cast<unsigned int>(fcnn->WeightsMemory()), static_cast<long>(avg), diff);
+        }
+    }
+
+    fcnn.reset();
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void expression_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("******************** EXPRESSION TEST **********************\n\n");
+
+#if defined(ESP_PLATFORM)
+    const size_t N = 64;
+#else
+    const size_t N = 512;
+#endif
+    const uint8_t TESTS = 20;
+    const double lr = 0.01;
+
+    Briand::Matrix w1(N, N), w2(N, N);
+    vector<double> a(N), d(N), b(N), z(N), out1(N), out2(N);
+    w1.Randomize();
+    w2 = w1;
+    for (size_t i = 0; i < N; i++) {
+        a[i] = Briand::Math::Random() - 0.5;
+        d[i] = Briand::Math::Random() - 0.5;
+        b[i] = Briand::Math::Random() - 0.5;
+        z[i] = Briand::Math::Random() - 0.5;
+    }
+
+    // Temporaries of the chained version: one N x N matrix (plus row pointers) or one/two vectors
+    const unsigned int matrixTemp = static_cast<unsigned int>(N * N * sizeof(double) + N * sizeof(double*));
+    const unsigned int vectorTemp = static_cast<unsigned int>(N * sizeof(double));
+    double chained, fused, diff;
+
+    printf("Matrix %ux%u, AVG of %u, chained (temporaries) vs fused (expression templates)\n", static_cast<unsigned int>(N), static_cast<unsigned int>(N), TESTS);
+
+    // 1. Weight update W -= lr * d * a^T
+    chained = fused = 0;
+    for (uint8_t i = 0; i < TESTS; i++) {
+        long start = esp_timer_get_time();
+        auto m1 = Briand::Matrix::DotMultiplyVectors(d, a);
+        m1->MultiplyScalar(lr);
+        for (size_t r = 0; r < N; r++) for (size_t c = 0; c < N; c++) w1.at(r, c) -= m1->at(r, c);
+        chained += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+
+        start = esp_timer_get_time();
+        w2 -= lr * Briand::Outer(d, a);
+        fused += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+    }
+    diff = 0;
+    for (size_t r = 0; r < N; r++) for (size_t c = 0; c < N; c++) diff = std::max(diff, fabs(w1[r][c] - w2[r][c]));
+    printf("W -= lr*outer(d,a)        : chained %6ldus (%u bytes temporaries), fused %6ldus (0 bytes), max diff %.1e\n", static_cast<long>(chained), matrixTemp, static_cast<long>(fused), diff);
+
+    // 2. Layer forward out = ReLU(W*a + b)
+    chained = fused = 0;
+    for (uint8_t i = 0; i < TESTS; i++) {
+        long start = esp_timer_get_time();
+        auto net = w1.MultiplyVector(a);
+        for (size_t r = 0; r < N; r++) out1[r] = Briand::Math::ReLU(net->at(r) + b[r]);
+        chained += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+
+        start = esp_timer_get_time();
+        Briand::Assign(out2, Briand::Apply(w2 * a + b, Briand::Math::ReLU));
+        fused += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+    }
+    diff = 0;
+    for (size_t r = 0; r < N; r++) diff = std::max(diff, fabs(out1[r] - out2[r]));
+    printf("out = ReLU(W*a + b)       : chained %6ldus (%u bytes temporaries), fused %6ldus (0 bytes), max diff %.1e\n", static_cast<long>(chained), vectorTemp, static_cast<long>(fused), diff);
+
+    // 3. Backpropagation delta = (W^T * d) hadamard df(z)
+    chained = fused = 0;
+    for (uint8_t i = 0; i < TESTS; i++) {
+        long start = esp_timer_get_time();
+        auto wt = w1.Transpose();
+        auto temp = wt->MultiplyVector(d);
+        for (size_t r = 0; r < N; r++) out1[r] = temp->at(r) * Briand::Math::DeReLU(z[r]);
+        chained += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+
+        start = esp_timer_get_time();
+        Briand::Assign(out2, Briand::Hadamard(Briand::Transpose(w2) * d, Briand::Apply(z, Briand::Math::DeReLU)));
+        fused += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+    }
+    diff = 0;
+    for (size_t r = 0; r < N; r++) diff = std::max(diff, fabs(out1[r] - out2[r]));
+    printf("delta = (W^T*d) . df(z)   : chained %6ldus (%u bytes temporaries), fused %6ldus (0 bytes), max diff %.1e\n", static_cast<long>(chained), matrixTemp + vectorTemp, static_cast<long>(fused), diff);
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void simplenn_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************* SIMPLENN TEST ***********************\n\n");
+
+#if defined(ESP_PLATFORM)
+    const size_t SIZES[] = { 2000, 10000 };
+#else
+    const size_t SIZES[] = { 10000, 100000, 1000000 };
+#endif
+    const size_t INPUTS = 64;
+    const size_t OUTPUTS = 10;
+    const size_t HIDDEN_LAYERS = 4;
+    const size_t FAN_IN = 32;
+    const uint8_t TESTS = 10;
+
+    printf("Randomly wired networks (%u inputs, %u hidden layers, %u outputs, fan-in %u from any previous layer), AVG of %u\n",
+        static_cast<unsigned int>(INPUTS), static_cast<unsigned int>(HIDDEN_LAYERS), static_cast<unsigned int>(OUTPUTS), static_cast<unsigned int>(FAN_IN), TESTS);
+
+    for (const auto& synapses : SIZES) {
+        const size_t hidden = (synapses / FAN_IN - OUTPUTS) / HIDDEN_LAYERS;
+
+        // Build the graph: every neuron takes FAN_IN random sources from all the previous layers
+        auto nn = make_unique<Briand::SimpleNN::NeuralNetwork>();
+        nn->InputLayer = make_unique<Briand::SimpleNN::NeuralLayer>(Briand::LayerType::Input, Briand::Math::Sigmoid);
+        nn->HiddenLayers = make_unique<vector<unique_ptr<Briand::SimpleNN::NeuralLayer>>>();
+        nn->OutputLayer = make_unique<Briand::SimpleNN::NeuralLayer>(Briand::LayerType::Output, Briand::Math::Sigmoid);
+
+        vector<unique_ptr<Briand::SimpleNN::Neuron>*> previous;
+        for (size_t i = 0; i < INPUTS; i++) {
+            nn->InputLayer->Neurons->push_back(make_unique<Briand::SimpleNN::Neuron>(0.0));
+        }
+        for (auto& n : *nn->InputLayer->Neurons.get()) previous.push_back(&n);
+
+        for (size_t l = 0; l <= HIDDEN_LAYERS; l++) {
+            Briand::SimpleNN::NeuralLayer* layer;
+            if (l < HIDDEN_LAYERS) {
+                nn->HiddenLayers->push_back(make_unique<Briand::SimpleNN::NeuralLayer>(Briand::LayerType::Hidden, Briand::Math::Sigmoid));
+                layer = nn->HiddenLayers->back().get();
+            }
+            else layer = nn->OutputLayer.get();
+
+            const size_t count = (l < HIDDEN_LAYERS ? hidden : OUTPUTS);
+            for (size_t i = 0; i < count; i++) {
+                layer->Neurons->push_back(make_unique<Briand::SimpleNN::Neuron>(0.0));
+                for (size_t k = 0; k < FAN_IN; k++) {
+                    const auto& source = *previous[esp_random() % previous.size()];
+                    source->ConnectTo(layer->Neurons->back(), Briand::Math::Random() - 0.5);
+                }
+            }
+            for (auto& n : *layer->Neurons.get()) previous.push_back(&n);
+        }
+
+        vector<double> in(INPUTS), out(OUTPUTS);
+        for (size_t i = 0; i < INPUTS; i++) in[i] = Briand::Math::Random();
+
+        long start = esp_timer_get_time();
+        auto compiled = nn->Compile();
+        long compileTime = esp_timer_get_time() - start;
+
+        double graph = 0, flat = 0;
+        for (uint8_t t = 0; t < TESTS; t++) {
+            start = esp_timer_get_time();
+            for (size_t i = 0; i < INPUTS; i++) nn->InputLayer->Neurons->at(i)->Value = in[i];
+            nn->PropagateForward();
+            graph += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+
+            start = esp_timer_get_time();
+            compiled->Forward(in, out);
+            flat += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+        }
+
+        // Same results of the object graph
+        double diff = 0;
+        for (size_t i = 0; i < OUTPUTS; i++) diff = std::max(diff, fabs(out[i] - nn->OutputLayer->Neurons->at(i)->Value));
+
+        // Object graph memory: neurons, synapses and their owning pointers (allocator overhead not counted)
+        const size_t graphBytes = compiled->Neurons() * (sizeof(Briand::SimpleNN::Neuron) + sizeof(vector<unique_ptr<Briand::SimpleNN::Synapsis>>) + sizeof(unique_ptr<Briand::SimpleNN::Neuron>))
+            + compiled->Synapses() * (sizeof(Briand::SimpleNN::Synapsis) + sizeof(unique_ptr<Briand::SimpleNN::Synapsis>));
+
+        printf("%7u synapses, %6u neurons: graph %8ldus (%8u bytes), compiled %8ldus (%8u bytes), speedup %.1lfx, compile %ldus, max diff %.1e\n",
+            static_cast<unsigned int>(compiled->Synapses()), static_cast<unsigned int>(compiled->Neurons()),
+            static_cast<long>(graph), static_cast<unsigned int>(graphBytes), static_cast<long>(flat), static_cast<unsigned int>(compiled->MemoryBytes()),
+            graph / (flat > 0 ? flat : 1), compileTime, diff);
+
+        compiled.reset();
+        nn.reset();
+    }
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void random_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** RANDOM TEST ************************\n\n");
+
+#if defined(ESP_PLATFORM)
+    const size_t N = 64;
+#else
+    const size_t N = 512;
+#endif
+    const uint8_t TESTS = 10;
+
+    Briand::Matrix m(N, N);
+    double perElement = 0, bulk = 0, normal = 0;
+
+    for (uint8_t t = 0; t < TESTS; t++) {
+        // Old way: one esp_random() for each element
+        long start = esp_timer_get_time();
+        for (size_t i = 0; i < N; i++) for (size_t j = 0; j < N; j++) m[i][j] = static_cast<double>(esp_random()) / static_cast<double>(UINT32_MAX);
+        perElement += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+
+        start = esp_timer_get_time();
+        m.Randomize();
+        bulk += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+
+        Briand::Philox generator(t);
+        start = esp_timer_get_time();
+        generator.FillNormal(m);
+        normal += static_cast<double>(esp_timer_get_time() - start) / TESTS;
+    }
+    printf("Matrix %ux%u fill, AVG of %u: esp_random() per element %ldus, Philox uniform %ldus, Philox normal %ldus\n",
+        static_cast<unsigned int>(N), static_cast<unsigned int>(N), TESTS, static_cast<long>(perElement), static_cast<long>(bulk), static_cast<long>(normal));
+
+    // Initializers: measured against expected statistics
+    const char* names[] = { "Uniform", "Xavier", "He", "LeCun" };
+    const Briand::WeightInitializer schemes[] = { Briand::WeightInitializer::Uniform, Briand::WeightInitializer::Xavier, Briand::WeightInitializer::He, Briand::WeightInitializer::LeCun };
+    const double expectedStd[] = { sqrt(1.0 / 12.0), sqrt(6.0 / (2.0 * N)) / sqrt(3.0), sqrt(2.0 / N), sqrt(1.0 / N) };
+    const double expectedMean[] = { 0.5, 0.0, 0.0, 0.0 };
+
+    for (uint8_t s = 0; s < 4; s++) {
+        Briand::Philox generator(1234);
+        generator.Initialize(m, schemes[s]);
+
+        double mean = 0, var = 0;
+        for (size_t i = 0; i < N; i++) for (size_t j = 0; j < N; j++) mean += m[i][j];
+        mean /= static_cast<double>(N * N);
+        for (size_t i = 0; i < N; i++) for (size_t j = 0; j < N; j++) var += (m[i][j] - mean) * (m[i][j] - mean);
+        var /= static_cast<double>(N * N);
+
+        printf("%-8s init %ux%u: mean %+.4lf (expected %+.4lf), stddev %.4lf (expected %.4lf)\n", names[s],
+            static_cast<unsigned int>(N), static_cast<unsigned int>(N), mean, expectedMean[s], sqrt(var), expectedStd[s]);
+    }
+
+    // Same numbers with any number of threads
+    double checksum[2] = { 0, 0 };
+    const size_t workers[2] = { 0, 3 };
+    for (uint8_t w = 0; w < 2; w++) {
+        Briand::ThreadPool::SetDefaultWorkers(workers[w]);
+        Briand::Philox generator(42);
+        generator.Initialize(m, Briand::WeightInitializer::He);
+        for (size_t i = 0; i < N; i++) for (size_t j = 0; j < N; j++) checksum[w] += m[i][j] * static_cast<double>(i * N + j + 1);
+    }
+    Briand::ThreadPool::SetDefaultWorkers(Briand::ThreadPool::Cores() > 1 ? Briand::ThreadPool::Cores() - 1 : 0);
+    printf("He init with seed 42: checksum with 0 workers %.10e, with 3 workers %.10e -> %s\n", checksum[0], checksum[1], checksum[0] == checksum[1] ? "SAME" : "DIFFERENT");
+
+    // Same seed, same network
+    vector<double> in(16, 0.5), out1, out2;
+    for (uint8_t k = 0; k < 2; k++) {
+        auto fcnn = make_unique<Briand::FCNN>();
+        fcnn->SetSeed(7);
+        fcnn->SetInitializer(Briand::WeightInitializer::Auto);
+        fcnn->AddInputLayer(16);
+        fcnn->AddHiddenLayer(32, Briand::Math::ReLU, Briand::Math::DeReLU);
+        fcnn->AddOutputLayer(4, Briand::Math::Sigmoid, Briand::Math::DeSigmoid, Briand::Math::MSE, Briand::Math::DeMSE);
+        auto context = fcnn->CreateContext();
+        vector<double> out(4);
+        fcnn->Predict(*context.get(), in, out);
+        if (k == 0) out1 = out;
+        else out2 = out;
+    }
+    printf("FCNN(16,32,4) built twice with seed 7: outputs %s\n", out1 == out2 ? "SAME" : "DIFFERENT");
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void softmax_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************* SOFTMAX TEST ************************\n\n");
+
+    const size_t FEATURES = 16;
+    const size_t CLASSES = 10;
+#if defined(ESP_PLATFORM)
+    const size_t TRAIN = 300;
+#else
+    const size_t TRAIN = 1000;
+#endif
+    const size_t TEST = 500;
+    const size_t MAX_EPOCHS = 50;
+
+    // Stability: huge logits do not overflow
+    vector<double> z = { 1000.0, 1001.0, 1002.0 }, p(3);
+    const double lse = Briand::Math::Softmax(z, p);
+    printf("Softmax(1000, 1001, 1002) = (%.4lf, %.4lf, %.4lf), log-sum-exp %.4lf\n\n", p[0], p[1], p[2], lse);
+
+    // Gaussian blobs, overlapping a bit
+    Briand::Philox generator(34);
+    vector<vector<double>> centers(CLASSES, vector<double>(FEATURES));
+    for (auto& c : centers) generator.FillUniform(c, -1.0, 1.0);
+
+    Briand::Dataset train, test;
+    vector<double> x(FEATURES), noise(FEATURES), target(CLASSES);
+    for (size_t i = 0; i < TRAIN + TEST; i++) {
+        const size_t c = i % CLASSES;
+        generator.FillNormal(noise, 0.0, 0.6);
+        for (size_t k = 0; k < FEATURES; k++) x[k] = centers[c][k] + noise[k];
+        std::fill(target.begin(), target.end(), 0.0);
+        target[c] = 1.0;
+        if (i < TRAIN) train.Add(x, target);
+        else test.Add(x, target);
+    }
+
+    auto accuracy = [&test](Briand::FCNN& nn) {
+        auto context = nn.CreateContext();
+        vector<double> out;
+        size_t correct = 0;
+        for (size_t i = 0; i < test.Size(); i++) {
+            nn.Predict(*context.get(), test.Inputs->at(i), out);
+            const auto& t = test.Targets->at(i);
+            if (std::max_element(out.begin(), out.end()) - out.begin() == std::max_element(t.begin(), t.end()) - t.begin()) correct++;
+        }
+        return 100.0 * static_cast<double>(correct) / static_cast<double>(test.Size());
+    };
+
+    printf("%u classes, %u features, %u train / %u test samples, FCNN(%u,32,%u), max %u epochs\n", static_cast<unsigned int>(CLASSES), static_cast<unsigned int>(FEATURES),
+        static_cast<unsigned int>(TRAIN), static_cast<unsigned int>(TEST), static_cast<unsigned int>(FEATURES), static_cast<unsigned int>(CLASSES), static_cast<unsigned int>(MAX_EPOCHS));
+
+    const char* names[] = { "sigmoid + MSE", "softmax + cross-entropy" };
+    const size_t batches[] = { 1, 16 };
+
+    for (const auto& batch : batches) {
+        for (uint8_t mode = 0; mode < 2; mode++) {
+            auto nn = make_unique<Briand::FCNN>();
+            nn->SetSeed(34);
+            nn->SetInitializer(Briand::WeightInitializer::Auto);
+            nn->AddInputLayer(FEATURES);
+            nn->AddHiddenLayer(32, Briand::Math::ReLU, Briand::Math::DeReLU);
+            if (mode == 0) nn->AddOutputLayer(CLASSES, Briand::Math::Sigmoid, Briand::Math::DeSigmoid, Briand::Math::MSE, Briand::Math::DeMSE);
+            else nn->AddSoftmaxOutputLayer(CLASSES);
+
+            Briand::FitOptions options;
+            options.Epochs = 1;
+            options.LearningRate = (batch > 1 ? 0.1 : 0.01);
+            options.BatchSize = batch;
+            options.Patience = 0;
+            options.RestoreBest = false;
+
+            // One epoch at a time to measure test accuracy after each one
+            size_t to85 = 0, to90 = 0, bestEpoch = 0;
+            double best = 0;
+            long time = 0;
+            for (size_t e = 1; e <= MAX_EPOCHS; e++) {
+                options.Seed = e;
+                time += nn->Fit(train, options)->Time;
+                const double current = accuracy(*nn.get());
+                if (to85 == 0 && current >= 85.0) to85 = e;
+                if (to90 == 0 && current >= 90.0) to90 = e;
+                if (current > best) {
+                    best = current;
+                    bestEpoch = e;
+                }
+            }
+
+            printf("batch %2u %-24s: 85%% at epoch %3u, 90%% at epoch %3u, best accuracy %.1lf%% at epoch %3u, training %ldms\n", static_cast<unsigned int>(batch), names[mode],
+                static_cast<unsigned int>(to85), static_cast<unsigned int>(to90), best, static_cast<unsigned int>(bestEpoch), time / 1000);
+        }
+    }
+    printf("(epoch 0 = not reached)\n");
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void compile_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** COMPILE TEST ***********************\n\n");
+
+    const size_t INPUTS = 16;
+    const size_t WIDTH = 24;
+    const size_t OUTPUTS = 4;
+#if defined(ESP_PLATFORM)
+    const size_t DEPTH = 16;
+    const size_t RUNS = 200;
+#else
+    const size_t DEPTH = 64;
+    const size_t RUNS = 2000;
+#endif
+
+    auto build = [INPUTS, WIDTH, OUTPUTS](const size_t& depth) {
+        auto nn = make_unique<Briand::FCNN>();
+        nn->SetSeed(35);
+        nn->SetInitializer(Briand::WeightInitializer::Auto);
+        nn->AddInputLayer(INPUTS);
+        for (size_t k = 0; k < depth; k++) nn->AddHiddenLayer(WIDTH, Briand::Math::ReLU, Briand::Math::DeReLU);
+        nn->AddOutputLayer(OUTPUTS, Briand::Math::Sigmoid, Briand::Math::DeSigmoid, Briand::Math::MSE, Briand::Math::DeMSE);
+        return nn;
+    };
+
+    // Deep and narrow: many layers, few neurons each
+    auto nn = build(DEPTH);
+
+    // Memory of each way to run inference
+    const size_t layerSizes = INPUTS + DEPTH * WIDTH + OUTPUTS;
+    const size_t contextBytes = 2 * layerSizes * sizeof(double) + 2 * (DEPTH + 2) * (sizeof(unique_ptr<vector<double>>) + sizeof(vector<double>));
+    auto plan = nn->Compile(Briand::CompileMode::Inference);
+    auto training = nn->Compile(Briand::CompileMode::Training);
+
+    printf("FCNN(%u, %u x %u, %u)\n", static_cast<unsigned int>(INPUTS), static_cast<unsigned int>(DEPTH), static_cast<unsigned int>(WIDTH), static_cast<unsigned int>(OUTPUTS));
+    printf("Activations owned by layers (net, out, delta): %u bytes\n", static_cast<unsigned int>(nn->ActivationsMemory()));
+    printf("ExecutionContext (net, out of each layer):     %u bytes\n", static_cast<unsigned int>(contextBytes));
+    printf("Compiled inference plan (planned peak):        %u bytes\n", static_cast<unsigned int>(plan->PlannedBytes()));
+    printf("Compiled training plan (planned peak):         %u bytes\n", static_cast<unsigned int>(training->PlannedBytes()));
+
+    // Same outputs, speed
+    vector<double> in(INPUTS), out1(OUTPUTS), out2(OUTPUTS);
+    Briand::Philox generator(35);
+    generator.FillUniform(in, -1.0, 1.0);
+
+    auto context = nn->CreateContext();
+    long start = esp_timer_get_time();
+    for (size_t r = 0; r < RUNS; r++) nn->Predict(*context.get(), in, out1);
+    const long contextTime = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (size_t r = 0; r < RUNS; r++) plan->Forward(in, out2);
+    const long planTime = esp_timer_get_time() - start;
+
+    double maxDiff = 0;
+    for (size_t i = 0; i < OUTPUTS; i++) maxDiff = std::max(maxDiff, fabs(out1[i] - out2[i]));
+    printf("%u inferences: Predict(context) %ldus, compiled Forward %ldus, max output difference %.3e\n", static_cast<unsigned int>(RUNS), contextTime, planTime, maxDiff);
+
+    // Training plan: same steps as FCNN::Train() on a copy (shallow network, not saturated)
+    auto trained = build(4);
+    auto copy = trained->Clone();
+    auto trainer = copy->Compile(Briand::CompileMode::Training);
+    auto shallowContext = trained->CreateContext();
+    vector<double> target = { 0.1, 0.9, 0.3, 0.7 };
+    double error1 = 0, error2 = 0;
+    for (size_t r = 0; r < 20; r++) {
+        error1 = trained->Train(in, target, 0.1);
+        error2 = trainer->Train(in, target, 0.1);
+    }
+    trained->Predict(*shallowContext.get(), in, out1);
+    trainer->Forward(in, out2);
+    maxDiff = 0;
+    for (size_t i = 0; i < OUTPUTS; i++) maxDiff = std::max(maxDiff, fabs(out1[i] - out2[i]));
+    printf("FCNN(%u, 4 x %u, %u), 20 training steps: FCNN::Train() error %.6lf, compiled Train() error %.6lf, max output difference %.3e\n",
+        static_cast<unsigned int>(INPUTS), static_cast<unsigned int>(WIDTH), static_cast<unsigned int>(OUTPUTS), error1, error2, maxDiff);
+
+    // Plans are invalidated by changes of weights storage
+    nn->OptimizeSparse(1.0);
+    try {
+        plan->Forward(in, out2);
+        printf("Stale plan: NOT DETECTED\n");
+    }
+    catch (const runtime_error& e) {
+        printf("Stale plan detected: %s\n", e.what());
+    }
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void memory_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** MEMORY TEST ************************\n\n");
+
+    const size_t INPUTS = 128;
+    const size_t HIDDEN = 256;
+    const size_t OUTPUTS = 10;
+    const size_t RUNS = 20;
+
+    // ESP32-WROVER like board: 320KB internal RAM, 4MB PSRAM. Latency for each 32 bytes line read from PSRAM:
+    // 1us on cache miss (direct access), 0.4us with sequential bursts (no effect on ESP, the real hardware is used)
+    Briand::Memory::Simulate(320 * 1024, 4 * 1024 * 1024, 1000, 400);
+    printf("Internal RAM free %u bytes, PSRAM %s, free %u bytes\n", static_cast<unsigned int>(Briand::Memory::FreeBytes(Briand::MemoryTier::Internal)),
+        Briand::Memory::HasExternal() ? "available" : "NOT available", static_cast<unsigned int>(Briand::Memory::FreeBytes(Briand::MemoryTier::External)));
+
+    {
+        // Big weights are placed by the policy, small ones stay internal
+        Briand::Matrix big(HIDDEN, INPUTS), small(OUTPUTS, HIDDEN / 4);
+        printf("Weights %ux%u (%u bytes): %s, weights %ux%u (%u bytes): %s\n",
+            static_cast<unsigned int>(HIDDEN), static_cast<unsigned int>(INPUTS), static_cast<unsigned int>(HIDDEN * INPUTS * sizeof(double)),
+            big.Tier() == Briand::MemoryTier::External ? "PSRAM" : "internal",
+            static_cast<unsigned int>(OUTPUTS), static_cast<unsigned int>(HIDDEN / 4), static_cast<unsigned int>(OUTPUTS * HIDDEN / 4 * sizeof(double)),
+            small.Tier() == Briand::MemoryTier::External ? "PSRAM" : "internal");
+
+        Briand::Philox generator(36);
+        generator.FillUniform(big, -1.0, 1.0);
+        vector<double> in(INPUTS, 0.5), out1(HIDDEN), out2(HIDDEN), out3(HIDDEN);
+
+        // GEMV with weights in PSRAM read directly, in PSRAM streamed by tiles, in internal RAM
+        Briand::Matrix::StreamExternal = false;
+        long start = esp_timer_get_time();
+        for (size_t r = 0; r < RUNS; r++) big.MultiplyVector(in, out1);
+        const long direct = (esp_timer_get_time() - start) / RUNS;
+
+        Briand::Matrix::StreamExternal = true;
+        start = esp_timer_get_time();
+        for (size_t r = 0; r < RUNS; r++) big.MultiplyVector(in, out2);
+        const long streamed = (esp_timer_get_time() - start) / RUNS;
+
+        big.MoveTo(Briand::MemoryTier::Internal);
+        start = esp_timer_get_time();
+        for (size_t r = 0; r < RUNS; r++) big.MultiplyVector(in, out3);
+        const long internal = (esp_timer_get_time() - start) / RUNS;
+
+        printf("GEMV %ux%u AVG of %u: PSRAM direct %ldus, PSRAM streamed (%u bytes tiles) %ldus, internal RAM %ldus, results %s\n",
+            static_cast<unsigned int>(HIDDEN), static_cast<unsigned int>(INPUTS), static_cast<unsigned int>(RUNS), direct,
+            static_cast<unsigned int>(Briand::Memory::TileBytes), streamed, internal, (out1 == out2 && out2 == out3) ? "SAME" : "DIFFERENT");
+        printf("Internal RAM free after moving weights %u bytes\n", static_cast<unsigned int>(Briand::Memory::FreeBytes(Briand::MemoryTier::Internal)));
+    }
+
+    // A network: weights follow the policy, the compiled plan keeps activations in internal RAM
+    auto nn = make_unique<Briand::FCNN>();
+    nn->SetSeed(36);
+    nn->SetInitializer(Briand::WeightInitializer::Auto);
+    nn->AddInputLayer(INPUTS);
+    nn->AddHiddenLayer(HIDDEN, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddHiddenLayer(HIDDEN, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddSoftmaxOutputLayer(OUTPUTS);
+    auto plan = nn->Compile();
+
+    vector<double> in(INPUTS, 0.5), out(OUTPUTS);
+    long start = esp_timer_get_time();
+    for (size_t r = 0; r < RUNS; r++) plan->Forward(in, out);
+    printf("FCNN(%u,%u,%u,%u) with PSRAM weights: compiled inference AVG %ldus, internal RAM free %u bytes, PSRAM free %u bytes\n",
+        static_cast<unsigned int>(INPUTS), static_cast<unsigned int>(HIDDEN), static_cast<unsigned int>(HIDDEN), static_cast<unsigned int>(OUTPUTS),
+        static_cast<long>((esp_timer_get_time() - start) / RUNS),
+        static_cast<unsigned int>(Briand::Memory::FreeBytes(Briand::MemoryTier::Internal)), static_cast<unsigned int>(Briand::Memory::FreeBytes(Briand::MemoryTier::External)));
+
+    // Back to the default (Linux: unlimited internal RAM, no PSRAM)
+    plan.reset();
+    nn.reset();
+    Briand::Memory::Simulate(0, 0, 0, 0);
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void streaming_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("******************** STREAMING TEST ***********************\n\n");
+
+    const size_t INPUTS = 64;
+    const size_t HIDDEN = 192;
+    const size_t DEPTH = 8;
+    const size_t OUTPUTS = 10;
+    const size_t RUNS = 20;
+
+    auto nn = make_unique<Briand::FCNN>();
+    nn->SetSeed(37);
+    nn->SetInitializer(Briand::WeightInitializer::Auto);
+    nn->AddInputLayer(INPUTS);
+    for (size_t d = 0; d < DEPTH; d++) nn->AddHiddenLayer(HIDDEN, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddSoftmaxOutputLayer(OUTPUTS);
+
+    vector<double> in(INPUTS), resident(OUTPUTS), streamed(OUTPUTS);
+    Briand::Philox generator(37);
+    generator.FillUniform(in, 0.0, 1.0);
+
+    // Reference: fully resident weights
+    auto plan = nn->Compile();
+    long start = esp_timer_get_time();
+    for (size_t r = 0; r < RUNS; r++) plan->Forward(in, resident);
+    const long residentTime = (esp_timer_get_time() - start) / RUNS;
+    printf("FCNN(%u,%ux%u,%u) resident: weights %u bytes, AVG %ldus\n", static_cast<unsigned int>(INPUTS), static_cast<unsigned int>(DEPTH),
+        static_cast<unsigned int>(HIDDEN), static_cast<unsigned int>(OUTPUTS), static_cast<unsigned int>(nn->WeightsMemory()), residentTime);
+    plan.reset();
+
+#if !defined(ESP_PLATFORM)
+    // Simulated 4MB data partition, read speed of a 80MHz QIO flash (about 40MB/s). On ESP the partition table must have a "weights" data partition.
+    briand_porting_partition_simulate("weights", 4 * 1024 * 1024, 40 * 1024 * 1024);
+#endif
+
+    // Weights in a flash partition, then in a file. Loads are hidden only when a layer computes longer than the next one loads
+    // (doubles are software emulated on ESP32, so compute is much slower there than on Linux).
+    for (int store = 0; store < 2; store++) {
+        unique_ptr<Briand::StreamedFCNN> model = nullptr;
+        try {
+            if (store == 0) model = Briand::StreamedFCNN::Create(*nn.get(), make_unique<Briand::PartitionWeightStore>("weights"));
+            else model = Briand::StreamedFCNN::Create(*nn.get(), make_unique<Briand::FileWeightStore>("streaming_test.bin"));
+        }
+        catch (const exception& e) {
+            printf("%s store not available: %s\n", store == 0 ? "Partition" : "File", e.what());
+            continue;
+        }
+
+        // First call pays the load of the first layer, not overlapped
+        model->Forward(in, streamed);
+        model->ResetStats();
+        for (size_t r = 0; r < RUNS; r++) model->Forward(in, streamed);
+
+        // Kernels sum in a different order: results match up to rounding
+        double diff = 0;
+        for (size_t i = 0; i < OUTPUTS; i++) diff = std::max(diff, fabs(streamed[i] - resident[i]));
+
+        const auto& stats = model->Stats();
+        const long streamedTime = stats.Time / static_cast<long>(stats.Inferences);
+        printf("%s store: resident %u bytes instead of %u, AVG %ldus (%+.1lf%% vs resident), overlap %.1lf%%, max diff from resident %.1e\n",
+            store == 0 ? "Partition" : "File", static_cast<unsigned int>(model->ResidentBytes()), static_cast<unsigned int>(nn->WeightsMemory()),
+            streamedTime, 100.0 * static_cast<double>(streamedTime - residentTime) / static_cast<double>(residentTime > 0 ? residentTime : 1),
+            stats.Overlap() * 100.0, diff);
+        model->Print();
+    }
+
+    remove("streaming_test.bin");
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void half_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("*********************** HALF TEST *************************\n\n");
+
+    const Briand::WeightPrecision precisions[] = { Briand::WeightPrecision::Double, Briand::WeightPrecision::FP16, Briand::WeightPrecision::BF16 };
+    const char* names[] = { "double", "fp16", "bf16" };
+    const size_t RUNS = 20;
+
+    // Rounding
+    const float values[] = { 1.0f / 3.0f, -0.1f, 65504.0f, 70000.0f, 1e-6f };
+    for (const auto& v : values) {
+        printf("%g -> fp16 %.8g, bf16 %.8g\n", v, Briand::HalfMatrix::FromFP16(Briand::HalfMatrix::ToFP16(v)), Briand::HalfMatrix::FromBF16(Briand::HalfMatrix::ToBF16(v)));
+    }
+    printf("\n");
+
+    // Memory, bandwidth and latency: weights in internal RAM, then on a board with PSRAM (see memory_test)
+    const size_t INPUTS = 128;
+    const size_t HIDDEN = 256;
+    const size_t OUTPUTS = 10;
+    vector<double> in(INPUTS, 0.5), reference(OUTPUTS), out(OUTPUTS);
+
+    for (uint8_t board = 0; board < 2; board++) {
+        if (board == 1) Briand::Memory::Simulate(320 * 1024, 4 * 1024 * 1024, 1000, 400);
+
+        auto nn = make_unique<Briand::FCNN>();
+        nn->SetSeed(38);
+        nn->SetInitializer(Briand::WeightInitializer::Auto);
+        nn->AddInputLayer(INPUTS);
+        nn->AddHiddenLayer(HIDDEN, Briand::Math::ReLU, Briand::Math::DeReLU);
+        nn->AddHiddenLayer(HIDDEN, Briand::Math::ReLU, Briand::Math::DeReLU);
+        nn->AddSoftmaxOutputLayer(OUTPUTS);
+
+        printf("FCNN(%u,%u,%u,%u), weights in %s:\n", static_cast<unsigned int>(INPUTS), static_cast<unsigned int>(HIDDEN), static_cast<unsigned int>(HIDDEN),
+            static_cast<unsigned int>(OUTPUTS), board == 0 ? "internal RAM" : "PSRAM (simulated)");
+
+        for (uint8_t p = 0; p < 3; p++) {
+            nn->SetWeightPrecision(precisions[p]);
+            auto plan = nn->Compile();
+
+            const long start = esp_timer_get_time();
+            for (size_t r = 0; r < RUNS; r++) plan->Forward(in, out);
+            const long time = (esp_timer_get_time() - start) / RUNS;
+            if (p == 0) reference = out;
+
+            double diff = 0;
+            for (size_t i = 0; i < OUTPUTS; i++) diff = std::max(diff, fabs(out[i] - reference[i]));
+
+            // Each weight is read once for each inference: bytes read = weights memory
+            printf("  %-6s weights %7u bytes, read %6.1lf MB/s, AVG %6ldus, max output diff %.1e\n", names[p], static_cast<unsigned int>(nn->WeightsMemory()),
+                static_cast<double>(nn->WeightsMemory()) / static_cast<double>(time > 0 ? time : 1), time, diff);
+        }
+
+        nn.reset();
+        if (board == 1) Briand::Memory::Simulate(0, 0, 0, 0);
+    }
+    printf("\n");
+
+    // Accuracy on example 2 (regression: sum of two numbers) and a classifier (as softmax_test)
+    Briand::Philox generator(38);
+    Briand::Dataset sums, sumsTest, blobs, blobsTest;
+    for (size_t i = 0; i < 500; i++) {
+        const double a = 0.5 * generator.NextUniform();
+        const double b = 0.5 * generator.NextUniform();
+        if (i < 400) sums.Add({ a, b }, { a + b });
+        else sumsTest.Add({ a, b }, { a + b });
+    }
+
+    const size_t FEATURES = 16;
+    const size_t CLASSES = 10;
+    vector<vector<double>> centers(CLASSES, vector<double>(FEATURES));
+    for (auto& c : centers) generator.FillUniform(c, -1.0, 1.0);
+    vector<double> x(FEATURES), noise(FEATURES), target(CLASSES);
+    for (size_t i = 0; i < 1500; i++) {
+        const size_t c = i % CLASSES;
+        generator.FillNormal(noise, 0.0, 0.6);
+        for (size_t k = 0; k < FEATURES; k++) x[k] = centers[c][k] + noise[k];
+        std::fill(target.begin(), target.end(), 0.0);
+        target[c] = 1.0;
+        if (i < 1000) blobs.Add(x, target);
+        else blobsTest.Add(x, target);
+    }
+
+    auto regression = make_unique<Briand::FCNN>();
+    regression->SetSeed(2);
+    regression->SetInitializer(Briand::WeightInitializer::Auto);
+    regression->AddInputLayer(2);
+    regression->AddHiddenLayer(8, Briand::Math::ReLU, Briand::Math::DeReLU);
+    regression->AddOutputLayer(1, Briand::Math::Identity, Briand::Math::DeIdentity, Briand::Math::MSE, Briand::Math::DeMSE);
+
+    auto classifier = make_unique<Briand::FCNN>();
+    classifier->SetSeed(34);
+    classifier->SetInitializer(Briand::WeightInitializer::Auto);
+    classifier->AddInputLayer(FEATURES);
+    classifier->AddHiddenLayer(32, Briand::Math::ReLU, Briand::Math::DeReLU);
+    classifier->AddSoftmaxOutputLayer(CLASSES);
+
+    // Training always runs on the full precision master weights
+    Briand::FitOptions options;
+    options.Epochs = 200;
+    options.LearningRate = 0.01;
+    options.Patience = 0;
+    options.Seed = 38;
+    regression->Fit(sums, options);
+    options.Epochs = 10;
+    options.BatchSize = 16;
+    options.LearningRate = 0.1;
+    classifier->Fit(blobs, options);
+
+    printf("Accuracy: example 2 (sum, FCNN(2,8,1)) and classifier (FCNN(%u,32,%u)) on test samples\n", static_cast<unsigned int>(FEATURES), static_cast<unsigned int>(CLASSES));
+    double baseMse = 0, baseAccuracy = 0;
+    for (uint8_t p = 0; p < 3; p++) {
+        regression->SetWeightPrecision(precisions[p]);
+        classifier->SetWeightPrecision(precisions[p]);
+
+        auto context = regression->CreateContext();
+        double mse = 0;
+        for (size_t i = 0; i < sumsTest.Size(); i++) {
+            regression->Predict(*context.get(), sumsTest.Inputs->at(i), out);
+            mse += pow(out[0] - sumsTest.Targets->at(i)[0], 2);
+        }
+        mse /= static_cast<double>(sumsTest.Size());
+
+        context = classifier->CreateContext();
+        size_t correct = 0;
+        for (size_t i = 0; i < blobsTest.Size(); i++) {
+            classifier->Predict(*context.get(), blobsTest.Inputs->at(i), out);
+            const auto& t = blobsTest.Targets->at(i);
+            if (std::max_element(out.begin(), out.end()) - out.begin() == std::max_element(t.begin(), t.end()) - t.begin()) correct++;
+        }
+        const double accuracy = 100.0 * static_cast<double>(correct) / static_cast<double>(blobsTest.Size());
+
+        if (p == 0) {
+            baseMse = mse;
+            baseAccuracy = accuracy;
+        }
+        printf("  %-6s sum MSE %.3e (%+.3e), classifier accuracy %.1lf%% (%+.1lf%%)\n", names[p], mse, mse - baseMse, accuracy, accuracy - baseAccuracy);
+    }
+
+    // Training drops the 16 bit copies and updates the master weights
+    classifier->SetWeightPrecision(Briand::WeightPrecision::FP16);
+    const size_t before = classifier->WeightsMemory();
+    classifier->Train(blobs.Inputs->at(0), blobs.Targets->at(0), 0.01);
+    printf("Classifier weights %u bytes in fp16, %u bytes after Train() (master copy)\n", static_cast<unsigned int>(before), static_cast<unsigned int>(classifier->WeightsMemory()));
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void neuron_pruning_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("***************** NEURON PRUNING TEST *********************\n\n");
+
+    const size_t FEATURES = 16;
+    const size_t CLASSES = 10;
+    const size_t RUNS = 200;
+
+    // Gaussian blobs (as softmax_test)
+    Briand::Philox generator(39);
+    vector<vector<double>> centers(CLASSES, vector<double>(FEATURES));
+    for (auto& c : centers) generator.FillUniform(c, -1.0, 1.0);
+
+    Briand::Dataset train, test;
+    vector<double> x(FEATURES), noise(FEATURES), target(CLASSES);
+    for (size_t i = 0; i < 1500; i++) {
+        const size_t c = i % CLASSES;
+        generator.FillNormal(noise, 0.0, 0.6);
+        for (size_t k = 0; k < FEATURES; k++) x[k] = centers[c][k] + noise[k];
+        std::fill(target.begin(), target.end(), 0.0);
+        target[c] = 1.0;
+        if (i < 1000) train.Add(x, target);
+        else test.Add(x, target);
+    }
+
+    auto accuracy = [&test](Briand::FCNN& nn) {
+        auto context = nn.CreateContext();
+        vector<double> out;
+        size_t correct = 0;
+        for (size_t i = 0; i < test.Size(); i++) {
+            nn.Predict(*context.get(), test.Inputs->at(i), out);
+            const auto& t = test.Targets->at(i);
+            if (std::max_element(out.begin(), out.end()) - out.begin() == std::max_element(t.begin(), t.end()) - t.begin()) correct++;
+        }
+        return 100.0 * static_cast<double>(correct) / static_cast<double>(test.Size());
+    };
+
+    auto latency = [&test, RUNS](Briand::FCNN& nn) {
+        auto plan = nn.Compile();
+        vector<double> out;
+        const long start = esp_timer_get_time();
+        for (size_t r = 0; r < RUNS; r++) plan->Forward(test.Inputs->at(r % test.Size()), out);
+        return (esp_timer_get_time() - start) / static_cast<long>(RUNS);
+    };
+
+    // Oversized ReLU network: some units die while training
+    auto nn = make_unique<Briand::FCNN>();
+    nn->SetSeed(39);
+    nn->SetInitializer(Briand::WeightInitializer::Auto);
+    nn->AddInputLayer(FEATURES);
+    nn->AddHiddenLayer(256, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddHiddenLayer(128, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddSoftmaxOutputLayer(CLASSES);
+
+    Briand::FitOptions options;
+    options.Epochs = 10;
+    options.BatchSize = 16;
+    options.LearningRate = 0.1;
+    options.Patience = 0;
+    options.Seed = 39;
+    nn->Fit(train, options);
+
+    const double baseAccuracy = accuracy(*nn.get());
+    const long baseLatency = latency(*nn.get());
+    printf("FCNN(%u,256,128,%u) trained: accuracy %.1lf%%, weights %u bytes, compiled inference AVG %ldus\n\n", static_cast<unsigned int>(FEATURES),
+        static_cast<unsigned int>(CLASSES), baseAccuracy, static_cast<unsigned int>(nn->WeightsMemory()), baseLatency);
+
+    const double thresholds[] = { 0.0, 0.5, 1.0 };
+    for (const auto& threshold : thresholds) {
+        for (uint8_t tune = 0; tune < 2; tune++) {
+            auto pruned = nn->Clone();
+
+            Briand::NeuronPruningOptions pruning;
+            pruning.ScoreThreshold = threshold;
+            pruning.MaxRemoval = 0.9;
+            if (tune == 1) {
+                pruning.FineTune = options;
+                pruning.FineTune.Epochs = 3;
+                pruning.FineTune.LearningRate = 0.01;
+            }
+
+            auto result = pruned->PruneNeurons(train, pruning);
+            const double prunedAccuracy = accuracy(*pruned.get());
+            const long prunedLatency = latency(*pruned.get());
+
+            printf("Score threshold %.1lf%s: ", threshold, tune == 1 ? " + 3 epochs fine tuning" : "");
+            result->Print();
+            printf("  accuracy %.1lf%% (%+.1lf%%), weights -%.1lf%%, compiled inference AVG %ldus (%+.1lf%%)\n", prunedAccuracy, prunedAccuracy - baseAccuracy,
+                100.0 * (1.0 - static_cast<double>(result->WeightsAfter) / static_cast<double>(result->WeightsBefore)), prunedLatency,
+                100.0 * (static_cast<double>(prunedLatency) / static_cast<double>(baseLatency > 0 ? baseLatency : 1) - 1.0));
+        }
+    }
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void model_batch_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("****************** MODEL BATCH TEST ***********************\n\n");
+
+    const size_t MODELS = 256;
+    const size_t EPOCHS = 200;
+
+    // XOR with some noisy copies
+    Briand::Philox generator(40);
+    Briand::Dataset train;
+    vector<double> x(2), noise(2);
+    for (size_t i = 0; i < 32; i++) {
+        const double a = static_cast<double>(i % 2);
+        const double b = static_cast<double>((i / 2) % 2);
+        generator.FillNormal(noise, 0.0, 0.05);
+        x[0] = a + noise[0];
+        x[1] = b + noise[1];
+        train.Add(x, { a != b ? 1.0 : 0.0 });
+    }
+
+    // Hyperparameter sweep: a seed (initial weights and shuffling) and a learning rate for each model
+    vector<unique_ptr<Briand::FCNN>> networks;
+    vector<const Briand::FCNN*> sources;
+    vector<double> rates;
+    vector<uint64_t> seeds;
+    for (size_t m = 0; m < MODELS; m++) {
+        auto nn = make_unique<Briand::FCNN>();
+        nn->SetSeed(m + 1);
+        nn->SetInitializer(Briand::WeightInitializer::Auto);
+        nn->AddInputLayer(2);
+        nn->AddHiddenLayer(4, Briand::Math::Sigmoid, Briand::Math::DeSigmoid);
+        nn->AddOutputLayer(1, Briand::Math::Sigmoid, Briand::Math::DeSigmoid, Briand::Math::MSE, Briand::Math::DeMSE);
+        sources.push_back(nn.get());
+        networks.push_back(std::move(nn));
+        rates.push_back(0.1 + 0.9 * static_cast<double>(m % 16) / 15.0);
+        seeds.push_back(m + 1);
+    }
+
+    auto batch = make_unique<Briand::ModelBatch>(sources, rates, seeds);
+
+    // Separate FCNN objects, one after another (same SGD: batch size 1, no validation, no early stop)
+    long start = esp_timer_get_time();
+    vector<double> loopLosses(MODELS);
+    for (size_t m = 0; m < MODELS; m++) {
+        Briand::FitOptions options;
+        options.Epochs = EPOCHS;
+        options.BatchSize = 1;
+        options.LearningRate = rates[m];
+        options.Patience = 0;
+        options.RestoreBest = false;
+        options.Seed = seeds[m];
+        auto result = networks[m]->Fit(train, options);
+        loopLosses[m] = result->History->back().TrainLoss;
+    }
+    const long loopTime = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    auto losses = batch->Fit(train, EPOCHS);
+    const long batchTime = esp_timer_get_time() - start;
+
+    // Same weights: compare the outputs of each model
+    auto check = networks[0]->Clone();
+    vector<vector<double>> outputs;
+    double maxDifference = 0.0, maxLossDifference = 0.0;
+    size_t solved = 0;
+    for (size_t m = 0; m < MODELS; m++) {
+        batch->CopyTo(m, *check.get());
+        bool ok = true;
+        for (size_t i = 0; i < 4; i++) {
+            const vector<double> in = { static_cast<double>(i % 2), static_cast<double>(i / 2) };
+            const double expected = networks[m]->Predict(in)->at(0);
+            maxDifference = std::max(maxDifference, fabs(check->Predict(in)->at(0) - expected));
+            if ((expected > 0.5) != ((i % 2) != (i / 2))) ok = false;
+        }
+        if (ok) solved++;
+        maxLossDifference = std::max(maxLossDifference, fabs(losses->at(m) - loopLosses[m]));
+    }
+
+    // Ensemble prediction of all models at once
+    batch->Predict({ 1.0, 0.0 }, outputs);
+    double mean = 0.0;
+    for (const auto& o : outputs) mean += o[0] / static_cast<double>(MODELS);
+
+    printf("%u FCNN(2,4,1) x %u epochs on %u samples, learning rates from %.1lf to %.1lf\n", static_cast<unsigned int>(MODELS), static_cast<unsigned int>(EPOCHS),
+        static_cast<unsigned int>(train.Size()), rates.front(), 1.0);
+    printf("Loop of FCNN::Fit():  %8ld us, %8.1lf models trained/s\n", loopTime, static_cast<double>(MODELS) * 1000000.0 / static_cast<double>(loopTime > 0 ? loopTime : 1));
+    printf("ModelBatch::Fit():    %8ld us, %8.1lf models trained/s (x%.1lf)\n", batchTime, static_cast<double>(MODELS) * 1000000.0 / static_cast<double>(batchTime > 0 ? batchTime : 1),
+        static_cast<double>(loopTime) / static_cast<double>(batchTime > 0 ? batchTime : 1));
+    printf("Max output difference %.3e, max loss difference %.3e. XOR solved by %u models, ensemble output for (1,0): %.3lf\n", maxDifference, maxLossDifference,
+        static_cast<unsigned int>(solved), mean);
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void batch_norm_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("****************** BATCH NORMALIZATION TEST ***************\n\n");
+
+    const size_t FEATURES = 16;
+    const size_t CLASSES = 4;
+    const size_t DEPTH = 5;
+    const size_t EPOCHS = 30;
+    const size_t RUNS = 200;
+
+    // Gaussian blobs (as softmax_test)
+    Briand::Philox generator(41);
+    vector<vector<double>> centers(CLASSES, vector<double>(FEATURES));
+    for (auto& c : centers) generator.FillUniform(c, -1.0, 1.0);
+
+    Briand::Dataset train, test;
+    vector<double> x(FEATURES), noise(FEATURES), target(CLASSES);
+    for (size_t i = 0; i < 1000; i++) {
+        const size_t c = i % CLASSES;
+        generator.FillNormal(noise, 0.0, 0.6);
+        for (size_t k = 0; k < FEATURES; k++) x[k] = centers[c][k] + noise[k];
+        std::fill(target.begin(), target.end(), 0.0);
+        target[c] = 1.0;
+        if (i < 800) train.Add(x, target);
+        else test.Add(x, target);
+    }
+
+    auto accuracy = [&test](Briand::FCNN& nn) {
+        auto context = nn.CreateContext();
+        vector<double> out;
+        size_t correct = 0;
+        for (size_t i = 0; i < test.Size(); i++) {
+            nn.Predict(*context.get(), test.Inputs->at(i), out);
+            const auto& t = test.Targets->at(i);
+            if (std::max_element(out.begin(), out.end()) - out.begin() == std::max_element(t.begin(), t.end()) - t.begin()) correct++;
+        }
+        return 100.0 * static_cast<double>(correct) / static_cast<double>(test.Size());
+    };
+
+    // Deep sigmoid stack with a linear projection before the classifier, default initializer
+    auto build = [&](const bool& normalized) {
+        auto nn = make_unique<Briand::FCNN>();
+        nn->SetSeed(41);
+        nn->AddInputLayer(FEATURES);
+        for (size_t d = 0; d < DEPTH; d++) {
+            nn->AddHiddenLayer(32, Briand::Math::Sigmoid, Briand::Math::DeSigmoid);
+            if (normalized) nn->AddBatchNormalization();
+        }
+        nn->AddHiddenLayer(16, Briand::Math::Identity, Briand::Math::DeIdentity);
+        nn->AddSoftmaxOutputLayer(CLASSES);
+        return nn;
+    };
+
+    unique_ptr<Briand::FCNN> trained[2];
+    for (uint8_t normalized = 0; normalized < 2; normalized++) {
+        auto nn = build(normalized == 1);
+        size_t reached = 0;
+        double last = 0.0;
+
+        Briand::FitOptions options;
+        options.Epochs = 1;
+        options.LearningRate = 0.05;
+        options.Patience = 0;
+        options.RestoreBest = false;
+
+        const long start = esp_timer_get_time();
+        for (size_t epoch = 1; epoch <= EPOCHS; epoch++) {
+            options.Seed = epoch;
+            nn->Fit(train, options);
+            last = accuracy(*nn.get());
+            if (reached == 0 && last >= 90.0) reached = epoch;
+        }
+        const long took = esp_timer_get_time() - start;
+
+        printf("FCNN(%u,%ux32 sigmoid%s,16 linear,%u softmax): accuracy %.1lf%% after %u epochs, 90%% reached %s (%ldms)\n", static_cast<unsigned int>(FEATURES),
+            static_cast<unsigned int>(DEPTH), normalized == 1 ? " + batch norm" : "", static_cast<unsigned int>(CLASSES), last, static_cast<unsigned int>(EPOCHS),
+            reached == 0 ? "never" : ("at epoch " + to_string(reached)).c_str(), took / 1000);
+        trained[normalized] = std::move(nn);
+    }
+
+    // Inference pass: folding and merging, same outputs
+    auto nn = std::move(trained[1]);
+    auto folded = nn->Clone();
+    const size_t layersBefore = DEPTH + 3;
+    const size_t merged = folded->OptimizeForInference();
+
+    auto context = nn->CreateContext();
+    auto plan = folded->Compile();
+    vector<double> a, b;
+    double maxDifference = 0.0;
+    long start = esp_timer_get_time();
+    for (size_t r = 0; r < RUNS; r++) nn->Predict(*context.get(), test.Inputs->at(r % test.Size()), a);
+    const long beforeLatency = (esp_timer_get_time() - start) / static_cast<long>(RUNS);
+    start = esp_timer_get_time();
+    for (size_t r = 0; r < RUNS; r++) plan->Forward(test.Inputs->at(r % test.Size()), b);
+    const long afterLatency = (esp_timer_get_time() - start) / static_cast<long>(RUNS);
+
+    for (size_t i = 0; i < test.Size(); i++) {
+        nn->Predict(*context.get(), test.Inputs->at(i), a);
+        plan->Forward(test.Inputs->at(i), b);
+        for (size_t j = 0; j < a.size(); j++) maxDifference = std::max(maxDifference, fabs(a[j] - b[j]));
+    }
+
+    printf("OptimizeForInference(): %u batch norms folded, %u linear layers merged, GEMVs %u -> %u, inference AVG %ldus -> %ldus (compiled), max output difference %.3e\n",
+        static_cast<unsigned int>(DEPTH), static_cast<unsigned int>(merged), static_cast<unsigned int>(layersBefore - 1), static_cast<unsigned int>(plan->Kernels()),
+        beforeLatency, afterLatency, maxDifference);
+
+    // The identity network of performance_test collapses into a single matrix
+    auto identity = make_unique<Briand::FCNN>();
+    identity->AddInputLayer(2, {1, 1});
+    identity->AddHiddenLayer(2, Briand::Math::Identity, Briand::Math::DeIdentity, { {0.5, 0.5}, { 0.5, 0.5 } });
+    identity->AddHiddenLayer(2, Briand::Math::Identity, Briand::Math::DeIdentity, { {1, 1}, { 1, 1 } });
+    identity->AddOutputLayer(2, Briand::Math::Identity, Briand::Math::DeIdentity, Briand::Math::MSE, Briand::Math::DeMSE, { {0.1, 0.2}, { 0.1, 0.1 } });
+    auto expected = identity->Predict({1, 1});
+    const size_t identityMerged = identity->OptimizeForInference();
+    auto result = identity->Predict({1, 1});
+    printf("FCNN(2,2,2,2) identity layers: %u merged (one GEMV left), output (%.3lf, %.3lf) -> (%.3lf, %.3lf)\n", static_cast<unsigned int>(identityMerged),
+        expected->at(0), expected->at(1), result->at(0), result->at(1));
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void tuner_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** KERNEL TUNER TEST ******************\n\n");
+
+    const size_t RUNS = 500;
+    const string TABLE = "tuner_test.txt";
+
+    // Decisions of a previous run (same platform only)
+    Briand::KernelTuner::Clear();
+    const bool loaded = Briand::KernelTuner::Load(TABLE);
+    printf("Platform %s, saved table %s (%u shapes)\n", Briand::KernelTuner::Platform().c_str(), loaded ? "loaded" : "not found",
+        static_cast<unsigned int>(Briand::KernelTuner::Entries().size()));
+
+    // Shapes from tiny to large
+    const size_t shapes[][2] = { {5, 7}, {32, 16}, {128, 128}, {512, 512} };
+    for (const auto& shape : shapes) Briand::KernelTuner::Tune(shape[0], shape[1]);
+
+    // A network: tuning at finalization, then compiled plans dispatch through the table
+    auto nn = make_unique<Briand::FCNN>();
+    nn->SetSeed(42);
+    nn->SetInitializer(Briand::WeightInitializer::Auto);
+    nn->AddInputLayer(16);
+    nn->AddHiddenLayer(256, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddHiddenLayer(64, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddSoftmaxOutputLayer(10);
+
+    const long start = esp_timer_get_time();
+    const size_t tuned = Briand::KernelTuner::Tune(*nn.get(), true);
+    printf("%u network shapes tuned in %ldms\n", static_cast<unsigned int>(tuned), (esp_timer_get_time() - start) / 1000);
+    Briand::KernelTuner::Print();
+
+    Briand::Philox generator(42);
+    vector<double> input(16), a, b;
+    generator.FillUniform(input, -1.0, 1.0);
+
+    auto latency = [&](Briand::CompiledFCNN& plan, vector<double>& out) {
+        const long t = esp_timer_get_time();
+        for (size_t r = 0; r < RUNS; r++) plan.Forward(input, out);
+        return static_cast<double>(esp_timer_get_time() - t) / static_cast<double>(RUNS);
+    };
+
+    auto tunedPlan = nn->Compile();
+    tunedPlan->Print();
+    const double tunedLatency = latency(*tunedPlan.get(), a);
+
+    // Override all the network shapes with the untuned kernel
+    const auto entries = Briand::KernelTuner::Entries();
+    Briand::KernelTuner::Set(256, 16, Briand::GemvKernel::Default);
+    Briand::KernelTuner::Set(64, 256, Briand::GemvKernel::Default);
+    Briand::KernelTuner::Set(10, 64, Briand::GemvKernel::Default);
+    auto defaultPlan = nn->Compile();
+    const double defaultLatency = latency(*defaultPlan.get(), b);
+
+    double maxDifference = 0.0;
+    for (size_t i = 0; i < a.size(); i++) maxDifference = std::max(maxDifference, fabs(a[i] - b[i]));
+    printf("FCNN(16,256,64,10) compiled inference: default kernels AVG %.2lfus, tuned kernels AVG %.2lfus (x%.2lf), max output difference %.3e\n",
+        defaultLatency, tunedLatency, defaultLatency / (tunedLatency > 0.0 ? tunedLatency : 1.0), maxDifference);
+
+    // Put back the measured decisions and persist them
+    for (const auto& e : entries) Briand::KernelTuner::Set(e.Rows, e.Cols, e.Kernel);
+    printf("Table %s saved: %s\n", TABLE.c_str(), Briand::KernelTuner::Save(TABLE) ? "yes" : "no");
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void federated_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************* FEDERATED AVERAGING TEST ************\n\n");
+
+    const size_t FEATURES = 16;
+    const size_t CLASSES = 4;
+    const size_t NODES = 8;
+    const size_t ROUNDS = 30;
+
+    // Gaussian blobs (as softmax_test), test set shared, training split across nodes
+    Briand::Philox generator(43);
+    vector<vector<double>> centers(CLASSES, vector<double>(FEATURES));
+    for (auto& c : centers) generator.FillUniform(c, -1.0, 1.0);
+
+    Briand::Dataset test;
+    vector<Briand::Dataset> local(NODES);
+    vector<double> x(FEATURES), noise(FEATURES), target(CLASSES);
+    for (size_t i = 0; i < 1600; i++) {
+        const size_t c = i % CLASSES;
+        generator.FillNormal(noise, 0.0, 0.6);
+        for (size_t k = 0; k < FEATURES; k++) x[k] = centers[c][k] + noise[k];
+        std::fill(target.begin(), target.end(), 0.0);
+        target[c] = 1.0;
+        if (i >= 1200) {
+            test.Add(x, target);
+            continue;
+        }
+        // Non-IID: node n only sees classes n % 4 and (n + 1) % 4
+        const size_t candidates[] = { c, c + CLASSES, (c + CLASSES - 1) % CLASSES, (c + CLASSES - 1) % CLASSES + CLASSES };
+        local[candidates[(i / CLASSES) % 4]].Add(x, target);
+    }
+
+    auto accuracy = [&test](Briand::FCNN& nn) {
+        auto context = nn.CreateContext();
+        vector<double> out;
+        size_t correct = 0;
+        for (size_t i = 0; i < test.Size(); i++) {
+            nn.Predict(*context.get(), test.Inputs->at(i), out);
+            const auto& t = test.Targets->at(i);
+            if (std::max_element(out.begin(), out.end()) - out.begin() == std::max_element(t.begin(), t.end()) - t.begin()) correct++;
+        }
+        return 100.0 * static_cast<double>(correct) / static_cast<double>(test.Size());
+    };
+
+    auto build = [&]() {
+        auto nn = make_unique<Briand::FCNN>();
+        nn->SetSeed(43);
+        nn->SetInitializer(Briand::WeightInitializer::Auto);
+        nn->AddInputLayer(FEATURES);
+        nn->AddHiddenLayer(32, Briand::Math::Sigmoid, Briand::Math::DeSigmoid);
+        nn->AddSoftmaxOutputLayer(CLASSES);
+        return nn;
+    };
+
+    Briand::FitOptions options;
+    options.Epochs = 1;
+    options.LearningRate = 0.05;
+    options.Patience = 0;
+    options.RestoreBest = false;
+
+    struct Setup { const char* Name; double Density; bool Quantize; };
+    const Setup setups[] = { { "dense float", 1.0, false }, { "dense int8", 1.0, true }, { "top 10% float", 0.1, false }, { "top 10% int8", 0.1, true } };
+
+    for (const auto& setup : setups) {
+        auto global = build();
+        Briand::DeltaCompression compression;
+        compression.Density = setup.Density;
+        compression.Quantize = setup.Quantize;
+
+        // Each node serves on its own thread, the coordinator runs here
+        Briand::LoopbackTransport transport(NODES + 1);
+        vector<unique_ptr<Briand::FederatedNode>> nodes;
+        vector<std::thread> threads;
+        for (size_t n = 0; n < NODES; n++) {
+            nodes.push_back(make_unique<Briand::FederatedNode>(static_cast<uint16_t>(n + 1), transport, *global.get(), local[n], options, compression));
+            threads.push_back(std::thread(&Briand::FederatedNode::Serve, nodes.back().get()));
+        }
+
+        Briand::FederatedCoordinator coordinator(transport, *global.get(), NODES);
+        size_t reached = 0, bytesUp = 0, bytesDown = 0, reachedBytes = 0;
+        double last = 0.0;
+        long took = 0;
+        for (size_t r = 1; r <= ROUNDS; r++) {
+            const auto stats = coordinator.Round();
+            bytesUp += stats.BytesUp;
+            bytesDown += stats.BytesDown;
+            took += stats.Time;
+            last = accuracy(*global.get());
+            if (reached == 0 && last >= 90.0) {
+                reached = r;
+                reachedBytes = bytesUp;
+            }
+        }
+        coordinator.Stop();
+        for (auto& t : threads) t.join();
+
+        printf("%-14s: accuracy %.1lf%% after %u rounds, upload %6u bytes/round, 90%% reached %s, total up %u down %u bytes (%ldms)\n", setup.Name, last,
+            static_cast<unsigned int>(ROUNDS), static_cast<unsigned int>(bytesUp / ROUNDS / NODES),
+            reached == 0 ? "never" : ("at round " + to_string(reached) + " with " + to_string(reachedBytes) + " bytes up").c_str(),
+            static_cast<unsigned int>(bytesUp), static_cast<unsigned int>(bytesDown), took / 1000);
+    }
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void log_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("************************** LOGGING TEST *******************\n\n");
+
+    const size_t SAMPLES = 20000;
+    const size_t CALLS = 1000000;
+
+    // ESP_LOGx with the tag disabled: one relaxed atomic load, no map lookup
+    long start = esp_timer_get_time();
+    for (size_t i = 0; i < CALLS; i++) ESP_LOGI("LogTest", "call %u\n", static_cast<unsigned int>(i));
+    const long disabled = esp_timer_get_time() - start;
+    printf("ESP_LOGI on a disabled tag: %.2lfns/call\n", static_cast<double>(disabled) * 1000.0 / static_cast<double>(CALLS));
+
+    // BRIAND_LOGD is above the compile-time level (BRIAND_LOG_LEVEL = %d): no code at all
+    start = esp_timer_get_time();
+    for (size_t i = 0; i < CALLS; i++) BRIAND_LOGD("LogTest", "call %u", i);
+    const long compiled = esp_timer_get_time() - start;
+    printf("BRIAND_LOGD compiled out (level %d): %.2lfns/call\n", BRIAND_LOG_LEVEL, static_cast<double>(compiled) * 1000.0 / static_cast<double>(CALLS));
+
+    // Training with one log record and one span for each sample
+    Briand::Philox generator(44);
+    Briand::Dataset data;
+    vector<double> x(8), target(2);
+    for (size_t i = 0; i < 256; i++) {
+        generator.FillUniform(x, -1.0, 1.0);
+        target[0] = (x[0] * x[1] > 0.0 ? 1.0 : 0.0);
+        target[1] = 1.0 - target[0];
+        data.Add(x, target);
+    }
+
+    auto nn = make_unique<Briand::FCNN>();
+    nn->SetSeed(44);
+    nn->SetInitializer(Briand::WeightInitializer::Auto);
+    nn->AddInputLayer(8);
+    nn->AddHiddenLayer(16, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddSoftmaxOutputLayer(2);
+
+    std::atomic<size_t> lines(0);
+    const auto defaultSink = Briand::TraceLog::Sink;
+    Briand::TraceLog::Sink = [&lines](const char*) { lines++; };
+
+    auto train = [&](const bool& instrumented) {
+        const long begin = esp_timer_get_time();
+        for (size_t i = 0; i < SAMPLES; i++) {
+            const size_t s = i % data.Size();
+            if (!instrumented) {
+                nn->Train(data.Inputs->at(s), data.Targets->at(s), 0.01);
+                continue;
+            }
+            Briand::TraceScope span(3, "LogTest", "train step");
+            const double error = nn->Train(data.Inputs->at(s), data.Targets->at(s), 0.01);
+            BRIAND_LOGI("LogTest", "sample %u error %.6lf rate %.3lf", s, error, 0.01);
+        }
+        const long took = esp_timer_get_time() - begin;
+        return static_cast<double>(SAMPLES) * 1000000.0 / static_cast<double>(took > 0 ? took : 1);
+    };
+
+    train(false);
+    const double baseline = train(false);
+    printf("Training, no logging:              %8.0lf samples/s\n", baseline);
+
+    Briand::TraceLog::Level = ESP_LOG_NONE;
+    const double discarded = train(true);
+    printf("Training, runtime level none:      %8.0lf samples/s (x%.2lf)\n", discarded, discarded / baseline);
+    Briand::TraceLog::Level = ESP_LOG_VERBOSE;
+
+    lines = 0;
+    const double synchronous = train(true);
+    printf("Training, formatted by caller:     %8.0lf samples/s (x%.2lf), %u lines\n", synchronous, synchronous / baseline, static_cast<unsigned int>(lines.load()));
+
+    lines = 0;
+    Briand::TraceLog::Start(65536);
+    const double ring = train(true);
+    const size_t recorded = Briand::TraceLog::Recorded();
+    const size_t dropped = Briand::TraceLog::Dropped();
+    Briand::TraceLog::Stop();
+    printf("Training, ring + drainer:          %8.0lf samples/s (x%.2lf), %u records, %u dropped, %u lines\n", ring, ring / baseline,
+        static_cast<unsigned int>(recorded), static_cast<unsigned int>(dropped), static_cast<unsigned int>(lines.load()));
+
+    Briand::TraceLog::Sink = defaultSink;
+
+    // A sample of the formatted output
+    BRIAND_LOGI("LogTest", "formatted: %d %5.2f %s %x %c", -7, 3.14159, "text", 255u, 'z');
+    BRIAND_LOGW("LogTest", "no arguments");
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void dvfs_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** DEADLINE DVFS TEST *****************\n\n");
+
+    const size_t PERIODS = 60;
+    const size_t BURST = 6;
+    const size_t BURST_EVERY = 10;
+
+    auto nn = make_unique<Briand::FCNN>();
+    nn->SetSeed(45);
+    nn->SetInitializer(Briand::WeightInitializer::Auto);
+    nn->AddInputLayer(128);
+    nn->AddHiddenLayer(1024, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddHiddenLayer(512, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddSoftmaxOutputLayer(10);
+    auto plan = nn->Compile();
+
+    vector<double> input(128);
+    Briand::Philox generator(45);
+    generator.FillUniform(input, -1.0, 1.0);
+
+    // Cost profile (at the current frequency)
+    const vector<double> cycles = plan->Profile(input, 200);
+    double total = 0.0;
+    printf("Cost profile:");
+    for (size_t k = 0; k < cycles.size(); k++) {
+        printf(" layer %u %.0lf cycles,", static_cast<unsigned int>(k + 1), cycles[k]);
+        total += cycles[k];
+    }
+    printf(" total %.0lf cycles (%.0lfus at 80 MHz, %.0lfus at 240 MHz)\n", total, total / 80.0, total / 240.0);
+
+    // Budget: a lone request fits at 80 MHz, a burst of 6 needs 160 MHz
+    const int64_t budget = static_cast<int64_t>(4.0 * total / 80.0);
+    const int64_t period = static_cast<int64_t>(6.0 * total / 80.0);
+    printf("Workload: one request every %ldus, a burst of %u every %u periods, budget %ldus\n\n", static_cast<long>(period), static_cast<unsigned int>(BURST),
+        static_cast<unsigned int>(BURST_EVERY), static_cast<long>(budget));
+
+    struct Policy { const char* Name; vector<Briand::CpuOperatingPoint> Points; };
+    const auto esp32 = Briand::DeadlineScheduler::Esp32Points();
+    const Policy policies[] = { { "fixed 240 MHz", { esp32[2] } }, { "fixed 80 MHz", { esp32[0] } }, { "deadline-aware", esp32 } };
+
+    for (const auto& policy : policies) {
+        std::atomic<int64_t> worstSlack(INT64_MAX);
+        Briand::DeadlineScheduler scheduler(policy.Points, [&worstSlack](const Briand::ScheduledInference& r) {
+            const int64_t slack = r.Deadline - r.Finished;
+            int64_t seen = worstSlack.load();
+            while (slack < seen && !worstSlack.compare_exchange_weak(seen, slack)) {}
+        });
+        const size_t model = scheduler.AddModel(*plan.get(), cycles);
+
+        const long start = esp_timer_get_time();
+        for (size_t p = 0; p < PERIODS; p++) {
+            const size_t requests = (p % BURST_EVERY == BURST_EVERY - 1 ? BURST : 1);
+            for (size_t r = 0; r < requests; r++) scheduler.Submit(model, input, budget);
+
+            // Next period (sleep, then yield the last part: sleeps are coarse)
+            const long next = start + static_cast<long>((p + 1) * period);
+            const long left = next - static_cast<long>(esp_timer_get_time());
+            if (left > 300) std::this_thread::sleep_for(std::chrono::microseconds(left - 300));
+            while (static_cast<long>(esp_timer_get_time()) < next) std::this_thread::yield();
+        }
+        scheduler.Wait();
+
+        const auto s = scheduler.Statistics();
+        printf("%-15s: %3u inferences, %2u missed, worst slack %6ldus, %2u switches, energy %.3lfmJ (running %.3lfmJ)", policy.Name,
+            static_cast<unsigned int>(s.Completed), static_cast<unsigned int>(s.Missed), static_cast<long>(worstSlack.load()), static_cast<unsigned int>(s.Switches),
+            s.ActiveMillijoules + s.IdleMillijoules, s.ActiveMillijoules);
+        for (size_t p = 0; p < policy.Points.size(); p++) {
+            if (policy.Points.size() > 1) printf(", %u MHz %ldus", static_cast<unsigned int>(policy.Points[p].Mhz), static_cast<long>(s.ActiveUs[p]));
+        }
+        printf("\n");
+    }
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void early_exit_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** EARLY EXIT TEST ********************\n\n");
+
+    const size_t FEATURES = 8;
+    const size_t CLASSES = 8;
+#if defined(ESP_PLATFORM)
+    const size_t TRAIN = 400;
+    const size_t NEURONS = 32;
+#else
+    const size_t TRAIN = 6000;
+    const size_t NEURONS = 64;
+#endif
+    const size_t TEST = 1000;
+
+    // Each class is a mixture of 3 Gaussian blobs: samples near a blob center are easy, the others need a deeper network
+    Briand::Philox generator(46);
+    vector<vector<double>> centers(3 * CLASSES, vector<double>(FEATURES));
+    for (auto& c : centers) generator.FillUniform(c, -1.0, 1.0);
+
+    Briand::Dataset train, test;
+    vector<double> x(FEATURES), noise(FEATURES), target(CLASSES);
+    for (size_t i = 0; i < TRAIN + TEST; i++) {
+        const size_t blob = generator.NextUInt32() % centers.size();
+        generator.FillNormal(noise, 0.0, 0.35);
+        for (size_t k = 0; k < FEATURES; k++) x[k] = centers[blob][k] + noise[k];
+        std::fill(target.begin(), target.end(), 0.0);
+        target[blob % CLASSES] = 1.0;
+        if (i < TRAIN) train.Add(x, target);
+        else test.Add(x, target);
+    }
+
+    // Four hidden layers, heads after the first and the third
+    Briand::FCNN nn;
+    nn.SetSeed(46);
+    nn.SetInitializer(Briand::WeightInitializer::Auto);
+    nn.AddInputLayer(FEATURES);
+    nn.AddHiddenLayer(NEURONS, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn.AddExitHead(CLASSES, 0.3);
+    nn.AddHiddenLayer(NEURONS, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn.AddHiddenLayer(NEURONS, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn.AddExitHead(CLASSES, 0.3);
+    nn.AddHiddenLayer(NEURONS, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn.AddSoftmaxOutputLayer(CLASSES);
+
+    Briand::FitOptions options;
+    options.Epochs = 10;
+    options.LearningRate = 0.01;
+    options.Seed = 46;
+    auto fit = nn.Fit(train, options);
+    printf("Trained jointly with 2 exit heads: %u epochs, train loss %.4lf, %.1lfs\n\n", static_cast<unsigned int>(fit->History->size()),
+        fit->History->back().TrainLoss, static_cast<double>(fit->Time) / 1000000.0);
+
+    auto context = nn.CreateContext();
+    vector<double> out;
+
+    // Runs the test set (best of 3 runs), returns the mean latency (us)
+    auto evaluate = [&](const int64_t& budgetUs, size_t& correct, size_t exits[]) {
+        int64_t best = INT64_MAX;
+        for (size_t run = 0; run < 3; run++) {
+            correct = 0;
+            exits[0] = exits[1] = exits[2] = 0;
+            int64_t elapsed = 0;
+            for (size_t i = 0; i < test.Size(); i++) {
+                const int64_t start = esp_timer_get_time();
+                if (budgetUs < 0) nn.Predict(*context.get(), test.Inputs->at(i), out);
+                else nn.PredictAnytime(*context.get(), test.Inputs->at(i), out, budgetUs);
+                elapsed += esp_timer_get_time() - start;
+
+                const auto& t = test.Targets->at(i);
+                if (std::distance(out.begin(), std::max_element(out.begin(), out.end())) == std::distance(t.begin(), std::max_element(t.begin(), t.end()))) correct++;
+                exits[context->Exit == 1 ? 0 : (context->Exit == 3 ? 1 : 2)]++;
+            }
+            best = min(best, elapsed);
+        }
+        return static_cast<double>(best) / static_cast<double>(test.Size());
+    };
+
+    // Confidence threshold: latency against accuracy
+    size_t correct, exits[3];
+    double full = 0.0;
+    printf("Threshold       mean latency   accuracy   exit 1   exit 2   output\n");
+    for (const double threshold : { 2.0, 0.99, 0.95, 0.9, 0.8, 0.6 }) {
+        nn.SetExitThreshold(threshold);
+        const double latency = evaluate(-1, correct, exits);
+        if (threshold > 1.0) full = latency;
+
+        if (threshold > 1.0) printf("     none");
+        else printf("%9.2lf", threshold);
+        printf("   %6.1lfus x%.2lf   %7.2lf%%   %5.1lf%%   %5.1lf%%   %5.1lf%%\n", latency, latency / full,
+            100.0 * static_cast<double>(correct) / static_cast<double>(test.Size()), 100.0 * static_cast<double>(exits[0]) / static_cast<double>(test.Size()),
+            100.0 * static_cast<double>(exits[1]) / static_cast<double>(test.Size()), 100.0 * static_cast<double>(exits[2]) / static_cast<double>(test.Size()));
+    }
+
+    // Anytime: best answer when the budget runs out (no threshold)
+    nn.SetExitThreshold(2.0);
+    printf("\nAnytime budget   mean latency   accuracy   exit 1   exit 2   output\n");
+    for (const double fraction : { 0.0, 0.3, 0.6, 1.5 }) {
+        const int64_t budget = static_cast<int64_t>(fraction * full);
+        const double latency = evaluate(budget, correct, exits);
+        printf("%12ldus   %10.1lfus   %7.2lf%%   %5.1lf%%   %5.1lf%%   %5.1lf%%\n", static_cast<long>(budget), latency,
+            100.0 * static_cast<double>(correct) / static_cast<double>(test.Size()), 100.0 * static_cast<double>(exits[0]) / static_cast<double>(test.Size()),
+            100.0 * static_cast<double>(exits[1]) / static_cast<double>(test.Size()), 100.0 * static_cast<double>(exits[2]) / static_cast<double>(test.Size()));
+    }
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void incremental_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** INCREMENTAL INFERENCE TEST *********\n\n");
+
+#if defined(ESP_PLATFORM)
+    const size_t INPUTS = 64;
+    const size_t STEPS = 200;
+#else
+    const size_t INPUTS = 256;
+    const size_t STEPS = 2000;
+#endif
+
+    // Sensor node: many features, a few of them change at each reading
+    auto nn = make_unique<Briand::FCNN>();
+    nn->SetSeed(47);
+    nn->SetInitializer(Briand::WeightInitializer::Auto);
+    nn->AddInputLayer(INPUTS);
+    nn->AddHiddenLayer(256, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddHiddenLayer(64, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddSoftmaxOutputLayer(10);
+
+    auto full = nn->CreateContext();
+    auto incremental = nn->CreateContext();
+    vector<double> expected, out;
+    printf("Network %u-256-64-10, %u readings for each changed fraction\n\n", static_cast<unsigned int>(INPUTS), static_cast<unsigned int>(STEPS));
+    printf("Changed inputs   Predict   PredictIncremental   speedup   incremental layers   max error\n");
+
+    for (const double fraction : { 0.0, 0.01, 0.02, 0.05, 0.1, 0.2, 0.3, 0.4, 0.6 }) {
+        // Same readings for both
+        Briand::Philox generator(47);
+        vector<vector<double>> readings(STEPS, vector<double>(INPUTS));
+        generator.FillUniform(readings[0], 0.0, 1.0);
+        const size_t changes = static_cast<size_t>(fraction * static_cast<double>(INPUTS) + 0.5);
+        vector<size_t> features(INPUTS);
+        for (size_t i = 0; i < INPUTS; i++) features[i] = i;
+        for (size_t s = 1; s < STEPS; s++) {
+            // Distinct random features drift a little
+            readings[s] = readings[s - 1];
+            for (size_t c = 0; c < changes; c++) {
+                std::swap(features[c], features[c + generator.NextUInt32() % (INPUTS - c)]);
+                readings[s][features[c]] += 0.05 * (generator.NextUniform() - 0.5);
+            }
+        }
+
+        int64_t start = esp_timer_get_time();
+        for (const auto& r : readings) nn->Predict(*full.get(), r, expected);
+        const int64_t fullTime = esp_timer_get_time() - start;
+
+        size_t layers = 0;
+        start = esp_timer_get_time();
+        for (const auto& r : readings) layers += nn->PredictIncremental(*incremental.get(), r, out);
+        const int64_t incrementalTime = esp_timer_get_time() - start;
+
+        double error = 0.0;
+        for (size_t i = 0; i < out.size(); i++) error = max(error, fabs(out[i] - expected[i]));
+
+        printf("  %5u (%4.1lf%%)  %7.2lfus   %16.2lfus   x%6.2lf   %18.2lf   %.1le\n", static_cast<unsigned int>(changes), 100.0 * static_cast<double>(changes) / static_cast<double>(INPUTS),
+            static_cast<double>(fullTime) / static_cast<double>(STEPS), static_cast<double>(incrementalTime) / static_cast<double>(STEPS),
+            static_cast<double>(fullTime) / static_cast<double>(incrementalTime > 0 ? incrementalTime : 1), static_cast<double>(layers) / static_cast<double>(STEPS), error);
+    }
+
+    printf("***********************************************************\n\n\n");    
+}
+
+void server_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** INFERENCE SERVER TEST **************\n\n");
+
+    const size_t PRODUCERS = 4;
+#if defined(ESP_PLATFORM)
+    const size_t REQUESTS = 100;
+    const size_t INPUTS = 32;
+    const size_t NEURONS = 128;
+#else
+    const size_t REQUESTS = 400;
+    const size_t INPUTS = 64;
+    const size_t NEURONS = 512;
+#endif
+
+    auto nn = make_unique<Briand::FCNN>();
+    nn->SetSeed(48);
+    nn->SetInitializer(Briand::WeightInitializer::Auto);
+    nn->AddInputLayer(INPUTS);
+    nn->AddHiddenLayer(NEURONS, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddHiddenLayer(NEURONS, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddSoftmaxOutputLayer(10);
+
+    vector<vector<double>> inputs(PRODUCERS, vector<double>(INPUTS));
+    Briand::Philox generator(48);
+    for (auto& in : inputs) generator.FillUniform(in, -1.0, 1.0);
+
+    // Cost of one synchronous prediction
+    auto context = nn->CreateContext();
+    vector<double> out;
+    const size_t CALIBRATION = 200;
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < CALIBRATION; i++) nn->Predict(*context.get(), inputs[i % PRODUCERS], out);
+    const double single = static_cast<double>(esp_timer_get_time() - start) / static_cast<double>(CALIBRATION);
+
+    // Same results from a batch
+    {
+        Briand::InferenceServer server(*nn.get());
+        auto future = server.Submit(inputs[0]);
+        nn->Predict(*context.get(), inputs[0], out);
+        const auto result = future.get();
+        double error = 0.0;
+        for (size_t i = 0; i < out.size(); i++) error = max(error, fabs(result.Outputs[i] - out[i]));
+        printf("Network %u-%u-%u-10, one Predict %.0lfus, future result max diff from Predict %.1le\n", static_cast<unsigned int>(INPUTS),
+            static_cast<unsigned int>(NEURONS), static_cast<unsigned int>(NEURONS), single, error);
+    }
+
+    // Open loop: each producer submits at a fixed rate, latency from the scheduled time (a late producer does not hide queueing)
+    vector<int64_t> latencies(PRODUCERS * REQUESTS);
+    auto report = [&](const char* name, const int64_t& elapsed, const size_t& batches) {
+        vector<int64_t> done;
+        for (const auto& l : latencies) if (l >= 0) done.push_back(l);
+        std::sort(done.begin(), done.end());
+        const size_t n = done.size();
+        printf("  %-24s %8.0lf req/s   p50 %7ldus   p99 %7ldus   mean batch %5.2lf   rejected %u\n", name,
+            static_cast<double>(n) * 1000000.0 / static_cast<double>(elapsed > 0 ? elapsed : 1),
+            static_cast<long>(n > 0 ? done[n / 2] : 0), static_cast<long>(n > 0 ? done[(n * 99) / 100] : 0),
+            batches > 0 ? static_cast<double>(n) / static_cast<double>(batches) : 1.0, static_cast<unsigned int>(latencies.size() - n));
+    };
+
+    auto run = [&](const int64_t& interval, const std::function<void(const size_t& p, const size_t& i, const int64_t& scheduled)>& submit) {
+        std::fill(latencies.begin(), latencies.end(), -1);
+        const int64_t t0 = esp_timer_get_time() + 1000;
+        vector<std::thread> producers;
+        for (size_t p = 0; p < PRODUCERS; p++) {
+            producers.push_back(std::thread([&, p]() {
+                for (size_t i = 0; i < REQUESTS; i++) {
+                    const int64_t scheduled = t0 + static_cast<int64_t>(i) * interval + static_cast<int64_t>(p) * interval / static_cast<int64_t>(PRODUCERS);
+                    const int64_t wait = scheduled - esp_timer_get_time();
+                    if (wait > 0) std::this_thread::sleep_for(std::chrono::microseconds(wait));
+                    submit(p, i, scheduled);
+                }
+            }));
+        }
+        for (auto& t : producers) t.join();
+        return t0;
+    };
+
+    struct Window { const char* Name; size_t MaxBatch; int64_t MaxWaitUs; };
+    const Window windows[] = { { "server batch 1", 1, 0 }, { "server batch 8, no wait", 8, 0 }, { "server batch 8, 200us", 8, 200 }, { "server batch 16, 1ms", 16, 1000 } };
+
+    for (const double load : { 0.5, 1.5 }) {
+        // Each producer alone offers load / PRODUCERS of what a synchronous Predict can serve
+        const int64_t interval = static_cast<int64_t>(static_cast<double>(PRODUCERS) * single / load);
+        printf("\nOffered load x%.1lf of one synchronous Predict (%.0lf req/s, %u producers)\n", load, 1000000.0 * static_cast<double>(PRODUCERS) / static_cast<double>(interval),
+            static_cast<unsigned int>(PRODUCERS));
+
+        // Today: a lock around a shared network
+        {
+            std::mutex lock;
+            auto shared = nn->CreateContext();
+            vector<double> sharedOut;
+            const int64_t t0 = run(interval, [&](const size_t& p, const size_t& i, const int64_t& scheduled) {
+                std::lock_guard<std::mutex> guard(lock);
+                nn->Predict(*shared.get(), inputs[p], sharedOut);
+                latencies[p * REQUESTS + i] = esp_timer_get_time() - scheduled;
+            });
+            report("lock + Predict", esp_timer_get_time() - t0, 0);
+        }
+
+        for (const auto& window : windows) {
+            Briand::InferenceServerConfig config;
+            config.MaxBatch = window.MaxBatch;
+            config.MaxWaitUs = window.MaxWaitUs;
+            config.QueueCapacity = 256;
+
+            size_t batches;
+            int64_t t0, end;
+            {
+                Briand::InferenceServer server(*nn.get(), config);
+                t0 = run(interval, [&](const size_t& p, const size_t& i, const int64_t& scheduled) {
+                    server.Submit(inputs[p], [&latencies, p, i, scheduled, REQUESTS](const Briand::InferenceResult& r) {
+                        latencies[p * REQUESTS + i] = r.Finished - scheduled;
+                    });
+                });
+                while (server.Statistics().Completed + server.Statistics().Rejected < PRODUCERS * REQUESTS) std::this_thread::sleep_for(std::chrono::microseconds(100));
+                end = esp_timer_get_time();
+                batches = server.Statistics().Batches;
+            }
+            report(window.Name, end - t0, batches);
+        }
+    }
+
+    printf("***********************************************************\n\n\n");    
+}
+
+/** @brief Synthetic camera for pipeline test */
+class SyntheticCamera {
+    public:
+    /// @brief Frame period (us), 0 = as fast as possible
+    uint64_t Period;
+    /// @brief Next frame due time
+    uint64_t NextFrame;
+    /// @brief Classifier (used by inference stage only)
+    unique_ptr<Briand::FCNN> Model;
+    /// @brief Frames per predicted class (used by post stage only)
+    uint64_t Classes[3];
+};
+
+/** @brief Pipeline capture: synthetic 8x8 RGB frame, normalized to [0,1] */
+static bool pipeline_capture(Briand::PipelineFrame& frame, void* context) {
+    auto camera = static_cast<SyntheticCamera*>(context);
+    if (camera->Period > 0) {
+        const uint64_t now = esp_timer_get_time();
+        if (now < camera->NextFrame) return false;
+        camera->NextFrame = now + camera->Period;
+    }
+
+    // Dominant channel changes with the frame number, plus some noise
+    const size_t dominant = static_cast<size_t>(frame.Sequence % 3);
+    for (size_t i = 0; i < frame.Input->size(); i++) {
+        const double pixel = (i % 3 == dominant ? 200.0 : 30.0) + 50.0 * Briand::Math::Random();
+        frame.Input->at(i) = pixel / 255.0;
+    }
+    return true;
+}
+
+/** @brief Pipeline inference */
+static void pipeline_inference(Briand::PipelineFrame& frame, void* context) {
+    auto camera = static_cast<SyntheticCamera*>(context);
+    auto out = camera->Model->Predict(*frame.Input.get());
+    std::copy(out->begin(), out->end(), frame.Output->begin());
+}
+
+/** @brief Pipeline post-processing: argmax */
+static void pipeline_post(Briand::PipelineFrame& frame, void* context) {
+    auto camera = static_cast<SyntheticCamera*>(context);
+    auto best = std::max_element(frame.Output->begin(), frame.Output->end());
+    camera->Classes[std::distance(frame.Output->begin(), best)]++;
+}
+
+/** @brief Streaming pipeline test (synthetic camera frames -> FCNN -> classification) */
+void pipeline_test() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("********************** PIPELINE TEST **********************\n\n");
+
+    // 8x8 RGB frames, 3 classes
+    const size_t INPUTS = 8 * 8 * 3;
+
+    auto camera = make_unique<SyntheticCamera>();
+    camera->Model = make_unique<Briand::FCNN>();
+    camera->Model->AddInputLayer(INPUTS);
+    camera->Model->AddHiddenLayer(32, Briand::Math::ReLU, Briand::Math::DeReLU);
+    camera->Model->AddHiddenLayer(16, Briand::Math::ReLU, Briand::Math::DeReLU);
+    camera->Model->AddOutputLayer(3, Briand::Math::Sigmoid, Briand::Math::DeSigmoid, Briand::Math::MSE, Briand::Math::DeMSE);
+
+    Briand::PipelineConfig config(INPUTS, 3);
+
+    // 1) Camera at 100 fps, backpressure
+    camera->Period = 10000;
+    camera->NextFrame = 0;
+    std::fill_n(camera->Classes, 3, 0);
+    config.Overflow = Briand::PipelineOverflow::Block;
+    auto pipeline = make_unique<Briand::StreamingPipeline>(config, pipeline_capture, pipeline_inference, pipeline_post, camera.get());
+    pipeline->Start();
+    vTaskDelay(2000 / portTICK_PERIOD_MS);
+    pipeline->Stop();
+    printf("100 fps source, block on overflow:\n");
+    pipeline->GetStatistics().Print();
+    printf("Classes: %llu %llu %llu\n\n", static_cast<unsigned long long>(camera->Classes[0]), static_cast<unsigned long long>(camera->Classes[1]), static_cast<unsigned long long>(camera->Classes[2]));
+    pipeline.reset();
+
+    // 2) Free running camera, frames dropped when inference is late
+    camera->Period = 0;
+    std::fill_n(camera->Classes, 3, 0);
+    config.Overflow = Briand::PipelineOverflow::DropNewest;
+    pipeline = make_unique<Briand::StreamingPipeline>(config, pipeline_capture, pipeline_inference, pipeline_post, camera.get());
+    pipeline->Start();
+    vTaskDelay(2000 / portTICK_PERIOD_MS);
+    pipeline->Stop();
+    printf("Free running source, drop on overflow:\n");
+    pipeline->GetStatistics().Print();
+    printf("Classes: %llu %llu %llu\n", static_cast<unsigned long long>(camera->Classes[0]), static_cast<unsigned long long>(camera->Classes[1]), static_cast<unsigned long long>(camera->Classes[2]));
+    pipeline.reset();
 
     printf("***********************************************************\n\n\n");    
 }
 
 /** @brief Example project 1: OR port with NN */
 void example_1() {
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("******************* EXAMPLE 1: OR/XOR *********************\n\n");
+
+    const char* names[] = { "OR", "XOR" };
+    const double X[4][2] = { {0, 0}, {0, 1}, {1, 0}, {1, 1} };
+    const double Y[2][4] = { {0, 1, 1, 1}, {0, 1, 1, 0} };
+
+    for (uint8_t g = 0; g < 2; g++) {
+        Briand::Dataset data;
+        for (uint8_t i = 0; i < 4; i++) data.Add({ X[i][0], X[i][1] }, { Y[g][i] });
+
+        auto nn = make_unique<Briand::FCNN>();
+        nn->SetSeed(1);
+        nn->SetInitializer(Briand::WeightInitializer::Xavier);
+        nn->AddInputLayer(2);
+        nn->AddHiddenLayer(4, Briand::Math::Sigmoid, Briand::Math::DeSigmoid);
+        nn->AddOutputLayer(1, Briand::Math::Sigmoid, Briand::Math::DeSigmoid, Briand::Math::MSE, Briand::Math::DeMSE);
+
+        // Only 4 samples: no validation, stop when training loss is low enough
+        Briand::FitOptions options;
+        options.Epochs = 20000;
+        options.LearningRate = 0.5;
+        options.Patience = 0;
+        options.TargetLoss = 0.001;
+        options.Seed = 1;
+
+        printf("%s port with FCNN(2,4,1)\n", names[g]);
+        auto result = nn->Fit(data, options);
+        result->Print();
+
+        auto context = nn->CreateContext();
+        vector<double> out(1);
+        for (uint8_t i = 0; i < 4; i++) {
+            nn->Predict(*context.get(), data.Inputs->at(i), out);
+            printf("%.0lf %s %.0lf = %.4lf (expected %.0lf)\n", X[i][0], names[g], X[i][1], out[0], Y[g][i]);
+        }
+        printf("\n");
+    }
 
+    printf("***********************************************************\n\n\n");    
 }
 
 /** @brief Example project 2: sum two numbers */
 void example_2() {
-    
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("******************** EXAMPLE 2: SUM ***********************\n\n");
+
+    // a + b with a, b in [0, 0.5)
+    Briand::Philox generator(2);
+    Briand::Dataset data;
+    for (size_t i = 0; i < 400; i++) {
+        const double a = 0.5 * generator.NextUniform();
+        const double b = 0.5 * generator.NextUniform();
+        data.Add({ a, b }, { a + b });
+    }
+
+    auto nn = make_unique<Briand::FCNN>();
+    nn->SetSeed(2);
+    nn->SetInitializer(Briand::WeightInitializer::Auto);
+    nn->AddInputLayer(2);
+    nn->AddHiddenLayer(8, Briand::Math::ReLU, Briand::Math::DeReLU);
+    nn->AddOutputLayer(1, Briand::Math::Identity, Briand::Math::DeIdentity, Briand::Math::MSE, Briand::Math::DeMSE);
+
+    Briand::FitOptions options;
+    options.Epochs = 500;
+    options.LearningRate = 0.01;
+    options.ValidationSplit = 0.2;
+    options.Patience = 20;
+    options.MinDelta = 1e-8;
+    options.Seed = 2;
+    options.PrintEvery = 50;
+
+    printf("Sum of two numbers with FCNN(2,8,1), %u samples (20%% validation)\n", static_cast<unsigned int>(data.Size()));
+    auto result = nn->Fit(data, options);
+    result->Print();
+
+    auto context = nn->CreateContext();
+    vector<double> out(1);
+    const double tests[][2] = { {0.1, 0.2}, {0.25, 0.25}, {0.4, 0.05}, {0.33, 0.44} };
+    for (const auto& t : tests) {
+        nn->Predict(*context.get(), { t[0], t[1] }, out);
+        printf("%.2lf + %.2lf = %.4lf (expected %.2lf)\n", t[0], t[1], out[0], t[0] + t[1]);
+    }
+
+    printf("***********************************************************\n\n\n");    
 }
 
 /** @brief Example project 3: color recognition/classifier (supervised) */
 void example_3() {
-    
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("**************** EXAMPLE 3: COLOR CLASSIFIER **************\n\n");
+
+    const char* names[] = { "red", "green", "blue", "yellow", "white", "black" };
+    const double colors[6][3] = { {1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {1, 1, 0}, {1, 1, 1}, {0, 0, 0} };
+    const size_t CLASSES = 6;
+
+    // Noisy samples around each color
+    Briand::Philox generator(3);
+    auto sample = [&](const size_t& c, vector<double>& rgb) {
+        for (uint8_t k = 0; k < 3; k++) rgb[k] = std::min(1.0, std::max(0.0, colors[c][k] + 0.3 * (generator.NextUniform() - 0.5)));
+    };
+
+    Briand::Dataset data, test;
+    vector<double> rgb(3), target(CLASSES);
+    for (size_t i = 0; i < 720; i++) {
+        const size_t c = i % CLASSES;
+        sample(c, rgb);
+        std::fill(target.begin(), target.end(), 0.0);
+        target[c] = 1.0;
+        if (i < 600) data.Add(rgb, target);
+        else test.Add(rgb, target);
+    }
+
+    auto build = [&]() {
+        auto nn = make_unique<Briand::FCNN>();
+        nn->SetSeed(3);
+        nn->SetInitializer(Briand::WeightInitializer::Xavier);
+        nn->AddInputLayer(3);
+        nn->AddHiddenLayer(12, Briand::Math::Sigmoid, Briand::Math::DeSigmoid);
+        nn->AddOutputLayer(6, Briand::Math::Sigmoid, Briand::Math::DeSigmoid, Briand::Math::MSE, Briand::Math::DeMSE);
+        return nn;
+    };
+
+    auto accuracy = [&test](Briand::FCNN& nn) {
+        auto context = nn.CreateContext();
+        vector<double> out(6);
+        size_t correct = 0;
+        for (size_t i = 0; i < test.Size(); i++) {
+            nn.Predict(*context.get(), test.Inputs->at(i), out);
+            const auto& t = test.Targets->at(i);
+            if (std::max_element(out.begin(), out.end()) - out.begin() == std::max_element(t.begin(), t.end()) - t.begin()) correct++;
+        }
+        return 100.0 * static_cast<double>(correct) / static_cast<double>(test.Size());
+    };
+
+    Briand::FitOptions options;
+    options.Epochs = 300;
+    options.LearningRate = 0.5;
+    options.ValidationSplit = 0.2;
+    options.Patience = 15;
+    options.Seed = 3;
+
+    printf("RGB classifier FCNN(3,12,6), %u samples (20%% validation), %u test samples\n", static_cast<unsigned int>(data.Size()), static_cast<unsigned int>(test.Size()));
+    auto nn = build();
+    auto result = nn->Fit(data, options);
+    result->Print();
+    printf("Fit(): test accuracy %.1lf%%\n", accuracy(*nn.get()));
+
+    // Same epochs with a hand-written loop: copied and shuffled samples, validation on all held out samples after each epoch
+    auto manual = build();
+    const size_t epochs = result->History->size();
+    const size_t trainCount = data.Size() - data.Size() / 5;
+    long start = esp_timer_get_time();
+    for (size_t e = 0; e < epochs; e++) {
+        vector<vector<double>> inputs(data.Inputs->begin(), data.Inputs->begin() + trainCount);
+        vector<vector<double>> targets(data.Targets->begin(), data.Targets->begin() + trainCount);
+        for (size_t i = trainCount; i > 1; i--) {
+            const size_t j = generator.NextUInt32() % i;
+            std::swap(inputs[i - 1], inputs[j]);
+            std::swap(targets[i - 1], targets[j]);
+        }
+        for (size_t i = 0; i < trainCount; i++) manual->Train(inputs[i], targets[i], options.LearningRate);
+
+        double loss = 0;
+        for (size_t i = trainCount; i < data.Size(); i++) {
+            auto out = manual->Predict(data.Inputs->at(i));
+            for (size_t j = 0; j < CLASSES; j++) loss += Briand::Math::MSE(data.Targets->at(i)[j], out->at(j));
+        }
+    }
+    long manualTime = esp_timer_get_time() - start;
+    printf("Hand-written loop, same %u epochs: %ldms (Fit() %ldms), test accuracy %.1lf%%\n", static_cast<unsigned int>(epochs), manualTime / 1000, result->Time / 1000, accuracy(*manual.get()));
+
+    // A few predictions
+    auto context = nn->CreateContext();
+    vector<double> out(CLASSES);
+    for (size_t c = 0; c < CLASSES; c++) {
+        sample(c, rgb);
+        nn->Predict(*context.get(), rgb, out);
+        const size_t predicted = std::max_element(out.begin(), out.end()) - out.begin();
+        printf("RGB(%.2lf, %.2lf, %.2lf) is %s (expected %s)\n", rgb[0], rgb[1], rgb[2], names[predicted], names[c]);
+    }
+
+    printf("***********************************************************\n\n\n");    
 }
 
 /** @brief Example project 4: color recognition/classifier (unsupervised) */
 void example_4() {
-    
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("************* EXAMPLE 4: COLOR CLUSTERING (K-MEANS) *******\n\n");
+
+    const char* names[] = { "red", "green", "blue", "yellow", "cyan", "magenta", "white", "black" };
+    const double colors[8][3] = { {1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {1, 1, 0}, {0, 1, 1}, {1, 0, 1}, {1, 1, 1}, {0, 0, 0} };
+    const size_t CLASSES = 8;
+#if defined(ESP_PLATFORM)
+    const size_t SAMPLES = 4000;
+#else
+    const size_t SAMPLES = 200000;
+#endif
+
+    // Noisy pixels around each color, no labels given to k-means (kept only to measure the result)
+    Briand::Philox generator(4);
+    auto sample = [&](const size_t& c, double* rgb) {
+        for (uint8_t k = 0; k < 3; k++) rgb[k] = std::min(1.0, std::max(0.0, colors[c][k] + 0.15 * generator.NextNormal()));
+    };
+
+    Briand::Matrix pixels(SAMPLES, 3);
+    vector<size_t> truth(SAMPLES);
+    for (size_t i = 0; i < SAMPLES; i++) {
+        truth[i] = generator.NextUInt32() % CLASSES;
+        sample(truth[i], pixels[i]);
+    }
+
+    // Each cluster takes the name of the nearest color, accuracy counts pixels whose cluster has the name of their color
+    auto accuracy = [&](const Briand::KMeans& model) {
+        vector<size_t> named(CLASSES);
+        for (size_t j = 0; j < CLASSES; j++) {
+            const double* c = model.Centroids()[j];
+            double best = 1e300;
+            for (size_t n = 0; n < CLASSES; n++) {
+                double s = 0.0;
+                for (uint8_t k = 0; k < 3; k++) s += (c[k] - colors[n][k]) * (c[k] - colors[n][k]);
+                if (s < best) {
+                    best = s;
+                    named[j] = n;
+                }
+            }
+        }
+        vector<size_t> labels;
+        model.Assign(pixels, labels);
+        size_t correct = 0;
+        for (size_t i = 0; i < SAMPLES; i++) if (named[labels[i]] == truth[i]) correct++;
+        return 100.0 * static_cast<double>(correct) / static_cast<double>(SAMPLES);
+    };
+
+    // Lloyd on the whole set
+    printf("%u RGB pixels, %u clusters, %u default pool workers\n", static_cast<unsigned int>(SAMPLES), static_cast<unsigned int>(CLASSES),
+        static_cast<unsigned int>(Briand::ThreadPool::Default().Workers()));
+    Briand::KMeans model(CLASSES, 3, 4);
+    auto result = model.Fit(pixels);
+    result->Print();
+    printf("Lloyd: %.2lf Mpoints/s in assignment, accuracy %.1lf%%\n", static_cast<double>(SAMPLES * (result->Iterations + 1)) / static_cast<double>(result->AssignTime), accuracy(model));
+
+    // Assignment kernel against the textbook loop (distance to each centroid)
+    vector<size_t> labels(SAMPLES);
+    int64_t start = esp_timer_get_time();
+    model.Assign(pixels, labels);
+    const int64_t gemm = esp_timer_get_time() - start;
+    const Briand::Matrix& centroids = model.Centroids();
+    start = esp_timer_get_time();
+    for (size_t i = 0; i < SAMPLES; i++) {
+        const double* x = pixels[i];
+        double best = 1e300;
+        for (size_t j = 0; j < CLASSES; j++) {
+            double s = 0.0;
+            for (uint8_t k = 0; k < 3; k++) s += (x[k] - centroids[j][k]) * (x[k] - centroids[j][k]);
+            if (s < best) {
+                best = s;
+                labels[i] = j;
+            }
+        }
+    }
+    const int64_t naive = esp_timer_get_time() - start;
+    printf("Assign(): %.2lf Mpoints/s, distance loop %.2lf Mpoints/s\n", static_cast<double>(SAMPLES) / static_cast<double>(gemm > 0 ? gemm : 1),
+        static_cast<double>(SAMPLES) / static_cast<double>(naive > 0 ? naive : 1));
+
+    // Mini-batch: one pass over the pixels as a stream
+    const size_t BATCH = 256;
+    Briand::KMeans streamed(CLASSES, 3, 4);
+    Briand::Matrix batch(BATCH, 3);
+    start = esp_timer_get_time();
+    for (size_t i = 0; i + BATCH <= SAMPLES; i += BATCH) {
+        std::copy(pixels[i], pixels[i] + BATCH * 3, batch.Data());
+        streamed.PartialFit(batch);
+    }
+    const int64_t stream = esp_timer_get_time() - start;
+    printf("Mini-batch (%u pixels each, one pass): %.2lf Mpoints/s, accuracy %.1lf%%\n", static_cast<unsigned int>(BATCH),
+        static_cast<double>(SAMPLES - SAMPLES % BATCH) / static_cast<double>(stream > 0 ? stream : 1), accuracy(streamed));
+
+    // On device: nearest centroid lookup
+    const size_t LOOKUPS = 10000;
+    size_t sink = 0;
+    start = esp_timer_get_time();
+    for (size_t i = 0; i < LOOKUPS; i++) sink += model.Predict(pixels[i % SAMPLES]);
+    const int64_t lookup = esp_timer_get_time() - start;
+    printf("Predict(): %.0lfns per pixel, centroids table %u bytes (checksum %u)\n", 1000.0 * static_cast<double>(lookup) / static_cast<double>(LOOKUPS),
+        static_cast<unsigned int>(CLASSES * 3 * sizeof(double)), static_cast<unsigned int>(sink));
+
+    model.Print();
+
+    // A few predictions
+    vector<double> rgb(3);
+    for (size_t c = 0; c < CLASSES; c++) {
+        sample(c, rgb.data());
+        const double* centroid = model.Centroids()[model.Predict(rgb)];
+        printf("RGB(%.2lf, %.2lf, %.2lf) is in cluster RGB(%.2lf, %.2lf, %.2lf) (expected %s)\n", rgb[0], rgb[1], rgb[2], centroid[0], centroid[1], centroid[2], names[c]);
+    }
+
+    printf("***********************************************************\n\n\n");    
 }
 
 /** @brief Example project 5: human face detection (single) */
@@ -367,14 +2606,206 @@ void example_7() {
     
 }
 
+/** @brief Synthetic face embeddings for examples 8 and 9 (stand-in for the output of a face network).
+    Each identity is near one of a few look-alike groups, each photo is its identity plus noise. Vectors are regenerated from the identity. */
+class SyntheticFaces {
+    public:
+    /// @brief Embedding size and seed
+    size_t Dimensions;
+    uint64_t Seed;
+    /// @brief Look-alike groups (unit vectors, one for each 64 identities)
+    size_t Groups;
+    vector<double> Centers;
+
+    SyntheticFaces(const size_t& dimensions, const size_t& identities, const uint64_t& seed) {
+        this->Dimensions = dimensions;
+        this->Seed = seed;
+        this->Groups = std::max<size_t>(1, identities / 64);
+        this->Centers.resize(this->Groups * dimensions);
+        Briand::Philox generator(seed, 0xFFFFFFFF);
+        for (size_t g = 0; g < this->Groups; g++) {
+            double* c = this->Centers.data() + g * dimensions;
+            double norm = 0.0;
+            for (size_t j = 0; j < dimensions; j++) {
+                c[j] = generator.NextNormal();
+                norm += c[j] * c[j];
+            }
+            for (size_t j = 0; j < dimensions; j++) c[j] /= sqrt(norm);
+        }
+    }
+
+    /// @brief Embedding of an identity (group center plus a personal offset of norm about 0.8, uniform values are enough in many dimensions)
+    void Identity(const uint32_t& id, double* out) const {
+        Briand::Philox generator(this->Seed, id);
+        const double* c = this->Centers.data() + (generator.NextUInt32() % this->Groups) * this->Dimensions;
+        const double spread = sqrt(3.0) * 0.8 / sqrt(static_cast<double>(this->Dimensions));
+        for (size_t j = 0; j < this->Dimensions; j++) out[j] = c[j] + spread * (2.0 * generator.NextUniform() - 1.0);
+    }
+
+    /// @brief Embedding of a photo of an identity (noise of norm about 0.5: pose, light)
+    void Photo(const uint32_t& id, const uint32_t& shot, double* out) const {
+        this->Identity(id, out);
+        Briand::Philox generator(this->Seed + 1, (static_cast<uint64_t>(id) << 32) | shot);
+        const double noise = sqrt(3.0) * 0.5 / sqrt(static_cast<double>(this->Dimensions));
+        for (size_t j = 0; j < this->Dimensions; j++) out[j] += noise * (2.0 * generator.NextUniform() - 1.0);
+    }
+};
+
 /** @brief Example project 8: human face recognition (single) */
 void example_8() {
-    
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("************** EXAMPLE 8: FACE RECOGNITION (SINGLE) *******\n\n");
+
+    const size_t DIMENSIONS = 128;
+    const size_t PEOPLE = 100;
+    const double THRESHOLD = 0.7;
+    SyntheticFaces faces(DIMENSIONS, PEOPLE, 8);
+    vector<double> embedding(DIMENSIONS);
+    vector<Briand::EmbeddingMatch> matches;
+
+    // Enroll the gallery (one photo each)
+    Briand::EmbeddingIndex gallery(DIMENSIONS, Briand::EmbeddingPrecision::Int8);
+    for (uint32_t id = 0; id < PEOPLE; id++) {
+        faces.Photo(id, 0, embedding.data());
+        gallery.Enroll(id, embedding);
+    }
+    gallery.Print();
+
+    // Who is it? Below THRESHOLD the face is unknown
+    auto recognize = [&](const Briand::EmbeddingIndex& index, const char* who) {
+        const int64_t start = esp_timer_get_time();
+        index.Search(embedding, 3, matches);
+        const int64_t time = esp_timer_get_time() - start;
+        if (matches.empty() || matches[0].Similarity < THRESHOLD) printf("  %-28s unknown (best %.3f), %ldus\n", who, matches.empty() ? 0.0f : matches[0].Similarity, static_cast<long>(time));
+        else printf("  %-28s person %u (similarity %.3f, distance %.3f, next %.3f), %ldus\n", who, static_cast<unsigned int>(matches[0].Id), matches[0].Similarity,
+            matches[0].Distance, matches.size() > 1 ? matches[1].Similarity : 0.0f, static_cast<long>(time));
+    };
+
+    printf("New photos:\n");
+    faces.Photo(7, 1, embedding.data());
+    recognize(gallery, "person 7");
+    faces.Photo(42, 1, embedding.data());
+    recognize(gallery, "person 42");
+    SyntheticFaces strangers(DIMENSIONS, PEOPLE, 1008);
+    strangers.Photo(5, 1, embedding.data());
+    recognize(gallery, "a stranger");
+
+    // Incremental changes
+    gallery.Remove(7);
+    faces.Photo(7, 2, embedding.data());
+    recognize(gallery, "person 7 after Remove(7)");
+    strangers.Photo(5, 0, embedding.data());
+    gallery.Enroll(1000, embedding);
+    strangers.Photo(5, 2, embedding.data());
+    recognize(gallery, "stranger enrolled as 1000");
+
+    // Saved to flash and used in place
+#if !defined(ESP_PLATFORM)
+    // Simulated 1MB data partition. On ESP the partition table must have a "faces" data partition.
+    briand_porting_partition_simulate("faces", 1024 * 1024, 40 * 1024 * 1024);
+#endif
+    try {
+        Briand::PartitionWeightStore store("faces");
+        printf("Saved %u bytes to the \"faces\" partition\n", static_cast<unsigned int>(gallery.Save(store)));
+        auto mapped = Briand::EmbeddingIndex::Map("faces");
+        mapped->Print();
+        faces.Photo(42, 3, embedding.data());
+        recognize(*mapped.get(), "person 42 (mapped index)");
+        strangers.Photo(5, 3, embedding.data());
+        recognize(*mapped.get(), "person 1000 (mapped index)");
+    }
+    catch (const exception& e) {
+        printf("Flash partition: %s\n", e.what());
+    }
+
+    printf("***********************************************************\n\n\n");    
 }
 
 /** @brief Example project 9: human face recognition (multiple) */
 void example_9() {
-    
+    printf("\n\n");
+    printf("***********************************************************\n");   
+    printf("************* EXAMPLE 9: FACE RECOGNITION (GALLERY) *******\n\n");
+
+    const size_t DIMENSIONS = 128;
+#if defined(ESP_PLATFORM)
+    const vector<size_t> SIZES = { 100, 1000 };
+#else
+    const vector<size_t> SIZES = { 100, 10000, 1000000 };
+#endif
+    const size_t K = 10;
+
+    printf("Synthetic %u-d face embeddings, photos of enrolled people as queries, top %u. Reference: exact float32 scan.\n",
+        static_cast<unsigned int>(DIMENSIONS), static_cast<unsigned int>(K));
+
+    for (const size_t people : SIZES) {
+        SyntheticFaces faces(DIMENSIONS, people, 9);
+        vector<double> embedding(DIMENSIONS);
+
+        // Same gallery in both precisions
+        Briand::EmbeddingIndex exact(DIMENSIONS, Briand::EmbeddingPrecision::Float32);
+        Briand::EmbeddingIndex quantized(DIMENSIONS, Briand::EmbeddingPrecision::Int8);
+        int64_t start = esp_timer_get_time();
+        for (uint32_t id = 0; id < people; id++) {
+            faces.Photo(id, 0, embedding.data());
+            exact.Enroll(id, embedding);
+            quantized.Enroll(id, embedding);
+        }
+        const int64_t enroll = esp_timer_get_time() - start;
+
+        const size_t QUERIES = (people >= 1000000 ? 100 : 1000);
+        Briand::Matrix queries(QUERIES, DIMENSIONS);
+        vector<uint32_t> who(QUERIES);
+        for (size_t q = 0; q < QUERIES; q++) {
+            who[q] = static_cast<uint32_t>(q * people / QUERIES);
+            faces.Photo(who[q], 1, queries[q]);
+        }
+
+        printf("\n%u people (enrolled twice in %ldms)\n", static_cast<unsigned int>(people), static_cast<long>(enroll / 1000));
+
+        vector<vector<Briand::EmbeddingMatch>> truth, found;
+        auto run = [&](const Briand::EmbeddingIndex& index, const char* name, vector<vector<Briand::EmbeddingMatch>>& results) {
+            const int64_t t = esp_timer_get_time();
+            index.SearchBatch(queries, K, results);
+            const int64_t time = esp_timer_get_time() - t;
+
+            // Recall: found ids among the reference top 1 / top K
+            size_t top1 = 0, topK = 0, identified = 0;
+            for (size_t q = 0; q < QUERIES; q++) {
+                if (!results[q].empty() && results[q][0].Id == truth[q][0].Id) top1++;
+                if (!results[q].empty() && results[q][0].Id == who[q]) identified++;
+                for (const auto& m : results[q]) {
+                    for (const auto& t : truth[q]) if (m.Id == t.Id) topK++;
+                }
+            }
+
+            printf("  %-22s %8u KB %10.0lf queries/s   recall@1 %5.1lf%%   recall@%u %5.1lf%%   identified %5.1lf%%\n", name,
+                static_cast<unsigned int>(index.Bytes() / 1024), static_cast<double>(QUERIES) * 1000000.0 / static_cast<double>(time > 0 ? time : 1),
+                100.0 * static_cast<double>(top1) / static_cast<double>(QUERIES), static_cast<unsigned int>(K),
+                100.0 * static_cast<double>(topK) / static_cast<double>(QUERIES * K), 100.0 * static_cast<double>(identified) / static_cast<double>(QUERIES));
+        };
+
+        run(exact, "float32 scan", truth);
+        run(quantized, "int8 scan", found);
+
+        // Coarse partitions for large galleries (about sqrt(people) / 4 lists keeps Partition() short here)
+        if (people >= 10000) {
+            const size_t lists = static_cast<size_t>(sqrt(static_cast<double>(people))) / 4;
+            start = esp_timer_get_time();
+            quantized.Partition(lists, 10, 9);
+            const int64_t partition = esp_timer_get_time() - start;
+            printf("  Partition(%u lists): %ldms\n", static_cast<unsigned int>(lists), static_cast<long>(partition / 1000));
+
+            for (const size_t probes : { 4, 16 }) {
+                quantized.Probes = probes;
+                string name = "int8 IVF, " + to_string(probes) + " probes";
+                run(quantized, name.c_str(), found);
+            }
+        }
+    }
+
+    printf("***********************************************************\n\n\n");    
 }
 
 /** @brief Example project 10: if all working, separate project for my idea (upcoming maybe!) */
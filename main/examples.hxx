@@ -25,6 +25,69 @@
     /** @brief Performance test */
     void performance_test();
 
+    /** @brief Thread pool test (matrix kernels speedup against number of cores) */
+    void threadpool_test();
+
+    /** @brief Sparse weights test (memory and latency at 50/80/95% sparsity) */
+    void sparse_test();
+
+    /** @brief Matrix expression templates test (fused vs chained operations with temporaries) */
+    void expression_test();
+
+    /** @brief SimpleNN compiled execution test (object graph vs flat CSR arrays on random graphs) */
+    void simplenn_test();
+
+    /** @brief Random generator test (bulk fills, initializers, determinism with threads) */
+    void random_test();
+
+    /** @brief Softmax + cross-entropy output test (epochs to accuracy against sigmoid + MSE) */
+    void softmax_test();
+
+    /** @brief FCNN::Compile() test (planned activations memory and speed against ExecutionContext on a deep narrow network) */
+    void compile_test();
+
+    /** @brief Memory tiers test (weights placement in internal RAM / PSRAM and tile streaming, simulated latency on Linux) */
+    void memory_test();
+
+    /** @brief Out-of-core inference test (weights streamed from a flash partition or a file with prefetch of the next layer, latency and overlap against resident weights) */
+    void streaming_test();
+
+    /** @brief Half precision weights test (fp16/bf16 storage against double: memory, latency and accuracy) */
+    void half_test();
+
+    /** @brief Structured neuron pruning test (accuracy, weights and compiled latency against score threshold, with and without fine tuning) */
+    void neuron_pruning_test();
+
+    /** @brief Lockstep training of many small FCNN (models trained per second against a loop of FCNN::Fit(), same weights) */
+    void model_batch_test();
+
+    /** @brief Batch normalization test (deep sigmoid stack training, folding and linear layers merging for inference) */
+    void batch_norm_test();
+
+    /** @brief GEMV kernel auto-tuner test (candidates for each shape, compiled plans with tuned kernels, persisted table) */
+    void tuner_test();
+
+    /** @brief Federated averaging test (simulated nodes over the loopback transport, dense vs sparse/quantized deltas, accuracy against bytes exchanged) */
+    void federated_test();
+
+    /** @brief Logging test (compile-time filtered tags, lock-free ring with background drainer vs synchronous formatting, training throughput) */
+    void log_test();
+
+    /** @brief Deadline-aware CPU frequency scaling test (cost profile, lone requests and bursts, energy and missed deadlines against fixed frequencies) */
+    void dvfs_test();
+
+    /** @brief Early exit heads test: latency against accuracy for confidence thresholds, anytime inference with time budgets */
+    void early_exit_test();
+
+    /** @brief Incremental inference test (inputs changing a little between calls: speedup against the changed fraction, error against full forward) */
+    void incremental_test();
+
+    /** @brief Inference server test (producer tasks, micro-batching windows: throughput and p99 latency against a lock around Predict) */
+    void server_test();
+
+    /** @brief Streaming pipeline test (synthetic camera frames -> FCNN -> classification) */
+    void pipeline_test();
+
     /** @brief Example project 1: OR port with NN */
     void example_1();
 
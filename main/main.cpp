@@ -25,6 +25,48 @@ extern "C" void app_main(void)
 
     performance_test();
 
+    threadpool_test();
+
+    sparse_test();
+
+    expression_test();
+
+    simplenn_test();
+
+    random_test();
+
+    softmax_test();
+
+    compile_test();
+
+    memory_test();
+
+    streaming_test();
+
+    half_test();
+
+    neuron_pruning_test();
+
+    model_batch_test();
+
+    batch_norm_test();
+
+    tuner_test();
+
+    federated_test();
+
+    log_test();
+
+    dvfs_test();
+
+    early_exit_test();
+
+    incremental_test();
+
+    server_test();
+
+    pipeline_test();
+
     example_1();
     example_2();
     example_3();